@@ -395,8 +395,7 @@ bool gptj_eval(
         const int n_threads,
         const int n_past,
         const std::vector<gpt_vocab::id> & embd_inp,
-              std::vector<float>         & embd_w,
-              size_t                     & mem_per_token) {
+              std::vector<float>         & embd_w) {
     const int N = embd_inp.size();
 
     const auto & hparams = model.hparams;
@@ -410,32 +409,16 @@ bool gptj_eval(
 
     const int d_key = n_embd/n_head;
 
-    static size_t buf_size = 256u*1024*1024;
-    static void * buf = malloc(buf_size);
-
-    if (mem_per_token > 0 && mem_per_token*N > buf_size) {
-        const size_t buf_size_new = 1.1*(mem_per_token*N); // add 10% to account for ggml object overhead
-        //printf("\n%s: reallocating buffer from %zu to %zu bytes\n", __func__, buf_size, buf_size_new);
-
-        // reallocate
-        buf_size = buf_size_new;
-        buf = realloc(buf, buf_size);
-        if (buf == nullptr) {
-            fprintf(stderr, "%s: failed to allocate %zu bytes\n", __func__, buf_size);
-            return false;
-        }
-    }
-
     struct ggml_init_params params = {
-        .mem_size   = buf_size,
-        .mem_buffer = buf,
+        .mem_size   = gpt_graph_ctx_size(),
+        .mem_buffer = nullptr,
+        .no_alloc   = true,
     };
 
     struct ggml_context * ctx0 = ggml_init(params);
     struct ggml_cgraph gf = { .n_threads = n_threads };
 
     struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, N);
-    memcpy(embd->data, embd_inp.data(), N*ggml_element_size(embd));
 
     // wte
     struct ggml_tensor * inpL = ggml_get_rows(ctx0, model.wte, embd);
@@ -479,7 +462,7 @@ bool gptj_eval(
                             ggml_cpy(ctx0,
                                 Qcur,
                                 ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_embd/n_head, n_head, N)),
-                            n_past, n_rot, 0),
+                            n_past, n_rot, 0, 0),
                         0, 2, 1, 3);
 
             // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1, 3)
@@ -489,7 +472,7 @@ bool gptj_eval(
                             ggml_reshape_3d(ctx0,
                                 ggml_view_1d(ctx0, model.memory_k, (n_past + N)*n_embd, il*n_ctx*ggml_element_size(model.memory_k)*n_embd),
                                 n_embd/n_head, n_head, n_past + N),
-                            n_past, n_rot, 1),
+                            n_past, n_rot, 1, 0),
                         0, 2, 1, 3);
 
             // K * Q
@@ -592,9 +575,17 @@ bool gptj_eval(
     // logits -> probs
     //inpL = ggml_soft_max(ctx0, inpL);
 
-    // run the computation
     ggml_build_forward_expand(&gf, inpL);
-    ggml_graph_compute       (ctx0, &gf);
+
+    static gpt_graph_buf buf_graph;
+
+    gpt_graph_alloc(gf, buf_graph);
+    gpt_graph_set_work(ctx0, gf, buf_graph);
+
+    memcpy(embd->data, embd_inp.data(), N*ggml_element_size(embd));
+
+    // run the computation
+    ggml_graph_compute(ctx0, &gf);
 
     //if (n_past%100 == 0) {
     //    ggml_graph_print   (&gf);
@@ -608,11 +599,6 @@ bool gptj_eval(
     embd_w.resize(n_vocab);
     memcpy(embd_w.data(), (float *) ggml_get_data(inpL) + (n_vocab*(N-1)), sizeof(float)*n_vocab);
 
-    if (mem_per_token == 0) {
-        mem_per_token = ggml_used_mem(ctx0)/N;
-    }
-    //printf("used_mem = %zu\n", ggml_used_mem(ctx0));
-
     ggml_free(ctx0);
 
     return true;
@@ -634,6 +620,14 @@ int main(int argc, char ** argv) {
 
     printf("%s: seed = %d\n", __func__, params.seed);
 
+    if (params.numa) {
+        ggml_numa_init();
+    }
+
+    if (!gpt_params_init_threads(params)) {
+        return 1;
+    }
+
     std::mt19937 rng(params.seed);
     if (params.prompt.empty()) {
         params.prompt = gpt_random_prompt(rng);
@@ -673,16 +667,12 @@ int main(int argc, char ** argv) {
 
     std::vector<gpt_vocab::id> embd;
 
-    // determine the required inference memory per token:
-    size_t mem_per_token = 0;
-    gptj_eval(model, params.n_threads, 0, { 0, 1, 2, 3 }, logits, mem_per_token);
-
     for (int i = embd.size(); i < embd_inp.size() + params.n_predict; i++) {
         // predict
         if (embd.size() > 0) {
             const int64_t t_start_us = ggml_time_us();
 
-            if (!gptj_eval(model, params.n_threads, n_past, embd, logits, mem_per_token)) {
+            if (!gptj_eval(model, params.n_threads, n_past, embd, logits)) {
                 printf("Failed to predict\n");
                 return 1;
             }
@@ -741,7 +731,6 @@ int main(int argc, char ** argv) {
         const int64_t t_main_end_us = ggml_time_us();
 
         printf("\n\n");
-        printf("%s: mem per token = %8zu bytes\n", __func__, mem_per_token);
         printf("%s:     load time = %8.2f ms\n", __func__, t_load_us/1000.0f);
         printf("%s:   sample time = %8.2f ms\n", __func__, t_sample_us/1000.0f);
         printf("%s:  predict time = %8.2f ms / %.2f ms per token\n", __func__, t_predict_us/1000.0f, t_predict_us/1000.0f/n_past);
@@ -16,6 +16,9 @@
 # At the start of the ggml file we write the model parameters
 # and vocabulary.
 #
+# This is the legacy format: llama-convert rewrites it as an indexed
+# file with a table of the tensors and aligned tensor data.
+#
 
 import os
 import sys
@@ -0,0 +1,119 @@
+#include "ggml/ggml.h"
+
+#include "utils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// convert a legacy model file to an indexed one (see gpt_file) - the tensors are copied as they are
+bool llama_model_convert(const std::string & fname_inp, const std::string & fname_out) {
+    printf("%s: loading model from '%s'\n", __func__, fname_inp.c_str());
+
+    auto finp = std::ifstream(fname_inp, std::ios::binary);
+    if (!finp) {
+        fprintf(stderr, "%s: failed to open '%s' for reading\n", __func__, fname_inp.c_str());
+        return false;
+    }
+
+    gpt_file file;
+
+    if (!gpt_file_read(finp, 8, file) || file.hparams.size() < 8) {
+        fprintf(stderr, "%s: invalid model file '%s'\n", __func__, fname_inp.c_str());
+        return false;
+    }
+
+    printf("%s: %s model file, %zu tensors\n", __func__, file.indexed ? "indexed" : "legacy", file.tensors.size());
+
+    // the offsets of the output are assigned by gpt_file_write_header
+    const gpt_file file_inp = file;
+
+    auto fout = std::ofstream(fname_out, std::ios::binary);
+    if (!fout) {
+        fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname_out.c_str());
+        return false;
+    }
+
+    if (!gpt_file_write_header(fout, file)) {
+        fprintf(stderr, "%s: failed to write '%s'\n", __func__, fname_out.c_str());
+        return false;
+    }
+
+    std::vector<char> data;
+
+    size_t total_size = 0;
+
+    for (size_t it = 0; it < file.tensors.size(); ++it) {
+        const auto & tensor_inp = file_inp.tensors[it];
+        const auto & tensor_out = file.tensors[it];
+
+        data.resize(tensor_inp.size);
+
+        finp.seekg(tensor_inp.offset);
+        finp.read(data.data(), tensor_inp.size);
+
+        if (!finp) {
+            fprintf(stderr, "%s: failed to read tensor '%s'\n", __func__, tensor_inp.name.c_str());
+            return false;
+        }
+
+        if (!gpt_file_write_data(fout, tensor_out, data.data())) {
+            fprintf(stderr, "%s: failed to write tensor '%s'\n", __func__, tensor_out.name.c_str());
+            return false;
+        }
+
+        printf("%48s - [%5d, %5d], offset = %12zu, size = %8.3f MB\n",
+                tensor_out.name.c_str(), tensor_out.ne[0], tensor_out.ne[1], tensor_out.offset, tensor_out.size/1024.0/1024.0);
+
+        total_size += tensor_out.size;
+    }
+
+    printf("%s: model size  = %8.2f MB\n", __func__, total_size/1024.0/1024.0);
+
+    finp.close();
+    fout.close();
+
+    return true;
+}
+
+// usage:
+//  ./llama-convert models/llama-model.bin models/llama-model-indexed.bin
+//
+int main(int argc, char ** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s models/llama-model.bin models/llama-model-indexed.bin\n", argv[0]);
+        return 1;
+    }
+
+    const std::string fname_inp = argv[1];
+    const std::string fname_out = argv[2];
+
+    const int64_t t_main_start_us = ggml_time_us();
+
+    int64_t t_convert_us = 0;
+
+    // convert the model
+    {
+        const int64_t t_start_us = ggml_time_us();
+
+        if (!llama_model_convert(fname_inp, fname_out)) {
+            fprintf(stderr, "%s: failed to convert model from '%s'\n", __func__, fname_inp.c_str());
+            return 1;
+        }
+
+        t_convert_us = ggml_time_us() - t_start_us;
+    }
+
+    // report timing
+    {
+        const int64_t t_main_end_us = ggml_time_us();
+
+        printf("\n");
+        printf("%s: convert time = %8.2f ms\n", __func__, t_convert_us/1000.0f);
+        printf("%s:   total time = %8.2f ms\n", __func__, (t_main_end_us - t_main_start_us)/1000.0f);
+    }
+
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <cstring>
 #include <fstream>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -76,12 +77,21 @@ struct llama_model {
     struct ggml_tensor * memory_v;
 
     //
-    struct ggml_context * ctx;
+    struct ggml_context * ctx;    // the weights - with a mapped file, only the tensor objects
+    struct ggml_context * ctx_kv; // the key + value memory
+
+    // the model file, if the weights point into it (see gpt_mmap_open)
+    gpt_mmap mapping;
+
     std::map<std::string, struct ggml_tensor *> tensors;
 };
 
 // load the model's weights from a file
-bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab & vocab) {
+//
+// with use_mmap the file is mapped and the weights point into the mapping: nothing is copied and the pages are read
+// on first use (or all ahead with prefetch). If the file cannot be mapped, the weights are read into memory by
+// n_io_threads threads (see gpt_read_parallel)
+bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab & vocab, bool use_mmap, bool prefetch, int n_io_threads) {
     printf("loading LLaMa from path: '%s' \n", fname.c_str());
 
     auto fin = std::ifstream(fname, std::ios::binary);
@@ -90,35 +100,34 @@ bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab
         return false;
     }
 
-    // verify magic
-    {
-        uint32_t magic;
-        fin.read((char *) &magic, sizeof(magic));
-        if (magic != 0x596f7572) { // Your in hex
-            fprintf(stderr, "%s: invalid model file '%s' (bad magic)\n", __func__, fname.c_str());
-            fprintf(stderr, "Expected 0x596f7572, got 0x%08x", magic);
-            return false;
-        }
-        fin.read((char *) &magic, sizeof(magic));
-        if (magic != 0x47505473) {// GPTs in hex
-            fprintf(stderr, "%s: invalid model file '%s' (bad magic)\n", __func__, fname.c_str());
-            fprintf(stderr, "Expected 0x47505473, got 0x%08x", magic);
-            return false;
-        }
+    if (use_mmap && !gpt_mmap_open(fname, prefetch, model.mapping)) {
+        fprintf(stderr, "%s: failed to map '%s', reading it instead\n", __func__, fname.c_str());
     }
 
+    const bool mapped = model.mapping.addr != nullptr;
+
+    // the header and the table of the tensors - a legacy file is walked once to find them
+    gpt_file file;
+
+    if (!gpt_file_read(fin, 8, file) || file.hparams.size() < 8) {
+        fprintf(stderr, "%s: invalid model file '%s'\n", __func__, fname.c_str());
+        return false;
+    }
+
+    printf("%s: %s model file, %zu tensors\n", __func__, file.indexed ? "indexed" : "legacy", file.tensors.size());
+
     // load hparams
     {
         auto & hparams = model.hparams;
 
-        fin.read((char *) &hparams.n_vocab, sizeof(hparams.n_vocab));
-        fin.read((char *) &hparams.n_ctx,   sizeof(hparams.n_ctx));
-        fin.read((char *) &hparams.n_embd,  sizeof(hparams.n_embd));
-        fin.read((char *) &hparams.n_hddn,  sizeof(hparams.n_hddn));
-        fin.read((char *) &hparams.n_head,  sizeof(hparams.n_head));
-        fin.read((char *) &hparams.n_layer, sizeof(hparams.n_layer));
-        fin.read((char *) &hparams.n_rot,   sizeof(hparams.n_rot));
-        fin.read((char *) &hparams.f16,     sizeof(hparams.f16));
+        hparams.n_vocab = file.hparams[0];
+        hparams.n_ctx   = file.hparams[1];
+        hparams.n_embd  = file.hparams[2];
+        hparams.n_hddn  = file.hparams[3];
+        hparams.n_head  = file.hparams[4];
+        hparams.n_layer = file.hparams[5];
+        hparams.n_rot   = file.hparams[6];
+        hparams.f16     = file.hparams[7];
 
         // printf("%s: n_vocab = %d\n", __func__, hparams.n_vocab);
         // printf("%s: n_ctx   = %d\n", __func__, hparams.n_ctx);
@@ -162,6 +171,8 @@ bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab
         case 1: wtype = GGML_TYPE_F16; break;
         case 2: wtype = GGML_TYPE_Q4_0; break;
         case 3: wtype = GGML_TYPE_Q4_1; break;
+        case 4: wtype = GGML_TYPE_Q4_0I; break;
+        case 5: wtype = GGML_TYPE_Q4_0H; break;
         default:
             {
                 fprintf(stderr, "%s: invalid model file '%s' (bad f16 %d)\n",
@@ -220,21 +231,22 @@ bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab
 
         // printf("%s: ggml ctx size w/o memory = %6.2f MB\n", __func__, ctx_size/(1024.0*1024.0));
 
-        ctx_size += n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F32); // memory_k
-        ctx_size += n_ctx * n_layer * n_embd * ggml_type_sizef(GGML_TYPE_F32); // memory_v
+        printf("Total model size = %2.6f GB%s\n", ctx_size/(1024.0*1024.0*1024.0), mapped ? " (mapped)" : "");
 
-        ctx_size += (3 + 9 * n_layer) * 256; // object overhead - 3 for wte, final_norm, lmh_g, 9 for each llama layer
-        // printf("%s: ggml ctx size w/ memory = %6.2f MB\n", __func__, ctx_size/(1024.0*1024.0));
-        // ctx_size += 2; // 8KB for the context itself
+        // the mapped weights only need their tensor objects
+        if (mapped) {
+            ctx_size = 0;
+        }
 
-        printf("Total model size = %2.6f GB\n", ctx_size/(1024.0*1024.0*1024.0));
+        ctx_size += (3 + 9 * n_layer) * 256; // object overhead - 3 for wte, final_norm, lmh_g, 9 for each llama layer
     }
 
-    // create the ggml context
+    // create the ggml contexts
     {
         struct ggml_init_params params = {
             .mem_size   = ctx_size,
             .mem_buffer = NULL,
+            .no_alloc   = mapped,
         };
 
         model.ctx = ggml_init(params);
@@ -244,6 +256,27 @@ bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab
         }
     }
 
+    {
+        const auto & hparams = model.hparams;
+
+        const int n_embd  = hparams.n_embd;
+        const int n_layer = hparams.n_layer;
+        const int n_ctx   = hparams.n_ctx;
+
+        const size_t kv_size = 2*(ggml_type_size(GGML_TYPE_F32)*n_ctx*n_layer*n_embd + 256); // memory_k + memory_v
+
+        struct ggml_init_params params = {
+            .mem_size   = kv_size,
+            .mem_buffer = NULL,
+        };
+
+        model.ctx_kv = ggml_init(params);
+        if (!model.ctx_kv) {
+            fprintf(stderr, "%s: ggml_init() failed\n", __func__);
+            return false;
+        }
+    }
+
     // prepare memory for the weights
     {
         const auto & hparams = model.hparams;
@@ -318,8 +351,12 @@ bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab
         const int n_mem      = n_layer*n_ctx;
         const int n_elements = n_embd*n_mem;
 
-        model.memory_k = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
-        model.memory_v = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_elements);
+        model.memory_k = ggml_new_tensor_1d(model.ctx_kv, GGML_TYPE_F32, n_elements);
+        model.memory_v = ggml_new_tensor_1d(model.ctx_kv, GGML_TYPE_F32, n_elements);
+
+        // the cached graph of llama_eval reads the rows past n_past too (masked out) - they must not be NaN
+        ggml_set_zero(model.memory_k);
+        ggml_set_zero(model.memory_v);
 
         const size_t memory_size = ggml_nbytes(model.memory_k) + ggml_nbytes(model.memory_v);
 
@@ -331,36 +368,30 @@ bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab
         int n_tensors = 0;
         size_t total_size = 0;
 
-        // printf("%s: ", __func__);
+        // the reads of the tensors that are not mapped, all issued together after the checks
+        std::vector<gpt_read_request> requests;
 
-        while (true) {
-            int32_t n_dims;
-            int32_t length;
-            int32_t ftype;
+        std::set<std::string> loaded;
 
-            fin.read(reinterpret_cast<char *>(&n_dims), sizeof(n_dims));
-            fin.read(reinterpret_cast<char *>(&length), sizeof(length));
-            fin.read(reinterpret_cast<char *>(&ftype),  sizeof(ftype));
+        // printf("%s: ", __func__);
 
-            if (fin.eof()) {
-                break;
-            }
+        for (const auto & record : file.tensors) {
+            const std::string & name = record.name;
 
-            int32_t nelements = 1;
-            int32_t ne[2] = { 1, 1 };
-            for (int i = 0; i < n_dims; ++i) {
-                fin.read(reinterpret_cast<char *>(&ne[i]), sizeof(ne[i]));
-                nelements *= ne[i];
-            }
+            const int32_t * ne = record.ne;
 
-            std::string name(length, 0);
-            fin.read(&name[0], length);
+            const int32_t nelements = ne[0]*ne[1];
 
             if (model.tensors.find(name.data()) == model.tensors.end()) {
                 fprintf(stderr, "%s: unknown tensor '%s' in model file\n", __func__, name.data());
                 return false;
             }
 
+            if (!loaded.insert(name).second) {
+                fprintf(stderr, "%s: tensor '%s' appears more than once in model file\n", __func__, name.data());
+                return false;
+            }
+
             auto tensor = model.tensors[name.data()];
             if (ggml_nelements(tensor) != nelements) {
                 fprintf(stderr, "%s: tensor '%s' has wrong size in model file\n", __func__, name.data());
@@ -373,52 +404,75 @@ bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab
                 return false;
             }
 
+            if (gpt_file_tensor_type(record.ftype) != tensor->type) {
+                fprintf(stderr, "%s: tensor '%s' has wrong type in model file: got ftype %d\n",
+                        __func__, name.data(), record.ftype);
+                return false;
+            }
+
             if (0) {
-                static const char * ftype_str[] = { "f32", "f16", "q4_0", "q4_1", };
+                static const char * ftype_str[] = { "f32", "f16", "q4_0", "q4_1", "q4_0i", "q4_0h", };
                 printf("%24s - [%5d, %5d], type = %6s, %6.2f MB\n, %9zu bytes\n",
-                    name.data(), ne[0], ne[1], ftype_str[ftype], ggml_nbytes(tensor)/1024.0/1024.0, ggml_nbytes(tensor));
+                    name.data(), ne[0], ne[1], ftype_str[record.ftype], ggml_nbytes(tensor)/1024.0/1024.0, ggml_nbytes(tensor));
             }
-        
-            size_t bpe = 0;
-
-            switch (ftype) {
-                case 0: bpe = ggml_type_size(GGML_TYPE_F32); break;
-                case 1: bpe = ggml_type_size(GGML_TYPE_F16); break;
-                case 2: bpe = ggml_type_size(GGML_TYPE_Q4_0); assert(ne[0] % 64 == 0); break;
-                case 3: bpe = ggml_type_size(GGML_TYPE_Q4_1); assert(ne[0] % 64 == 0); break;
-                default: {
-                    fprintf(stderr, "%s: unknown ftype %d in model file\n", __func__, ftype);
-                    return false;
-                }
-            };
 
-            if (nelements*bpe/ggml_blck_size(tensor->type) != ggml_nbytes(tensor)) {
+            if (record.size != ggml_nbytes(tensor)) {
                 fprintf(stderr, "%s: tensor '%s' has wrong size in model file: got %zu, expected %zu\n",
-                        __func__, name.data(), ggml_nbytes(tensor), nelements*bpe);
-                fprintf(stderr, "  nelements = %d, bpe = %zu, ftype = %d", nelements, bpe, ftype);
+                        __func__, name.data(), record.size, ggml_nbytes(tensor));
+                fprintf(stderr, "  nelements = %d, ftype = %d", nelements, record.ftype);
                 return false;
             }
 
-            fin.read(reinterpret_cast<char *>(tensor->data), ggml_nbytes(tensor));
-            // If tensor name is "tok_embeddings.weight", then print the first 10 elements (it is float16, typedef __fp16 ggml_fp16_t, so we need to cast to float and print 7 digits after the decimal point)
-            if ( name == "layers.0.attention_norm.weight") {
-                printf("First 10 elements of layers.0.attention_norm.weight (of size: %zu): ", nelements*bpe/4);
-                for (int i = 0; i < 5; i++) {
-                    // printf("%.9f ", (float)((ggml_fp16_t *)tensor->data)[i]);
-                    printf("%.4f ", ((float *)tensor->data)[i]);
-                } // similarly for last 5 elements
-                for (int i = nelements-5; i < nelements; i++) {
-                    printf("%.4f ", ((float *)tensor->data)[i]);
+            if (mapped) {
+                if (record.offset + record.size > model.mapping.size) {
+                    fprintf(stderr, "%s: tensor '%s' is past the end of the model file\n", __func__, name.data());
+                    return false;
                 }
-                printf("\n");
+
+                tensor->data = (char *) model.mapping.addr + record.offset;
+            } else {
+                requests.push_back({ record.offset, record.size, tensor->data });
             }
 
-            // printf("%42s - [%5d, %5d], type = %6s, %6.2f MB\n", name.data(), ne[0], ne[1], ftype == 0 ? "float" : "f16", ggml_nbytes(tensor)/1024.0/1024.0);
+            // printf("%42s - [%5d, %5d], type = %6s, %6.2f MB\n", name.data(), ne[0], ne[1], record.ftype == 0 ? "float" : "f16", ggml_nbytes(tensor)/1024.0/1024.0);
             total_size += ggml_nbytes(tensor);
-            if (++n_tensors % 64 == 0) {
-                printf("Still Loading ...\n");
-                fflush(stdout);
+            n_tensors++;
+        }
+
+        if (n_tensors != (int) model.tensors.size()) {
+            fprintf(stderr, "%s: model file has %d tensors, expected %zu\n", __func__, n_tensors, model.tensors.size());
+            return false;
+        }
+
+        if (!requests.empty()) {
+            const int64_t t_start_us = ggml_time_us();
+
+            if (!gpt_read_parallel(fname, requests, n_io_threads)) {
+                fprintf(stderr, "%s: failed to read the tensors of '%s'\n", __func__, fname.c_str());
+                return false;
+            }
+
+            // at least 1 us - a small file can be read within the resolution of the timer
+            const int64_t t_read_us = std::max<int64_t>(1, ggml_time_us() - t_start_us);
+
+            printf("%s: read %.2f MB with %d threads in %.2f ms (%.2f GB/s)\n", __func__, total_size/1024.0/1024.0,
+                    n_io_threads, t_read_us/1000.0, total_size/1024.0/1024.0/1024.0/(t_read_us/1e6));
+        }
+
+        // print the first and the last elements of a small tensor as a check
+        {
+            const ggml_tensor * tensor = model.tensors["layers.0.attention_norm.weight"];
+
+            const int nelements = ggml_nelements(tensor);
+
+            printf("First 10 elements of layers.0.attention_norm.weight (of size: %d): ", nelements);
+            for (int i = 0; i < 5; i++) {
+                printf("%.4f ", ((float *)tensor->data)[i]);
+            } // similarly for last 5 elements
+            for (int i = nelements-5; i < nelements; i++) {
+                printf("%.4f ", ((float *)tensor->data)[i]);
             }
+            printf("\n");
         }
 
         printf("Finished loading LLaMa\n");
@@ -431,63 +485,57 @@ bool llama_model_load(const std::string & fname, llama_model & model, gpt_vocab
     return true;
 }
 
-// evaluate the transformer
-//
-//   - model:     the model
-//   - n_threads: number of threads to use
-//   - n_past:    the context size so far
-//   - embd_inp:  the embeddings of the tokens in the context
-//   - embd_w:    the predicted logits for the next token
-//
-// The GPT-J model requires about 16MB of memory per input token.
+// number of KV cache rows the cached graph of llama_eval reads at a time
+#define LLAMA_KV_BLOCK 128
+
+// the graph of llama_eval and the tensors that change between the tokens
 //
-bool llama_eval(
-        const llama_model & model,
-        const int n_threads,
-        const int n_past,
-        const std::vector<gpt_vocab::id> & embd_inp,
-              std::vector<float>         & embd_w,
-              size_t                     & mem_per_token) {
-    const int N = embd_inp.size();
+// besides the token, the graph depends on n_past only through:
+//   - the offsets of the views that the new K and V rows are copied into (kv_views)
+//   - the n_past of ROPE and DIAG_MASK_INF (n_past_nodes) - they read it when the graph is computed
+//   - the number of cached K and V rows that the attention reads: the graph reads n_kv >= n_past + N rows and
+//     DIAG_MASK_INF masks out the ones past n_past + N
+// so the graph of one token is built with n_kv rounded up to LLAMA_KV_BLOCK and computed again for the next tokens
+// until n_past + 1 reaches n_kv
+struct llama_graph {
+    struct ggml_context * ctx = nullptr;
+    struct ggml_cgraph    gf  = {};
+
+    // the data of the tensors and the work buffer - ctx holds the rest
+    gpt_graph_buf buf;
+
+    int N    = 0;
+    int n_kv = 0;
+
+    struct ggml_tensor * embd   = nullptr;
+    struct ggml_tensor * logits = nullptr;
+
+    std::vector<struct ggml_tensor *> n_past_nodes;
+
+    // the view and its offset for n_past = 0
+    std::vector<std::pair<struct ggml_tensor *, size_t>> kv_views;
+};
 
+// build the graph of N tokens that reads n_kv rows of the KV cache in graph.ctx and place its tensors in graph.buf
+void llama_build_graph(const llama_model & model, llama_graph & graph, const int n_past, const int N, const int n_kv) {
     const auto & hparams = model.hparams;
 
     const int n_embd  = hparams.n_embd;
-    const int n_hddn  = hparams.n_hddn;
     const int n_layer = hparams.n_layer;
     const int n_ctx   = hparams.n_ctx;
     const int n_head  = hparams.n_head;
-    const int n_vocab = hparams.n_vocab;
     const int n_rot   = hparams.n_rot;
 
-    const int d_key = n_embd / n_head;
-
-    static size_t buf_size = 256u * 1024 * 1024;
-    static void * buf = malloc(buf_size);
-
-    if (mem_per_token > 0 && mem_per_token * N > buf_size) {
-        const size_t buf_size_new = 1.1 * (mem_per_token * N); // add 10% to account for ggml object overhead
-        //printf("\n%s: reallocating buffer from %zu to %zu bytes\n", __func__, buf_size, buf_size_new);
-
-        // reallocate
-        buf_size = buf_size_new;
-        buf = realloc(buf, buf_size);
-        if (buf == nullptr) {
-            fprintf(stderr, "%s: failed to allocate %zu bytes\n", __func__, buf_size);
-            return false;
-        }
-    }
+    struct ggml_context * ctx0 = graph.ctx;
+    struct ggml_cgraph  & gf   = graph.gf;
 
-    struct ggml_init_params params = {
-        .mem_size   = buf_size,
-        .mem_buffer = buf,
-    };
+    graph.N    = N;
+    graph.n_kv = n_kv;
 
-    struct ggml_context * ctx0 = ggml_init(params);
-    struct ggml_cgraph gf = { .n_threads = n_threads };
+    graph.n_past_nodes.clear();
+    graph.kv_views.clear();
 
     struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, N);
-    memcpy(embd->data, embd_inp.data(), N*ggml_element_size(embd));
 
     // wte
     struct ggml_tensor * inpL = ggml_get_rows(ctx0, model.wte, embd);
@@ -510,33 +558,43 @@ bool llama_eval(
             struct ggml_tensor * Kcur = ggml_mul_mat(ctx0, model.layers[il].c_attn_k_proj_w, cur);
             struct ggml_tensor * Vcur = ggml_mul_mat(ctx0, model.layers[il].c_attn_v_proj_w, cur);
 
+            // rotate the new keys before they are stored: the cached rows keep their rotation
+            struct ggml_tensor * Krope =
+                        ggml_rope(ctx0,
+                            ggml_reshape_3d(ctx0, Kcur, n_embd/n_head, n_head, N),
+                            n_past, n_rot, 0, 1);
+
             // store key and value to memory
             if (N >= 1) {
-                struct ggml_tensor * k = ggml_view_1d(ctx0, model.memory_k, N*n_embd, (ggml_element_size(model.memory_k)*n_embd)*(il*n_ctx + n_past));
-                struct ggml_tensor * v = ggml_view_1d(ctx0, model.memory_v, N*n_embd, (ggml_element_size(model.memory_v)*n_embd)*(il*n_ctx + n_past));
+                const size_t offs_k = (ggml_element_size(model.memory_k)*n_embd)*(il*n_ctx);
+                const size_t offs_v = (ggml_element_size(model.memory_v)*n_embd)*(il*n_ctx);
+
+                struct ggml_tensor * k = ggml_view_1d(ctx0, model.memory_k, N*n_embd, offs_k + (ggml_element_size(model.memory_k)*n_embd)*n_past);
+                struct ggml_tensor * v = ggml_view_1d(ctx0, model.memory_v, N*n_embd, offs_v + (ggml_element_size(model.memory_v)*n_embd)*n_past);
 
-                ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Kcur, k));
+                ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Krope, k));
                 ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcur, v));
+
+                graph.kv_views.push_back({ k, offs_k });
+                graph.kv_views.push_back({ v, offs_v });
             }
 
             // Q = Qcur.contiguous().view(n_embd/n_head, n_head, N).permute(0, 2, 1, 3)
-            struct ggml_tensor * Q =
-                ggml_permute(ctx0,
+            struct ggml_tensor * Qrope =
                         ggml_rope(ctx0,
                             ggml_cpy(ctx0,
                                 Qcur,
                                 ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_embd/n_head, n_head, N)),
-                            n_past, n_rot, 0, 1),
-                        0, 2, 1, 3);
+                            n_past, n_rot, 0, 1);
+
+            struct ggml_tensor * Q = ggml_permute(ctx0, Qrope, 0, 2, 1, 3);
 
-            // K = Kmem.view(n_embd/n_head, n_head, n_past + N).permute(0, 2, 1, 3)
+            // K = Kmem.view(n_embd/n_head, n_head, n_kv).permute(0, 2, 1, 3)
             struct ggml_tensor * K =
                 ggml_permute(ctx0,
-                        ggml_rope(ctx0,
-                            ggml_reshape_3d(ctx0,
-                                ggml_view_1d(ctx0, model.memory_k, (n_past + N)*n_embd, il*n_ctx*ggml_element_size(model.memory_k)*n_embd),
-                                n_embd/n_head, n_head, n_past + N),
-                            n_past, n_rot, 1, 1),
+                        ggml_reshape_3d(ctx0,
+                            ggml_view_1d(ctx0, model.memory_k, n_kv*n_embd, il*n_ctx*ggml_element_size(model.memory_k)*n_embd),
+                            n_embd/n_head, n_head, n_kv),
                         0, 2, 1, 3);
 
             // K * Q
@@ -555,12 +613,12 @@ bool llama_eval(
             // KQ = soft_max(KQ_masked)
             struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, KQ_masked);
 
-            // V_trans = Vmem.view(n_embd/n_head, n_head, n_past + N).permute(1, 2, 0, 3).contiguous()
+            // V_trans = Vmem.view(n_embd/n_head, n_head, n_kv).permute(1, 2, 0, 3).contiguous()
             struct ggml_tensor * V_trans =
                 ggml_permute(ctx0,
                         ggml_reshape_3d(ctx0,
-                            ggml_view_1d(ctx0, model.memory_v, (n_past + N)*n_embd, il*n_ctx*ggml_element_size(model.memory_v)*n_embd),
-                            n_embd/n_head, n_head, n_past + N),
+                            ggml_view_1d(ctx0, model.memory_v, n_kv*n_embd, il*n_ctx*ggml_element_size(model.memory_v)*n_embd),
+                            n_embd/n_head, n_head, n_kv),
                         1, 2, 0, 3);
 
             // KQV = transpose(V) * KQ_soft_max
@@ -576,6 +634,10 @@ bool llama_eval(
 
             // projection (no bias)
             cur = ggml_mul_mat(ctx0, model.layers[il].c_attn_proj_w, cur);
+
+            graph.n_past_nodes.push_back(Qrope);
+            graph.n_past_nodes.push_back(Krope);
+            graph.n_past_nodes.push_back(KQ_masked);
         }
 
         // self-attention + Input
@@ -630,30 +692,106 @@ bool llama_eval(
     // logits -> probs
     //inpL = ggml_soft_max(ctx0, inpL);
 
-    // run the computation
     ggml_build_forward_expand(&gf, inpL);
-    ggml_graph_compute       (ctx0, &gf);
+
+    graph.embd   = embd;
+    graph.logits = inpL;
+
+    gpt_graph_alloc(gf, graph.buf);
+}
+
+// move the graph to another n_past with the same number of tokens, up to n_past + N = n_kv
+void llama_graph_set_n_past(const llama_model & model, llama_graph & graph, const int n_past) {
+    const size_t row_size = ggml_element_size(model.memory_k)*model.hparams.n_embd;
+
+    for (auto * node : graph.n_past_nodes) {
+        ggml_set_n_past(node, n_past);
+    }
+
+    for (const auto & kv : graph.kv_views) {
+        ggml_graph_set_view_offset(&graph.gf, kv.first, kv.second + row_size*n_past);
+    }
+}
+
+// evaluate the transformer
+//
+//   - model:      the model
+//   - threadpool: the threads to compute on (see ggml_threadpool_create)
+//   - n_past:     the context size so far
+//   - embd_inp:   the embeddings of the tokens in the context
+//   - embd_w:     the predicted logits for the next token
+//
+// A single token is computed with a cached graph (see llama_graph), the prompt with a new graph for each batch.
+//
+bool llama_eval(
+        const llama_model & model,
+        struct ggml_threadpool * threadpool,
+        const int n_past,
+        const std::vector<gpt_vocab::id> & embd_inp,
+              std::vector<float>         & embd_w) {
+    const int N = embd_inp.size();
+
+    const auto & hparams = model.hparams;
+
+    const int n_ctx   = hparams.n_ctx;
+    const int n_vocab = hparams.n_vocab;
+
+    // the graph of the last single token
+    static llama_graph graph_tok;
+
+    // the graph of the last batch - only its buffers are kept
+    static llama_graph graph_batch;
+
+    llama_graph & graph = N == 1 ? graph_tok : graph_batch;
+
+    if (N == 1 && graph.ctx != nullptr && n_past + N <= graph.n_kv) {
+        llama_graph_set_n_past(model, graph, n_past);
+    } else {
+        if (graph.ctx != nullptr) {
+            ggml_free(graph.ctx);
+        }
+
+        struct ggml_init_params params = {
+            .mem_size   = gpt_graph_ctx_size(),
+            .mem_buffer = nullptr,
+            .no_alloc   = true,
+        };
+
+        graph.ctx = ggml_init(params);
+        graph.gf  = {};
+
+        const int n_kv = N == 1 ? std::min(n_ctx, (n_past + N + LLAMA_KV_BLOCK - 1)/LLAMA_KV_BLOCK*LLAMA_KV_BLOCK) : n_past + N;
+
+        llama_build_graph(model, graph, n_past, N, n_kv);
+    }
+
+    graph.gf.threadpool = threadpool;
+
+    gpt_graph_set_work(graph.ctx, graph.gf, graph.buf);
+
+    memcpy(graph.embd->data, embd_inp.data(), N*ggml_element_size(graph.embd));
+
+    // run the computation
+    ggml_graph_compute(graph.ctx, &graph.gf);
 
     // if (n_past%100 == 0) {
-    //    ggml_graph_print   (&gf);
-    //    ggml_graph_dump_dot(&gf, NULL, "llama.dot");
+    //    ggml_graph_print   (&graph.gf);
+    //    ggml_graph_dump_dot(&graph.gf, NULL, "llama.dot");
     // }
     // return true;
 
 
     //embd_w.resize(n_vocab*N);
-    //memcpy(embd_w.data(), ggml_get_data(inpL), sizeof(float)*n_vocab*N);
+    //memcpy(embd_w.data(), ggml_get_data(graph.logits), sizeof(float)*n_vocab*N);
 
     // return result for just the last token
     embd_w.resize(n_vocab);
-    memcpy(embd_w.data(), (float *) ggml_get_data(inpL) + (n_vocab*(N-1)), sizeof(float)*n_vocab);
+    memcpy(embd_w.data(), (float *) ggml_get_data(graph.logits) + (n_vocab*(N-1)), sizeof(float)*n_vocab);
 
-    if (mem_per_token == 0) {
-        mem_per_token = ggml_used_mem(ctx0)/N;
+    if (N > 1) {
+        ggml_free(graph.ctx);
+        graph.ctx = nullptr;
     }
-    //printf("used_mem = %zu\n", ggml_used_mem(ctx0));
-
-    ggml_free(ctx0);
 
     return true;
 }
@@ -788,6 +926,22 @@ int main(int argc, char ** argv) {
         params.prompt = gpt_random_prompt(rng);
     }
 
+    // before the model is allocated: the pages of the weights are spread over the nodes as they are first touched
+    if (params.numa) {
+        ggml_numa_init();
+
+        printf("%s: numa = %s\n", __func__, ggml_is_numa() ? "interleaved" : "single node");
+
+        // the pages of a mapped file stay where the page cache put them
+        if (ggml_is_numa()) {
+            params.use_mmap = false;
+        }
+    }
+
+    if (!gpt_params_init_threads(params)) {
+        return 1;
+    }
+
     int64_t t_load_us = 0;
 
     gpt_vocab vocab;
@@ -797,7 +951,7 @@ int main(int argc, char ** argv) {
     {
         const int64_t t_start_us = ggml_time_us();
 
-        if (!llama_model_load(params.model, model, vocab)) {
+        if (!llama_model_load(params.model, model, vocab, params.use_mmap, params.prefetch, params.n_io_threads)) {
             fprintf(stderr, "%s: failed to load model from '%s'\n", __func__, params.model.c_str());
             return 1;
         }
@@ -849,9 +1003,9 @@ int main(int argc, char ** argv) {
 
     std::vector<gpt_vocab::id> embd;
 
-    // determine the required inference memory per token:
-    size_t mem_per_token = 0;
-    llama_eval(model, params.n_threads, 0, {1,   887,   526,   302,  29889}, logits, mem_per_token);
+    // the same worker threads compute all the tokens
+    struct ggml_threadpool * threadpool = ggml_threadpool_create(params.n_threads);
+
     printf("\n\n\n\n");
     int iiii = 0;
     for (int i = embd.size(); i < embd_inp.size() + params.n_predict; i++) {
@@ -863,7 +1017,7 @@ int main(int argc, char ** argv) {
             //     printf("%d ", embd[i]);
             // }
             // printf("\n");
-            if (!llama_eval(model, params.n_threads, n_past, embd, logits, mem_per_token)) {
+            if (!llama_eval(model, threadpool, n_past, embd, logits)) {
                 printf("Failed to predict\n");
                 return 1;
             }
@@ -954,14 +1108,18 @@ int main(int argc, char ** argv) {
     //     const int64_t t_main_end_us = ggml_time_us();
 
     //     printf("\n\n");
-    //     printf("%s: mem per token = %8zu bytes\n", __func__, mem_per_token);
     //     printf("%s:     load time = %8.2f ms\n", __func__, t_load_us/1000.0f);
     //     printf("%s:   sample time = %8.2f ms\n", __func__, t_sample_us/1000.0f);
     //     printf("%s:  predict time = %8.2f ms / %.2f ms per token\n", __func__, t_predict_us/1000.0f, t_predict_us/1000.0f/n_past);
     //     printf("%s:    total time = %8.2f ms\n", __func__, (t_main_end_us - t_main_start_us)/1000.0f);
     // }
 
+    ggml_threadpool_free(threadpool);
+
     ggml_free(model.ctx);
+    ggml_free(model.ctx_kv);
+
+    gpt_mmap_close(model.mapping);
 
     return 0;
 }
@@ -34,10 +34,12 @@ bool llama_model_quantize(const std::string & fname_inp, const std::string & fna
     switch (itype) {
         case 2: type = GGML_TYPE_Q4_0; break;
         case 3: type = GGML_TYPE_Q4_1; break;
+        case 4: type = GGML_TYPE_Q4_0I; break;
+        case 5: type = GGML_TYPE_Q4_0H; break;
         default: fprintf(stderr, "%s: invalid quantization type %d\n", __func__, itype); return 1;
     };
 
-    if (type != GGML_TYPE_Q4_0 && type != GGML_TYPE_Q4_1) {
+    if (type != GGML_TYPE_Q4_0 && type != GGML_TYPE_Q4_1 && type != GGML_TYPE_Q4_0I && type != GGML_TYPE_Q4_0H) {
         fprintf(stderr, "%s: invalid quantization type %d\n", __func__, type);
         return false;
     }
@@ -58,37 +60,25 @@ bool llama_model_quantize(const std::string & fname_inp, const std::string & fna
         return false;
     }
 
-    // verify magic
-    {
-        uint32_t magic;
-        finp.read((char *) &magic, sizeof(magic));
-        if (magic != 0x596f7572) { // Your in hex
-            fprintf(stderr, "%s: invalid model file '%s' (bad magic)\n", __func__, fname_inp.c_str());
-            return false;
-        }
-        fout.write((char *) &magic, sizeof(magic));
-
-        finp.read((char *) &magic, sizeof(magic));
-        if (magic != 0x47505473) {// GPTs in hex
-            fprintf(stderr, "%s: invalid model file '%s' (bad magic)\n", __func__, fname_inp.c_str());
-            return false;
-        }
+    gpt_file file_inp;
 
-        fout.write((char *) &magic, sizeof(magic));
+    if (!gpt_file_read(finp, 8, file_inp) || file_inp.hparams.size() < 8) {
+        fprintf(stderr, "%s: invalid model file '%s'\n", __func__, fname_inp.c_str());
+        return false;
     }
 
     llama_hparams hparams;
 
     // load hparams
     {
-        finp.read((char *) &hparams.n_vocab, sizeof(hparams.n_vocab));
-        finp.read((char *) &hparams.n_ctx,   sizeof(hparams.n_ctx));
-        finp.read((char *) &hparams.n_embd,  sizeof(hparams.n_embd));
-        finp.read((char *) &hparams.n_hddn, sizeof(hparams.n_hddn));
-        finp.read((char *) &hparams.n_head,  sizeof(hparams.n_head));
-        finp.read((char *) &hparams.n_layer, sizeof(hparams.n_layer));
-        finp.read((char *) &hparams.n_rot,   sizeof(hparams.n_rot));
-        finp.read((char *) &hparams.f16,     sizeof(hparams.f16));
+        hparams.n_vocab = file_inp.hparams[0];
+        hparams.n_ctx   = file_inp.hparams[1];
+        hparams.n_embd  = file_inp.hparams[2];
+        hparams.n_hddn  = file_inp.hparams[3];
+        hparams.n_head  = file_inp.hparams[4];
+        hparams.n_layer = file_inp.hparams[5];
+        hparams.n_rot   = file_inp.hparams[6];
+        hparams.f16     = file_inp.hparams[7];
 
         printf("%s: n_vocab = %d\n", __func__, hparams.n_vocab);
         printf("%s: n_ctx   = %d\n", __func__, hparams.n_ctx);
@@ -97,43 +87,58 @@ bool llama_model_quantize(const std::string & fname_inp, const std::string & fna
         printf("%s: n_head  = %d\n", __func__, hparams.n_head);
         printf("%s: n_layer = %d\n", __func__, hparams.n_layer);
         printf("%s: f16     = %d\n", __func__, hparams.f16);
+    }
+
+    // regexes of tensor names to be quantized
+    const std::vector<std::string> k_names = {
+        ".*weight",
+    };
+    // We skip quantization for `tok_embeddings.weight`.
+    const char * k_names_skip = "tok_embeddings";
+
+    // the output is an indexed file (see gpt_file): its table needs the sizes of the quantized tensors up front
+    gpt_file file_out = file_inp;
+
+    file_out.hparams[7] = itype;
+
+    std::vector<bool> quantize_tensor(file_inp.tensors.size(), false);
+
+    for (size_t it = 0; it < file_inp.tensors.size(); ++it) {
+        auto & tensor = file_out.tensors[it];
 
-        fout.write((char *) &hparams.n_vocab, sizeof(hparams.n_vocab));
-        fout.write((char *) &hparams.n_ctx,   sizeof(hparams.n_ctx));
-        fout.write((char *) &hparams.n_embd,  sizeof(hparams.n_embd));
-        fout.write((char *) &hparams.n_hddn, sizeof(hparams.n_hddn));
-        fout.write((char *) &hparams.n_head,  sizeof(hparams.n_head));
-        fout.write((char *) &hparams.n_layer, sizeof(hparams.n_layer));
-        fout.write((char *) &hparams.n_rot,   sizeof(hparams.n_rot));
-        fout.write((char *) &itype,           sizeof(hparams.f16));
+        bool quantize = false;
+        for (const auto & s : k_names) {
+            if (std::regex_match(tensor.name, std::regex(s))) {
+                if (tensor.name.find(k_names_skip) != std::string::npos) {
+                    // printf("skipped k_names_skip for %s layer", tensor.name.c_str());
+                    break;
+                }
+
+                quantize = true;
+                break;
+            }
+        }
+        // printf("quantize = %d for layer %s", quantize, tensor.name.c_str());
+        // quantize only 2D tensors
+        quantize &= (tensor.n_dims == 2);
+
+        if (quantize) {
+            if (tensor.ftype != 0 && tensor.ftype != 1) {
+                fprintf(stderr, "%s: unsupported ftype %d for integer quantization\n", __func__, tensor.ftype);
+                return false;
+            }
+
+            tensor.ftype = itype;
+            tensor.size  = gpt_file_tensor_size(tensor.ftype, tensor.n_dims, tensor.ne);
+        }
+
+        quantize_tensor[it] = quantize;
     }
 
-    // // load vocab
-    // {
-    //     int32_t n_vocab = 0;
-    //     finp.read ((char *) &n_vocab, sizeof(n_vocab));
-    //     fout.write((char *) &n_vocab, sizeof(n_vocab));
-
-    //     if (n_vocab != hparams.n_vocab) {
-    //         fprintf(stderr, "%s: invalid model file '%s' (bad vocab size %d != %d)\n",
-    //                 __func__, fname_inp.c_str(), n_vocab, hparams.n_vocab);
-    //         return false;
-    //     }
-
-    //     std::string word;
-    //     for (int i = 0; i < n_vocab; i++) {
-    //         uint32_t len;
-    //         finp.read ((char *) &len, sizeof(len));
-    //         fout.write((char *) &len, sizeof(len));
-
-    //         word.resize(len);
-    //         finp.read ((char *) word.data(), len);
-    //         fout.write((char *) word.data(), len);
-
-    //         vocab.token_to_id[word] = i;
-    //         vocab.id_to_token[i] = word;
-    //     }
-    // }
+    if (!gpt_file_write_header(fout, file_out)) {
+        fprintf(stderr, "%s: failed to write '%s'\n", __func__, fname_out.c_str());
+        return false;
+    }
 
     // load weights
     {
@@ -148,64 +153,27 @@ bool llama_model_quantize(const std::string & fname_inp, const std::string & fna
 
         std::vector<int64_t> hist_all(1 << 4, 0);
 
-        while (true) {
-            int32_t n_dims;
-            int32_t length;
-            int32_t ftype;
+        for (size_t it = 0; it < file_inp.tensors.size(); ++it) {
+            const auto & tensor_inp = file_inp.tensors[it];
+            const auto & tensor_out = file_out.tensors[it];
 
-            finp.read(reinterpret_cast<char *>(&n_dims), sizeof(n_dims));
-            finp.read(reinterpret_cast<char *>(&length), sizeof(length));
-            finp.read(reinterpret_cast<char *>(&ftype),  sizeof(ftype));
+            const std::string & name = tensor_inp.name;
 
-            if (finp.eof()) {
-                break;
-            }
+            const int32_t * ne = tensor_inp.ne;
 
-            int32_t nelements = 1;
-            int32_t ne[2] = { 1, 1 };
-            for (int i = 0; i < n_dims; ++i) {
-                finp.read (reinterpret_cast<char *>(&ne[i]), sizeof(ne[i]));
-                nelements *= ne[i];
-            }
+            const int32_t nelements = ne[0]*ne[1];
 
-            std::string name(length, 0);
-            finp.read (&name[0], length);
+            const bool quantize = quantize_tensor[it];
 
             {
-                static const char * ftype_str[] = { "f32", "f16", "q4_0", "q4_1", };
-                printf("%48s - [%5d, %5d], type = %6s ", name.data(), ne[0], ne[1], ftype_str[ftype]);
+                static const char * ftype_str[] = { "f32", "f16", "q4_0", "q4_1", "q4_0i", "q4_0h", };
+                printf("%48s - [%5d, %5d], type = %6s ", name.data(), ne[0], ne[1], ftype_str[tensor_inp.ftype]);
             }
 
-            // regexes of tensor names to be quantized
-            const std::vector<std::string> k_names = {
-                ".*weight",
-            };
-            // We skip quantization for `tok_embeddings.weight`.
-            const char * k_names_skip = "tok_embeddings";
-
-            bool quantize = false;
-            for (const auto & s : k_names) {
-                if (std::regex_match(name, std::regex(s))) {
-                    if (name.find(k_names_skip) != std::string::npos) {
-                        // printf("skipped k_names_skip for %s layer", name.c_str());
-                        break;
-                    } 
-
-                    quantize = true;
-                    break;
-                }
-            }
-            // printf("quantize = %d for layer %s", quantize, name.c_str());
-            // quantize only 2D tensors
-            quantize &= (n_dims == 2);
+            finp.seekg(tensor_inp.offset);
 
             if (quantize) {
-                if (ftype != 0 && ftype != 1) {
-                    fprintf(stderr, "%s: unsupported ftype %d for integer quantization\n", __func__, ftype);
-                    return false;
-                }
-
-                if (ftype == 1) {
+                if (tensor_inp.ftype == 1) {
                     data_f16.resize(nelements);
                     finp.read(reinterpret_cast<char *>(data_f16.data()), nelements * sizeof(ggml_fp16_t));
                     data_f32.resize(nelements);
@@ -216,22 +184,15 @@ bool llama_model_quantize(const std::string & fname_inp, const std::string & fna
                     data_f32.resize(nelements);
                     finp.read(reinterpret_cast<char *>(data_f32.data()), nelements * sizeof(float));
                 }
-
-                ftype = itype;
             } else {
-                const int bpe = (ftype == 0) ? sizeof(float) : sizeof(uint16_t);
-
-                data_u8.resize(nelements*bpe);
-                finp.read(reinterpret_cast<char *>(data_u8.data()), nelements * bpe);
+                data_u8.resize(tensor_inp.size);
+                finp.read(reinterpret_cast<char *>(data_u8.data()), tensor_inp.size);
             }
 
-            fout.write(reinterpret_cast<char *>(&n_dims), sizeof(n_dims));
-            fout.write(reinterpret_cast<char *>(&length), sizeof(length));
-            fout.write(reinterpret_cast<char *>(&ftype),  sizeof(ftype));
-            for (int i = 0; i < n_dims; ++i) {
-                fout.write(reinterpret_cast<char *>(&ne[i]), sizeof(ne[i]));
+            if (!finp) {
+                fprintf(stderr, "%s: failed to read tensor '%s'\n", __func__, name.c_str());
+                return false;
             }
-            fout.write(&name[0], length);
 
             if (quantize) {
                 printf("quantizing .. ");
@@ -249,6 +210,14 @@ bool llama_model_quantize(const std::string & fname_inp, const std::string & fna
                         {
                             cur_size = ggml_quantize_q4_1(data_f32.data(), work.data(), nelements, ne[0], QK, hist_cur.data());
                         } break;
+                    case GGML_TYPE_Q4_0I:
+                        {
+                            cur_size = ggml_quantize_q4_0i(data_f32.data(), work.data(), nelements, ne[0], QK, hist_cur.data());
+                        } break;
+                    case GGML_TYPE_Q4_0H:
+                        {
+                            cur_size = ggml_quantize_q4_0h(data_f32.data(), work.data(), nelements, ne[0], QK, hist_cur.data());
+                        } break;
                     default:
                         {
                             fprintf(stderr, "%s: unsupported quantization type %d\n", __func__, type);
@@ -256,7 +225,15 @@ bool llama_model_quantize(const std::string & fname_inp, const std::string & fna
                         }
                 }
 
-                fout.write(reinterpret_cast<char *>(work.data()), cur_size);
+                if (cur_size != tensor_out.size) {
+                    fprintf(stderr, "%s: tensor '%s' quantized to %zu bytes, expected %zu\n", __func__, name.c_str(), cur_size, tensor_out.size);
+                    return false;
+                }
+
+                if (!gpt_file_write_data(fout, tensor_out, work.data())) {
+                    fprintf(stderr, "%s: failed to write tensor '%s'\n", __func__, name.c_str());
+                    return false;
+                }
                 total_size_new += cur_size;
 
                 printf("size = %8.2f MB -> %8.2f MB | hist: ", nelements * sizeof(float)/1024.0/1024.0, cur_size/1024.0/1024.0);
@@ -270,7 +247,10 @@ bool llama_model_quantize(const std::string & fname_inp, const std::string & fna
                 printf("\n");
             } else {
                 printf("size = %8.3f MB\n", data_u8.size()/1024.0/1024.0);
-                fout.write(reinterpret_cast<char *>(data_u8.data()), data_u8.size());
+                if (!gpt_file_write_data(fout, tensor_out, data_u8.data())) {
+                    fprintf(stderr, "%s: failed to write tensor '%s'\n", __func__, name.c_str());
+                    return false;
+                }
                 total_size_new += data_u8.size();
             }
 
@@ -303,11 +283,15 @@ bool llama_model_quantize(const std::string & fname_inp, const std::string & fna
 // usage:
 //  ./llama-quantize models/llama-model.bin models/llama-model-quant.bin type
 //
+// the input can be a legacy or an indexed file, the output is an indexed file (see gpt_file)
+//
 int main(int argc, char ** argv) {
     if (argc != 4) {
         fprintf(stderr, "usage: %s models/llama-model.bin models/llama-model-quant.bin type\n", argv[0]);
         fprintf(stderr, "  type = 2 - q4_0\n");
         fprintf(stderr, "  type = 3 - q4_1\n");
+        fprintf(stderr, "  type = 4 - q4_0i (q4_0 with the scales interleaved with the nibbles)\n");
+        fprintf(stderr, "  type = 5 - q4_0h (q4_0i with fp16 scales)\n");
         return 1;
     }
 
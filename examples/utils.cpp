@@ -1,7 +1,35 @@
 #include "utils.h"
 
+#include "ggml/ggml.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <regex>
+#include <set>
+#include <sstream>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+// the cpu ids that fit in an affinity mask
+#if defined(CPU_SETSIZE)
+#define GPT_MAX_CPUS CPU_SETSIZE
+#else
+#define GPT_MAX_CPUS 1024
+#endif
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 bool gpt_params_parse(int argc, char ** argv, gpt_params & params) {
     for (int i = 1; i < argc; i++) {
@@ -23,6 +51,20 @@ bool gpt_params_parse(int argc, char ** argv, gpt_params & params) {
             params.temp = std::stof(argv[++i]);
         } else if (arg == "-b" || arg == "--batch_size") {
             params.n_batch = std::stoi(argv[++i]);
+        } else if (arg == "--numa") {
+            params.numa = true;
+        } else if (arg == "--physical-cores") {
+            params.physical_cores = true;
+        } else if (arg == "--cpus") {
+            params.cpu_list = argv[++i];
+        } else if (arg == "--pin") {
+            params.pin_threads = true;
+        } else if (arg == "--no-mmap") {
+            params.use_mmap = false;
+        } else if (arg == "--prefetch") {
+            params.prefetch = true;
+        } else if (arg == "--io-threads") {
+            params.n_io_threads = std::stoi(argv[++i]);
         } else if (arg == "-m" || arg == "--model" || arg == "--model_path") {
             params.model = argv[++i];
         } else if (arg == "-v" || arg == "--vocab" || arg == "--vocab_path") {
@@ -54,6 +96,13 @@ void gpt_print_usage(int argc, char ** argv, const gpt_params & params) {
     fprintf(stderr, "  --top_p N              top-p sampling (default: %.1f)\n", params.top_p);
     fprintf(stderr, "  --temp --temperature N temperature (default: %.1f)\n", params.temp);
     fprintf(stderr, "  -b N, --batch_size N   batch size for prompt processing (default: %d)\n", params.n_batch);
+    fprintf(stderr, "  --numa                 interleave the model over the NUMA nodes and keep each thread on one node\n");
+    fprintf(stderr, "  --physical-cores       run at most one thread per physical core (no SMT siblings)\n");
+    fprintf(stderr, "  --cpus LIST            run the threads on these cpus only, e.g. 0-7,16,18\n");
+    fprintf(stderr, "  --pin                  pin each thread to one cpu\n");
+    fprintf(stderr, "  --no-mmap              read the model into memory instead of mapping it\n");
+    fprintf(stderr, "  --prefetch             read the whole mapped model ahead at startup\n");
+    fprintf(stderr, "  --io-threads N         number of threads that read the model with --no-mmap (default: %d)\n", params.n_io_threads);
     fprintf(stderr, "  -m Path/to/llama/7B, --model Path/to/llama/7B, --model_path Path/to/llama/7B\n");
     fprintf(stderr, "  -v Path/to/llama/tokenizer.model, --vocab Path/to/llama/tokenizer.model, --model_path Path/to/llama/tokenizer.model\n");
     fprintf(stderr, "                         model path (default: %s)\n", params.model.c_str());
@@ -79,6 +128,578 @@ std::string gpt_random_prompt(std::mt19937 & rng) {
     return "The";
 }
 
+std::vector<gpt_cpu> gpt_cpu_topology() {
+    std::vector<gpt_cpu> cpus;
+
+#if defined(__linux__)
+    auto read_int = [](const std::string & path, int & value) {
+        std::ifstream fin(path);
+        return (bool) (fin >> value);
+    };
+
+    // the online cpus, like "0-3,8-11" - the ids can have gaps
+    std::vector<int> ids;
+    {
+        std::ifstream fin("/sys/devices/system/cpu/online");
+        std::string list;
+        if (!(fin >> list) || !gpt_parse_cpu_list(list, ids)) {
+            ids.clear();
+        }
+    }
+
+    for (int id : ids) {
+        const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(id);
+
+        gpt_cpu cpu = { id, id, 0 };
+        if (!read_int(dir + "/topology/core_id", cpu.core)) {
+            continue;
+        }
+        read_int(dir + "/topology/physical_package_id", cpu.package);
+
+        cpus.push_back(cpu);
+    }
+#endif
+
+    if (cpus.empty()) {
+        const int n = std::max(1u, std::thread::hardware_concurrency());
+        for (int id = 0; id < n; id++) {
+            cpus.push_back({ id, id, 0 });
+        }
+    }
+
+    return cpus;
+}
+
+bool gpt_parse_cpu_list(const std::string & list, std::vector<int> & cpus) {
+    cpus.clear();
+
+    std::stringstream ss(list);
+    std::string range;
+
+    while (std::getline(ss, range, ',')) {
+        int first = 0;
+        int last  = 0;
+        char dash = 0;
+
+        std::stringstream rs(range);
+        if (!(rs >> first) || first < 0 || first >= GPT_MAX_CPUS) {
+            return false;
+        }
+        if (rs >> dash) {
+            if (dash != '-' || !(rs >> last) || last < first || last >= GPT_MAX_CPUS) {
+                return false;
+            }
+        } else {
+            last = first;
+        }
+
+        for (int id = first; id <= last; id++) {
+            cpus.push_back(id);
+        }
+    }
+
+    return !cpus.empty();
+}
+
+bool gpt_params_init_threads(gpt_params & params) {
+    const std::vector<gpt_cpu> topology = gpt_cpu_topology();
+
+    std::set<std::pair<int, int>> cores;
+    std::set<int> packages;
+    for (const auto & cpu : topology) {
+        cores.insert({ cpu.package, cpu.core });
+        packages.insert(cpu.package);
+    }
+
+    // the cpus to choose from, in order
+    std::vector<gpt_cpu> cpus;
+
+    if (!params.cpu_list.empty()) {
+        std::vector<int> ids;
+        if (!gpt_parse_cpu_list(params.cpu_list, ids)) {
+            fprintf(stderr, "%s: invalid cpu list '%s'\n", __func__, params.cpu_list.c_str());
+            return false;
+        }
+
+        for (int id : ids) {
+            auto it = std::find_if(topology.begin(), topology.end(), [id](const gpt_cpu & cpu) { return cpu.id == id; });
+            if (it == topology.end()) {
+                fprintf(stderr, "%s: cpu %d is not online\n", __func__, id);
+                return false;
+            }
+            cpus.push_back(*it);
+        }
+    } else {
+        cpus = topology;
+    }
+
+    // keep the first cpu of each core, then no two threads share a core
+    if (params.physical_cores) {
+        std::set<std::pair<int, int>> used;
+        std::vector<gpt_cpu> first;
+        for (const auto & cpu : cpus) {
+            if (used.insert({ cpu.package, cpu.core }).second) {
+                first.push_back(cpu);
+            }
+        }
+        cpus = first;
+    }
+
+    const bool restrict_cpus = params.physical_cores || !params.cpu_list.empty();
+
+    if (restrict_cpus) {
+        params.n_threads = std::min(params.n_threads, (int32_t) cpus.size());
+    }
+
+    std::vector<int> ids;
+    for (int i = 0; i < (int) cpus.size() && (int) ids.size() < params.n_threads; i++) {
+        ids.push_back(cpus[i].id);
+    }
+
+    if (params.pin_threads) {
+        // more threads than cpus: the threads take the cpus round-robin
+        ggml_set_thread_affinity(ids.data(), ids.size());
+    } else if (restrict_cpus) {
+#if defined(__linux__)
+        // the threads created from now on inherit the cpus of this one, the OS moves them only between these
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (int id : ids) {
+            CPU_SET(id, &cpuset);
+        }
+
+        if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
+            fprintf(stderr, "%s: failed to set the affinity of the threads\n", __func__);
+        }
+#endif
+    }
+
+    std::string list;
+    for (int id : ids) {
+        list += (list.empty() ? "" : ",") + std::to_string(id);
+    }
+
+    printf("%s: %zu logical cpus, %zu physical cores, %zu packages\n", __func__, topology.size(), cores.size(), packages.size());
+    printf("%s: n_threads = %d, cpus = %s%s\n", __func__, params.n_threads,
+            restrict_cpus || params.pin_threads ? list.c_str() : "any",
+            params.pin_threads ? " (pinned)" : "");
+
+    return true;
+}
+
+bool gpt_mmap_open(const std::string & fname, bool prefetch, gpt_mmap & mapping) {
+#if defined(_WIN32)
+    (void) fname;
+    (void) prefetch;
+    (void) mapping;
+
+    return false;
+#else
+    const int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    int flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+    if (prefetch) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+
+    void * addr = mmap(NULL, st.st_size, PROT_READ, flags, fd, 0);
+
+    // the mapping keeps the file open
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+#if !defined(MAP_POPULATE)
+    if (prefetch) {
+        posix_madvise(addr, st.st_size, POSIX_MADV_WILLNEED);
+    }
+#endif
+
+    mapping.addr = addr;
+    mapping.size = st.st_size;
+
+    return true;
+#endif
+}
+
+void gpt_mmap_close(gpt_mmap & mapping) {
+#if !defined(_WIN32)
+    if (mapping.addr) {
+        munmap(mapping.addr, mapping.size);
+    }
+#endif
+
+    mapping.addr = nullptr;
+    mapping.size = 0;
+}
+
+int gpt_file_tensor_type(int32_t ftype) {
+    static const ggml_type types[] = {
+        GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_Q4_0, GGML_TYPE_Q4_1, GGML_TYPE_Q4_0I, GGML_TYPE_Q4_0H,
+    };
+
+    if (ftype < 0 || ftype >= (int32_t) (sizeof(types)/sizeof(types[0]))) {
+        return GGML_TYPE_COUNT;
+    }
+
+    return types[ftype];
+}
+
+size_t gpt_file_tensor_size(int32_t ftype, int32_t n_dims, const int32_t * ne) {
+    const int type = gpt_file_tensor_type(ftype);
+
+    if (type == GGML_TYPE_COUNT) {
+        return 0;
+    }
+
+    size_t nelements = 1;
+    for (int i = 0; i < n_dims; ++i) {
+        nelements *= ne[i];
+    }
+
+    return nelements*ggml_type_size((ggml_type) type)/ggml_blck_size((ggml_type) type);
+}
+
+// n_dims, name length, ftype, ne[n_dims], name
+static bool gpt_file_read_tensor(std::istream & fin, gpt_file_tensor & tensor) {
+    int32_t length = 0;
+
+    fin.read((char *) &tensor.n_dims, sizeof(tensor.n_dims));
+    fin.read((char *) &length,        sizeof(length));
+    fin.read((char *) &tensor.ftype,  sizeof(tensor.ftype));
+
+    if (!fin || tensor.n_dims < 1 || tensor.n_dims > 2 || length <= 0) {
+        return false;
+    }
+
+    for (int i = 0; i < tensor.n_dims; ++i) {
+        fin.read((char *) &tensor.ne[i], sizeof(tensor.ne[i]));
+    }
+
+    tensor.name.resize(length);
+    fin.read(&tensor.name[0], length);
+
+    tensor.size = gpt_file_tensor_size(tensor.ftype, tensor.n_dims, tensor.ne);
+
+    return fin && tensor.size > 0;
+}
+
+static void gpt_file_write_tensor(std::ostream & fout, const gpt_file_tensor & tensor) {
+    const int32_t length = tensor.name.size();
+
+    fout.write((const char *) &tensor.n_dims, sizeof(tensor.n_dims));
+    fout.write((const char *) &length,        sizeof(length));
+    fout.write((const char *) &tensor.ftype,  sizeof(tensor.ftype));
+
+    for (int i = 0; i < tensor.n_dims; ++i) {
+        fout.write((const char *) &tensor.ne[i], sizeof(tensor.ne[i]));
+    }
+
+    fout.write(tensor.name.data(), length);
+}
+
+bool gpt_file_read(std::istream & fin, int n_hparams, gpt_file & file) {
+    uint32_t magic[2] = { 0, 0 };
+    fin.read((char *) magic, sizeof(magic));
+
+    if (!fin || magic[0] != GPT_FILE_MAGIC) {
+        fprintf(stderr, "%s: bad magic 0x%08x\n", __func__, magic[0]);
+        return false;
+    }
+
+    file.tensors.clear();
+
+    if (magic[1] == GPT_FILE_MAGIC_LEGACY) {
+        file.indexed   = false;
+        file.version   = 0;
+        file.alignment = 1;
+
+        file.hparams.resize(n_hparams);
+        fin.read((char *) file.hparams.data(), n_hparams*sizeof(int32_t));
+
+        while (true) {
+            gpt_file_tensor tensor;
+
+            if (!gpt_file_read_tensor(fin, tensor)) {
+                if (fin.eof()) {
+                    break;
+                }
+
+                fprintf(stderr, "%s: bad tensor record after %zu tensors\n", __func__, file.tensors.size());
+                return false;
+            }
+
+            tensor.offset = fin.tellg();
+            fin.seekg(tensor.size, std::ios::cur);
+
+            file.tensors.push_back(tensor);
+        }
+
+        fin.clear();
+
+        return true;
+    }
+
+    if (magic[1] != GPT_FILE_MAGIC_INDEXED) {
+        fprintf(stderr, "%s: bad magic 0x%08x\n", __func__, magic[1]);
+        return false;
+    }
+
+    file.indexed = true;
+
+    fin.read((char *) &file.version,   sizeof(file.version));
+    fin.read((char *) &file.alignment, sizeof(file.alignment));
+
+    if (file.version != GPT_FILE_VERSION) {
+        fprintf(stderr, "%s: unsupported version %u\n", __func__, file.version);
+        return false;
+    }
+
+    int32_t n = 0;
+
+    fin.read((char *) &n, sizeof(n));
+    if (!fin || n < 0 || n > 1024) {
+        fprintf(stderr, "%s: bad number of hparams %d\n", __func__, n);
+        return false;
+    }
+
+    file.hparams.resize(n);
+    fin.read((char *) file.hparams.data(), n*sizeof(int32_t));
+
+    fin.read((char *) &n, sizeof(n));
+    if (!fin || n < 0) {
+        fprintf(stderr, "%s: bad number of tensors %d\n", __func__, n);
+        return false;
+    }
+
+    file.tensors.resize(n);
+
+    for (auto & tensor : file.tensors) {
+        uint64_t offset = 0;
+        uint64_t size   = 0;
+
+        const size_t size_expected = gpt_file_read_tensor(fin, tensor) ? tensor.size : 0;
+
+        fin.read((char *) &offset, sizeof(offset));
+        fin.read((char *) &size,   sizeof(size));
+
+        if (!fin || size_expected == 0 || size != size_expected) {
+            fprintf(stderr, "%s: bad tensor '%s' in the table\n", __func__, tensor.name.c_str());
+            return false;
+        }
+
+        tensor.offset = offset;
+        tensor.size   = size;
+    }
+
+    return true;
+}
+
+bool gpt_file_write_header(std::ostream & fout, gpt_file & file) {
+    file.indexed   = true;
+    file.version   = GPT_FILE_VERSION;
+    file.alignment = std::max<uint32_t>(file.alignment, GPT_FILE_ALIGNMENT);
+
+    const uint32_t magic[2] = { GPT_FILE_MAGIC, GPT_FILE_MAGIC_INDEXED };
+
+    const int32_t n_hparams = file.hparams.size();
+    const int32_t n_tensors = file.tensors.size();
+
+    // the size of the header, the data starts after it
+    size_t offset = sizeof(magic) + sizeof(file.version) + sizeof(file.alignment) +
+        sizeof(n_hparams) + n_hparams*sizeof(int32_t) + sizeof(n_tensors);
+
+    for (const auto & tensor : file.tensors) {
+        offset += 3*sizeof(int32_t) + tensor.n_dims*sizeof(int32_t) + tensor.name.size() + 2*sizeof(uint64_t);
+    }
+
+    for (auto & tensor : file.tensors) {
+        offset = (offset + file.alignment - 1)/file.alignment*file.alignment;
+
+        tensor.offset = offset;
+        offset += tensor.size;
+    }
+
+    fout.write((const char *) magic,           sizeof(magic));
+    fout.write((const char *) &file.version,   sizeof(file.version));
+    fout.write((const char *) &file.alignment, sizeof(file.alignment));
+
+    fout.write((const char *) &n_hparams,          sizeof(n_hparams));
+    fout.write((const char *) file.hparams.data(), n_hparams*sizeof(int32_t));
+
+    fout.write((const char *) &n_tensors, sizeof(n_tensors));
+
+    for (const auto & tensor : file.tensors) {
+        const uint64_t offset = tensor.offset;
+        const uint64_t size   = tensor.size;
+
+        gpt_file_write_tensor(fout, tensor);
+
+        fout.write((const char *) &offset, sizeof(offset));
+        fout.write((const char *) &size,   sizeof(size));
+    }
+
+    return (bool) fout;
+}
+
+bool gpt_file_write_data(std::ostream & fout, const gpt_file_tensor & tensor, const void * data) {
+    const size_t pos = fout.tellp();
+
+    if (pos > tensor.offset) {
+        fprintf(stderr, "%s: tensor '%s' written out of order\n", __func__, tensor.name.c_str());
+        return false;
+    }
+
+    // zero padding up to the aligned offset
+    const std::vector<char> pad(tensor.offset - pos, 0);
+
+    fout.write(pad.data(), pad.size());
+    fout.write((const char *) data, tensor.size);
+
+    return (bool) fout;
+}
+
+bool gpt_read_parallel(const std::string & fname, const std::vector<gpt_read_request> & requests, int n_threads) {
+#if defined(_WIN32)
+    (void) n_threads;
+
+    auto fin = std::ifstream(fname, std::ios::binary);
+    if (!fin) {
+        return false;
+    }
+
+    for (const auto & req : requests) {
+        fin.seekg(req.offset);
+        fin.read((char *) req.dst, req.size);
+    }
+
+    return (bool) fin;
+#else
+    const int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: failed to open '%s'\n", __func__, fname.c_str());
+        return false;
+    }
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // the chunks in file order: the threads move through the file together and the read-ahead stays useful
+    std::vector<gpt_read_request> chunks;
+
+    for (const auto & req : requests) {
+        for (size_t offs = 0; offs < req.size; offs += GPT_READ_CHUNK) {
+            chunks.push_back({ req.offset + offs, std::min<size_t>(GPT_READ_CHUNK, req.size - offs), (char *) req.dst + offs });
+        }
+    }
+
+    std::sort(chunks.begin(), chunks.end(), [](const gpt_read_request & a, const gpt_read_request & b) {
+        return a.offset < b.offset;
+    });
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool>   failed(false);
+
+    auto worker = [&]() {
+        while (!failed) {
+            const size_t ic = next++;
+            if (ic >= chunks.size()) {
+                break;
+            }
+
+            const auto & chunk = chunks[ic];
+
+            // pread can return less than asked for
+            for (size_t done = 0; done < chunk.size; ) {
+                const ssize_t n = pread(fd, (char *) chunk.dst + done, chunk.size - done, chunk.offset + done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                // an error or the end of the file before the end of the chunk
+                if (n <= 0) {
+                    failed = true;
+                    break;
+                }
+
+                done += n;
+            }
+        }
+    };
+
+    n_threads = std::max(1, std::min<int>(n_threads, chunks.size()));
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto & t : threads) {
+        t.join();
+    }
+
+    close(fd);
+
+    if (failed) {
+        fprintf(stderr, "%s: failed to read '%s'\n", __func__, fname.c_str());
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+size_t gpt_graph_ctx_size() {
+    // at most GGML_MAX_NODES nodes and as many leafs, with a few bytes for the parameters (the 4 of ROPE are the most)
+    return 2*GGML_MAX_NODES*(ggml_tensor_overhead() + 4*sizeof(int32_t));
+}
+
+void gpt_graph_alloc(struct ggml_cgraph & gf, gpt_graph_buf & buf) {
+    const size_t size = ggml_graph_alloc_size(&gf);
+
+    if (buf.data.size() < size) {
+        buf.data.resize(size);
+    }
+
+    ggml_graph_alloc(&gf, buf.data.data(), buf.data.size());
+}
+
+void gpt_graph_set_work(struct ggml_context * ctx, struct ggml_cgraph & gf, gpt_graph_buf & buf) {
+    const size_t work_size = ggml_graph_work_size(&gf);
+
+    if (work_size == 0) {
+        return;
+    }
+
+    if (buf.work.size() < work_size) {
+        buf.work.resize(work_size);
+    }
+
+    if (gf.work == nullptr) {
+        // only the object, the context does not allocate
+        gf.work = ggml_new_tensor_1d(ctx, GGML_TYPE_I8, work_size);
+    }
+
+    gf.work->data = buf.work.data();
+    gf.work_size  = buf.work.size();
+}
+
 void replace(std::string & str, const std::string & needle, const std::string & replacement) {
     size_t pos = 0;
     while ((pos = str.find(needle, pos)) != std::string::npos) {
@@ -451,3 +1072,71 @@ size_t ggml_quantize_q4_1(float * src, void * dst, int n, int k, int qk, int64_t
 
     return (n/k)*row_size;
 }
+
+static size_t ggml_quantize_q4_0_interleaved(float * src, void * dst, int n, int k, int qk, bool f16, int64_t * hist) {
+    const int nb = k / qk;
+    const size_t scale_size = f16 ? sizeof(ggml_fp16_t) : sizeof(float);
+    const size_t block_size = scale_size + sizeof(uint8_t)*qk/2;
+    const size_t row_size = nb*block_size;
+
+    assert(k % qk == 0);
+
+    uint8_t pp[qk/2];
+
+    char * pdst = (char *) dst;
+
+    for (int j = 0; j < n; j += k) {
+        char * prow = pdst + (j/k)*row_size;
+
+        for (int i = 0; i < nb; i++) {
+            char * pblk = prow + i*block_size;
+
+            float amax = 0.0f; // absolute max
+
+            {
+                for (int l = 0; l < qk; l++) {
+                    const float v = src[j + i*qk + l];
+                    amax = std::max(amax, fabsf(v));
+                }
+
+                const float d = amax / ((1 << 3) - 1);
+                const float id = d ? 1.0f/d : 0.0f;
+
+                if (f16) {
+                    const ggml_fp16_t dh = ggml_fp32_to_fp16(d);
+                    memcpy(pblk, &dh, sizeof(dh));
+                } else {
+                    memcpy(pblk, &d, sizeof(d));
+                }
+
+                for (int l = 0; l < qk; l += 2) {
+                    const float v0 = (src[j + i*qk + l + 0])*id;
+                    const float v1 = (src[j + i*qk + l + 1])*id;
+
+                    const uint8_t vi0 = ((int8_t) (round(v0))) + 8;
+                    const uint8_t vi1 = ((int8_t) (round(v1))) + 8;
+
+                    assert(vi0 >= 0 && vi0 < 16);
+                    assert(vi1 >= 0 && vi1 < 16);
+
+                    hist[vi0]++;
+                    hist[vi1]++;
+
+                    pp[l/2] = vi0 | (vi1 << 4);
+                }
+
+                memcpy(pblk + scale_size, pp, sizeof(pp));
+            }
+        }
+    }
+
+    return (n/k)*row_size;
+}
+
+size_t ggml_quantize_q4_0i(float * src, void * dst, int n, int k, int qk, int64_t * hist) {
+    return ggml_quantize_q4_0_interleaved(src, dst, n, k, qk, false, hist);
+}
+
+size_t ggml_quantize_q4_0h(float * src, void * dst, int n, int k, int qk, int64_t * hist) {
+    return ggml_quantize_q4_0_interleaved(src, dst, n, k, qk, true, hist);
+}
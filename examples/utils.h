@@ -8,6 +8,8 @@
 #include <random>
 #include <thread>
 #include <codecvt>
+#include <istream>
+#include <ostream>
 
 //
 // CLI argument parsing
@@ -25,6 +27,18 @@ struct gpt_params {
 
     int32_t n_batch = 16; // batch size for prompt processing
 
+    bool numa = false; // interleave the weights over the NUMA nodes and keep the threads on their nodes
+
+    bool use_mmap = true;  // map the weights from the model file instead of reading them into memory
+    bool prefetch = false; // read the whole mapped file ahead instead of faulting it in on first use
+
+    int32_t n_io_threads = 4; // threads that read the weights without the mapping
+
+    // cpu affinity (see gpt_params_init_threads)
+    bool        physical_cores = false; // one thread per physical core - no two threads on SMT siblings
+    std::string cpu_list;               // the cpus to run on, e.g. "0-7,16,18"
+    bool        pin_threads    = false; // keep each thread on one cpu
+
     std::string model = "models/gpt-2-117M/ggml-model.bin"; // model path
     std::string vocab_path;
     std::string prompt;
@@ -36,6 +50,139 @@ void gpt_print_usage(int argc, char ** argv, const gpt_params & params);
 
 std::string gpt_random_prompt(std::mt19937 & rng);
 
+//
+// CPU topology
+//
+
+struct gpt_cpu {
+    int id;
+    int core;    // physical core id within the package
+    int package; // socket
+};
+
+// the online logical cpus (Linux: from sysfs, elsewhere every cpu is its own core)
+std::vector<gpt_cpu> gpt_cpu_topology();
+
+// parse a list of cpus like "0-3,8,10-11", returns false on a malformed list or on an id that does not fit in an
+// affinity mask (CPU_SETSIZE)
+bool gpt_parse_cpu_list(const std::string & list, std::vector<int> & cpus);
+
+// choose the cpus of the threads from the affinity options, limit n_threads to them, pin the ggml threads if asked
+// and print the chosen topology. Call it before creating the thread pool
+bool gpt_params_init_threads(gpt_params & params);
+
+//
+// Model file utils
+//
+
+// a read-only mapping of a whole file, shared with the page cache and with the other processes that map it
+struct gpt_mmap {
+    void * addr = nullptr;
+    size_t size = 0;
+};
+
+// map the file, with prefetch read it all ahead (MAP_POPULATE on Linux, madvise elsewhere)
+// returns false if the file cannot be mapped - the caller reads it instead
+bool gpt_mmap_open(const std::string & fname, bool prefetch, gpt_mmap & mapping);
+
+void gpt_mmap_close(gpt_mmap & mapping);
+
+// model files
+//
+// legacy: the magics "Your" and "GPTs", the hparams, then a record for each tensor:
+//   n_dims, name length, ftype, ne[n_dims], name, data
+// the tensors can only be found by walking the records and the data has no alignment
+//
+// indexed (GPT_FILE_VERSION): the magics "Your" and "GPTi", then
+//   uint32 version, uint32 alignment
+//   int32 n_hparams, int32 hparams[n_hparams]
+//   int32 n_tensors and for each tensor: n_dims, name length, ftype, ne[n_dims], name, uint64 offset, uint64 size
+//   the data of the tensors, each at its offset from the start of the file - a multiple of the alignment
+//
+// ftype: 0 = f32, 1 = f16, 2 = q4_0, 3 = q4_1, 4 = q4_0i, 5 = q4_0h
+
+#define GPT_FILE_MAGIC         0x596f7572 // Your
+#define GPT_FILE_MAGIC_LEGACY  0x47505473 // GPTs
+#define GPT_FILE_MAGIC_INDEXED 0x47505469 // GPTi
+#define GPT_FILE_VERSION       1
+#define GPT_FILE_ALIGNMENT     64
+
+struct gpt_file_tensor {
+    std::string name;
+
+    int32_t ftype  = 0;
+    int32_t n_dims = 0;
+    int32_t ne[2]  = { 1, 1 };
+
+    size_t offset = 0; // of the data from the start of the file
+    size_t size   = 0; // of the data in bytes
+};
+
+struct gpt_file {
+    bool     indexed   = true;
+    uint32_t version   = GPT_FILE_VERSION;
+    uint32_t alignment = GPT_FILE_ALIGNMENT;
+
+    std::vector<int32_t> hparams;
+
+    std::vector<gpt_file_tensor> tensors;
+};
+
+// the ggml_type of a tensor ftype, GGML_TYPE_COUNT for an unknown ftype
+int gpt_file_tensor_type(int32_t ftype);
+
+// the size of the data of a tensor from its ftype and shape, 0 for an unknown ftype
+size_t gpt_file_tensor_size(int32_t ftype, int32_t n_dims, const int32_t * ne);
+
+// read the header and the tensor table of a file in either format
+// a legacy file has n_hparams hparams and its records are walked to find the tensors
+bool gpt_file_read(std::istream & fin, int n_hparams, gpt_file & file);
+
+// write the header of an indexed file - the offsets of the tensors are assigned from their sizes, aligned to at least
+// GPT_FILE_ALIGNMENT
+bool gpt_file_write_header(std::ostream & fout, gpt_file & file);
+
+// write the data of a tensor after the header, in the order of the table
+bool gpt_file_write_data(std::ostream & fout, const gpt_file_tensor & tensor, const void * data);
+
+// the requests are split into chunks of up to GPT_READ_CHUNK bytes
+#define GPT_READ_CHUNK (8*1024*1024)
+
+struct gpt_read_request {
+    size_t offset; // in the file
+    size_t size;
+    void * dst;
+};
+
+// read parts of a file with n_threads threads that take the chunks of the requests in file order, each with pread.
+// The kernel is told to read ahead (POSIX_FADV_SEQUENTIAL) and several reads stay in flight on the device.
+// Without pread (Windows) the requests are read one after the other
+bool gpt_read_parallel(const std::string & fname, const std::vector<gpt_read_request> & requests, int n_threads);
+
+//
+// Graph memory
+//
+
+struct ggml_context;
+struct ggml_cgraph;
+
+// the memory of a graph built in a no_alloc context
+struct gpt_graph_buf {
+    std::vector<uint8_t> data; // the data of the tensors, placed by ggml_graph_alloc
+    std::vector<uint8_t> work; // the work buffer of ggml_graph_compute
+};
+
+// the size of a no_alloc context for one graph: the tensors without their data and the parameters of the ops
+size_t gpt_graph_ctx_size();
+
+// place the tensors of the graph in buf.data - the intermediate results of a layer go over the ones of the previous
+// layer, so it grows to about the size of the ones of one layer
+void gpt_graph_alloc(struct ggml_cgraph & gf, gpt_graph_buf & buf);
+
+// point the graph to a work buffer in buf.work that is large enough for computing it as it is now: the size depends on
+// the threads and on where the tensors are. Call it before each ggml_graph_compute
+void gpt_graph_set_work(struct ggml_context * ctx, struct ggml_cgraph & gf, gpt_graph_buf & buf);
+
 //
 // Vocab utils
 //
@@ -98,3 +245,7 @@ gpt_vocab::id gpt_sample_top_k_top_p(
 
 size_t ggml_quantize_q4_0(float * src, void * dst, int n, int k, int qk, int64_t * hist);
 size_t ggml_quantize_q4_1(float * src, void * dst, int n, int k, int qk, int64_t * hist);
+
+// block-interleaved Q4_0: each block is the scale (f32 or f16) followed by its qk/2 bytes of nibbles
+size_t ggml_quantize_q4_0i(float * src, void * dst, int n, int k, int qk, int64_t * hist);
+size_t ggml_quantize_q4_0h(float * src, void * dst, int n, int k, int qk, int64_t * hist);
@@ -183,6 +183,8 @@ extern "C" {
 #define GGML_MAX_CONTEXTS 64
 #define GGML_MAX_OPT      4
 
+#define GGML_DEFAULT_N_SPIN 1024
+
 #ifdef __ARM_NEON
 // we use the built-in 16-bit float type
 typedef __fp16 ggml_fp16_t;
@@ -194,12 +196,18 @@ typedef uint16_t ggml_fp16_t;
 float       ggml_fp16_to_fp32(ggml_fp16_t x);
 ggml_fp16_t ggml_fp32_to_fp16(float x);
 
+void ggml_fp16_to_fp32_row(const ggml_fp16_t * x, float * y, size_t n);
+void ggml_fp32_to_fp16_row(const float * x, ggml_fp16_t * y, size_t n);
+
 struct ggml_object;
 struct ggml_context;
 
 enum ggml_type {
     GGML_TYPE_Q4_0,
     GGML_TYPE_Q4_1,
+    GGML_TYPE_Q4_0I, // Q4_0 with the scale of each block stored next to its nibbles
+    GGML_TYPE_Q4_0H, // same as Q4_0I, with fp16 scales
+    GGML_TYPE_Q8_0, // 8-bit blocks, used for the activations of the quantized matrix multiplications
     GGML_TYPE_I8,
     GGML_TYPE_I16,
     GGML_TYPE_I32,
@@ -283,8 +291,17 @@ struct ggml_tensor {
     int64_t perf_time_us; // 8 bytes
 
     void * data; // 8 bytes
+
+    // if the tensor is a view (or the in-place result) of another tensor: the tensor that owns the data and the
+    // offset of the view in it - see ggml_graph_alloc
+    struct ggml_tensor * view_src; // 8 bytes
+    size_t view_offs; // 8 bytes
+
     char padding[8]; // 8 bytes
-}; // total: 4 + 4 + 16 + 32 + 4 + 1 + 8 + 8 + 8 + 32 + 4 + 8 + 8 + 8 + 8 = 153 bytes
+}; // total: 4 + 4 + 16 + 32 + 4 + 1 + 8 + 8 + 8 + 32 + 4 + 8 + 8 + 8 + 8 + 8 + 8 = 169 bytes
+
+// see ggml_threadpool_create
+struct ggml_threadpool;
 
 // computation graph
 struct ggml_cgraph {
@@ -292,6 +309,9 @@ struct ggml_cgraph {
     int n_leafs;
     int n_threads;
 
+    // if set, the graph is computed on these threads and n_threads is taken from the pool
+    struct ggml_threadpool * threadpool;
+
     size_t work_size;
     struct ggml_tensor * work;
 
@@ -316,6 +336,7 @@ struct ggml_init_params {
     // memory pool
     size_t mem_size;   // bytes
     void * mem_buffer; // if NULL, memory will be allocated internally
+    bool   no_alloc;   // don't reserve memory for the data of the new tensors - the caller sets tensor->data
 };
 
 void    ggml_time_init(void); // call this once at the beginning of the program
@@ -341,6 +362,9 @@ void ggml_free(struct ggml_context * ctx);
 
 size_t ggml_used_mem(const struct ggml_context * ctx);
 
+// the memory that a tensor takes in a context besides its data (e.g. in a no_alloc context)
+size_t ggml_tensor_overhead(void);
+
 size_t ggml_set_scratch(struct ggml_context * ctx, struct ggml_scratch scratch);
 
 struct ggml_tensor * ggml_new_tensor(
@@ -379,7 +403,7 @@ struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value);
 struct ggml_tensor * ggml_new_f32(struct ggml_context * ctx, float value);
 
 struct ggml_tensor * ggml_dup_tensor (struct ggml_context * ctx, const struct ggml_tensor * src);
-struct ggml_tensor * ggml_view_tensor(struct ggml_context * ctx, const struct ggml_tensor * src);
+struct ggml_tensor * ggml_view_tensor(struct ggml_context * ctx, struct ggml_tensor * src);
 
 struct ggml_tensor * ggml_set_zero(struct ggml_tensor * tensor);
 struct ggml_tensor * ggml_set_i32 (struct ggml_tensor * tensor, int32_t value);
@@ -640,6 +664,69 @@ struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cg
 void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph);
 void ggml_graph_reset  (struct ggml_cgraph * cgraph);
 
+// a graph can be computed many times with different values of n_past (e.g. once for each generated token)
+// without building it again:
+//   - ROPE and DIAG_MASK_INF read n_past when they are computed, ggml_set_n_past changes it
+//   - ggml_graph_set_view_offset moves a view (e.g. the part of the KV cache that a ggml_cpy writes to) within
+//     the viewed tensor, together with the nodes of the graph that alias it (the ggml_cpy into it)
+// the shapes of the tensors cannot change
+void ggml_set_n_past(struct ggml_tensor * tensor, int n_past);
+void ggml_graph_set_view_offset(struct ggml_cgraph * cgraph, struct ggml_tensor * view, size_t offset);
+
+// the intermediate results of a graph built in a no_alloc context (see ggml_init_params) can share one buffer: the
+// result of a node is placed over the tensors that no node after it reads
+//   - ggml_graph_alloc_size returns the size of the buffer, ggml_graph_alloc sets the data of the tensors in it
+//   - the tensors that the graph reads before writing them (the inputs) get their own space, so that they can be
+//     set before ggml_graph_compute - so do the results that no node reads (the outputs), which are kept after it
+//   - the views follow the tensors that they view
+// only the tensors without data are placed - e.g. the weights and the KV cache stay where they are
+// the parameters of the ops (e.g. of ROPE) are still allocated in the context, which must have room for them - so is
+// the work buffer of ggml_graph_compute, unless the caller sets one (see ggml_graph_work_size)
+size_t ggml_graph_alloc_size(struct ggml_cgraph * cgraph);
+void   ggml_graph_alloc     (struct ggml_cgraph * cgraph, void * buffer, size_t size);
+
+// the size of the work buffer that ggml_graph_compute needs for the graph where its tensors are now, on the threads
+// of cgraph - the caller can set cgraph->work (and work_size) to a buffer of its own of at least this size
+size_t ggml_graph_work_size(struct ggml_cgraph * cgraph);
+
+// long-lived worker threads for computing graphs repeatedly (e.g. once per generated token)
+// without a pool, ggml_graph_compute creates and joins n_threads - 1 threads on each call
+// a pool computes one graph at a time - the workers sleep between the graphs
+struct ggml_threadpool * ggml_threadpool_create(int n_threads);
+void                     ggml_threadpool_free  (struct ggml_threadpool * threadpool);
+int                      ggml_threadpool_n_threads(const struct ggml_threadpool * threadpool);
+
+// total time (summed over the threads) spent waiting at the end of the rounds for the slowest thread
+int64_t                  ggml_threadpool_wait_us(const struct ggml_threadpool * threadpool);
+
+// a thread that waits for the other threads (or for work) checks this many times before it blocks
+// 0 - block right away (best when the threads share cores with other processes)
+// applies to the thread pools created afterwards, including the temporary ones of ggml_graph_compute
+void ggml_set_n_spin(int n_spin);
+int  ggml_get_n_spin(void);
+
+// how the threads of a node split its rows (mul_mat, the element-wise ops, get_rows, soft_max, ...)
+enum ggml_sched_rows {
+    GGML_SCHED_ROWS_STATIC,  // one equal range per thread
+    GGML_SCHED_ROWS_CHUNKED, // small chunks taken from a shared counter - a slow thread leaves its rows to the others
+};
+
+// applies to the graphs computed afterwards (default: GGML_SCHED_ROWS_CHUNKED)
+void                 ggml_set_sched_rows(enum ggml_sched_rows sched_rows);
+enum ggml_sched_rows ggml_get_sched_rows(void);
+
+// NUMA (Linux): the memory that ggml_init allocates afterwards is interleaved page by page over the nodes, so the
+// weights are read through the memory controllers of all the sockets, and the worker threads of the thread pools
+// created afterwards stay on the cores of one node each
+// call it first - it does nothing on a machine with a single node
+void ggml_numa_init(void);
+bool ggml_is_numa(void);
+
+// pin thread ith of the thread pools created afterwards to cpus[ith % n_cpus] (Linux), the thread that creates a pool
+// is its thread 0 and is pinned as well. Takes precedence over the NUMA binding of the threads. n_cpus = 0 - no pinning
+void ggml_set_thread_affinity(const int * cpus, int n_cpus);
+int  ggml_get_thread_affinity(int * cpus, int n_max); // returns n_cpus
+
 // print info and performance information for the graph
 void ggml_graph_print(const struct ggml_cgraph * cgraph);
 
@@ -745,6 +832,30 @@ enum ggml_opt_result ggml_opt(
         struct ggml_opt_params params,
         struct ggml_tensor * f);
 
+//
+// quantization
+//
+
+// rows of k elements, k must be a multiple of the block size (32)
+void quantize_row_q4_0(const float * x, void * y, int k);
+void quantize_row_q4_1(const float * x, void * y, int k);
+void quantize_row_q4_0i(const float * x, void * y, int k);
+void quantize_row_q4_0h(const float * x, void * y, int k);
+void quantize_row_q8_0(const float * x, void * y, int k);
+
+void dequantize_row_q4_0(const void * x, float * y, int k);
+void dequantize_row_q4_1(const void * x, float * y, int k);
+void dequantize_row_q4_0i(const void * x, float * y, int k);
+void dequantize_row_q4_0h(const void * x, float * y, int k);
+void dequantize_row_q8_0(const void * x, float * y, int k);
+
+// ggml_mul_mat with Q4_0 or Q4_1 weights quantizes the F32 activations (src1) to Q8_0 (default)
+// when disabled, the activations are quantized to the type of the weights instead - this is the
+// behavior of previous versions: slightly faster, but the rounding error of the product is larger
+// Q4_0I and Q4_0H weights always use Q8_0 activations
+void ggml_set_q8_activations(bool enable);
+bool ggml_get_q8_activations(void);
+
 //
 // system info
 //
@@ -752,6 +863,7 @@ enum ggml_opt_result ggml_opt(
 int ggml_cpu_has_avx(void);
 int ggml_cpu_has_avx2(void);
 int ggml_cpu_has_avx512(void);
+int ggml_cpu_has_avx512_vnni(void);
 int ggml_cpu_has_fma(void);
 int ggml_cpu_has_neon(void);
 int ggml_cpu_has_arm_fma(void);
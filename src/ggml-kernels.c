@@ -0,0 +1,2487 @@
+#include "ggml-kernels.h"
+#include "ggml-simd.h"
+
+#include <assert.h>
+#include <float.h>
+#include <stdbool.h>
+
+#ifndef GGML_KERNELS_VARIANT
+#define GGML_KERNELS_VARIANT native
+#endif
+
+//
+// quantization
+//
+
+// method 5
+// blocks of QK elements
+// represented with a single float (delta) and QK/2 8-bit ints (i.e QK 4-bit signed integer factors)
+inline static void ggml_quantize_row_q4_0(const float * restrict x, void * restrict y, int k) {
+    assert(k % QK == 0);
+
+    const int nb = k / QK;
+
+    float   * restrict pd = (float *)   (y);
+    uint8_t * restrict pb = (uint8_t *) (pd + nb);
+
+    uint8_t pp[QK/2];
+
+#if __ARM_NEON
+#if QK == 32
+    for (int i = 0; i < nb; i++) {
+        float amax = 0.0f; // absolute max
+
+        float32x4_t srcv [8];
+        float32x4_t asrcv[8];
+        float32x4_t amaxv[8];
+
+        for (int l = 0; l < 8; l++) srcv[l]  = vld1q_f32(x + i*32 + 4*l);
+        for (int l = 0; l < 8; l++) asrcv[l] = vabsq_f32(srcv[l]);
+
+        for (int l = 0; l < 4; l++) amaxv[2*l] = vmaxq_f32(asrcv[2*l], asrcv[2*l+1]);
+        for (int l = 0; l < 2; l++) amaxv[4*l] = vmaxq_f32(amaxv[4*l], amaxv[4*l+2]);
+        for (int l = 0; l < 1; l++) amaxv[8*l] = vmaxq_f32(amaxv[8*l], amaxv[8*l+4]);
+
+        amax = MAX(
+                MAX(vgetq_lane_f32(amaxv[0], 0), vgetq_lane_f32(amaxv[0], 1)),
+                MAX(vgetq_lane_f32(amaxv[0], 2), vgetq_lane_f32(amaxv[0], 3)));
+
+        const float d = amax / ((1 << 3) - 1);
+        const float id = d ? 1.0/d : 0.0;
+
+        pd[i] = d;
+
+        for (int l = 0; l < 8; l++) {
+            const float32x4_t v  = vmulq_n_f32(srcv[l], id);
+            const float32x4_t vf = vaddq_f32(v, vdupq_n_f32(8.5f));
+            const int32x4_t   vi = vcvtq_s32_f32(vf);
+
+            pp[2*l + 0] = vgetq_lane_s32(vi, 0) | (vgetq_lane_s32(vi, 1) << 4);
+            pp[2*l + 1] = vgetq_lane_s32(vi, 2) | (vgetq_lane_s32(vi, 3) << 4);
+        }
+
+        memcpy(pb + i*16, pp, sizeof(pp));
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__wasm_simd128__)
+#if QK == 32
+    for (int i = 0; i < nb; i++) {
+        float amax = 0.0f; // absolute max
+
+        v128_t srcv [8];
+        v128_t asrcv[8];
+        v128_t amaxv[8];
+
+        for (int l = 0; l < 8; l++) srcv[l]  = wasm_v128_load(x + i*32 + 4*l);
+        for (int l = 0; l < 8; l++) asrcv[l] = wasm_f32x4_abs(srcv[l]);
+
+        for (int l = 0; l < 4; l++) amaxv[2*l] = wasm_f32x4_max(asrcv[2*l], asrcv[2*l+1]);
+        for (int l = 0; l < 2; l++) amaxv[4*l] = wasm_f32x4_max(amaxv[4*l], amaxv[4*l+2]);
+        for (int l = 0; l < 1; l++) amaxv[8*l] = wasm_f32x4_max(amaxv[8*l], amaxv[8*l+4]);
+
+        amax = MAX(
+                MAX(wasm_f32x4_extract_lane(amaxv[0], 0), wasm_f32x4_extract_lane(amaxv[0], 1)),
+                MAX(wasm_f32x4_extract_lane(amaxv[0], 2), wasm_f32x4_extract_lane(amaxv[0], 3)));
+
+        const float d = amax / ((1 << 3) - 1);
+        const float id = d ? 1.0/d : 0.0;
+
+        pd[i] = d;
+
+        for (int l = 0; l < 8; l++) {
+            const v128_t v  = wasm_f32x4_mul(srcv[l], wasm_f32x4_splat(id));
+            const v128_t vf = wasm_f32x4_add(v, wasm_f32x4_splat(8.5f));
+            const v128_t vi = wasm_i32x4_trunc_sat_f32x4(vf);
+
+            pp[2*l + 0] = wasm_i32x4_extract_lane(vi, 0) | (wasm_i32x4_extract_lane(vi, 1) << 4);
+            pp[2*l + 1] = wasm_i32x4_extract_lane(vi, 2) | (wasm_i32x4_extract_lane(vi, 3) << 4);
+        }
+
+        memcpy(pb + i*16, pp, sizeof(pp));
+    }
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        float amax = 0.0f; // absolute max
+
+        for (int l = 0; l < QK; l++) {
+            const float v = x[i*QK + l];
+            amax = MAX(amax, fabsf(v));
+        }
+
+        const float d = amax / ((1 << 3) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        pd[i] = d;
+
+        for (int l = 0; l < QK; l += 2) {
+            const float v0 = x[i*QK + l + 0]*id;
+            const float v1 = x[i*QK + l + 1]*id;
+
+            const uint8_t vi0 = ((int8_t) (round(v0))) + 8;
+            const uint8_t vi1 = ((int8_t) (round(v1))) + 8;
+
+            assert(vi0 >= 0 && vi0 < 16);
+            assert(vi1 >= 0 && vi1 < 16);
+
+            pp[l/2] = vi0 | (vi1 << 4);
+        }
+
+        memcpy(pb + i*QK/2, pp, sizeof(pp));
+    }
+#endif
+}
+
+// method 4
+// blocks of QK elements
+// represented with 2 floats (min + delta) and QK/2 8-bit ints (i.e QK 4-bit unsigned integer factors)
+inline static void ggml_quantize_row_q4_1(const float * restrict x, void * restrict y, int k) {
+    assert(k % QK == 0);
+
+    const int nb = k / QK;
+
+    float   * restrict pm = (float *)   (y);
+    float   * restrict pd = (float *)   (pm + nb);
+    uint8_t * restrict pb = (uint8_t *) (pd + nb);
+
+    uint8_t pp[QK/2];
+
+    for (int i = 0; i < nb; i++) {
+        float min = FLT_MAX;
+        float max = -FLT_MAX;
+
+        for (int l = 0; l < QK; l++) {
+            const float v = x[i*QK + l];
+            if (v < min) min = v;
+            if (v > max) max = v;
+        }
+
+        const float d = (max - min) / ((1 << 4) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        pm[i] = min;
+        pd[i] = d;
+
+        for (int l = 0; l < QK; l += 2) {
+            const float v0 = (x[i*QK + l + 0] - min)*id;
+            const float v1 = (x[i*QK + l + 1] - min)*id;
+
+            const uint8_t vi0 = round(v0);
+            const uint8_t vi1 = round(v1);
+
+            assert(vi0 >= 0 && vi0 < 16);
+            assert(vi1 >= 0 && vi1 < 16);
+
+            pp[l/2] = vi0 | (vi1 << 4);
+        }
+
+        memcpy(pb + i*QK/2, pp, sizeof(pp));
+    }
+}
+
+// TODO: vectorize
+inline static void ggml_dequantize_row_q4_0(const void * restrict x, float * restrict y, int k) {
+    assert(k % QK == 0);
+
+    const int nb = k / QK;
+
+    const float   * restrict pd = (const float *)   (x);
+    const uint8_t * restrict pb = (const uint8_t *) (pd + nb);
+
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const float d = pd[i];
+
+        const uint8_t * restrict pp = pb + i*QK/2;
+
+        for (int l = 0; l < QK; l += 2) {
+            const uint8_t vi = pp[l/2];
+
+            const int8_t vi0 = vi & 0xf;
+            const int8_t vi1 = vi >> 4;
+
+            const float v0 = (vi0 - 8)*d;
+            const float v1 = (vi1 - 8)*d;
+
+            y[i*QK + l + 0] = v0;
+            y[i*QK + l + 1] = v1;
+
+            assert(!isnan(y[i*QK + l + 0]));
+            assert(!isnan(y[i*QK + l + 1]));
+        }
+    }
+}
+
+inline static void ggml_dequantize_row_q4_1(const void * restrict x, float * restrict y, int k) {
+    assert(k % QK == 0);
+
+    const int nb = k / QK;
+
+    const float   * restrict pm = (const float *)   (x);
+    const float   * restrict pd = (const float *)   (pm + nb);
+    const uint8_t * restrict pb = (const uint8_t *) (pd + nb);
+
+    for (int i = 0; i < nb; i++) {
+        const float m = pm[i];
+        const float d = pd[i];
+
+        const uint8_t * restrict pp = pb + i*QK/2;
+
+        for (int l = 0; l < QK; l += 2) {
+            const uint8_t vi = pp[l/2];
+
+            const int8_t vi0 = vi & 0xf;
+            const int8_t vi1 = vi >> 4;
+
+            const float v0 = vi0*d + m;
+            const float v1 = vi1*d + m;
+
+            y[i*QK + l + 0] = v0;
+            y[i*QK + l + 1] = v1;
+
+            assert(!isnan(y[i*QK + l + 0]));
+            assert(!isnan(y[i*QK + l + 1]));
+        }
+    }
+}
+
+// blocks of QK elements
+// represented with a single float (delta) and QK 8-bit signed integer factors
+// only used for the activations of the quantized matrix multiplications, so the layout is chosen to
+// match the Q4 types: each block stores its even elements first, followed by the odd elements, which
+// is the order in which the low and high nibbles of a Q4 block unpack
+inline static void ggml_quantize_row_q8_0(const float * restrict x, void * restrict y, int k) {
+    assert(k % QK == 0);
+
+    const int nb = k / QK;
+
+    float  * restrict pd = (float *)  (y);
+    int8_t * restrict pb = (int8_t *) (pd + nb);
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#if QK == 32
+    for (int i = 0; i < nb; i++) {
+        // deinterleave on load: val[0] holds the even elements and val[1] the odd ones
+        float32x4x2_t srcv[4];
+
+        for (int l = 0; l < 4; l++) srcv[l] = vld2q_f32(x + i*32 + 8*l);
+
+        float32x4_t amaxv = vdupq_n_f32(0.0f);
+        for (int l = 0; l < 4; l++) {
+            amaxv = vmaxq_f32(amaxv, vabsq_f32(srcv[l].val[0]));
+            amaxv = vmaxq_f32(amaxv, vabsq_f32(srcv[l].val[1]));
+        }
+
+        const float amax = vmaxvq_f32(amaxv);
+
+        const float d = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        pd[i] = d;
+
+        for (int h = 0; h < 2; h++) {
+            int32x4_t vi[4];
+            for (int l = 0; l < 4; l++) vi[l] = vcvtnq_s32_f32(vmulq_n_f32(srcv[l].val[h], id));
+
+            const int16x8_t v0 = vcombine_s16(vmovn_s32(vi[0]), vmovn_s32(vi[1]));
+            const int16x8_t v1 = vcombine_s16(vmovn_s32(vi[2]), vmovn_s32(vi[3]));
+
+            vst1q_s8(pb + i*32 + 16*h, vcombine_s8(vmovn_s16(v0), vmovn_s16(v1)));
+        }
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX2__)
+#if QK == 32
+    const __m256 sign_bit = _mm256_set1_ps(-0.0f);
+
+    // packs interleaves the 128-bit lanes - perm restores the element order and
+    // shuf + permute4x64 move the even elements to the first half of the block
+    const __m256i perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const __m256i shuf = _mm256_setr_epi8(
+            0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+            0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+
+    for (int i = 0; i < nb; i++) {
+        __m256 v0 = _mm256_loadu_ps(x + i*32 +  0);
+        __m256 v1 = _mm256_loadu_ps(x + i*32 +  8);
+        __m256 v2 = _mm256_loadu_ps(x + i*32 + 16);
+        __m256 v3 = _mm256_loadu_ps(x + i*32 + 24);
+
+        __m256 amaxv = _mm256_andnot_ps(sign_bit, v0);
+        amaxv = _mm256_max_ps(amaxv, _mm256_andnot_ps(sign_bit, v1));
+        amaxv = _mm256_max_ps(amaxv, _mm256_andnot_ps(sign_bit, v2));
+        amaxv = _mm256_max_ps(amaxv, _mm256_andnot_ps(sign_bit, v3));
+
+        __m128 max4 = _mm_max_ps(_mm256_extractf128_ps(amaxv, 1), _mm256_castps256_ps128(amaxv));
+        max4 = _mm_max_ps(max4, _mm_movehl_ps(max4, max4));
+        max4 = _mm_max_ss(max4, _mm_movehdup_ps(max4));
+
+        const float amax = _mm_cvtss_f32(max4);
+
+        const float d = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        pd[i] = d;
+
+        const __m256 mul = _mm256_set1_ps(id);
+
+        v0 = _mm256_round_ps(_mm256_mul_ps(v0, mul), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        v1 = _mm256_round_ps(_mm256_mul_ps(v1, mul), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        v2 = _mm256_round_ps(_mm256_mul_ps(v2, mul), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        v3 = _mm256_round_ps(_mm256_mul_ps(v3, mul), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+
+        // int32 -> int16 -> int8
+        const __m256i i01 = _mm256_packs_epi32(_mm256_cvtps_epi32(v0), _mm256_cvtps_epi32(v1));
+        const __m256i i23 = _mm256_packs_epi32(_mm256_cvtps_epi32(v2), _mm256_cvtps_epi32(v3));
+
+        __m256i q = _mm256_permutevar8x32_epi32(_mm256_packs_epi16(i01, i23), perm);
+
+        q = _mm256_shuffle_epi8(q, shuf);
+        q = _mm256_permute4x64_epi64(q, _MM_SHUFFLE(3, 1, 2, 0));
+
+        _mm256_storeu_si256((__m256i *) (pb + i*32), q);
+    }
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        float amax = 0.0f; // absolute max
+
+        for (int l = 0; l < QK; l++) {
+            const float v = x[i*QK + l];
+            amax = MAX(amax, fabsf(v));
+        }
+
+        const float d = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        pd[i] = d;
+
+        for (int l = 0; l < QK/2; l++) {
+            pb[i*QK + l]        = roundf(x[i*QK + 2*l + 0]*id);
+            pb[i*QK + QK/2 + l] = roundf(x[i*QK + 2*l + 1]*id);
+        }
+    }
+#endif
+}
+
+inline static void ggml_dequantize_row_q8_0(const void * restrict x, float * restrict y, int k) {
+    assert(k % QK == 0);
+
+    const int nb = k / QK;
+
+    const float  * restrict pd = (const float *)  (x);
+    const int8_t * restrict pb = (const int8_t *) (pd + nb);
+
+    for (int i = 0; i < nb; i++) {
+        const float d = pd[i];
+
+        const int8_t * restrict pp = pb + i*QK;
+
+        for (int l = 0; l < QK/2; l++) {
+            y[i*QK + 2*l + 0] = pp[l]*d;
+            y[i*QK + 2*l + 1] = pp[QK/2 + l]*d;
+        }
+    }
+}
+
+// the block-interleaved Q4_0 kernels are written once for both scale types - f16 is always a constant,
+// so each of the wrappers below gets its own specialized copy
+
+#define Q4_0X_BLOCK_SIZE(f16) ((f16) ? sizeof(block_q4_0h) : sizeof(block_q4_0i))
+
+static inline float q4_0x_get_d(const uint8_t * restrict b, const bool f16) {
+    return f16 ? GGML_FP16_TO_FP32(((const block_q4_0h *) b)->d) : ((const block_q4_0i *) b)->d;
+}
+
+static inline const uint8_t * q4_0x_get_qs(const uint8_t * restrict b, const bool f16) {
+    return f16 ? ((const block_q4_0h *) b)->qs : ((const block_q4_0i *) b)->qs;
+}
+
+inline static void ggml_quantize_row_q4_0x(const float * restrict x, void * restrict y, int k, const bool f16) {
+    assert(k % QK == 0);
+
+    const int nb = k / QK;
+    const size_t bs = Q4_0X_BLOCK_SIZE(f16);
+
+    uint8_t * restrict pb = (uint8_t *) y;
+
+    for (int i = 0; i < nb; i++) {
+        float amax = 0.0f; // absolute max
+
+        for (int l = 0; l < QK; l++) {
+            const float v = x[i*QK + l];
+            amax = MAX(amax, fabsf(v));
+        }
+
+        const float d = amax / ((1 << 3) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        uint8_t * restrict qs;
+
+        if (f16) {
+            block_q4_0h * restrict b = (block_q4_0h *) (pb + i*bs);
+            b->d = GGML_COMPUTE_FP32_TO_FP16(d);
+            qs = b->qs;
+        } else {
+            block_q4_0i * restrict b = (block_q4_0i *) (pb + i*bs);
+            b->d = d;
+            qs = b->qs;
+        }
+
+        for (int l = 0; l < QK; l += 2) {
+            const float v0 = x[i*QK + l + 0]*id;
+            const float v1 = x[i*QK + l + 1]*id;
+
+            const uint8_t vi0 = ((int8_t) (round(v0))) + 8;
+            const uint8_t vi1 = ((int8_t) (round(v1))) + 8;
+
+            assert(vi0 >= 0 && vi0 < 16);
+            assert(vi1 >= 0 && vi1 < 16);
+
+            qs[l/2] = vi0 | (vi1 << 4);
+        }
+    }
+}
+
+inline static void ggml_dequantize_row_q4_0x(const void * restrict x, float * restrict y, int k, const bool f16) {
+    assert(k % QK == 0);
+
+    const int nb = k / QK;
+    const size_t bs = Q4_0X_BLOCK_SIZE(f16);
+
+    const uint8_t * restrict pb = (const uint8_t *) x;
+
+    for (int i = 0; i < nb; i++) {
+        const uint8_t * restrict b = pb + i*bs;
+
+        // can be called before ggml_init, so no fp16 lookup table
+        const float d = f16 ? GGML_COMPUTE_FP16_TO_FP32(((const block_q4_0h *) b)->d) : ((const block_q4_0i *) b)->d;
+
+        const uint8_t * restrict qs = q4_0x_get_qs(b, f16);
+
+        for (int l = 0; l < QK; l += 2) {
+            const uint8_t vi = qs[l/2];
+
+            y[i*QK + l + 0] = ((int8_t) (vi & 0xf) - 8)*d;
+            y[i*QK + l + 1] = ((int8_t) (vi >> 4)  - 8)*d;
+        }
+    }
+}
+
+static void ggml_quantize_row_q4_0i  (const float * restrict x, void  * restrict y, int k) { ggml_quantize_row_q4_0x  (x, y, k, false); }
+static void ggml_quantize_row_q4_0h  (const float * restrict x, void  * restrict y, int k) { ggml_quantize_row_q4_0x  (x, y, k, true);  }
+static void ggml_dequantize_row_q4_0i(const void  * restrict x, float * restrict y, int k) { ggml_dequantize_row_q4_0x(x, y, k, false); }
+static void ggml_dequantize_row_q4_0h(const void  * restrict x, float * restrict y, int k) { ggml_dequantize_row_q4_0x(x, y, k, true);  }
+
+//
+// fp16 conversion
+//
+
+inline static void ggml_vec_fp16_to_fp32(const int n, float * restrict y, const ggml_fp16_t * restrict x) {
+    int i = 0;
+
+#if defined(__AVX512F__)
+    for (; i + 15 < n; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x + i))));
+    }
+#endif
+#if defined(__F16C__)
+    for (; i + 7 < n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + i))));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        y[i] = GGML_FP16_TO_FP32(x[i]);
+    }
+}
+
+inline static void ggml_vec_fp32_to_fp16(const int n, ggml_fp16_t * restrict y, const float * restrict x) {
+    int i = 0;
+
+#if defined(__AVX512F__)
+    for (; i + 15 < n; i += 16) {
+        _mm256_storeu_si256((__m256i *)(y + i), _mm512_cvtps_ph(_mm512_loadu_ps(x + i), 0));
+    }
+#endif
+#if defined(__F16C__)
+    for (; i + 7 < n; i += 8) {
+        _mm_storeu_si128((__m128i *)(y + i), _mm256_cvtps_ph(_mm256_loadu_ps(x + i), 0));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        y[i] = GGML_FP32_TO_FP16(x[i]);
+    }
+}
+
+//
+// dot products
+//
+
+inline static void ggml_vec_dot_f32(const int n, float * restrict s, const float * restrict x, const float * restrict y) {
+    ggml_float sumf = 0.0;
+
+#ifdef GGML_SIMD
+    const int np = (n & ~(GGML_F32_STEP - 1));
+
+    GGML_F32_VEC sum[GGML_F32_ARR] = { GGML_F32_VEC_ZERO };
+
+    GGML_F32_VEC ax[GGML_F32_ARR];
+    GGML_F32_VEC ay[GGML_F32_ARR];
+
+    for (int i = 0; i < np; i += GGML_F32_STEP) {
+        for (int j = 0; j < GGML_F32_ARR; j++) {
+            ax[j] = GGML_F32_VEC_LOAD(x + i + j*GGML_F32_EPR);
+            ay[j] = GGML_F32_VEC_LOAD(y + i + j*GGML_F32_EPR);
+
+            sum[j] = GGML_F32_VEC_FMA(sum[j], ax[j], ay[j]);
+        }
+    }
+
+    // reduce sum0..sum3 to sum0
+    GGML_F32_VEC_REDUCE(sumf, sum);
+
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        sumf += x[i]*y[i];
+    }
+#else
+    // scalar
+    for (int i = 0; i < n; ++i) {
+        sumf += x[i]*y[i];
+    }
+#endif
+
+    *s = sumf;
+}
+
+inline static void ggml_vec_dot_f16(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y) {
+    ggml_float sumf = 0.0;
+
+    #if defined(GGML_SIMD)
+        const int np = (n & ~(GGML_F16_STEP - 1));
+
+        GGML_F16_VEC sum[GGML_F16_ARR] = { GGML_F16_VEC_ZERO };
+
+        GGML_F16_VEC ax[GGML_F16_ARR];
+        GGML_F16_VEC ay[GGML_F16_ARR];
+
+        for (int i = 0; i < np; i += GGML_F16_STEP) {
+            for (int j = 0; j < GGML_F16_ARR; j++) {
+                ax[j] = GGML_F16_VEC_LOAD(x + i + j*GGML_F16_EPR, j);
+                ay[j] = GGML_F16_VEC_LOAD(y + i + j*GGML_F16_EPR, j);
+
+                sum[j] = GGML_F16_VEC_FMA(sum[j], ax[j], ay[j]);
+            }
+        }
+
+        // reduce sum0..sum3 to sum0
+        GGML_F16_VEC_REDUCE(sumf, sum);
+
+        // leftovers
+        for (int i = np; i < n; ++i) {
+            sumf += GGML_FP16_TO_FP32(x[i])*GGML_FP16_TO_FP32(y[i]);
+        }
+    #else
+        for (int i = 0; i < n; ++i) {
+            sumf += GGML_FP16_TO_FP32(x[i])*GGML_FP16_TO_FP32(y[i]);
+        }
+    #endif
+
+    *s = sumf;
+}
+
+#if defined(__ARM_NEON)
+// horizontally add 8 uint16 lanes
+static inline uint32_t hsum_u16x8(const uint16x8_t v) {
+#if defined(__aarch64__)
+    return vaddlvq_u16(v);
+#else
+    const uint64x2_t t = vpaddlq_u32(vpaddlq_u16(v));
+    return (uint32_t) (vgetq_lane_u64(t, 0) + vgetq_lane_u64(t, 1));
+#endif
+}
+
+// horizontally add 8 int16 lanes
+static inline int32_t hsum_s16x8(const int16x8_t v) {
+#if defined(__aarch64__)
+    return vaddlvq_s16(v);
+#else
+    const int64x2_t t = vpaddlq_s32(vpaddlq_s16(v));
+    return (int32_t) (vgetq_lane_s64(t, 0) + vgetq_lane_s64(t, 1));
+#endif
+}
+
+// dot product of 2 pairs of int8 vectors
+// without the dot product extension the products are accumulated in int16, so |x*y| must stay below 2^13
+static inline int32_t dot_s8x16x2(const int8x16_t x0, const int8x16_t y0, const int8x16_t x1, const int8x16_t y1) {
+#if defined(__ARM_FEATURE_DOTPROD)
+    return vaddvq_s32(vdotq_s32(vdotq_s32(vdupq_n_s32(0), x0, y0), x1, y1));
+#else
+    int16x8_t p = vmull_s8(vget_low_s8 (x0), vget_low_s8 (y0));
+    p = vmlal_s8(p,        vget_high_s8(x0), vget_high_s8(y0));
+    p = vmlal_s8(p,        vget_low_s8 (x1), vget_low_s8 (y1));
+    p = vmlal_s8(p,        vget_high_s8(x1), vget_high_s8(y1));
+    return hsum_s16x8(p);
+#endif
+}
+#endif
+
+#if defined(__AVX2__)
+// a*b + c
+static inline __m256 mul_add_ps(const __m256 a, const __m256 b, const __m256 c) {
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+// horizontally add 8 floats
+static inline float hsum_float_8(const __m256 x) {
+    __m128 res = _mm256_extractf128_ps(x, 1);
+    res = _mm_add_ps(res, _mm256_castps256_ps128(x));
+    res = _mm_add_ps(res, _mm_movehl_ps(res, res));
+    res = _mm_add_ss(res, _mm_movehdup_ps(res));
+    return _mm_cvtss_f32(res);
+}
+
+// unpack 32 4-bit fields from 16 bytes into 32 bytes
+// the low nibbles go to bytes 0..15 and the high nibbles to bytes 16..31
+static inline __m256i bytes_from_nibbles_32(const uint8_t * rsi) {
+    const __m128i tmp = _mm_loadu_si128((const __m128i *) rsi);
+    const __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(tmp), _mm_srli_epi16(tmp, 4), 1);
+    return _mm256_and_si256(bytes, _mm256_set1_epi8(0xf));
+}
+
+// multiply int8 pairs and add the products of each group of 4 into int32 lanes
+// uses the sign of x to make the first operand unsigned for maddubs
+static inline __m256i mul_sum_i8_pairs(const __m256i x, const __m256i y) {
+    const __m256i ax = _mm256_sign_epi8(x, x);
+    const __m256i sy = _mm256_sign_epi8(y, x);
+    const __m256i dot = _mm256_maddubs_epi16(ax, sy);
+    return _mm256_madd_epi16(dot, _mm256_set1_epi16(1));
+}
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+// unpack the 64 4-bit fields of 2 consecutive blocks from 32 bytes into 64 bytes
+// 128-bit lanes 0 and 2 hold the low and high nibbles of the first block, lanes 1 and 3 of the second
+static inline __m512i bytes_from_nibbles_64(const uint8_t * rsi) {
+    const __m256i tmp = _mm256_loadu_si256((const __m256i *) rsi);
+    const __m512i bytes = _mm512_inserti64x4(_mm512_castsi256_si512(tmp), _mm256_srli_epi16(tmp, 4), 1);
+    return _mm512_and_si512(bytes, _mm512_set1_epi8(0xf));
+}
+
+// dot product of unsigned bytes x with signed bytes y, each group of 4 summed into an int32 lane
+static inline __m512i dot_u8_i8_512(const __m512i x, const __m512i y) {
+#if defined(__AVX512VNNI__)
+    return _mm512_dpbusd_epi32(_mm512_setzero_si512(), x, y);
+#else
+    return _mm512_madd_epi16(_mm512_maddubs_epi16(x, y), _mm512_set1_epi16(1));
+#endif
+}
+
+// broadcast the scales of 2 consecutive blocks to match the lane layout of bytes_from_nibbles_64
+static inline __m512 scales_x2_512(const float d0, const float d1) {
+    return _mm512_mask_blend_ps(0xF0F0, _mm512_set1_ps(d0), _mm512_set1_ps(d1));
+}
+#endif
+#elif defined(__SSE3__)
+// horizontally add 4 floats
+static inline float hsum_float_4(const __m128 x) {
+    __m128 res = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    res = _mm_add_ss(res, _mm_movehdup_ps(res));
+    return _mm_cvtss_f32(res);
+}
+
+// multiply int8 pairs and add the products of each group of 4 into int32 lanes
+// SSE2 only - the bytes are sign-extended to int16 before the multiplication
+static inline __m128i mul_sum_i8_pairs_sse(const __m128i x, const __m128i y) {
+    const __m128i xl = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+    const __m128i yl = _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8);
+    const __m128i xh = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+    const __m128i yh = _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8);
+    return _mm_add_epi32(_mm_madd_epi16(xl, yl), _mm_madd_epi16(xh, yh));
+}
+#endif
+
+inline static void ggml_vec_dot_q4_0(const int n, float * restrict s, const void * restrict x, const void * restrict y) {
+    const int nb = n / QK;
+
+    assert(n % QK == 0);
+
+    const float * restrict pd0 = (const float *) x;
+    const float * restrict pd1 = (const float *) y;
+
+    const uint8_t * restrict pb0 = (const uint8_t *) (pd0 + nb);
+    const uint8_t * restrict pb1 = (const uint8_t *) (pd1 + nb);
+
+    float sumf = 0.0;
+
+#ifdef __ARM_NEON
+#if QK == 32
+    assert(nb % 2 == 0);
+
+    float sum0 = 0.0f;
+    float sum1 = 0.0f;
+
+    for (int i = 0; i < nb; i += 2) {
+        const float d0_0 = pd0[i + 0];
+        const float d1_0 = pd1[i + 0];
+        const float d0_1 = pd0[i + 1];
+        const float d1_1 = pd1[i + 1];
+
+        //printf("d0_0: %f, d1_0: %f, d0_1: %f, d1_1: %f\n", d0_0, d1_0, d0_1, d1_1);
+
+        const uint8_t * restrict p0 = pb0 + i*16;
+        const uint8_t * restrict p1 = pb1 + i*16;
+
+        const uint8x16_t m4b = vdupq_n_u8(0xf);
+        const int8x16_t  s8b = vdupq_n_s8(0x8);
+
+        const uint8x16_t v0_0 = vld1q_u8(p0);
+        const uint8x16_t v1_0 = vld1q_u8(p1);
+        const uint8x16_t v0_1 = vld1q_u8(p0 + 16);
+        const uint8x16_t v1_1 = vld1q_u8(p1 + 16);
+
+        // 4-bit -> 8-bit
+        const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8(v0_0, m4b));
+        const int8x16_t v1_0l = vreinterpretq_s8_u8(vandq_u8(v1_0, m4b));
+
+        const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
+        const int8x16_t v1_0h = vreinterpretq_s8_u8(vshrq_n_u8(v1_0, 4));
+
+        const int8x16_t v0_1l = vreinterpretq_s8_u8(vandq_u8(v0_1, m4b));
+        const int8x16_t v1_1l = vreinterpretq_s8_u8(vandq_u8(v1_1, m4b));
+
+        const int8x16_t v0_1h = vreinterpretq_s8_u8(vshrq_n_u8(v0_1, 4));
+        const int8x16_t v1_1h = vreinterpretq_s8_u8(vshrq_n_u8(v1_1, 4));
+
+        // sub 8
+        const int8x16_t v0_0ls = vsubq_s8(v0_0l, s8b);
+        const int8x16_t v1_0ls = vsubq_s8(v1_0l, s8b);
+
+        const int8x16_t v0_0hs = vsubq_s8(v0_0h, s8b);
+        const int8x16_t v1_0hs = vsubq_s8(v1_0h, s8b);
+
+        const int8x16_t v0_1ls = vsubq_s8(v0_1l, s8b);
+        const int8x16_t v1_1ls = vsubq_s8(v1_1l, s8b);
+
+        const int8x16_t v0_1hs = vsubq_s8(v0_1h, s8b);
+        const int8x16_t v1_1hs = vsubq_s8(v1_1h, s8b);
+
+        // dot product into int16x8_t
+        const int16x8_t pl0l = vmull_s8(vget_low_s8 (v0_0ls), vget_low_s8 (v1_0ls));
+        const int16x8_t pl0h = vmull_s8(vget_high_s8(v0_0ls), vget_high_s8(v1_0ls));
+
+        const int16x8_t ph0l = vmull_s8(vget_low_s8 (v0_0hs), vget_low_s8 (v1_0hs));
+        const int16x8_t ph0h = vmull_s8(vget_high_s8(v0_0hs), vget_high_s8(v1_0hs));
+
+        const int16x8_t pl1l = vmull_s8(vget_low_s8 (v0_1ls), vget_low_s8 (v1_1ls));
+        const int16x8_t pl1h = vmull_s8(vget_high_s8(v0_1ls), vget_high_s8(v1_1ls));
+
+        const int16x8_t ph1l = vmull_s8(vget_low_s8 (v0_1hs), vget_low_s8 (v1_1hs));
+        const int16x8_t ph1h = vmull_s8(vget_high_s8(v0_1hs), vget_high_s8(v1_1hs));
+
+        const int16x8_t pl_0 = vaddq_s16(pl0l, pl0h);
+        const int16x8_t ph_0 = vaddq_s16(ph0l, ph0h);
+
+        const int16x8_t pl_1 = vaddq_s16(pl1l, pl1h);
+        const int16x8_t ph_1 = vaddq_s16(ph1l, ph1h);
+
+        const int16x8_t p_0 = vaddq_s16(pl_0, ph_0);
+        const int16x8_t p_1 = vaddq_s16(pl_1, ph_1);
+
+        // scalar
+#if defined(__ARM_FEATURE_QRDMX)
+        sum0 += d0_0*d1_0*vaddvq_s16(p_0);
+        sum1 += d0_1*d1_1*vaddvq_s16(p_1);
+#else
+        sum0 += d0_0*d1_0*(vgetq_lane_s16(p_0, 0) + vgetq_lane_s16(p_0, 1) + vgetq_lane_s16(p_0, 2) + vgetq_lane_s16(p_0, 3) + vgetq_lane_s16(p_0, 4) + vgetq_lane_s16(p_0, 5) + vgetq_lane_s16(p_0, 6) + vgetq_lane_s16(p_0, 7));
+        sum1 += d0_1*d1_1*(vgetq_lane_s16(p_1, 0) + vgetq_lane_s16(p_1, 1) + vgetq_lane_s16(p_1, 2) + vgetq_lane_s16(p_1, 3) + vgetq_lane_s16(p_1, 4) + vgetq_lane_s16(p_1, 5) + vgetq_lane_s16(p_1, 6) + vgetq_lane_s16(p_1, 7));
+#endif
+    }
+
+    sumf = sum0 + sum1;
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__wasm_simd128__)
+#if QK == 32
+    assert(nb % 2 == 0);
+
+    // wasm simd
+    float sum0 = 0.0f;
+    float sum1 = 0.0f;
+
+    for (int i = 0; i < nb; i += 2) {
+        const float d0_0 = pd0[i + 0];
+        const float d0_1 = pd0[i + 1];
+        const float d1_0 = pd1[i + 0];
+        const float d1_1 = pd1[i + 1];
+
+        const uint8_t * restrict p0 = pb0 + i*16;
+        const uint8_t * restrict p1 = pb1 + i*16;
+
+        const v128_t m4b = wasm_u8x16_splat(0xf);
+        const v128_t s8b = wasm_i8x16_splat(0x8);
+
+        const v128_t v0_0 = wasm_v128_load(p0);
+        const v128_t v0_1 = wasm_v128_load(p0 + 16);
+        const v128_t v1_0 = wasm_v128_load(p1);
+        const v128_t v1_1 = wasm_v128_load(p1 + 16);
+
+        // 4-bit -> 8-bit
+        const v128_t v0_0l = wasm_v128_and(v0_0, m4b);
+        const v128_t v1_0l = wasm_v128_and(v1_0, m4b);
+
+        const v128_t v0_0h = wasm_u8x16_shr(v0_0, 4);
+        const v128_t v1_0h = wasm_u8x16_shr(v1_0, 4);
+
+        const v128_t v0_1l = wasm_v128_and(v0_1, m4b);
+        const v128_t v1_1l = wasm_v128_and(v1_1, m4b);
+
+        const v128_t v0_1h = wasm_u8x16_shr(v0_1, 4);
+        const v128_t v1_1h = wasm_u8x16_shr(v1_1, 4);
+
+        // sub 8
+        const v128_t v0_0ls = wasm_i8x16_sub(v0_0l, s8b);
+        const v128_t v1_0ls = wasm_i8x16_sub(v1_0l, s8b);
+
+        const v128_t v0_0hs = wasm_i8x16_sub(v0_0h, s8b);
+        const v128_t v1_0hs = wasm_i8x16_sub(v1_0h, s8b);
+
+        const v128_t v0_1ls = wasm_i8x16_sub(v0_1l, s8b);
+        const v128_t v1_1ls = wasm_i8x16_sub(v1_1l, s8b);
+
+        const v128_t v0_1hs = wasm_i8x16_sub(v0_1h, s8b);
+        const v128_t v1_1hs = wasm_i8x16_sub(v1_1h, s8b);
+
+        // dot product into int16x8_t
+        const v128_t pl0l = wasm_i16x8_mul(wasm_i16x8_extend_low_i8x16(v0_0ls), wasm_i16x8_extend_low_i8x16(v1_0ls));
+        const v128_t pl0h = wasm_i16x8_mul(wasm_i16x8_extend_high_i8x16(v0_0ls), wasm_i16x8_extend_high_i8x16(v1_0ls));
+
+        const v128_t ph0l = wasm_i16x8_mul(wasm_i16x8_extend_low_i8x16(v0_0hs), wasm_i16x8_extend_low_i8x16(v1_0hs));
+        const v128_t ph0h = wasm_i16x8_mul(wasm_i16x8_extend_high_i8x16(v0_0hs), wasm_i16x8_extend_high_i8x16(v1_0hs));
+
+        const v128_t pl1l = wasm_i16x8_mul(wasm_i16x8_extend_low_i8x16(v0_1ls), wasm_i16x8_extend_low_i8x16(v1_1ls));
+        const v128_t pl1h = wasm_i16x8_mul(wasm_i16x8_extend_high_i8x16(v0_1ls), wasm_i16x8_extend_high_i8x16(v1_1ls));
+
+        const v128_t ph1l = wasm_i16x8_mul(wasm_i16x8_extend_low_i8x16(v0_1hs), wasm_i16x8_extend_low_i8x16(v1_1hs));
+        const v128_t ph1h = wasm_i16x8_mul(wasm_i16x8_extend_high_i8x16(v0_1hs), wasm_i16x8_extend_high_i8x16(v1_1hs));
+
+        const v128_t pl_0 = wasm_i16x8_add(pl0l, pl0h);
+        const v128_t ph_0 = wasm_i16x8_add(ph0l, ph0h);
+
+        const v128_t pl_1 = wasm_i16x8_add(pl1l, pl1h);
+        const v128_t ph_1 = wasm_i16x8_add(ph1l, ph1h);
+
+        const v128_t p_0 = wasm_i16x8_add(pl_0, ph_0);
+        const v128_t p_1 = wasm_i16x8_add(pl_1, ph_1);
+
+        sum0 += d0_0*d1_0*(
+                wasm_i16x8_extract_lane(p_0, 0) + wasm_i16x8_extract_lane(p_0, 1) +
+                wasm_i16x8_extract_lane(p_0, 2) + wasm_i16x8_extract_lane(p_0, 3) +
+                wasm_i16x8_extract_lane(p_0, 4) + wasm_i16x8_extract_lane(p_0, 5) +
+                wasm_i16x8_extract_lane(p_0, 6) + wasm_i16x8_extract_lane(p_0, 7));
+        sum1 += d0_1*d1_1*(
+                wasm_i16x8_extract_lane(p_1, 0) + wasm_i16x8_extract_lane(p_1, 1) +
+                wasm_i16x8_extract_lane(p_1, 2) + wasm_i16x8_extract_lane(p_1, 3) +
+                wasm_i16x8_extract_lane(p_1, 4) + wasm_i16x8_extract_lane(p_1, 5) +
+                wasm_i16x8_extract_lane(p_1, 6) + wasm_i16x8_extract_lane(p_1, 7));
+    }
+
+    sumf = sum0 + sum1;
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+#if QK == 32
+    // x*y = xu*y - 8*y, with xu the unsigned nibbles of x
+    const __m512i s8b = _mm512_set1_epi8(0x8);
+
+    __m512 acc = _mm512_setzero_ps();
+
+    for (int i = 0; i + 1 < nb; i += 2) {
+        const __m512 d = scales_x2_512(pd0[i + 0]*pd1[i + 0], pd0[i + 1]*pd1[i + 1]);
+
+        const __m512i xu = bytes_from_nibbles_64(pb0 + i*16);
+        const __m512i ys = _mm512_sub_epi8(bytes_from_nibbles_64(pb1 + i*16), s8b);
+
+        const __m512i p = _mm512_sub_epi32(dot_u8_i8_512(xu, ys), dot_u8_i8_512(s8b, ys));
+
+        acc = _mm512_fmadd_ps(d, _mm512_cvtepi32_ps(p), acc);
+    }
+
+    sumf = _mm512_reduce_add_ps(acc);
+
+    // the last block of an odd number of blocks, with the 256-bit code
+    if (nb % 2 == 1) {
+        const int i = nb - 1;
+
+        const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(pb0 + i*16), _mm256_set1_epi8(0x8));
+        const __m256i by = _mm256_sub_epi8(bytes_from_nibbles_32(pb1 + i*16), _mm256_set1_epi8(0x8));
+
+        sumf += pd0[i]*pd1[i]*hsum_float_8(_mm256_cvtepi32_ps(mul_sum_i8_pairs(bx, by)));
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX2__)
+#if QK == 32
+    const __m256i s8b = _mm256_set1_epi8(0x8);
+
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+
+    int i = 0;
+
+    for (; i + 1 < nb; i += 2) {
+        const __m256 d_0 = _mm256_set1_ps(pd0[i + 0]*pd1[i + 0]);
+        const __m256 d_1 = _mm256_set1_ps(pd0[i + 1]*pd1[i + 1]);
+
+        // 4-bit -> 8-bit, sub 8
+        const __m256i x_0 = _mm256_sub_epi8(bytes_from_nibbles_32(pb0 + i*16),      s8b);
+        const __m256i y_0 = _mm256_sub_epi8(bytes_from_nibbles_32(pb1 + i*16),      s8b);
+        const __m256i x_1 = _mm256_sub_epi8(bytes_from_nibbles_32(pb0 + i*16 + 16), s8b);
+        const __m256i y_1 = _mm256_sub_epi8(bytes_from_nibbles_32(pb1 + i*16 + 16), s8b);
+
+        // dot product into int32 lanes
+        const __m256 q_0 = _mm256_cvtepi32_ps(mul_sum_i8_pairs(x_0, y_0));
+        const __m256 q_1 = _mm256_cvtepi32_ps(mul_sum_i8_pairs(x_1, y_1));
+
+        acc0 = mul_add_ps(d_0, q_0, acc0);
+        acc1 = mul_add_ps(d_1, q_1, acc1);
+    }
+
+    // the last block of an odd number of blocks
+    for (; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(pd0[i]*pd1[i]);
+
+        const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(pb0 + i*16), s8b);
+        const __m256i by = _mm256_sub_epi8(bytes_from_nibbles_32(pb1 + i*16), s8b);
+
+        acc0 = mul_add_ps(d, _mm256_cvtepi32_ps(mul_sum_i8_pairs(bx, by)), acc0);
+    }
+
+    sumf = hsum_float_8(_mm256_add_ps(acc0, acc1));
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__SSE3__)
+#if QK == 32
+    const __m128i m4b = _mm_set1_epi8(0xf);
+    const __m128i s8b = _mm_set1_epi8(0x8);
+
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+
+    int i = 0;
+
+    for (; i + 1 < nb; i += 2) {
+        const __m128 d_0 = _mm_set1_ps(pd0[i + 0]*pd1[i + 0]);
+        const __m128 d_1 = _mm_set1_ps(pd0[i + 1]*pd1[i + 1]);
+
+        const __m128i v0_0 = _mm_loadu_si128((const __m128i *) (pb0 + i*16));
+        const __m128i v1_0 = _mm_loadu_si128((const __m128i *) (pb1 + i*16));
+        const __m128i v0_1 = _mm_loadu_si128((const __m128i *) (pb0 + i*16 + 16));
+        const __m128i v1_1 = _mm_loadu_si128((const __m128i *) (pb1 + i*16 + 16));
+
+        // 4-bit -> 8-bit, sub 8
+        const __m128i v0_0l = _mm_sub_epi8(_mm_and_si128(v0_0, m4b), s8b);
+        const __m128i v1_0l = _mm_sub_epi8(_mm_and_si128(v1_0, m4b), s8b);
+        const __m128i v0_0h = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v0_0, 4), m4b), s8b);
+        const __m128i v1_0h = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v1_0, 4), m4b), s8b);
+
+        const __m128i v0_1l = _mm_sub_epi8(_mm_and_si128(v0_1, m4b), s8b);
+        const __m128i v1_1l = _mm_sub_epi8(_mm_and_si128(v1_1, m4b), s8b);
+        const __m128i v0_1h = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v0_1, 4), m4b), s8b);
+        const __m128i v1_1h = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v1_1, 4), m4b), s8b);
+
+        // dot product into int32 lanes
+        const __m128i p_0 = _mm_add_epi32(mul_sum_i8_pairs_sse(v0_0l, v1_0l), mul_sum_i8_pairs_sse(v0_0h, v1_0h));
+        const __m128i p_1 = _mm_add_epi32(mul_sum_i8_pairs_sse(v0_1l, v1_1l), mul_sum_i8_pairs_sse(v0_1h, v1_1h));
+
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d_0, _mm_cvtepi32_ps(p_0)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(d_1, _mm_cvtepi32_ps(p_1)));
+    }
+
+    // the last block of an odd number of blocks
+    for (; i < nb; ++i) {
+        const __m128 d = _mm_set1_ps(pd0[i]*pd1[i]);
+
+        const __m128i v0 = _mm_loadu_si128((const __m128i *) (pb0 + i*16));
+        const __m128i v1 = _mm_loadu_si128((const __m128i *) (pb1 + i*16));
+
+        // 4-bit -> 8-bit, sub 8
+        const __m128i v0l = _mm_sub_epi8(_mm_and_si128(v0, m4b), s8b);
+        const __m128i v1l = _mm_sub_epi8(_mm_and_si128(v1, m4b), s8b);
+        const __m128i v0h = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v0, 4), m4b), s8b);
+        const __m128i v1h = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v1, 4), m4b), s8b);
+
+        const __m128i p = _mm_add_epi32(mul_sum_i8_pairs_sse(v0l, v1l), mul_sum_i8_pairs_sse(v0h, v1h));
+
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d, _mm_cvtepi32_ps(p)));
+    }
+
+    sumf = hsum_float_4(_mm_add_ps(acc0, acc1));
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const float d0 = pd0[i];
+        const float d1 = pd1[i];
+
+        const uint8_t * restrict p0 = pb0 + i*QK/2;
+        const uint8_t * restrict p1 = pb1 + i*QK/2;
+
+        for (int j = 0; j < QK/2; j++) {
+            const uint8_t v0 = p0[j];
+            const uint8_t v1 = p1[j];
+
+            const float f0 = d0*((int8_t) (v0 & 0xf) - 8);
+            const float f1 = d0*((int8_t) (v0 >> 4)  - 8);
+
+            const float f2 = d1*((int8_t) (v1 & 0xf) - 8);
+            const float f3 = d1*((int8_t) (v1 >> 4)  - 8);
+
+            sumf += f0*f2 + f1*f3;
+        }
+    }
+#endif
+
+    *s = sumf;
+}
+
+inline static void ggml_vec_dot_q4_1(const int n, float * restrict s, const void * restrict x, const void * restrict y) {
+    const int nb = n / QK;
+
+    const float * restrict pm0 = (const float *) x;
+    const float * restrict pm1 = (const float *) y;
+
+    const float * restrict pd0 = (const float *) (pm0 + nb);
+    const float * restrict pd1 = (const float *) (pm1 + nb);
+
+    const uint8_t * restrict pb0 = (const uint8_t *) (pd0 + nb);
+    const uint8_t * restrict pb1 = (const uint8_t *) (pd1 + nb);
+
+    float sumf = 0.0;
+
+    // (d0*x + m0)*(d1*y + m1) = d0*d1*x*y + d0*m1*x + m0*d1*y + m0*m1
+    // so only the integer dot product x*y and the sums of x and y are needed per block
+
+#if defined(__ARM_NEON)
+#if QK == 32
+    assert(nb % 2 == 0);
+
+    const uint8x16_t m4b = vdupq_n_u8(0xf);
+
+    float sum0 = 0.0f;
+    float sum1 = 0.0f;
+
+    for (int i = 0; i < nb; i += 2) {
+        const uint8_t * restrict p0 = pb0 + i*16;
+        const uint8_t * restrict p1 = pb1 + i*16;
+
+        const uint8x16_t v0_0 = vld1q_u8(p0);
+        const uint8x16_t v1_0 = vld1q_u8(p1);
+        const uint8x16_t v0_1 = vld1q_u8(p0 + 16);
+        const uint8x16_t v1_1 = vld1q_u8(p1 + 16);
+
+        // 4-bit -> 8-bit
+        const uint8x16_t v0_0l = vandq_u8(v0_0, m4b);
+        const uint8x16_t v1_0l = vandq_u8(v1_0, m4b);
+        const uint8x16_t v0_0h = vshrq_n_u8(v0_0, 4);
+        const uint8x16_t v1_0h = vshrq_n_u8(v1_0, 4);
+
+        const uint8x16_t v0_1l = vandq_u8(v0_1, m4b);
+        const uint8x16_t v1_1l = vandq_u8(v1_1, m4b);
+        const uint8x16_t v0_1h = vshrq_n_u8(v0_1, 4);
+        const uint8x16_t v1_1h = vshrq_n_u8(v1_1, 4);
+
+        // dot product into uint16x8_t (at most 4*15*15 per lane)
+        uint16x8_t p_0 = vmull_u8(vget_low_u8 (v0_0l), vget_low_u8 (v1_0l));
+        p_0 = vmlal_u8(p_0,       vget_high_u8(v0_0l), vget_high_u8(v1_0l));
+        p_0 = vmlal_u8(p_0,       vget_low_u8 (v0_0h), vget_low_u8 (v1_0h));
+        p_0 = vmlal_u8(p_0,       vget_high_u8(v0_0h), vget_high_u8(v1_0h));
+
+        uint16x8_t p_1 = vmull_u8(vget_low_u8 (v0_1l), vget_low_u8 (v1_1l));
+        p_1 = vmlal_u8(p_1,       vget_high_u8(v0_1l), vget_high_u8(v1_1l));
+        p_1 = vmlal_u8(p_1,       vget_low_u8 (v0_1h), vget_low_u8 (v1_1h));
+        p_1 = vmlal_u8(p_1,       vget_high_u8(v0_1h), vget_high_u8(v1_1h));
+
+        // sums of x and y
+        const uint16x8_t sx_0 = vpaddlq_u8(vaddq_u8(v0_0l, v0_0h));
+        const uint16x8_t sy_0 = vpaddlq_u8(vaddq_u8(v1_0l, v1_0h));
+        const uint16x8_t sx_1 = vpaddlq_u8(vaddq_u8(v0_1l, v0_1h));
+        const uint16x8_t sy_1 = vpaddlq_u8(vaddq_u8(v1_1l, v1_1h));
+
+        sum0 += pd0[i + 0]*pd1[i + 0]*hsum_u16x8(p_0) + pd0[i + 0]*pm1[i + 0]*hsum_u16x8(sx_0) + pm0[i + 0]*pd1[i + 0]*hsum_u16x8(sy_0) + QK*pm0[i + 0]*pm1[i + 0];
+        sum1 += pd0[i + 1]*pd1[i + 1]*hsum_u16x8(p_1) + pd0[i + 1]*pm1[i + 1]*hsum_u16x8(sx_1) + pm0[i + 1]*pd1[i + 1]*hsum_u16x8(sy_1) + QK*pm0[i + 1]*pm1[i + 1];
+    }
+
+    sumf = sum0 + sum1;
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+#if QK == 32
+    // the per-element sums of x and y are computed as dot products with 1
+    const __m512i ones = _mm512_set1_epi8(1);
+
+    __m512 acc = _mm512_setzero_ps();
+
+    float summ = 0.0f;
+
+    for (int i = 0; i + 1 < nb; i += 2) {
+        const __m512 dxy = scales_x2_512(pd0[i + 0]*pd1[i + 0], pd0[i + 1]*pd1[i + 1]);
+        const __m512 dxm = scales_x2_512(pd0[i + 0]*pm1[i + 0], pd0[i + 1]*pm1[i + 1]);
+        const __m512 mxd = scales_x2_512(pm0[i + 0]*pd1[i + 0], pm0[i + 1]*pd1[i + 1]);
+
+        summ += pm0[i + 0]*pm1[i + 0] + pm0[i + 1]*pm1[i + 1];
+
+        const __m512i bx = bytes_from_nibbles_64(pb0 + i*16);
+        const __m512i by = bytes_from_nibbles_64(pb1 + i*16);
+
+        acc = _mm512_fmadd_ps(dxy, _mm512_cvtepi32_ps(dot_u8_i8_512(bx, by)),   acc);
+        acc = _mm512_fmadd_ps(dxm, _mm512_cvtepi32_ps(dot_u8_i8_512(bx, ones)), acc);
+        acc = _mm512_fmadd_ps(mxd, _mm512_cvtepi32_ps(dot_u8_i8_512(by, ones)), acc);
+    }
+
+    sumf = _mm512_reduce_add_ps(acc) + QK*summ;
+
+    // the last block of an odd number of blocks, with the 256-bit code
+    if (nb % 2 == 1) {
+        const int i = nb - 1;
+
+        const __m256i bx = bytes_from_nibbles_32(pb0 + i*16);
+        const __m256i by = bytes_from_nibbles_32(pb1 + i*16);
+
+        const __m256i one = _mm256_set1_epi8(1);
+
+        const float xy = hsum_float_8(_mm256_cvtepi32_ps(_mm256_madd_epi16(_mm256_maddubs_epi16(bx, by),  _mm256_set1_epi16(1))));
+        const float sx = hsum_float_8(_mm256_cvtepi32_ps(_mm256_madd_epi16(_mm256_maddubs_epi16(bx, one), _mm256_set1_epi16(1))));
+        const float sy = hsum_float_8(_mm256_cvtepi32_ps(_mm256_madd_epi16(_mm256_maddubs_epi16(by, one), _mm256_set1_epi16(1))));
+
+        sumf += pd0[i]*pd1[i]*xy + pd0[i]*pm1[i]*sx + pm0[i]*pd1[i]*sy + QK*pm0[i]*pm1[i];
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX2__)
+#if QK == 32
+    // the sums of x and y are computed with sad against 0, which leaves them in the even int32 lanes
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256 acc = _mm256_setzero_ps();
+
+    float summ = 0.0f;
+
+    for (int i = 0; i < nb; ++i) {
+        const __m256 dxy = _mm256_set1_ps(pd0[i]*pd1[i]);
+        const __m256 dxm = _mm256_set1_ps(pd0[i]*pm1[i]);
+        const __m256 mxd = _mm256_set1_ps(pm0[i]*pd1[i]);
+
+        summ += pm0[i]*pm1[i];
+
+        const __m256i bx = bytes_from_nibbles_32(pb0 + i*16);
+        const __m256i by = bytes_from_nibbles_32(pb1 + i*16);
+
+        const __m256i xy = _mm256_madd_epi16(_mm256_maddubs_epi16(bx, by), _mm256_set1_epi16(1));
+
+        acc = mul_add_ps(dxy, _mm256_cvtepi32_ps(xy),                          acc);
+        acc = mul_add_ps(dxm, _mm256_cvtepi32_ps(_mm256_sad_epu8(bx, zero)), acc);
+        acc = mul_add_ps(mxd, _mm256_cvtepi32_ps(_mm256_sad_epu8(by, zero)), acc);
+    }
+
+    sumf = hsum_float_8(acc) + QK*summ;
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const float m0 = pm0[i];
+        const float m1 = pm1[i];
+
+        const float d0 = pd0[i];
+        const float d1 = pd1[i];
+
+        const uint8_t * restrict p0 = pb0 + i*QK/2;
+        const uint8_t * restrict p1 = pb1 + i*QK/2;
+
+        for (int j = 0; j < QK/2; j++) {
+            const uint8_t v0 = p0[j];
+            const uint8_t v1 = p1[j];
+
+            const float f0 = d0*(v0 & 0xf) + m0;
+            const float f1 = d0*(v0 >> 4)  + m0;
+
+            const float f2 = d1*(v1 & 0xf) + m1;
+            const float f3 = d1*(v1 >> 4)  + m1;
+
+            sumf += f0*f2 + f1*f3;
+        }
+    }
+#endif
+
+    *s = sumf;
+}
+
+// the q4 x q8 dot products quantize only the weights to 4 bits - the activations keep 8 bits
+// y is a row of Q8_0 blocks, see ggml_quantize_row_q8_0 for the order of the elements
+
+inline static void ggml_vec_dot_q4_0_q8_0(const int n, float * restrict s, const void * restrict x, const void * restrict y) {
+    const int nb = n / QK;
+
+    assert(n % QK == 0);
+
+    const float * restrict pd0 = (const float *) x;
+    const float * restrict pd1 = (const float *) y;
+
+    const uint8_t * restrict pb0 = (const uint8_t *) (pd0 + nb);
+    const int8_t  * restrict pb1 = (const int8_t  *) (pd1 + nb);
+
+    float sumf = 0.0;
+
+#if defined(__ARM_NEON)
+#if QK == 32
+    assert(nb % 2 == 0);
+
+    const uint8x16_t m4b = vdupq_n_u8(0xf);
+    const int8x16_t  s8b = vdupq_n_s8(0x8);
+
+    float sum0 = 0.0f;
+    float sum1 = 0.0f;
+
+    for (int i = 0; i < nb; i += 2) {
+        const uint8x16_t v0_0 = vld1q_u8(pb0 + i*16);
+        const uint8x16_t v0_1 = vld1q_u8(pb0 + i*16 + 16);
+
+        // 4-bit -> 8-bit, sub 8
+        const int8x16_t v0_0l = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v0_0, m4b)), s8b);
+        const int8x16_t v0_0h = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4)), s8b);
+        const int8x16_t v0_1l = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v0_1, m4b)), s8b);
+        const int8x16_t v0_1h = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v0_1, 4)), s8b);
+
+        // even and odd elements of y
+        const int8x16_t v1_0l = vld1q_s8(pb1 + i*32);
+        const int8x16_t v1_0h = vld1q_s8(pb1 + i*32 + 16);
+        const int8x16_t v1_1l = vld1q_s8(pb1 + i*32 + 32);
+        const int8x16_t v1_1h = vld1q_s8(pb1 + i*32 + 48);
+
+        sum0 += pd0[i + 0]*pd1[i + 0]*dot_s8x16x2(v0_0l, v1_0l, v0_0h, v1_0h);
+        sum1 += pd0[i + 1]*pd1[i + 1]*dot_s8x16x2(v0_1l, v1_1l, v0_1h, v1_1h);
+    }
+
+    sumf = sum0 + sum1;
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+#if QK == 32
+    // x*y = xu*y - 8*y, with xu the unsigned nibbles of x
+    const __m512i s8b = _mm512_set1_epi8(0x8);
+
+    __m512 acc = _mm512_setzero_ps();
+
+    for (int i = 0; i + 1 < nb; i += 2) {
+        const __m512 d = scales_x2_512(pd0[i + 0]*pd1[i + 0], pd0[i + 1]*pd1[i + 1]);
+
+        const __m512i xu = bytes_from_nibbles_64(pb0 + i*16);
+
+        // even/odd halves of the 2 blocks -> the lane layout of bytes_from_nibbles_64
+        __m512i ys = _mm512_loadu_si512((const __m512i *) (pb1 + i*32));
+        ys = _mm512_shuffle_i64x2(ys, ys, _MM_SHUFFLE(3, 1, 2, 0));
+
+        const __m512i p = _mm512_sub_epi32(dot_u8_i8_512(xu, ys), dot_u8_i8_512(s8b, ys));
+
+        acc = _mm512_fmadd_ps(d, _mm512_cvtepi32_ps(p), acc);
+    }
+
+    sumf = _mm512_reduce_add_ps(acc);
+
+    // the last block of an odd number of blocks, with the 256-bit code
+    if (nb % 2 == 1) {
+        const int i = nb - 1;
+
+        const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(pb0 + i*16), _mm256_set1_epi8(0x8));
+        const __m256i by = _mm256_loadu_si256((const __m256i *) (pb1 + i*32));
+
+        sumf += pd0[i]*pd1[i]*hsum_float_8(_mm256_cvtepi32_ps(mul_sum_i8_pairs(bx, by)));
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX2__)
+#if QK == 32
+    const __m256i s8b = _mm256_set1_epi8(0x8);
+
+    __m256 acc = _mm256_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(pd0[i]*pd1[i]);
+
+        // 4-bit -> 8-bit, sub 8
+        const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(pb0 + i*16), s8b);
+        const __m256i by = _mm256_loadu_si256((const __m256i *) (pb1 + i*32));
+
+        acc = mul_add_ps(d, _mm256_cvtepi32_ps(mul_sum_i8_pairs(bx, by)), acc);
+    }
+
+    sumf = hsum_float_8(acc);
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__SSE3__)
+#if QK == 32
+    const __m128i m4b = _mm_set1_epi8(0xf);
+    const __m128i s8b = _mm_set1_epi8(0x8);
+
+    __m128 acc = _mm_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+        const __m128 d = _mm_set1_ps(pd0[i]*pd1[i]);
+
+        const __m128i v0 = _mm_loadu_si128((const __m128i *) (pb0 + i*16));
+
+        // 4-bit -> 8-bit, sub 8
+        const __m128i v0l = _mm_sub_epi8(_mm_and_si128(v0, m4b), s8b);
+        const __m128i v0h = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v0, 4), m4b), s8b);
+
+        const __m128i v1l = _mm_loadu_si128((const __m128i *) (pb1 + i*32));
+        const __m128i v1h = _mm_loadu_si128((const __m128i *) (pb1 + i*32 + 16));
+
+        const __m128i p = _mm_add_epi32(mul_sum_i8_pairs_sse(v0l, v1l), mul_sum_i8_pairs_sse(v0h, v1h));
+
+        acc = _mm_add_ps(acc, _mm_mul_ps(d, _mm_cvtepi32_ps(p)));
+    }
+
+    sumf = hsum_float_4(acc);
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const uint8_t * restrict p0 = pb0 + i*QK/2;
+        const int8_t  * restrict p1 = pb1 + i*QK;
+
+        int sumi = 0;
+        for (int j = 0; j < QK/2; j++) {
+            const uint8_t v0 = p0[j];
+
+            sumi += ((v0 & 0xf) - 8)*p1[j] + ((v0 >> 4) - 8)*p1[QK/2 + j];
+        }
+
+        sumf += pd0[i]*pd1[i]*sumi;
+    }
+#endif
+
+    *s = sumf;
+}
+
+// compute GGML_VEC_DOT_Q_UNROLL dot products at once: rows x, x + xs, ... (xs in bytes) with the same y
+// each block of y is loaded once for all rows - this is what limits the single-token matrix-vector products
+inline static void ggml_vec_dot_q4_0_q8_0_unroll(const int n, const int xs, float * restrict s, const void * restrict x, const void * restrict y) {
+    const int nb = n / QK;
+
+    assert(n % QK == 0);
+
+    const float   * restrict pd0[GGML_VEC_DOT_Q_UNROLL];
+    const uint8_t * restrict pb0[GGML_VEC_DOT_Q_UNROLL];
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        pd0[k] = (const float *) ((const char *) x + k*xs);
+        pb0[k] = (const uint8_t *) (pd0[k] + nb);
+    }
+
+    const float  * restrict pd1 = (const float *) y;
+    const int8_t * restrict pb1 = (const int8_t *) (pd1 + nb);
+
+    float sumf[GGML_VEC_DOT_Q_UNROLL] = { 0.0f };
+
+#if defined(__ARM_NEON)
+#if QK == 32
+    const uint8x16_t m4b = vdupq_n_u8(0xf);
+    const int8x16_t  s8b = vdupq_n_s8(0x8);
+
+    for (int i = 0; i < nb; ++i) {
+        // even and odd elements of y
+        const int8x16_t v1l = vld1q_s8(pb1 + i*32);
+        const int8x16_t v1h = vld1q_s8(pb1 + i*32 + 16);
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            const uint8x16_t v0 = vld1q_u8(pb0[k] + i*16);
+
+            // 4-bit -> 8-bit, sub 8
+            const int8x16_t v0l = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v0, m4b)), s8b);
+            const int8x16_t v0h = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v0, 4)), s8b);
+
+            sumf[k] += pd0[k][i]*pd1[i]*dot_s8x16x2(v0l, v1l, v0h, v1h);
+        }
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+#if QK == 32
+    // x*y = xu*y - 8*y, with xu the unsigned nibbles of x - the 8*y term is shared by all rows
+    const __m512i s8b = _mm512_set1_epi8(0x8);
+
+    __m512 acc[GGML_VEC_DOT_Q_UNROLL];
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        acc[k] = _mm512_setzero_ps();
+    }
+
+    for (int i = 0; i + 1 < nb; i += 2) {
+        // even/odd halves of the 2 blocks -> the lane layout of bytes_from_nibbles_64
+        __m512i ys = _mm512_loadu_si512((const __m512i *) (pb1 + i*32));
+        ys = _mm512_shuffle_i64x2(ys, ys, _MM_SHUFFLE(3, 1, 2, 0));
+
+        const __m512i sy = dot_u8_i8_512(s8b, ys);
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            const __m512 d = scales_x2_512(pd0[k][i + 0]*pd1[i + 0], pd0[k][i + 1]*pd1[i + 1]);
+
+            const __m512i xu = bytes_from_nibbles_64(pb0[k] + i*16);
+
+            const __m512i p = _mm512_sub_epi32(dot_u8_i8_512(xu, ys), sy);
+
+            acc[k] = _mm512_fmadd_ps(d, _mm512_cvtepi32_ps(p), acc[k]);
+        }
+    }
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        sumf[k] = _mm512_reduce_add_ps(acc[k]);
+    }
+
+    // the last block of an odd number of blocks, with the 256-bit code
+    if (nb % 2 == 1) {
+        const int i = nb - 1;
+
+        const __m256i by = _mm256_loadu_si256((const __m256i *) (pb1 + i*32));
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(pb0[k] + i*16), _mm256_set1_epi8(0x8));
+
+            sumf[k] += pd0[k][i]*pd1[i]*hsum_float_8(_mm256_cvtepi32_ps(mul_sum_i8_pairs(bx, by)));
+        }
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX2__)
+#if QK == 32
+    const __m256i s8b = _mm256_set1_epi8(0x8);
+
+    __m256 acc[GGML_VEC_DOT_Q_UNROLL];
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        acc[k] = _mm256_setzero_ps();
+    }
+
+    for (int i = 0; i < nb; ++i) {
+        const __m256i by = _mm256_loadu_si256((const __m256i *) (pb1 + i*32));
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            const __m256 d = _mm256_set1_ps(pd0[k][i]*pd1[i]);
+
+            // 4-bit -> 8-bit, sub 8
+            const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(pb0[k] + i*16), s8b);
+
+            acc[k] = mul_add_ps(d, _mm256_cvtepi32_ps(mul_sum_i8_pairs(bx, by)), acc[k]);
+        }
+    }
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        sumf[k] = hsum_float_8(acc[k]);
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__SSE3__)
+#if QK == 32
+    const __m128i m4b = _mm_set1_epi8(0xf);
+    const __m128i s8b = _mm_set1_epi8(0x8);
+
+    __m128 acc[GGML_VEC_DOT_Q_UNROLL];
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        acc[k] = _mm_setzero_ps();
+    }
+
+    for (int i = 0; i < nb; ++i) {
+        const __m128i v1l = _mm_loadu_si128((const __m128i *) (pb1 + i*32));
+        const __m128i v1h = _mm_loadu_si128((const __m128i *) (pb1 + i*32 + 16));
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            const __m128 d = _mm_set1_ps(pd0[k][i]*pd1[i]);
+
+            const __m128i v0 = _mm_loadu_si128((const __m128i *) (pb0[k] + i*16));
+
+            // 4-bit -> 8-bit, sub 8
+            const __m128i v0l = _mm_sub_epi8(_mm_and_si128(v0, m4b), s8b);
+            const __m128i v0h = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v0, 4), m4b), s8b);
+
+            const __m128i p = _mm_add_epi32(mul_sum_i8_pairs_sse(v0l, v1l), mul_sum_i8_pairs_sse(v0h, v1h));
+
+            acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(d, _mm_cvtepi32_ps(p)));
+        }
+    }
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        sumf[k] = hsum_float_4(acc[k]);
+    }
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const int8_t * restrict p1 = pb1 + i*QK;
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            const uint8_t * restrict p0 = pb0[k] + i*QK/2;
+
+            int sumi = 0;
+            for (int j = 0; j < QK/2; j++) {
+                const uint8_t v0 = p0[j];
+
+                sumi += ((v0 & 0xf) - 8)*p1[j] + ((v0 >> 4) - 8)*p1[QK/2 + j];
+            }
+
+            sumf[k] += pd0[k][i]*pd1[i]*sumi;
+        }
+    }
+#endif
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        s[k] = sumf[k];
+    }
+}
+
+// GGML_VEC_DOT_Q_UNROLL x GGML_GEMM_Q_COLS tile of the product of Q4_0 rows with Q8_0 columns:
+//
+//   s[j*ss + k] = dot(x + k*xs, y + j*ys)
+//
+// each block of x and y is loaded once per tile, so the weights are reused for all the columns
+// and the activations for all the rows (xs and ys are in bytes, ss in floats)
+inline static void ggml_gemm_q4_0_q8_0(const int n, const int xs, const int ys, float * restrict s, const int ss, const void * restrict x, const void * restrict y) {
+    const int nb = n / QK;
+
+    assert(n % QK == 0);
+
+    const float   * restrict pd0[GGML_VEC_DOT_Q_UNROLL];
+    const uint8_t * restrict pb0[GGML_VEC_DOT_Q_UNROLL];
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        pd0[k] = (const float *) ((const char *) x + k*xs);
+        pb0[k] = (const uint8_t *) (pd0[k] + nb);
+    }
+
+    const float  * restrict pd1[GGML_GEMM_Q_COLS];
+    const int8_t * restrict pb1[GGML_GEMM_Q_COLS];
+
+    for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+        pd1[j] = (const float *) ((const char *) y + j*ys);
+        pb1[j] = (const int8_t *) (pd1[j] + nb);
+    }
+
+    float sumf[GGML_VEC_DOT_Q_UNROLL][GGML_GEMM_Q_COLS] = { { 0.0f } };
+
+#if defined(__ARM_NEON)
+#if QK == 32
+    const uint8x16_t m4b = vdupq_n_u8(0xf);
+    const int8x16_t  s8b = vdupq_n_s8(0x8);
+
+    for (int i = 0; i < nb; ++i) {
+        int8x16_t v0l[GGML_VEC_DOT_Q_UNROLL];
+        int8x16_t v0h[GGML_VEC_DOT_Q_UNROLL];
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            const uint8x16_t v0 = vld1q_u8(pb0[k] + i*16);
+
+            // 4-bit -> 8-bit, sub 8
+            v0l[k] = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v0, m4b)), s8b);
+            v0h[k] = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v0, 4)), s8b);
+        }
+
+        for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+            // even and odd elements of y
+            const int8x16_t v1l = vld1q_s8(pb1[j] + i*32);
+            const int8x16_t v1h = vld1q_s8(pb1[j] + i*32 + 16);
+
+            for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+                sumf[k][j] += pd0[k][i]*pd1[j][i]*dot_s8x16x2(v0l[k], v1l, v0h[k], v1h);
+            }
+        }
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+#if QK == 32
+    // x*y = xu*y - 8*y, with xu the unsigned nibbles of x
+    const __m512i s8b = _mm512_set1_epi8(0x8);
+
+    __m512 acc[GGML_VEC_DOT_Q_UNROLL][GGML_GEMM_Q_COLS];
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+            acc[k][j] = _mm512_setzero_ps();
+        }
+    }
+
+    for (int i = 0; i + 1 < nb; i += 2) {
+        __m512i xu[GGML_VEC_DOT_Q_UNROLL];
+        __m512  dx[GGML_VEC_DOT_Q_UNROLL];
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            xu[k] = bytes_from_nibbles_64(pb0[k] + i*16);
+            dx[k] = scales_x2_512(pd0[k][i + 0], pd0[k][i + 1]);
+        }
+
+        for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+            // even/odd halves of the 2 blocks -> the lane layout of bytes_from_nibbles_64
+            __m512i yv = _mm512_loadu_si512((const __m512i *) (pb1[j] + i*32));
+            yv = _mm512_shuffle_i64x2(yv, yv, _MM_SHUFFLE(3, 1, 2, 0));
+
+            const __m512i sy = dot_u8_i8_512(s8b, yv);
+            const __m512  dy = scales_x2_512(pd1[j][i + 0], pd1[j][i + 1]);
+
+            for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+                const __m512i p = _mm512_sub_epi32(dot_u8_i8_512(xu[k], yv), sy);
+
+                acc[k][j] = _mm512_fmadd_ps(_mm512_mul_ps(dx[k], dy), _mm512_cvtepi32_ps(p), acc[k][j]);
+            }
+        }
+    }
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+            sumf[k][j] = _mm512_reduce_add_ps(acc[k][j]);
+        }
+    }
+
+    // the last block of an odd number of blocks, with the 256-bit code
+    if (nb % 2 == 1) {
+        const int i = nb - 1;
+
+        __m256i bx[GGML_VEC_DOT_Q_UNROLL];
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            bx[k] = _mm256_sub_epi8(bytes_from_nibbles_32(pb0[k] + i*16), _mm256_set1_epi8(0x8));
+        }
+
+        for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+            const __m256i by = _mm256_loadu_si256((const __m256i *) (pb1[j] + i*32));
+
+            for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+                sumf[k][j] += pd0[k][i]*pd1[j][i]*hsum_float_8(_mm256_cvtepi32_ps(mul_sum_i8_pairs(bx[k], by)));
+            }
+        }
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX2__)
+#if QK == 32
+    // 16 ymm registers are not enough for the accumulators of the whole tile,
+    // so the rows are processed in pairs - the columns of y are still shared by 2 rows
+    const __m256i s8b = _mm256_set1_epi8(0x8);
+
+    for (int k0 = 0; k0 < GGML_VEC_DOT_Q_UNROLL; k0 += 2) {
+        __m256 acc[2][GGML_GEMM_Q_COLS];
+
+        for (int k = 0; k < 2; ++k) {
+            for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+                acc[k][j] = _mm256_setzero_ps();
+            }
+        }
+
+        for (int i = 0; i < nb; ++i) {
+            __m256i bx[2];
+            __m256i ax[2];
+
+            for (int k = 0; k < 2; ++k) {
+                // 4-bit -> 8-bit, sub 8
+                bx[k] = _mm256_sub_epi8(bytes_from_nibbles_32(pb0[k0 + k] + i*16), s8b);
+
+                // |x| for maddubs, the sign of x is moved to y (see mul_sum_i8_pairs)
+                ax[k] = _mm256_sign_epi8(bx[k], bx[k]);
+            }
+
+            for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+                const __m256i by = _mm256_loadu_si256((const __m256i *) (pb1[j] + i*32));
+
+                for (int k = 0; k < 2; ++k) {
+                    const __m256 d = _mm256_set1_ps(pd0[k0 + k][i]*pd1[j][i]);
+
+                    const __m256i dot = _mm256_maddubs_epi16(ax[k], _mm256_sign_epi8(by, bx[k]));
+                    const __m256i p   = _mm256_madd_epi16(dot, _mm256_set1_epi16(1));
+
+                    acc[k][j] = mul_add_ps(d, _mm256_cvtepi32_ps(p), acc[k][j]);
+                }
+            }
+        }
+
+        for (int k = 0; k < 2; ++k) {
+            for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+                sumf[k0 + k][j] = hsum_float_8(acc[k][j]);
+            }
+        }
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__SSE3__)
+#if QK == 32
+    const __m128i m4b = _mm_set1_epi8(0xf);
+    const __m128i s8b = _mm_set1_epi8(0x8);
+
+    __m128 acc[GGML_VEC_DOT_Q_UNROLL][GGML_GEMM_Q_COLS];
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+            acc[k][j] = _mm_setzero_ps();
+        }
+    }
+
+    for (int i = 0; i < nb; ++i) {
+        __m128i v0l[GGML_VEC_DOT_Q_UNROLL];
+        __m128i v0h[GGML_VEC_DOT_Q_UNROLL];
+
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            const __m128i v0 = _mm_loadu_si128((const __m128i *) (pb0[k] + i*16));
+
+            // 4-bit -> 8-bit, sub 8
+            v0l[k] = _mm_sub_epi8(_mm_and_si128(v0, m4b), s8b);
+            v0h[k] = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v0, 4), m4b), s8b);
+        }
+
+        for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+            const __m128i v1l = _mm_loadu_si128((const __m128i *) (pb1[j] + i*32));
+            const __m128i v1h = _mm_loadu_si128((const __m128i *) (pb1[j] + i*32 + 16));
+
+            for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+                const __m128 d = _mm_set1_ps(pd0[k][i]*pd1[j][i]);
+
+                const __m128i p = _mm_add_epi32(mul_sum_i8_pairs_sse(v0l[k], v1l), mul_sum_i8_pairs_sse(v0h[k], v1h));
+
+                acc[k][j] = _mm_add_ps(acc[k][j], _mm_mul_ps(d, _mm_cvtepi32_ps(p)));
+            }
+        }
+    }
+
+    for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+        for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+            sumf[k][j] = hsum_float_4(acc[k][j]);
+        }
+    }
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+            const int8_t * restrict p1 = pb1[j] + i*QK;
+
+            for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+                const uint8_t * restrict p0 = pb0[k] + i*QK/2;
+
+                int sumi = 0;
+                for (int l = 0; l < QK/2; l++) {
+                    const uint8_t v0 = p0[l];
+
+                    sumi += ((v0 & 0xf) - 8)*p1[l] + ((v0 >> 4) - 8)*p1[QK/2 + l];
+                }
+
+                sumf[k][j] += pd0[k][i]*pd1[j][i]*sumi;
+            }
+        }
+    }
+#endif
+
+    for (int j = 0; j < GGML_GEMM_Q_COLS; ++j) {
+        for (int k = 0; k < GGML_VEC_DOT_Q_UNROLL; ++k) {
+            s[j*ss + k] = sumf[k][j];
+        }
+    }
+}
+
+inline static void ggml_vec_dot_q4_1_q8_0(const int n, float * restrict s, const void * restrict x, const void * restrict y) {
+    const int nb = n / QK;
+
+    assert(n % QK == 0);
+
+    const float * restrict pm0 = (const float *) x;
+    const float * restrict pd0 = (const float *) (pm0 + nb);
+    const float * restrict pd1 = (const float *) y;
+
+    const uint8_t * restrict pb0 = (const uint8_t *) (pd0 + nb);
+    const int8_t  * restrict pb1 = (const int8_t  *) (pd1 + nb);
+
+    float sumf = 0.0;
+
+    // (d0*x + m0)*d1*y = d0*d1*x*y + m0*d1*y
+
+#if defined(__ARM_NEON)
+#if QK == 32
+    assert(nb % 2 == 0);
+
+    const uint8x16_t m4b = vdupq_n_u8(0xf);
+
+    float sum0 = 0.0f;
+    float sum1 = 0.0f;
+
+    for (int i = 0; i < nb; i += 2) {
+        const uint8x16_t v0_0 = vld1q_u8(pb0 + i*16);
+        const uint8x16_t v0_1 = vld1q_u8(pb0 + i*16 + 16);
+
+        // 4-bit -> 8-bit
+        const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8(v0_0, m4b));
+        const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
+        const int8x16_t v0_1l = vreinterpretq_s8_u8(vandq_u8(v0_1, m4b));
+        const int8x16_t v0_1h = vreinterpretq_s8_u8(vshrq_n_u8(v0_1, 4));
+
+        const int8x16_t v1_0l = vld1q_s8(pb1 + i*32);
+        const int8x16_t v1_0h = vld1q_s8(pb1 + i*32 + 16);
+        const int8x16_t v1_1l = vld1q_s8(pb1 + i*32 + 32);
+        const int8x16_t v1_1h = vld1q_s8(pb1 + i*32 + 48);
+
+        // sums of y
+        const int32_t sy_0 = hsum_s16x8(vaddq_s16(vpaddlq_s8(v1_0l), vpaddlq_s8(v1_0h)));
+        const int32_t sy_1 = hsum_s16x8(vaddq_s16(vpaddlq_s8(v1_1l), vpaddlq_s8(v1_1h)));
+
+        sum0 += pd0[i + 0]*pd1[i + 0]*dot_s8x16x2(v0_0l, v1_0l, v0_0h, v1_0h) + pm0[i + 0]*pd1[i + 0]*sy_0;
+        sum1 += pd0[i + 1]*pd1[i + 1]*dot_s8x16x2(v0_1l, v1_1l, v0_1h, v1_1h) + pm0[i + 1]*pd1[i + 1]*sy_1;
+    }
+
+    sumf = sum0 + sum1;
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+#if QK == 32
+    const __m512i ones = _mm512_set1_epi8(1);
+
+    __m512 acc = _mm512_setzero_ps();
+
+    for (int i = 0; i + 1 < nb; i += 2) {
+        const __m512 dxy = scales_x2_512(pd0[i + 0]*pd1[i + 0], pd0[i + 1]*pd1[i + 1]);
+        const __m512 mxd = scales_x2_512(pm0[i + 0]*pd1[i + 0], pm0[i + 1]*pd1[i + 1]);
+
+        const __m512i bx = bytes_from_nibbles_64(pb0 + i*16);
+
+        __m512i by = _mm512_loadu_si512((const __m512i *) (pb1 + i*32));
+        by = _mm512_shuffle_i64x2(by, by, _MM_SHUFFLE(3, 1, 2, 0));
+
+        acc = _mm512_fmadd_ps(dxy, _mm512_cvtepi32_ps(dot_u8_i8_512(bx,   by)), acc);
+        acc = _mm512_fmadd_ps(mxd, _mm512_cvtepi32_ps(dot_u8_i8_512(ones, by)), acc);
+    }
+
+    sumf = _mm512_reduce_add_ps(acc);
+
+    // the last block of an odd number of blocks, with the 256-bit code
+    if (nb % 2 == 1) {
+        const int i = nb - 1;
+
+        const __m256i bx = bytes_from_nibbles_32(pb0 + i*16);
+        const __m256i by = _mm256_loadu_si256((const __m256i *) (pb1 + i*32));
+
+        const __m256i xy = _mm256_madd_epi16(_mm256_maddubs_epi16(bx, by), _mm256_set1_epi16(1));
+        const __m256i sy = _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_set1_epi8(1), by), _mm256_set1_epi16(1));
+
+        sumf += pd0[i]*pd1[i]*hsum_float_8(_mm256_cvtepi32_ps(xy)) + pm0[i]*pd1[i]*hsum_float_8(_mm256_cvtepi32_ps(sy));
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX2__)
+#if QK == 32
+    const __m256i ones_8  = _mm256_set1_epi8(1);
+    const __m256i ones_16 = _mm256_set1_epi16(1);
+
+    __m256 acc = _mm256_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+        const __m256 dxy = _mm256_set1_ps(pd0[i]*pd1[i]);
+        const __m256 mxd = _mm256_set1_ps(pm0[i]*pd1[i]);
+
+        const __m256i bx = bytes_from_nibbles_32(pb0 + i*16);
+        const __m256i by = _mm256_loadu_si256((const __m256i *) (pb1 + i*32));
+
+        const __m256i xy = _mm256_madd_epi16(_mm256_maddubs_epi16(bx,     by), ones_16);
+        const __m256i sy = _mm256_madd_epi16(_mm256_maddubs_epi16(ones_8, by), ones_16);
+
+        acc = mul_add_ps(dxy, _mm256_cvtepi32_ps(xy), acc);
+        acc = mul_add_ps(mxd, _mm256_cvtepi32_ps(sy), acc);
+    }
+
+    sumf = hsum_float_8(acc);
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const uint8_t * restrict p0 = pb0 + i*QK/2;
+        const int8_t  * restrict p1 = pb1 + i*QK;
+
+        int sumi = 0;
+        int sumy = 0;
+        for (int j = 0; j < QK/2; j++) {
+            const uint8_t v0 = p0[j];
+
+            sumi += (v0 & 0xf)*p1[j] + (v0 >> 4)*p1[QK/2 + j];
+            sumy += p1[j] + p1[QK/2 + j];
+        }
+
+        sumf += pd0[i]*pd1[i]*sumi + pm0[i]*pd1[i]*sumy;
+    }
+#endif
+
+    *s = sumf;
+}
+
+inline static void ggml_vec_dot_q4_0x_q8_0(const int n, float * restrict s, const void * restrict x, const void * restrict y, const bool f16) {
+    const int nb = n / QK;
+    const size_t bs = Q4_0X_BLOCK_SIZE(f16);
+
+    assert(n % QK == 0);
+
+    const uint8_t * restrict px = (const uint8_t *) x;
+
+    const float  * restrict pd1 = (const float *)  y;
+    const int8_t * restrict pb1 = (const int8_t *) (pd1 + nb);
+
+    float sumf = 0.0;
+
+#if defined(__ARM_NEON)
+#if QK == 32
+    const uint8x16_t m4b = vdupq_n_u8(0xf);
+    const int8x16_t  s8b = vdupq_n_s8(0x8);
+
+    for (int i = 0; i < nb; i++) {
+        const uint8_t * restrict b = px + i*bs;
+
+        const uint8x16_t v0 = vld1q_u8(q4_0x_get_qs(b, f16));
+
+        // 4-bit -> 8-bit, sub 8
+        const int8x16_t v0l = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v0, m4b)), s8b);
+        const int8x16_t v0h = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v0, 4)), s8b);
+
+        const int8x16_t v1l = vld1q_s8(pb1 + i*32);
+        const int8x16_t v1h = vld1q_s8(pb1 + i*32 + 16);
+
+        sumf += q4_0x_get_d(b, f16)*pd1[i]*dot_s8x16x2(v0l, v1l, v0h, v1h);
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX2__)
+#if QK == 32
+    const __m256i s8b = _mm256_set1_epi8(0x8);
+
+    __m256 acc = _mm256_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+        const uint8_t * restrict b = px + i*bs;
+
+        const __m256 d = _mm256_set1_ps(q4_0x_get_d(b, f16)*pd1[i]);
+
+        // 4-bit -> 8-bit, sub 8
+        const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(q4_0x_get_qs(b, f16)), s8b);
+        const __m256i by = _mm256_loadu_si256((const __m256i *) (pb1 + i*32));
+
+        acc = mul_add_ps(d, _mm256_cvtepi32_ps(mul_sum_i8_pairs(bx, by)), acc);
+    }
+
+    sumf = hsum_float_8(acc);
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__SSE3__)
+#if QK == 32
+    const __m128i m4b = _mm_set1_epi8(0xf);
+    const __m128i s8b = _mm_set1_epi8(0x8);
+
+    __m128 acc = _mm_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+        const uint8_t * restrict b = px + i*bs;
+
+        const __m128 d = _mm_set1_ps(q4_0x_get_d(b, f16)*pd1[i]);
+
+        const __m128i v0 = _mm_loadu_si128((const __m128i *) q4_0x_get_qs(b, f16));
+
+        // 4-bit -> 8-bit, sub 8
+        const __m128i v0l = _mm_sub_epi8(_mm_and_si128(v0, m4b), s8b);
+        const __m128i v0h = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(v0, 4), m4b), s8b);
+
+        const __m128i v1l = _mm_loadu_si128((const __m128i *) (pb1 + i*32));
+        const __m128i v1h = _mm_loadu_si128((const __m128i *) (pb1 + i*32 + 16));
+
+        const __m128i p = _mm_add_epi32(mul_sum_i8_pairs_sse(v0l, v1l), mul_sum_i8_pairs_sse(v0h, v1h));
+
+        acc = _mm_add_ps(acc, _mm_mul_ps(d, _mm_cvtepi32_ps(p)));
+    }
+
+    sumf = hsum_float_4(acc);
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const uint8_t * restrict b = px + i*bs;
+
+        const uint8_t * restrict p0 = q4_0x_get_qs(b, f16);
+        const int8_t  * restrict p1 = pb1 + i*QK;
+
+        int sumi = 0;
+        for (int j = 0; j < QK/2; j++) {
+            const uint8_t v0 = p0[j];
+
+            sumi += ((v0 & 0xf) - 8)*p1[j] + ((v0 >> 4) - 8)*p1[QK/2 + j];
+        }
+
+        sumf += q4_0x_get_d(b, f16)*pd1[i]*sumi;
+    }
+#endif
+
+    *s = sumf;
+}
+
+static void ggml_vec_dot_q4_0i_q8_0(const int n, float * restrict s, const void * restrict x, const void * restrict y) { ggml_vec_dot_q4_0x_q8_0(n, s, x, y, false); }
+static void ggml_vec_dot_q4_0h_q8_0(const int n, float * restrict s, const void * restrict x, const void * restrict y) { ggml_vec_dot_q4_0x_q8_0(n, s, x, y, true);  }
+
+//
+// multiply-add
+//
+
+inline static void ggml_vec_mad_f32(const int n, float * restrict y, const float * restrict x, const float v) {
+    #if defined(GGML_SIMD)
+        const int np = (n & ~(GGML_F32_STEP - 1));
+
+        GGML_F32_VEC vx = GGML_F32_VEC_SET1(v);
+
+        GGML_F32_VEC ax[GGML_F32_ARR];
+        GGML_F32_VEC ay[GGML_F32_ARR];
+
+        for (int i = 0; i < np; i += GGML_F32_STEP) {
+            for (int j = 0; j < GGML_F32_ARR; j++) {
+                ax[j] = GGML_F32_VEC_LOAD(x + i + j*GGML_F32_EPR);
+                ay[j] = GGML_F32_VEC_LOAD(y + i + j*GGML_F32_EPR);
+                ay[j] = GGML_F32_VEC_FMA(ay[j], ax[j], vx);
+
+                GGML_F32_VEC_STORE(y + i + j*GGML_F32_EPR, ay[j]);
+            }
+        }
+
+        // leftovers
+        for (int i = np; i < n; ++i) {
+            y[i] += x[i]*v;
+        }
+    #else
+        // scalar
+        for (int i = 0; i < n; ++i) {
+            y[i] += x[i]*v;
+        }
+    #endif
+}
+
+inline static void ggml_vec_mad_f16(const int n, ggml_fp16_t * restrict y, ggml_fp16_t * restrict x, const float v) {
+    #if defined(GGML_SIMD)
+        const int np = (n & ~(GGML_F16_STEP - 1));
+
+        GGML_F16_VEC vx = GGML_F16_VEC_SET1(v);
+
+        GGML_F16_VEC ax[GGML_F16_ARR];
+        GGML_F16_VEC ay[GGML_F16_ARR];
+
+        for (int i = 0; i < np; i += GGML_F16_STEP) {
+            for (int j = 0; j < GGML_F16_ARR; j++) {
+                ax[j] = GGML_F16_VEC_LOAD(x + i + j*GGML_F16_EPR, j);
+                ay[j] = GGML_F16_VEC_LOAD(y + i + j*GGML_F16_EPR, j);
+                ay[j] = GGML_F16_VEC_FMA(ay[j], ax[j], vx);
+
+                GGML_F16_VEC_STORE(y + i + j*GGML_F16_EPR, ay, j);
+            }
+        }
+
+        // leftovers
+        for (int i = np; i < n; ++i) {
+            GGML_ASSERT(false);
+            y[i] = GGML_FP32_TO_FP16(GGML_FP16_TO_FP32(y[i]) + GGML_FP16_TO_FP32(x[i])*v);
+        }
+    #else
+        for (int i = 0; i < n; ++i) {
+            y[i] = GGML_FP32_TO_FP16(GGML_FP16_TO_FP32(y[i]) + GGML_FP16_TO_FP32(x[i])*v);
+        }
+    #endif
+}
+
+inline static void ggml_vec_mad_q4_0(const int n, float * restrict y, void * restrict x, const float v) {
+    assert(n % QK == 0);
+
+    const int nb = n / QK;
+
+    const float   * restrict pd = (const float *)   (x);
+    const uint8_t * restrict pb = (const uint8_t *) (pd + nb);
+
+#if __ARM_NEON
+#if QK == 32
+    for (int i = 0; i < nb; ++i) {
+        const float d0 = pd[i]*v;
+
+        const uint8_t * restrict pp = pb + i*16;
+
+        const uint8x8_t m4b = vdup_n_u8(0xf);
+        const int8x8_t  s8b = vdup_n_s8(0x8);
+
+        const float32x4_t vd = vdupq_n_f32(d0);
+
+        for (int j = 0; j < 2; j++) {
+            const uint8x8_t vx = vld1_u8(pp + j*8);
+
+            const int8x8_t vxl = vreinterpret_s8_u8(vand_u8(vx, m4b));
+            const int8x8_t vxh = vreinterpret_s8_u8(vshr_n_u8(vx, 4));
+
+            // sub 8
+            const int8x8_t vxls = vsub_s8(vxl, s8b);
+            const int8x8_t vxhs = vsub_s8(vxh, s8b);
+
+            //const int8x8_t vxlt = vzip_s8(vxls, vxhs)[0];
+            //const int8x8_t vxht = vzip_s8(vxls, vxhs)[1];
+            const int8x8_t vxlt = vzip1_s8(vxls, vxhs);
+            const int8x8_t vxht = vzip2_s8(vxls, vxhs);
+
+            const int8x16_t vxq = vcombine_s8(vxlt, vxht);
+
+            // convert to 2x int16x8_t
+            const int16x8_t vxq0 = vmovl_s8(vget_low_s8 (vxq));
+            const int16x8_t vxq1 = vmovl_s8(vget_high_s8(vxq));
+
+            // convert to 4x float32x4_t
+            const float32x4_t vx0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16 (vxq0)));
+            const float32x4_t vx1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(vxq0)));
+            const float32x4_t vx2 = vcvtq_f32_s32(vmovl_s16(vget_low_s16 (vxq1)));
+            const float32x4_t vx3 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(vxq1)));
+
+            const float32x4_t vy0 = vld1q_f32(y + i*32 + j*16 + 0);
+            const float32x4_t vy1 = vld1q_f32(y + i*32 + j*16 + 4);
+            const float32x4_t vy2 = vld1q_f32(y + i*32 + j*16 + 8);
+            const float32x4_t vy3 = vld1q_f32(y + i*32 + j*16 + 12);
+
+            const float32x4_t vr0 = vfmaq_f32(vy0, vx0, vd);
+            const float32x4_t vr1 = vfmaq_f32(vy1, vx1, vd);
+            const float32x4_t vr2 = vfmaq_f32(vy2, vx2, vd);
+            const float32x4_t vr3 = vfmaq_f32(vy3, vx3, vd);
+
+            vst1q_f32(y + i*32 + j*16 + 0,  vr0);
+            vst1q_f32(y + i*32 + j*16 + 4,  vr1);
+            vst1q_f32(y + i*32 + j*16 + 8,  vr2);
+            vst1q_f32(y + i*32 + j*16 + 12, vr3);
+        }
+    }
+#endif
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+#if QK == 32
+    const __m128i m4b = _mm_set1_epi8(0xf);
+    const __m128i s8b = _mm_set1_epi8(0x8);
+
+    for (int i = 0; i < nb; ++i) {
+        const __m512 vd = _mm512_set1_ps(pd[i]*v);
+
+        const __m128i vx = _mm_loadu_si128((const __m128i *) (pb + i*16));
+
+        // 4-bit -> 8-bit, sub 8
+        const __m128i vxl = _mm_sub_epi8(_mm_and_si128(vx, m4b), s8b);
+        const __m128i vxh = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(vx, 4), m4b), s8b);
+
+        // interleave back to the element order
+        const __m512 vx0 = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_unpacklo_epi8(vxl, vxh)));
+        const __m512 vx1 = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_unpackhi_epi8(vxl, vxh)));
+
+        _mm512_storeu_ps(y + i*32 +  0, _mm512_fmadd_ps(vx0, vd, _mm512_loadu_ps(y + i*32 +  0)));
+        _mm512_storeu_ps(y + i*32 + 16, _mm512_fmadd_ps(vx1, vd, _mm512_loadu_ps(y + i*32 + 16)));
+    }
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const float d = pd[i];
+
+        const uint8_t * restrict pp = pb + i*QK/2;
+
+        for (int l = 0; l < QK; l += 2) {
+            const uint8_t vi = pp[l/2];
+
+            const int8_t vi0 = vi & 0xf;
+            const int8_t vi1 = vi >> 4;
+
+            const float v0 = (vi0 - 8)*d;
+            const float v1 = (vi1 - 8)*d;
+
+            y[i*QK + l + 0] += v0*v;
+            y[i*QK + l + 1] += v1*v;
+
+            assert(!isnan(y[i*QK + l + 0]));
+            assert(!isnan(y[i*QK + l + 1]));
+            assert(!isinf(y[i*QK + l + 0]));
+            assert(!isinf(y[i*QK + l + 1]));
+        }
+    }
+#endif
+}
+
+inline static void ggml_vec_mad_q4_1(const int n, float * restrict y, void * restrict x, const float v) {
+    assert(n % QK == 0);
+
+    const int nb = n / QK;
+
+    const float   * restrict pm = (const float *)   (x);
+    const float   * restrict pd = (const float *)   (pm + nb);
+    const uint8_t * restrict pb = (const uint8_t *) (pd + nb);
+
+    // y += v*(d*x + m) = (v*d)*x + v*m
+
+#if __ARM_NEON
+#if QK == 32
+    const uint8x8_t m4b = vdup_n_u8(0xf);
+
+    for (int i = 0; i < nb; ++i) {
+        const float32x4_t vd = vdupq_n_f32(pd[i]*v);
+        const float32x4_t vm = vdupq_n_f32(pm[i]*v);
+
+        const uint8_t * restrict pp = pb + i*16;
+
+        for (int j = 0; j < 2; j++) {
+            const uint8x8_t vx = vld1_u8(pp + j*8);
+
+            const uint8x8_t vxl = vand_u8(vx, m4b);
+            const uint8x8_t vxh = vshr_n_u8(vx, 4);
+
+            // interleave back to the element order
+            const uint8x16_t vxq = vcombine_u8(vzip1_u8(vxl, vxh), vzip2_u8(vxl, vxh));
+
+            // convert to 2x uint16x8_t
+            const uint16x8_t vxq0 = vmovl_u8(vget_low_u8 (vxq));
+            const uint16x8_t vxq1 = vmovl_u8(vget_high_u8(vxq));
+
+            // convert to 4x float32x4_t
+            const float32x4_t vx0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16 (vxq0)));
+            const float32x4_t vx1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(vxq0)));
+            const float32x4_t vx2 = vcvtq_f32_u32(vmovl_u16(vget_low_u16 (vxq1)));
+            const float32x4_t vx3 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(vxq1)));
+
+            const float32x4_t vy0 = vld1q_f32(y + i*32 + j*16 + 0);
+            const float32x4_t vy1 = vld1q_f32(y + i*32 + j*16 + 4);
+            const float32x4_t vy2 = vld1q_f32(y + i*32 + j*16 + 8);
+            const float32x4_t vy3 = vld1q_f32(y + i*32 + j*16 + 12);
+
+            vst1q_f32(y + i*32 + j*16 + 0,  vfmaq_f32(vaddq_f32(vy0, vm), vx0, vd));
+            vst1q_f32(y + i*32 + j*16 + 4,  vfmaq_f32(vaddq_f32(vy1, vm), vx1, vd));
+            vst1q_f32(y + i*32 + j*16 + 8,  vfmaq_f32(vaddq_f32(vy2, vm), vx2, vd));
+            vst1q_f32(y + i*32 + j*16 + 12, vfmaq_f32(vaddq_f32(vy3, vm), vx3, vd));
+        }
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+#if QK == 32
+    const __m128i m4b = _mm_set1_epi8(0xf);
+
+    for (int i = 0; i < nb; ++i) {
+        const __m512 vd = _mm512_set1_ps(pd[i]*v);
+        const __m512 vm = _mm512_set1_ps(pm[i]*v);
+
+        const __m128i vx = _mm_loadu_si128((const __m128i *) (pb + i*16));
+
+        // 4-bit -> 8-bit
+        const __m128i vxl = _mm_and_si128(vx, m4b);
+        const __m128i vxh = _mm_and_si128(_mm_srli_epi16(vx, 4), m4b);
+
+        // interleave back to the element order
+        const __m512 vx0 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_unpacklo_epi8(vxl, vxh)));
+        const __m512 vx1 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_unpackhi_epi8(vxl, vxh)));
+
+        _mm512_storeu_ps(y + i*32 +  0, _mm512_fmadd_ps(vx0, vd, _mm512_add_ps(_mm512_loadu_ps(y + i*32 +  0), vm)));
+        _mm512_storeu_ps(y + i*32 + 16, _mm512_fmadd_ps(vx1, vd, _mm512_add_ps(_mm512_loadu_ps(y + i*32 + 16), vm)));
+    }
+#else
+#error "not implemented for QK"
+#endif
+#elif defined(__AVX2__)
+#if QK == 32
+    const __m128i m4b = _mm_set1_epi8(0xf);
+
+    for (int i = 0; i < nb; ++i) {
+        const __m256 vd = _mm256_set1_ps(pd[i]*v);
+        const __m256 vm = _mm256_set1_ps(pm[i]*v);
+
+        const __m128i vx = _mm_loadu_si128((const __m128i *) (pb + i*16));
+
+        // 4-bit -> 8-bit
+        const __m128i vxl = _mm_and_si128(vx, m4b);
+        const __m128i vxh = _mm_and_si128(_mm_srli_epi16(vx, 4), m4b);
+
+        // interleave back to the element order, 8 elements per register
+        const __m128i vx0 = _mm_unpacklo_epi8(vxl, vxh);
+        const __m128i vx1 = _mm_unpackhi_epi8(vxl, vxh);
+
+        const __m128i vq[4] = { vx0, _mm_srli_si128(vx0, 8), vx1, _mm_srli_si128(vx1, 8) };
+
+        for (int j = 0; j < 4; j++) {
+            float * restrict py = y + i*32 + j*8;
+
+            const __m256 vf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(vq[j]));
+
+            _mm256_storeu_ps(py, mul_add_ps(vf, vd, _mm256_add_ps(_mm256_loadu_ps(py), vm)));
+        }
+    }
+#else
+#error "not implemented for QK"
+#endif
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const float m = pm[i];
+        const float d = pd[i];
+
+        const uint8_t * restrict pp = pb + i*QK/2;
+
+        for (int l = 0; l < QK; l += 2) {
+            const uint8_t vi = pp[l/2];
+
+            const uint8_t vi0 = vi & 0xf;
+            const uint8_t vi1 = vi >> 4;
+
+            const float v0 = d*vi0 + m;
+            const float v1 = d*vi1 + m;
+
+            y[i*QK + l + 0] += v0*v;
+            y[i*QK + l + 1] += v1*v;
+
+            assert(!isnan(y[i*QK + l + 0]));
+            assert(!isnan(y[i*QK + l + 1]));
+            assert(!isinf(y[i*QK + l + 0]));
+            assert(!isinf(y[i*QK + l + 1]));
+            //printf("mad: v0 %f v1 %f, i = %d, l = %d, d = %f, vi = %d, vi0 = %d, vi1 = %d\n", v0, v1, i, l, d, vi, vi0, vi1);
+        }
+    }
+#endif
+}
+
+// TODO: vectorize
+inline static void ggml_vec_mad_q4_0x(const int n, float * restrict y, void * restrict x, const float v, const bool f16) {
+    const int nb = n / QK;
+    const size_t bs = Q4_0X_BLOCK_SIZE(f16);
+
+    assert(n % QK == 0);
+
+    const uint8_t * restrict px = (const uint8_t *) x;
+
+    for (int i = 0; i < nb; i++) {
+        const uint8_t * restrict b = px + i*bs;
+
+        const float d = q4_0x_get_d(b, f16)*v;
+
+        const uint8_t * restrict qs = q4_0x_get_qs(b, f16);
+
+        for (int j = 0; j < QK/2; j++) {
+            const uint8_t vi = qs[j];
+
+            y[i*QK + 2*j + 0] += ((int8_t) (vi & 0xf) - 8)*d;
+            y[i*QK + 2*j + 1] += ((int8_t) (vi >> 4)  - 8)*d;
+        }
+    }
+}
+
+static void ggml_vec_mad_q4_0i(const int n, float * restrict y, void * restrict x, const float v) { ggml_vec_mad_q4_0x(n, y, x, v, false); }
+static void ggml_vec_mad_q4_0h(const int n, float * restrict y, void * restrict x, const float v) { ggml_vec_mad_q4_0x(n, y, x, v, true);  }
+
+//
+// kernel table
+//
+
+#define GGML_KERNELS_STR_(variant) #variant
+#define GGML_KERNELS_STR(variant)  GGML_KERNELS_STR_(variant)
+
+const struct ggml_kernels GGML_KERNELS_NAME(GGML_KERNELS_VARIANT) = {
+    .name = GGML_KERNELS_STR(GGML_KERNELS_VARIANT),
+
+#if defined(__SSE3__)
+    .sse3 = 1,
+#endif
+#if defined(__AVX__)
+    .avx = 1,
+#endif
+#if defined(__AVX2__)
+    .avx2 = 1,
+#endif
+#if defined(__AVX512F__)
+    .avx512 = 1,
+#endif
+#if defined(__AVX512VNNI__)
+    .avx512_vnni = 1,
+#endif
+#if defined(__FMA__)
+    .fma = 1,
+#endif
+#if defined(__F16C__)
+    .f16c = 1,
+#endif
+
+    .fp16_to_fp32_row    = ggml_vec_fp16_to_fp32,
+    .fp32_to_fp16_row    = ggml_vec_fp32_to_fp16,
+
+    .quantize_row_q4_0   = ggml_quantize_row_q4_0,
+    .quantize_row_q4_1   = ggml_quantize_row_q4_1,
+    .dequantize_row_q4_0 = ggml_dequantize_row_q4_0,
+    .dequantize_row_q4_1 = ggml_dequantize_row_q4_1,
+    .quantize_row_q4_0i   = ggml_quantize_row_q4_0i,
+    .quantize_row_q4_0h   = ggml_quantize_row_q4_0h,
+    .dequantize_row_q4_0i = ggml_dequantize_row_q4_0i,
+    .dequantize_row_q4_0h = ggml_dequantize_row_q4_0h,
+    .quantize_row_q8_0   = ggml_quantize_row_q8_0,
+    .dequantize_row_q8_0 = ggml_dequantize_row_q8_0,
+
+    .vec_dot_f32         = ggml_vec_dot_f32,
+    .vec_dot_f16         = ggml_vec_dot_f16,
+    .vec_dot_q4_0        = ggml_vec_dot_q4_0,
+    .vec_dot_q4_1        = ggml_vec_dot_q4_1,
+    .vec_dot_q4_0_q8_0   = ggml_vec_dot_q4_0_q8_0,
+    .vec_dot_q4_1_q8_0   = ggml_vec_dot_q4_1_q8_0,
+    .vec_dot_q4_0_q8_0_unroll = ggml_vec_dot_q4_0_q8_0_unroll,
+    .gemm_q4_0_q8_0           = ggml_gemm_q4_0_q8_0,
+    .vec_dot_q4_0i_q8_0  = ggml_vec_dot_q4_0i_q8_0,
+    .vec_dot_q4_0h_q8_0  = ggml_vec_dot_q4_0h_q8_0,
+
+    .vec_mad_f32         = ggml_vec_mad_f32,
+    .vec_mad_f16         = ggml_vec_mad_f16,
+    .vec_mad_q4_0        = ggml_vec_mad_q4_0,
+    .vec_mad_q4_1        = ggml_vec_mad_q4_1,
+    .vec_mad_q4_0i       = ggml_vec_mad_q4_0i,
+    .vec_mad_q4_0h       = ggml_vec_mad_q4_0h,
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+//
+// hot compute kernels
+//
+// ggml-kernels.c can be compiled several times with different instruction set flags. Each build
+// exports a table of function pointers named after GGML_KERNELS_VARIANT and ggml_init picks the
+// best table for the CPU it is running on (see GGML_NATIVE in the root CMakeLists.txt)
+//
+
+#include "ggml.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define QK 32
+
+// number of weight rows per call of the multi-row dot kernels
+#define GGML_VEC_DOT_Q_UNROLL 4
+
+// number of activation columns per tile of the GEMM kernels (the rows are GGML_VEC_DOT_Q_UNROLL)
+#define GGML_GEMM_Q_COLS 4
+
+#undef MIN
+#undef MAX
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define GGML_ASSERT(x) \
+    do { \
+        if (!(x)) { \
+            fprintf(stderr, "GGML_ASSERT: %s:%d: %s\n", __FILE__, __LINE__, #x); \
+            abort(); \
+        } \
+    } while (0)
+
+// block-interleaved Q4_0 (GGML_TYPE_Q4_0I and GGML_TYPE_Q4_0H)
+// same quantization as Q4_0, but the scale of each block is stored right before its nibbles
+typedef struct {
+    float   d;
+    uint8_t qs[QK/2];
+} block_q4_0i;
+
+typedef struct {
+    ggml_fp16_t d;
+    uint8_t     qs[QK/2];
+} block_q4_0h;
+
+struct ggml_kernels {
+    const char * name;
+
+    // instruction set extensions the kernels were compiled with
+    int sse3;
+    int avx;
+    int avx2;
+    int avx512;
+    int avx512_vnni;
+    int fma;
+    int f16c;
+
+    void (*fp16_to_fp32_row)(const int n, float * y, const ggml_fp16_t * x);
+    void (*fp32_to_fp16_row)(const int n, ggml_fp16_t * y, const float * x);
+
+    void (*quantize_row_q4_0)  (const float * x, void * y, int k);
+    void (*quantize_row_q4_1)  (const float * x, void * y, int k);
+    void (*dequantize_row_q4_0)(const void * x, float * y, int k);
+    void (*dequantize_row_q4_1)(const void * x, float * y, int k);
+    void (*quantize_row_q4_0i)  (const float * x, void * y, int k);
+    void (*quantize_row_q4_0h)  (const float * x, void * y, int k);
+    void (*dequantize_row_q4_0i)(const void * x, float * y, int k);
+    void (*dequantize_row_q4_0h)(const void * x, float * y, int k);
+    void (*quantize_row_q8_0)   (const float * x, void * y, int k);
+    void (*dequantize_row_q8_0) (const void * x, float * y, int k);
+
+    void (*vec_dot_f32) (const int n, float * s, const float * x, const float * y);
+    void (*vec_dot_f16) (const int n, float * s, ggml_fp16_t * x, ggml_fp16_t * y);
+    void (*vec_dot_q4_0)(const int n, float * s, const void * x, const void * y);
+    void (*vec_dot_q4_1)(const int n, float * s, const void * x, const void * y);
+
+    // y is quantized to GGML_TYPE_Q8_0
+    void (*vec_dot_q4_0_q8_0)(const int n, float * s, const void * x, const void * y);
+    void (*vec_dot_q4_1_q8_0)(const int n, float * s, const void * x, const void * y);
+    void (*vec_dot_q4_0i_q8_0)(const int n, float * s, const void * x, const void * y);
+    void (*vec_dot_q4_0h_q8_0)(const int n, float * s, const void * x, const void * y);
+
+    // GGML_VEC_DOT_Q_UNROLL rows of x, xs bytes apart, with the same y
+    void (*vec_dot_q4_0_q8_0_unroll)(const int n, const int xs, float * s, const void * x, const void * y);
+
+    // GGML_VEC_DOT_Q_UNROLL rows of x (xs bytes apart) times GGML_GEMM_Q_COLS columns of y (ys bytes apart)
+    // the result of row k and column j goes to s[j*ss + k]
+    void (*gemm_q4_0_q8_0)(const int n, const int xs, const int ys, float * s, const int ss, const void * x, const void * y);
+
+    void (*vec_mad_f32) (const int n, float * y, const float * x, const float v);
+    void (*vec_mad_f16) (const int n, ggml_fp16_t * y, ggml_fp16_t * x, const float v);
+    void (*vec_mad_q4_0)(const int n, float * y, void * x, const float v);
+    void (*vec_mad_q4_1)(const int n, float * y, void * x, const float v);
+    void (*vec_mad_q4_0i)(const int n, float * y, void * x, const float v);
+    void (*vec_mad_q4_0h)(const int n, float * y, void * x, const float v);
+};
+
+#define GGML_KERNELS_NAME_(variant) ggml_kernels_ ## variant
+#define GGML_KERNELS_NAME(variant)  GGML_KERNELS_NAME_(variant)
+
+// built with the flags of the ggml target (GGML_NATIVE=ON)
+extern const struct ggml_kernels ggml_kernels_native;
+
+// built for runtime dispatch on x86 (GGML_NATIVE=OFF)
+extern const struct ggml_kernels ggml_kernels_generic;
+extern const struct ggml_kernels ggml_kernels_sse3;
+extern const struct ggml_kernels ggml_kernels_avx;
+extern const struct ggml_kernels ggml_kernels_avx2;
+extern const struct ggml_kernels ggml_kernels_avx512;
+extern const struct ggml_kernels ggml_kernels_avx512_vnni;
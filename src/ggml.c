@@ -1,4 +1,10 @@
+#if defined(__linux__)
+#define _GNU_SOURCE // pthread_setaffinity_np, CPU_SET
+#endif
+
 #include "ggml.h"
+#include "ggml-kernels.h"
+#include "ggml-simd.h"
 
 #if defined(_MSC_VER) || defined(__MINGW32__)
 #include <malloc.h> // using malloc.h with MSC/MINGW
@@ -65,6 +71,41 @@ static int pthread_join(pthread_t thread, void* unused) {
     return (int) WaitForSingleObject(thread, INFINITE);
 }
 
+typedef SRWLOCK            pthread_mutex_t;
+typedef CONDITION_VARIABLE pthread_cond_t;
+
+static int pthread_mutex_init(pthread_mutex_t * mutex, void * unused) {
+    InitializeSRWLock(mutex);
+    return 0;
+}
+static int pthread_mutex_destroy(pthread_mutex_t * mutex) {
+    return 0;
+}
+static int pthread_mutex_lock(pthread_mutex_t * mutex) {
+    AcquireSRWLockExclusive(mutex);
+    return 0;
+}
+static int pthread_mutex_unlock(pthread_mutex_t * mutex) {
+    ReleaseSRWLockExclusive(mutex);
+    return 0;
+}
+
+static int pthread_cond_init(pthread_cond_t * cond, void * unused) {
+    InitializeConditionVariable(cond);
+    return 0;
+}
+static int pthread_cond_destroy(pthread_cond_t * cond) {
+    return 0;
+}
+static int pthread_cond_wait(pthread_cond_t * cond, pthread_mutex_t * mutex) {
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+    return 0;
+}
+static int pthread_cond_broadcast(pthread_cond_t * cond) {
+    WakeAllConditionVariable(cond);
+    return 0;
+}
+
 static int sched_yield (void) {
     Sleep (0);
     return 0;
@@ -76,6 +117,13 @@ static int sched_yield (void) {
 typedef void* thread_ret_t;
 #endif
 
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
+
 #ifdef __HAIKU__
 #define static_assert(cond, msg) _Static_assert(cond, msg)
 #endif
@@ -88,6 +136,11 @@ typedef void* thread_ret_t;
 #define GGML_SOFT_MAX_UNROLL 4
 #define GGML_VEC_DOT_UNROLL  2
 
+// quantized mul_mat: use the GEMM kernels from this many src1 columns on,
+// with blocks of src0 rows of this size in bytes kept in L2 while the columns stream through
+#define GGML_MUL_MAT_Q_GEMM_MIN_NE11 4
+#define GGML_MUL_MAT_Q_GEMM_L2_BLOCK (128*1024)
+
 #ifdef GGML_USE_ACCELERATE
 // uncomment to use vDSP for soft max computation
 // note: not sure if it is actually faster
@@ -103,143 +156,12 @@ typedef void* thread_ret_t;
 #define UNUSED(x) (void)(x)
 #define SWAP(x, y, T) do { T SWAP = x; x = y; y = SWAP; } while (0)
 
-#define GGML_ASSERT(x) \
-    do { \
-        if (!(x)) { \
-            fprintf(stderr, "GGML_ASSERT: %s:%d: %s\n", __FILE__, __LINE__, #x); \
-            abort(); \
-        } \
-    } while (0)
-
 #ifdef GGML_USE_ACCELERATE
 #include <Accelerate/Accelerate.h>
-#elif GGML_USE_OPENBLAS
+#elif defined(GGML_USE_OPENBLAS)
 #include <cblas.h>
 #endif
 
-#undef MIN
-#undef MAX
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-
-// floating point type used to accumulate sums
-typedef double ggml_float;
-
-// 16-bit float
-// on Arm, we use __fp16
-// on x86, we use uint16_t
-#ifdef __ARM_NEON
-
-// if YCM cannot find <arm_neon.h>, make a symbolic link to it, for example:
-//
-//   $ ln -sfn /Library/Developer/CommandLineTools/usr/lib/clang/13.1.6/include/arm_neon.h ./src/
-//
-#include <arm_neon.h>
-
-#define GGML_COMPUTE_FP16_TO_FP32(x) (x)
-#define GGML_COMPUTE_FP32_TO_FP16(x) (x)
-
-#define GGML_FP16_TO_FP32(x) (x)
-#define GGML_FP32_TO_FP16(x) (x)
-
-#else
-
-#ifdef __wasm_simd128__
-#include <wasm_simd128.h>
-#else
-#ifdef __POWER9_VECTOR__
-#include <altivec.h>
-#undef bool
-#define bool _Bool
-#else
-#include <immintrin.h>
-#endif
-#endif
-
-#ifdef __F16C__
-
-#define GGML_COMPUTE_FP16_TO_FP32(x) _cvtsh_ss(x)
-#define GGML_COMPUTE_FP32_TO_FP16(x) _cvtss_sh(x, 0)
-
-#else
-
-// FP16 <-> FP32
-// ref: https://github.com/Maratyszcza/FP16
-
-static inline float fp32_from_bits(uint32_t w) {
-    union {
-        uint32_t as_bits;
-        float as_value;
-    } fp32;
-    fp32.as_bits = w;
-    return fp32.as_value;
-}
-
-static inline uint32_t fp32_to_bits(float f) {
-	union {
-		float as_value;
-		uint32_t as_bits;
-	} fp32;
-	fp32.as_value = f;
-	return fp32.as_bits;
-}
-
-static inline float ggml_compute_fp16_to_fp32(ggml_fp16_t h) {
-    const uint32_t w = (uint32_t) h << 16;
-    const uint32_t sign = w & UINT32_C(0x80000000);
-    const uint32_t two_w = w + w;
-
-    const uint32_t exp_offset = UINT32_C(0xE0) << 23;
-#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L) || defined(__GNUC__) && !defined(__STRICT_ANSI__)
-    const float exp_scale = 0x1.0p-112f;
-#else
-    const float exp_scale = fp32_from_bits(UINT32_C(0x7800000));
-#endif
-    const float normalized_value = fp32_from_bits((two_w >> 4) + exp_offset) * exp_scale;
-
-    const uint32_t magic_mask = UINT32_C(126) << 23;
-    const float magic_bias = 0.5f;
-    const float denormalized_value = fp32_from_bits((two_w >> 17) | magic_mask) - magic_bias;
-
-    const uint32_t denormalized_cutoff = UINT32_C(1) << 27;
-    const uint32_t result = sign |
-        (two_w < denormalized_cutoff ? fp32_to_bits(denormalized_value) : fp32_to_bits(normalized_value));
-    return fp32_from_bits(result);
-}
-
-static inline ggml_fp16_t ggml_compute_fp32_to_fp16(float f) {
-#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L) || defined(__GNUC__) && !defined(__STRICT_ANSI__)
-    const float scale_to_inf = 0x1.0p+112f;
-    const float scale_to_zero = 0x1.0p-110f;
-#else
-    const float scale_to_inf = fp32_from_bits(UINT32_C(0x77800000));
-    const float scale_to_zero = fp32_from_bits(UINT32_C(0x08800000));
-#endif
-    float base = (fabsf(f) * scale_to_inf) * scale_to_zero;
-
-    const uint32_t w = fp32_to_bits(f);
-    const uint32_t shl1_w = w + w;
-    const uint32_t sign = w & UINT32_C(0x80000000);
-    uint32_t bias = shl1_w & UINT32_C(0xFF000000);
-    if (bias < UINT32_C(0x71000000)) {
-        bias = UINT32_C(0x71000000);
-    }
-
-    base = fp32_from_bits((bias >> 1) + UINT32_C(0x07800000)) + base;
-    const uint32_t bits = fp32_to_bits(base);
-    const uint32_t exp_bits = (bits >> 13) & UINT32_C(0x00007C00);
-    const uint32_t mantissa_bits = bits & UINT32_C(0x00000FFF);
-    const uint32_t nonsign = exp_bits + mantissa_bits;
-    return (sign >> 16) | (shl1_w > UINT32_C(0xFF000000) ? UINT16_C(0x7E00) : nonsign);
-}
-
-#define GGML_COMPUTE_FP16_TO_FP32(x) ggml_compute_fp16_to_fp32(x)
-#define GGML_COMPUTE_FP32_TO_FP16(x) ggml_compute_fp32_to_fp16(x)
-
-#endif // __F16C__
-
-#endif // __ARM_NEON
-
 //
 // global data
 //
@@ -254,22 +176,8 @@ static ggml_fp16_t table_silu_f16[1 << 16];
 static ggml_fp16_t table_exp_f16[1 << 16];
 
 // precomputed f32 table for f16 (256 KB)
-static float table_f32_f16[1 << 16];
-
-// On ARM NEON, it's quicker to directly convert x -> x instead of calling into ggml_lookup_fp16_to_fp32,
-// so we define GGML_FP16_TO_FP32 and GGML_FP32_TO_FP16 elsewhere for NEON.
-#if !defined(GGML_FP16_TO_FP32) || !defined(GGML_FP32_TO_FP16)
-
-inline static float ggml_lookup_fp16_to_fp32(ggml_fp16_t f) {
-    uint16_t s;
-    memcpy(&s, &f, sizeof(uint16_t));
-    return table_f32_f16[s];
-}
-
-#define GGML_FP16_TO_FP32(x) ggml_lookup_fp16_to_fp32(x)
-#define GGML_FP32_TO_FP16(x) GGML_COMPUTE_FP32_TO_FP16(x)
+float ggml_table_f32_f16[1 << 16];
 
-#endif
 
 // note: do not use these inside ggml.c
 // these are meant to be used via the ggml.h API
@@ -354,729 +262,170 @@ int64_t ggml_cycles_per_ms(void) {
 static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 
 //
-// quantization
+// kernel dispatch
 //
 
-#define QK 32
-
-// method 5
-// blocks of QK elements
-// represented with a single float (delta) and QK/2 8-bit ints (i.e QK 4-bit signed integer factors)
-void quantize_row_q4_0(const float * restrict x, void * restrict y, int k) {
-    assert(k % QK == 0);
-
-    const int nb = k / QK;
-
-    float   * restrict pd = (float *)   (y);
-    uint8_t * restrict pb = (uint8_t *) (pd + nb);
-
-    uint8_t pp[QK/2];
-
-#if __ARM_NEON
-#if QK == 32
-    for (int i = 0; i < nb; i++) {
-        float amax = 0.0f; // absolute max
-
-        float32x4_t srcv [8];
-        float32x4_t asrcv[8];
-        float32x4_t amaxv[8];
-
-        for (int l = 0; l < 8; l++) srcv[l]  = vld1q_f32(x + i*32 + 4*l);
-        for (int l = 0; l < 8; l++) asrcv[l] = vabsq_f32(srcv[l]);
-
-        for (int l = 0; l < 4; l++) amaxv[2*l] = vmaxq_f32(asrcv[2*l], asrcv[2*l+1]);
-        for (int l = 0; l < 2; l++) amaxv[4*l] = vmaxq_f32(amaxv[4*l], amaxv[4*l+2]);
-        for (int l = 0; l < 1; l++) amaxv[8*l] = vmaxq_f32(amaxv[8*l], amaxv[8*l+4]);
-
-        amax = MAX(
-                MAX(vgetq_lane_f32(amaxv[0], 0), vgetq_lane_f32(amaxv[0], 1)),
-                MAX(vgetq_lane_f32(amaxv[0], 2), vgetq_lane_f32(amaxv[0], 3)));
-
-        const float d = amax / ((1 << 3) - 1);
-        const float id = d ? 1.0/d : 0.0;
-
-        pd[i] = d;
+// x86 instruction set extensions supported by the CPU and enabled by the OS
+#if defined(GGML_KERNELS_DISPATCH)
+#include <cpuid.h>
+
+struct ggml_x86_features {
+    bool sse3;
+    bool avx;
+    bool avx2;
+    bool avx512;
+    bool avx512_vnni;
+    bool fma;
+    bool f16c;
+};
 
-        for (int l = 0; l < 8; l++) {
-            const float32x4_t v  = vmulq_n_f32(srcv[l], id);
-            const float32x4_t vf = vaddq_f32(v, vdupq_n_f32(8.5f));
-            const int32x4_t   vi = vcvtq_s32_f32(vf);
+static struct ggml_x86_features ggml_x86_get_features(void) {
+    struct ggml_x86_features f = { 0 };
 
-            pp[2*l + 0] = vgetq_lane_s32(vi, 0) | (vgetq_lane_s32(vi, 1) << 4);
-            pp[2*l + 1] = vgetq_lane_s32(vi, 2) | (vgetq_lane_s32(vi, 3) << 4);
-        }
+    unsigned int eax, ebx, ecx, edx;
 
-        memcpy(pb + i*16, pp, sizeof(pp));
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return f;
     }
-#else
-#error "not implemented for QK"
-#endif
-#elif defined(__wasm_simd128__)
-#if QK == 32
-    for (int i = 0; i < nb; i++) {
-        float amax = 0.0f; // absolute max
-
-        v128_t srcv [8];
-        v128_t asrcv[8];
-        v128_t amaxv[8];
-
-        for (int l = 0; l < 8; l++) srcv[l]  = wasm_v128_load(x + i*32 + 4*l);
-        for (int l = 0; l < 8; l++) asrcv[l] = wasm_f32x4_abs(srcv[l]);
 
-        for (int l = 0; l < 4; l++) amaxv[2*l] = wasm_f32x4_max(asrcv[2*l], asrcv[2*l+1]);
-        for (int l = 0; l < 2; l++) amaxv[4*l] = wasm_f32x4_max(amaxv[4*l], amaxv[4*l+2]);
-        for (int l = 0; l < 1; l++) amaxv[8*l] = wasm_f32x4_max(amaxv[8*l], amaxv[8*l+4]);
+    f.sse3 = (ecx >> 0) & 1;
 
-        amax = MAX(
-                MAX(wasm_f32x4_extract_lane(amaxv[0], 0), wasm_f32x4_extract_lane(amaxv[0], 1)),
-                MAX(wasm_f32x4_extract_lane(amaxv[0], 2), wasm_f32x4_extract_lane(amaxv[0], 3)));
-
-        const float d = amax / ((1 << 3) - 1);
-        const float id = d ? 1.0/d : 0.0;
-
-        pd[i] = d;
-
-        for (int l = 0; l < 8; l++) {
-            const v128_t v  = wasm_f32x4_mul(srcv[l], wasm_f32x4_splat(id));
-            const v128_t vf = wasm_f32x4_add(v, wasm_f32x4_splat(8.5f));
-            const v128_t vi = wasm_i32x4_trunc_sat_f32x4(vf);
-
-            pp[2*l + 0] = wasm_i32x4_extract_lane(vi, 0) | (wasm_i32x4_extract_lane(vi, 1) << 4);
-            pp[2*l + 1] = wasm_i32x4_extract_lane(vi, 2) | (wasm_i32x4_extract_lane(vi, 3) << 4);
-        }
-
-        memcpy(pb + i*16, pp, sizeof(pp));
+    // the OS has to save the AVX registers on context switch (OSXSAVE + XCR0)
+    if (!((ecx >> 27) & 1)) {
+        return f;
     }
-#else
-#error "not implemented for QK"
-#endif
-#else
-    // scalar
-    for (int i = 0; i < nb; i++) {
-        float amax = 0.0f; // absolute max
 
-        for (int l = 0; l < QK; l++) {
-            const float v = x[i*QK + l];
-            amax = MAX(amax, fabsf(v));
-        }
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
 
-        const float d = amax / ((1 << 3) - 1);
-        const float id = d ? 1.0f/d : 0.0f;
+    const bool os_avx    = (xcr0_lo & 0x06) == 0x06;
+    const bool os_avx512 = (xcr0_lo & 0xe6) == 0xe6;
 
-        pd[i] = d;
+    f.avx  = os_avx && ((ecx >> 28) & 1);
+    f.fma  = f.avx  && ((ecx >> 12) & 1);
+    f.f16c = f.avx  && ((ecx >> 29) & 1);
 
-        for (int l = 0; l < QK; l += 2) {
-            const float v0 = x[i*QK + l + 0]*id;
-            const float v1 = x[i*QK + l + 1]*id;
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
 
-            const uint8_t vi0 = ((int8_t) (round(v0))) + 8;
-            const uint8_t vi1 = ((int8_t) (round(v1))) + 8;
+        f.avx2        = f.avx && ((ebx >> 5) & 1);
+        f.avx512      = os_avx512 && ((ebx >> 16) & 1) && ((ebx >> 30) & 1) && ((ebx >> 31) & 1); // F + BW + VL
+        f.avx512_vnni = f.avx512 && ((ecx >> 11) & 1);
+    }
 
-            assert(vi0 >= 0 && vi0 < 16);
-            assert(vi1 >= 0 && vi1 < 16);
+    return f;
+}
+#endif
 
-            pp[l/2] = vi0 | (vi1 << 4);
-        }
+static const struct ggml_kernels * ggml_kernels_select(void) {
+#if defined(GGML_KERNELS_DISPATCH)
+    const struct ggml_x86_features f = ggml_x86_get_features();
 
-        memcpy(pb + i*QK/2, pp, sizeof(pp));
+    if (f.avx512_vnni && f.avx2 && f.fma && f.f16c) {
+        return &ggml_kernels_avx512_vnni;
+    }
+    if (f.avx512 && f.avx2 && f.fma && f.f16c) {
+        return &ggml_kernels_avx512;
+    }
+    if (f.avx2 && f.fma && f.f16c) {
+        return &ggml_kernels_avx2;
     }
+    if (f.avx && f.f16c) {
+        return &ggml_kernels_avx;
+    }
+    if (f.sse3) {
+        return &ggml_kernels_sse3;
+    }
+
+    return &ggml_kernels_generic;
+#else
+    return &ggml_kernels_native;
 #endif
 }
 
-// method 4
-// blocks of QK elements
-// represented with 2 floats (min + delta) and QK/2 8-bit ints (i.e QK 4-bit unsigned integer factors)
-void quantize_row_q4_1(const float * restrict x, void * restrict y, int k) {
-    assert(k % QK == 0);
-
-    const int nb = k / QK;
-
-    float   * restrict pm = (float *)   (y);
-    float   * restrict pd = (float *)   (pm + nb);
-    uint8_t * restrict pb = (uint8_t *) (pd + nb);
-
-    uint8_t pp[QK/2];
-
-    for (int i = 0; i < nb; i++) {
-        float min = FLT_MAX;
-        float max = -FLT_MAX;
+// selected on the first call to ggml_init
+static const struct ggml_kernels * g_kernels = NULL;
 
-        for (int l = 0; l < QK; l++) {
-            const float v = x[i*QK + l];
-            if (v < min) min = v;
-            if (v > max) max = v;
-        }
-
-        const float d = (max - min) / ((1 << 4) - 1);
-        const float id = d ? 1.0f/d : 0.0f;
-
-        pm[i] = min;
-        pd[i] = d;
-
-        for (int l = 0; l < QK; l += 2) {
-            const float v0 = (x[i*QK + l + 0] - min)*id;
-            const float v1 = (x[i*QK + l + 1] - min)*id;
-
-            const uint8_t vi0 = round(v0);
-            const uint8_t vi1 = round(v1);
-
-            assert(vi0 >= 0 && vi0 < 16);
-            assert(vi1 >= 0 && vi1 < 16);
-
-            pp[l/2] = vi0 | (vi1 << 4);
-        }
-
-        memcpy(pb + i*QK/2, pp, sizeof(pp));
+static const struct ggml_kernels * ggml_kernels_get(void) {
+    if (g_kernels == NULL) {
+        g_kernels = ggml_kernels_select();
     }
-}
-
-// TODO: vectorize
-void dequantize_row_q4_0(const void * restrict x, float * restrict y, int k) {
-    assert(k % QK == 0);
-
-    const int nb = k / QK;
-
-    const float   * restrict pd = (const float *)   (x);
-    const uint8_t * restrict pb = (const uint8_t *) (pd + nb);
-
-    // scalar
-    for (int i = 0; i < nb; i++) {
-        const float d = pd[i];
-
-        const uint8_t * restrict pp = pb + i*QK/2;
-
-        for (int l = 0; l < QK; l += 2) {
-            const uint8_t vi = pp[l/2];
 
-            const int8_t vi0 = vi & 0xf;
-            const int8_t vi1 = vi >> 4;
-
-            const float v0 = (vi0 - 8)*d;
-            const float v1 = (vi1 - 8)*d;
-
-            y[i*QK + l + 0] = v0;
-            y[i*QK + l + 1] = v1;
-
-            assert(!isnan(y[i*QK + l + 0]));
-            assert(!isnan(y[i*QK + l + 1]));
-        }
-    }
+    return g_kernels;
 }
 
-void dequantize_row_q4_1(const void * restrict x, float * restrict y, int k) {
-    assert(k % QK == 0);
-
-    const int nb = k / QK;
-
-    const float   * restrict pm = (const float *)   (x);
-    const float   * restrict pd = (const float *)   (pm + nb);
-    const uint8_t * restrict pb = (const uint8_t *) (pd + nb);
-
-    for (int i = 0; i < nb; i++) {
-        const float m = pm[i];
-        const float d = pd[i];
+inline static void ggml_vec_fp16_to_fp32(const int n, float * y, const ggml_fp16_t * x) { g_kernels->fp16_to_fp32_row(n, y, x); }
+inline static void ggml_vec_fp32_to_fp16(const int n, ggml_fp16_t * y, const float * x) { g_kernels->fp32_to_fp16_row(n, y, x); }
 
-        const uint8_t * restrict pp = pb + i*QK/2;
+inline static void ggml_vec_dot_f32 (const int n, float * s, const float * x, const float * y) { g_kernels->vec_dot_f32 (n, s, x, y); }
+inline static void ggml_vec_dot_f16 (const int n, float * s, ggml_fp16_t * x, ggml_fp16_t * y) { g_kernels->vec_dot_f16 (n, s, x, y); }
+inline static void ggml_vec_dot_q4_0(const int n, float * s, const void  * x, const void  * y) { g_kernels->vec_dot_q4_0(n, s, x, y); }
+inline static void ggml_vec_dot_q4_1(const int n, float * s, const void  * x, const void  * y) { g_kernels->vec_dot_q4_1(n, s, x, y); }
 
-        for (int l = 0; l < QK; l += 2) {
-            const uint8_t vi = pp[l/2];
+inline static void ggml_vec_dot_q4_0_q8_0(const int n, float * s, const void * x, const void * y) { g_kernels->vec_dot_q4_0_q8_0(n, s, x, y); }
+inline static void ggml_vec_dot_q4_1_q8_0(const int n, float * s, const void * x, const void * y) { g_kernels->vec_dot_q4_1_q8_0(n, s, x, y); }
+inline static void ggml_vec_dot_q4_0i_q8_0(const int n, float * s, const void * x, const void * y) { g_kernels->vec_dot_q4_0i_q8_0(n, s, x, y); }
+inline static void ggml_vec_dot_q4_0h_q8_0(const int n, float * s, const void * x, const void * y) { g_kernels->vec_dot_q4_0h_q8_0(n, s, x, y); }
 
-            const int8_t vi0 = vi & 0xf;
-            const int8_t vi1 = vi >> 4;
+inline static void ggml_vec_dot_q4_0_q8_0_unroll(const int n, const int xs, float * s, const void * x, const void * y) { g_kernels->vec_dot_q4_0_q8_0_unroll(n, xs, s, x, y); }
 
-            const float v0 = vi0*d + m;
-            const float v1 = vi1*d + m;
+inline static void ggml_gemm_q4_0_q8_0(const int n, const int xs, const int ys, float * s, const int ss, const void * x, const void * y) { g_kernels->gemm_q4_0_q8_0(n, xs, ys, s, ss, x, y); }
 
-            y[i*QK + l + 0] = v0;
-            y[i*QK + l + 1] = v1;
+inline static void ggml_vec_mad_f32 (const int n, float       * y, const float * x, const float v) { g_kernels->vec_mad_f32 (n, y, x, v); }
+inline static void ggml_vec_mad_f16 (const int n, ggml_fp16_t * y, ggml_fp16_t * x, const float v) { g_kernels->vec_mad_f16 (n, y, x, v); }
+inline static void ggml_vec_mad_q4_0(const int n, float       * y, void        * x, const float v) { g_kernels->vec_mad_q4_0(n, y, x, v); }
+inline static void ggml_vec_mad_q4_1(const int n, float       * y, void        * x, const float v) { g_kernels->vec_mad_q4_1(n, y, x, v); }
+inline static void ggml_vec_mad_q4_0i(const int n, float      * y, void        * x, const float v) { g_kernels->vec_mad_q4_0i(n, y, x, v); }
+inline static void ggml_vec_mad_q4_0h(const int n, float      * y, void        * x, const float v) { g_kernels->vec_mad_q4_0h(n, y, x, v); }
 
-            assert(!isnan(y[i*QK + l + 0]));
-            assert(!isnan(y[i*QK + l + 1]));
-        }
-    }
+// the public conversion functions can be called before ggml_init
+void quantize_row_q4_0(const float * x, void * y, int k) {
+    ggml_kernels_get()->quantize_row_q4_0(x, y, k);
 }
 
-//
-// simd mappings
-//
-
-// we define a common set of C macros which map to specific intrinsics based on the current architecture
-// we then implement the fundamental computation operations below using only these macros
-// adding support for new architectures requires to define the corresponding SIMD macros
-//
-// GGML_F32_STEP / GGML_F16_STEP
-//   number of elements to process in a single step
-//
-// GGML_F32_EPR / GGML_F16_EPR
-//   number of elements to fit in a single register
-//
-
-#if defined(__ARM_NEON) && defined(__ARM_FEATURE_FMA)
-
-#define GGML_SIMD
-
-// F32 NEON
+void quantize_row_q4_1(const float * x, void * y, int k) {
+    ggml_kernels_get()->quantize_row_q4_1(x, y, k);
+}
 
-#define GGML_F32_STEP 16
-#define GGML_F32_EPR  4
+void quantize_row_q4_0i(const float * x, void * y, int k) {
+    ggml_kernels_get()->quantize_row_q4_0i(x, y, k);
+}
 
-#define GGML_F32x4              float32x4_t
-#define GGML_F32x4_ZERO         vdupq_n_f32(0.0f)
-#define GGML_F32x4_SET1(x)      vdupq_n_f32(x)
-#define GGML_F32x4_LOAD         vld1q_f32
-#define GGML_F32x4_STORE        vst1q_f32
-#define GGML_F32x4_FMA(a, b, c) vfmaq_f32(a, b, c)
-#define GGML_F32x4_ADD          vaddq_f32
-#define GGML_F32x4_MUL          vmulq_f32
-#if defined(__ARM_FEATURE_QRDMX)
-    #define GGML_F32x4_REDUCE_ONE(x) vaddvq_f32(x)
-#else
-    #define GGML_F32x4_REDUCE_ONE(x) \
-    (vgetq_lane_f32(x, 0) +          \
-     vgetq_lane_f32(x, 1) +          \
-     vgetq_lane_f32(x, 2) +          \
-     vgetq_lane_f32(x, 3))
-#endif
-#define GGML_F32x4_REDUCE(res, x)              \
-{                                              \
-    for (int i = 0; i < GGML_F32_ARR/2; ++i) { \
-        x[2*i] = vaddq_f32(x[2*i], x[2*i+1]);  \
-    }                                          \
-    for (int i = 0; i < GGML_F32_ARR/4; ++i) { \
-        x[4*i] = vaddq_f32(x[4*i], x[4*i+2]);  \
-    }                                          \
-    for (int i = 0; i < GGML_F32_ARR/8; ++i) { \
-        x[8*i] = vaddq_f32(x[8*i], x[8*i+4]);  \
-    }                                          \
-    res = GGML_F32x4_REDUCE_ONE(x[0]);         \
-}
-
-#define GGML_F32_VEC        GGML_F32x4
-#define GGML_F32_VEC_ZERO   GGML_F32x4_ZERO
-#define GGML_F32_VEC_SET1   GGML_F32x4_SET1
-#define GGML_F32_VEC_LOAD   GGML_F32x4_LOAD
-#define GGML_F32_VEC_STORE  GGML_F32x4_STORE
-#define GGML_F32_VEC_FMA    GGML_F32x4_FMA
-#define GGML_F32_VEC_ADD    GGML_F32x4_ADD
-#define GGML_F32_VEC_MUL    GGML_F32x4_MUL
-#define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
-
-// F16 NEON
+void quantize_row_q4_0h(const float * x, void * y, int k) {
+    ggml_kernels_get()->quantize_row_q4_0h(x, y, k);
+}
 
-#if defined(__ARM_FEATURE_FP16_VECTOR_ARITHMETIC)
-    #define GGML_F16_STEP 32
-    #define GGML_F16_EPR  8
-
-    #define GGML_F16x8              float16x8_t
-    #define GGML_F16x8_ZERO         vdupq_n_f16(0.0f)
-    #define GGML_F16x8_SET1(x)      vdupq_n_f16(x)
-    #define GGML_F16x8_LOAD         vld1q_f16
-    #define GGML_F16x8_STORE        vst1q_f16
-    #define GGML_F16x8_FMA(a, b, c) vfmaq_f16(a, b, c)
-    #define GGML_F16x8_ADD          vaddq_f16
-    #define GGML_F16x8_MUL          vmulq_f16
-    #define GGML_F16x8_REDUCE(res, x)                             \
-    {                                                             \
-        for (int i = 0; i < GGML_F16_ARR/2; ++i) {                \
-            x[2*i] = vaddq_f16(x[2*i], x[2*i+1]);                 \
-        }                                                         \
-        for (int i = 0; i < GGML_F16_ARR/4; ++i) {                \
-            x[4*i] = vaddq_f16(x[4*i], x[4*i+2]);                 \
-        }                                                         \
-        for (int i = 0; i < GGML_F16_ARR/8; ++i) {                \
-            x[8*i] = vaddq_f16(x[8*i], x[8*i+4]);                 \
-        }                                                         \
-        const float32x4_t t0 = vcvt_f32_f16(vget_low_f16 (x[0])); \
-        const float32x4_t t1 = vcvt_f32_f16(vget_high_f16(x[0])); \
-        res = vaddvq_f32(vaddq_f32(t0, t1));                      \
-    }
-
-    #define GGML_F16_VEC                GGML_F16x8
-    #define GGML_F16_VEC_ZERO           GGML_F16x8_ZERO
-    #define GGML_F16_VEC_SET1           GGML_F16x8_SET1
-    #define GGML_F16_VEC_LOAD(p, i)     GGML_F16x8_LOAD(p)
-    #define GGML_F16_VEC_STORE(p, r, i) GGML_F16x8_STORE(p, r[i])
-    #define GGML_F16_VEC_FMA            GGML_F16x8_FMA
-    #define GGML_F16_VEC_ADD            GGML_F16x8_ADD
-    #define GGML_F16_VEC_MUL            GGML_F16x8_MUL
-    #define GGML_F16_VEC_REDUCE         GGML_F16x8_REDUCE
-#else
-    // if FP16 vector arithmetic is not supported, we use FP32 instead
-    // and take advantage of the vcvt_ functions to convert to/from FP16
-
-    #define GGML_F16_STEP 16
-    #define GGML_F16_EPR  4
-
-    #define GGML_F32Cx4              float32x4_t
-    #define GGML_F32Cx4_ZERO         vdupq_n_f32(0.0f)
-    #define GGML_F32Cx4_SET1(x)      vdupq_n_f32(x)
-    #define GGML_F32Cx4_LOAD(x)      vcvt_f32_f16(vld1_f16(x))
-    #define GGML_F32Cx4_STORE(x, y)  vst1_f16(x, vcvt_f16_f32(y))
-    #define GGML_F32Cx4_FMA(a, b, c) vfmaq_f32(a, b, c)
-    #define GGML_F32Cx4_ADD          vaddq_f32
-    #define GGML_F32Cx4_MUL          vmulq_f32
-    #define GGML_F32Cx4_REDUCE       GGML_F32x4_REDUCE
-
-    #define GGML_F16_VEC                GGML_F32Cx4
-    #define GGML_F16_VEC_ZERO           GGML_F32Cx4_ZERO
-    #define GGML_F16_VEC_SET1           GGML_F32Cx4_SET1
-    #define GGML_F16_VEC_LOAD(p, i)     GGML_F32Cx4_LOAD(p)
-    #define GGML_F16_VEC_STORE(p, r, i) GGML_F32Cx4_STORE(p, r[i])
-    #define GGML_F16_VEC_FMA            GGML_F32Cx4_FMA
-    #define GGML_F16_VEC_ADD            GGML_F32Cx4_ADD
-    #define GGML_F16_VEC_MUL            GGML_F32Cx4_MUL
-    #define GGML_F16_VEC_REDUCE         GGML_F32Cx4_REDUCE
-#endif
+void quantize_row_q8_0(const float * x, void * y, int k) {
+    ggml_kernels_get()->quantize_row_q8_0(x, y, k);
+}
 
-#elif defined(__AVX__)
+void dequantize_row_q4_0(const void * x, float * y, int k) {
+    ggml_kernels_get()->dequantize_row_q4_0(x, y, k);
+}
 
-#define GGML_SIMD
+void dequantize_row_q4_1(const void * x, float * y, int k) {
+    ggml_kernels_get()->dequantize_row_q4_1(x, y, k);
+}
 
-// F32 AVX
+void dequantize_row_q4_0i(const void * x, float * y, int k) {
+    ggml_kernels_get()->dequantize_row_q4_0i(x, y, k);
+}
 
-#define GGML_F32_STEP 32
-#define GGML_F32_EPR  8
+void dequantize_row_q4_0h(const void * x, float * y, int k) {
+    ggml_kernels_get()->dequantize_row_q4_0h(x, y, k);
+}
 
-#define GGML_F32x8         __m256
-#define GGML_F32x8_ZERO    _mm256_setzero_ps()
-#define GGML_F32x8_SET1(x) _mm256_set1_ps(x)
-#define GGML_F32x8_LOAD    _mm256_loadu_ps
-#define GGML_F32x8_STORE   _mm256_storeu_ps
-#if defined(__FMA__)
-    #define GGML_F32x8_FMA(a, b, c) _mm256_fmadd_ps(b, c, a)
-#else
-    #define GGML_F32x8_FMA(a, b, c) _mm256_add_ps(_mm256_mul_ps(b, c), a)
-#endif
-#define GGML_F32x8_ADD     _mm256_add_ps
-#define GGML_F32x8_MUL     _mm256_mul_ps
-#define GGML_F32x8_REDUCE(res, x)                                 \
-{                                                                 \
-    for (int i = 0; i < GGML_F32_ARR/2; ++i) {                    \
-        x[2*i] = _mm256_add_ps(x[2*i], x[2*i+1]);                 \
-    }                                                             \
-    for (int i = 0; i < GGML_F32_ARR/4; ++i) {                    \
-        x[4*i] = _mm256_add_ps(x[4*i], x[4*i+2]);                 \
-    }                                                             \
-    for (int i = 0; i < GGML_F32_ARR/8; ++i) {                    \
-        x[8*i] = _mm256_add_ps(x[8*i], x[8*i+4]);                 \
-    }                                                             \
-    const __m128 t0 = _mm_add_ps(_mm256_castps256_ps128(x[0]),    \
-                                 _mm256_extractf128_ps(x[0], 1)); \
-    const __m128 t1 = _mm_hadd_ps(t0, t0);                        \
-    res = _mm_cvtss_f32(_mm_hadd_ps(t1, t1));                     \
-}
-// TODO: is this optimal ?
-
-#define GGML_F32_VEC        GGML_F32x8
-#define GGML_F32_VEC_ZERO   GGML_F32x8_ZERO
-#define GGML_F32_VEC_SET1   GGML_F32x8_SET1
-#define GGML_F32_VEC_LOAD   GGML_F32x8_LOAD
-#define GGML_F32_VEC_STORE  GGML_F32x8_STORE
-#define GGML_F32_VEC_FMA    GGML_F32x8_FMA
-#define GGML_F32_VEC_ADD    GGML_F32x8_ADD
-#define GGML_F32_VEC_MUL    GGML_F32x8_MUL
-#define GGML_F32_VEC_REDUCE GGML_F32x8_REDUCE
-
-// F16 AVX
-
-#define GGML_F16_STEP 32
-#define GGML_F16_EPR  8
-
-// F16 arithmetic is not supported by AVX, so we use F32 instead
-// we take advantage of the _mm256_cvt intrinsics to convert F16 <-> F32
-
-#define GGML_F32Cx8             __m256
-#define GGML_F32Cx8_ZERO        _mm256_setzero_ps()
-#define GGML_F32Cx8_SET1(x)     _mm256_set1_ps(x)
-#define GGML_F32Cx8_LOAD(x)     _mm256_cvtph_ps(_mm_loadu_si128((__m128i *)(x)))
-#define GGML_F32Cx8_STORE(x, y) _mm_storeu_si128((__m128i *)(x), _mm256_cvtps_ph(y, 0))
-#define GGML_F32Cx8_FMA         GGML_F32x8_FMA
-#define GGML_F32Cx8_ADD         _mm256_add_ps
-#define GGML_F32Cx8_MUL         _mm256_mul_ps
-#define GGML_F32Cx8_REDUCE      GGML_F32x8_REDUCE
-
-#define GGML_F16_VEC                GGML_F32Cx8
-#define GGML_F16_VEC_ZERO           GGML_F32Cx8_ZERO
-#define GGML_F16_VEC_SET1           GGML_F32Cx8_SET1
-#define GGML_F16_VEC_LOAD(p, i)     GGML_F32Cx8_LOAD(p)
-#define GGML_F16_VEC_STORE(p, r, i) GGML_F32Cx8_STORE(p, r[i])
-#define GGML_F16_VEC_FMA            GGML_F32Cx8_FMA
-#define GGML_F16_VEC_ADD            GGML_F32Cx8_ADD
-#define GGML_F16_VEC_MUL            GGML_F32Cx8_MUL
-#define GGML_F16_VEC_REDUCE         GGML_F32Cx8_REDUCE
-
-#elif defined(__POWER9_VECTOR__)
-
-#define GGML_SIMD
-
-// F32 POWER9
-
-#define GGML_F32_STEP 32
-#define GGML_F32_EPR  4
-
-#define GGML_F32x4              vector float
-#define GGML_F32x4_ZERO         0.0f
-#define GGML_F32x4_SET1         vec_splats
-#define GGML_F32x4_LOAD(p)      vec_xl(0, p)
-#define GGML_F32x4_STORE(p, r)  vec_xst(r, 0, p)
-#define GGML_F32x4_FMA(a, b, c) vec_madd(b, c, a)
-#define GGML_F32x4_ADD          vec_add
-#define GGML_F32x4_MUL          vec_mul
-#define GGML_F32x4_REDUCE(res, x)              \
-{                                              \
-    for (int i = 0; i < GGML_F32_ARR/2; ++i) { \
-        x[2*i] = vec_add(x[2*i], x[2*i+1]);    \
-    }                                          \
-    for (int i = 0; i < GGML_F32_ARR/4; ++i) { \
-        x[4*i] = vec_add(x[4*i], x[4*i+2]);    \
-    }                                          \
-    for (int i = 0; i < GGML_F32_ARR/8; ++i) { \
-        x[8*i] = vec_add(x[8*i], x[8*i+4]);    \
-    }                                          \
-    res = vec_extract(x[0], 0) +               \
-          vec_extract(x[0], 1) +               \
-          vec_extract(x[0], 2) +               \
-          vec_extract(x[0], 3);                \
-}
-
-#define GGML_F32_VEC        GGML_F32x4
-#define GGML_F32_VEC_ZERO   GGML_F32x4_ZERO
-#define GGML_F32_VEC_SET1   GGML_F32x4_SET1
-#define GGML_F32_VEC_LOAD   GGML_F32x4_LOAD
-#define GGML_F32_VEC_STORE  GGML_F32x4_STORE
-#define GGML_F32_VEC_FMA    GGML_F32x4_FMA
-#define GGML_F32_VEC_ADD    GGML_F32x4_ADD
-#define GGML_F32_VEC_MUL    GGML_F32x4_MUL
-#define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
-
-// F16 POWER9
-#define GGML_F16_STEP       GGML_F32_STEP
-#define GGML_F16_EPR        GGML_F32_EPR
-#define GGML_F16_VEC        GGML_F32x4
-#define GGML_F16_VEC_ZERO   GGML_F32x4_ZERO
-#define GGML_F16_VEC_SET1   GGML_F32x4_SET1
-#define GGML_F16_VEC_FMA    GGML_F32x4_FMA
-#define GGML_F16_VEC_REDUCE GGML_F32x4_REDUCE
-// Use vec_xl, not vec_ld, in case the load address is not aligned.
-#define GGML_F16_VEC_LOAD(p, i) (i & 0x1) ?                   \
-  vec_extract_fp32_from_shorth(vec_xl(0, p - GGML_F16_EPR)) : \
-  vec_extract_fp32_from_shortl(vec_xl(0, p))
-#define GGML_ENDIAN_BYTE(i) ((unsigned char *)&(uint16_t){1})[i]
-#define GGML_F16_VEC_STORE(p, r, i)                             \
-  if (i & 0x1)                                                  \
-    vec_xst(vec_pack_to_short_fp32(r[i - GGML_ENDIAN_BYTE(1)],  \
-                                   r[i - GGML_ENDIAN_BYTE(0)]), \
-            0, p - GGML_F16_EPR)
-
-#elif defined(__wasm_simd128__)
-
-#define GGML_SIMD
-
-// F32 WASM
-
-#define GGML_F32_STEP 16
-#define GGML_F32_EPR  4
-
-#define GGML_F32x4              v128_t
-#define GGML_F32x4_ZERO         wasm_f32x4_splat(0.0f)
-#define GGML_F32x4_SET1(x)      wasm_f32x4_splat(x)
-#define GGML_F32x4_LOAD         wasm_v128_load
-#define GGML_F32x4_STORE        wasm_v128_store
-#define GGML_F32x4_FMA(a, b, c) wasm_f32x4_add(wasm_f32x4_mul(b, c), a)
-#define GGML_F32x4_ADD          wasm_f32x4_add
-#define GGML_F32x4_MUL          wasm_f32x4_mul
-#define GGML_F32x4_REDUCE(res, x)                  \
-{                                                  \
-    for (int i = 0; i < GGML_F32_ARR/2; ++i) {     \
-        x[2*i] = wasm_f32x4_add(x[2*i], x[2*i+1]); \
-    }                                              \
-    for (int i = 0; i < GGML_F32_ARR/4; ++i) {     \
-        x[4*i] = wasm_f32x4_add(x[4*i], x[4*i+2]); \
-    }                                              \
-    for (int i = 0; i < GGML_F32_ARR/8; ++i) {     \
-        x[8*i] = wasm_f32x4_add(x[8*i], x[8*i+4]); \
-    }                                              \
-    res = wasm_f32x4_extract_lane(x[0], 0) +       \
-          wasm_f32x4_extract_lane(x[0], 1) +       \
-          wasm_f32x4_extract_lane(x[0], 2) +       \
-          wasm_f32x4_extract_lane(x[0], 3);        \
-}
-
-#define GGML_F32_VEC        GGML_F32x4
-#define GGML_F32_VEC_ZERO   GGML_F32x4_ZERO
-#define GGML_F32_VEC_SET1   GGML_F32x4_SET1
-#define GGML_F32_VEC_LOAD   GGML_F32x4_LOAD
-#define GGML_F32_VEC_STORE  GGML_F32x4_STORE
-#define GGML_F32_VEC_FMA    GGML_F32x4_FMA
-#define GGML_F32_VEC_ADD    GGML_F32x4_ADD
-#define GGML_F32_VEC_MUL    GGML_F32x4_MUL
-#define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
-
-// F16 WASM
-
-#define GGML_F16_STEP 16
-#define GGML_F16_EPR  4
-
-inline static v128_t __wasm_f16x4_load(const ggml_fp16_t * p) {
-    float tmp[4];
-
-    tmp[0] = GGML_FP16_TO_FP32(p[0]);
-    tmp[1] = GGML_FP16_TO_FP32(p[1]);
-    tmp[2] = GGML_FP16_TO_FP32(p[2]);
-    tmp[3] = GGML_FP16_TO_FP32(p[3]);
-
-    return wasm_v128_load(tmp);
-}
-
-inline static void __wasm_f16x4_store(ggml_fp16_t * p, v128_t x) {
-    float tmp[4];
-
-    wasm_v128_store(tmp, x);
-
-    p[0] = GGML_FP32_TO_FP16(tmp[0]);
-    p[1] = GGML_FP32_TO_FP16(tmp[1]);
-    p[2] = GGML_FP32_TO_FP16(tmp[2]);
-    p[3] = GGML_FP32_TO_FP16(tmp[3]);
-}
-
-#define GGML_F16x4             v128_t
-#define GGML_F16x4_ZERO        wasm_f32x4_splat(0.0f)
-#define GGML_F16x4_SET1(x)     wasm_f32x4_splat(x)
-#define GGML_F16x4_LOAD(x)     __wasm_f16x4_load(x)
-#define GGML_F16x4_STORE(x, y) __wasm_f16x4_store(x, y)
-#define GGML_F16x4_FMA         GGML_F32x4_FMA
-#define GGML_F16x4_ADD         wasm_f32x4_add
-#define GGML_F16x4_MUL         wasm_f32x4_mul
-#define GGML_F16x4_REDUCE(res, x)                  \
-{                                                  \
-    for (int i = 0; i < GGML_F16_ARR/2; ++i) {     \
-        x[2*i] = wasm_f32x4_add(x[2*i], x[2*i+1]); \
-    }                                              \
-    for (int i = 0; i < GGML_F16_ARR/4; ++i) {     \
-        x[4*i] = wasm_f32x4_add(x[4*i], x[4*i+2]); \
-    }                                              \
-    for (int i = 0; i < GGML_F16_ARR/8; ++i) {     \
-        x[8*i] = wasm_f32x4_add(x[8*i], x[8*i+4]); \
-    }                                              \
-    res = wasm_f32x4_extract_lane(x[0], 0) +       \
-          wasm_f32x4_extract_lane(x[0], 1) +       \
-          wasm_f32x4_extract_lane(x[0], 2) +       \
-          wasm_f32x4_extract_lane(x[0], 3);        \
-}
-
-#define GGML_F16_VEC                GGML_F16x4
-#define GGML_F16_VEC_ZERO           GGML_F16x4_ZERO
-#define GGML_F16_VEC_SET1           GGML_F16x4_SET1
-#define GGML_F16_VEC_LOAD(p, i)     GGML_F16x4_LOAD(p)
-#define GGML_F16_VEC_STORE(p, r, i) GGML_F16x4_STORE(p, r[i])
-#define GGML_F16_VEC_FMA            GGML_F16x4_FMA
-#define GGML_F16_VEC_ADD            GGML_F16x4_ADD
-#define GGML_F16_VEC_MUL            GGML_F16x4_MUL
-#define GGML_F16_VEC_REDUCE         GGML_F16x4_REDUCE
-
-#elif defined(__SSE3__)
-
-#define GGML_SIMD
-
-// F32 SSE
-
-#define GGML_F32_STEP 32
-#define GGML_F32_EPR  4
-
-#define GGML_F32x4         __m128
-#define GGML_F32x4_ZERO    _mm_setzero_ps()
-#define GGML_F32x4_SET1(x) _mm_set1_ps(x)
-#define GGML_F32x4_LOAD    _mm_loadu_ps
-#define GGML_F32x4_STORE   _mm_storeu_ps
-#if defined(__FMA__)
-    // TODO: Does this work?
-    #define GGML_F32x4_FMA(a, b, c) _mm_fmadd_ps(b, c, a)
-#else
-    #define GGML_F32x4_FMA(a, b, c) _mm_add_ps(_mm_mul_ps(b, c), a)
-#endif
-#define GGML_F32x4_ADD     _mm_add_ps
-#define GGML_F32x4_MUL     _mm_mul_ps
-#define GGML_F32x4_REDUCE(res, x)                                 \
-{                                                                 \
-    for (int i = 0; i < GGML_F32_ARR/2; ++i) {                    \
-        x[2*i] = _mm_add_ps(x[2*i], x[2*i+1]);                    \
-    }                                                             \
-    for (int i = 0; i < GGML_F32_ARR/4; ++i) {                    \
-        x[4*i] = _mm_add_ps(x[4*i], x[4*i+2]);                    \
-    }                                                             \
-    for (int i = 0; i < GGML_F32_ARR/8; ++i) {                    \
-        x[8*i] = _mm_add_ps(x[8*i], x[8*i+4]);                    \
-    }                                                             \
-    const __m128 t0 = _mm_hadd_ps(x[0], x[0]);                    \
-    res = _mm_cvtss_f32(_mm_hadd_ps(t0, t0));                     \
-}
-// TODO: is this optimal ?
-
-#define GGML_F32_VEC        GGML_F32x4
-#define GGML_F32_VEC_ZERO   GGML_F32x4_ZERO
-#define GGML_F32_VEC_SET1   GGML_F32x4_SET1
-#define GGML_F32_VEC_LOAD   GGML_F32x4_LOAD
-#define GGML_F32_VEC_STORE  GGML_F32x4_STORE
-#define GGML_F32_VEC_FMA    GGML_F32x4_FMA
-#define GGML_F32_VEC_ADD    GGML_F32x4_ADD
-#define GGML_F32_VEC_MUL    GGML_F32x4_MUL
-#define GGML_F32_VEC_REDUCE GGML_F32x4_REDUCE
-
-// F16 SSE
-
-#define GGML_F16_STEP 32
-#define GGML_F16_EPR  4
-
-static inline __m128 __sse_f16x4_load(ggml_fp16_t *x) {
-    float tmp[4];
-
-    tmp[0] = GGML_FP16_TO_FP32(x[0]);
-    tmp[1] = GGML_FP16_TO_FP32(x[1]);
-    tmp[2] = GGML_FP16_TO_FP32(x[2]);
-    tmp[3] = GGML_FP16_TO_FP32(x[3]);
-
-    return _mm_loadu_ps(tmp);
-}
-
-static inline void __sse_f16x4_store(ggml_fp16_t *x, __m128 y) {
-    float arr[4];
-
-    _mm_storeu_ps(arr, y);
-
-    x[0] = GGML_FP32_TO_FP16(arr[0]);
-    x[1] = GGML_FP32_TO_FP16(arr[1]);
-    x[2] = GGML_FP32_TO_FP16(arr[2]);
-    x[3] = GGML_FP32_TO_FP16(arr[3]);
-}
-
-#define GGML_F32Cx4             __m128
-#define GGML_F32Cx4_ZERO        _mm_setzero_ps()
-#define GGML_F32Cx4_SET1(x)     _mm_set1_ps(x)
-#define GGML_F32Cx4_LOAD(x)     __sse_f16x4_load(x)
-#define GGML_F32Cx4_STORE(x, y) __sse_f16x4_store(x, y)
-#define GGML_F32Cx4_FMA         GGML_F32x4_FMA
-#define GGML_F32Cx4_ADD         _mm_add_ps
-#define GGML_F32Cx4_MUL         _mm_mul_ps
-#define GGML_F32Cx4_REDUCE      GGML_F32x4_REDUCE
-
-#define GGML_F16_VEC                 GGML_F32Cx4
-#define GGML_F16_VEC_ZERO            GGML_F32Cx4_ZERO
-#define GGML_F16_VEC_SET1            GGML_F32Cx4_SET1
-#define GGML_F16_VEC_LOAD(p, i)      GGML_F32Cx4_LOAD(p)
-#define GGML_F16_VEC_STORE(p, r, i)  GGML_F32Cx4_STORE(p, r[i])
-#define GGML_F16_VEC_FMA             GGML_F32Cx4_FMA
-#define GGML_F16_VEC_ADD             GGML_F32Cx4_ADD
-#define GGML_F16_VEC_MUL             GGML_F32Cx4_MUL
-#define GGML_F16_VEC_REDUCE          GGML_F32Cx4_REDUCE
+void dequantize_row_q8_0(const void * x, float * y, int k) {
+    ggml_kernels_get()->dequantize_row_q8_0(x, y, k);
+}
 
-#endif
+void ggml_fp16_to_fp32_row(const ggml_fp16_t * x, float * y, size_t n) {
+    ggml_kernels_get()->fp16_to_fp32_row(n, y, x);
+}
 
-// GGML_F32_ARR / GGML_F16_ARR
-//   number of registers to use per step
-#ifdef GGML_SIMD
-#define GGML_F32_ARR (GGML_F32_STEP/GGML_F32_EPR)
-#define GGML_F16_ARR (GGML_F16_STEP/GGML_F16_EPR)
-#endif
+void ggml_fp32_to_fp16_row(const float * x, ggml_fp16_t * y, size_t n) {
+    ggml_kernels_get()->fp32_to_fp16_row(n, y, x);
+}
 
 //
 // fundamental operations
@@ -1100,638 +449,117 @@ inline static void ggml_vec_neg_f32 (const int n, float * y, const float * x)
 inline static void ggml_vec_mul_f32 (const int n, float * z, const float * x, const float * y) { for (int i = 0; i < n; ++i) z[i]  = x[i]*y[i];   }
 inline static void ggml_vec_div_f32 (const int n, float * z, const float * x, const float * y) { for (int i = 0; i < n; ++i) z[i]  = x[i]/y[i];   }
 
-inline static void ggml_vec_dot_f32(const int n, float * restrict s, const float * restrict x, const float * restrict y) {
-    ggml_float sumf = 0.0;
-
-#ifdef GGML_SIMD
-    const int np = (n & ~(GGML_F32_STEP - 1));
-
-    GGML_F32_VEC sum[GGML_F32_ARR] = { GGML_F32_VEC_ZERO };
-
-    GGML_F32_VEC ax[GGML_F32_ARR];
-    GGML_F32_VEC ay[GGML_F32_ARR];
-
-    for (int i = 0; i < np; i += GGML_F32_STEP) {
-        for (int j = 0; j < GGML_F32_ARR; j++) {
-            ax[j] = GGML_F32_VEC_LOAD(x + i + j*GGML_F32_EPR);
-            ay[j] = GGML_F32_VEC_LOAD(y + i + j*GGML_F32_EPR);
-
-            sum[j] = GGML_F32_VEC_FMA(sum[j], ax[j], ay[j]);
-        }
-    }
+// compute GGML_VEC_DOT_UNROLL dot products at once
+// xs - x row stride in bytes
+inline static void ggml_vec_dot_f16_unroll(const int n, const int xs, float * restrict s, void * restrict xv, ggml_fp16_t * restrict y) {
+    ggml_float sumf[GGML_VEC_DOT_UNROLL] = { 0.0 };
 
-    // reduce sum0..sum3 to sum0
-    GGML_F32_VEC_REDUCE(sumf, sum);
+    ggml_fp16_t * restrict x[GGML_VEC_DOT_UNROLL];
 
-    // leftovers
-    for (int i = np; i < n; ++i) {
-        sumf += x[i]*y[i];
-    }
-#else
-    // scalar
-    for (int i = 0; i < n; ++i) {
-        sumf += x[i]*y[i];
+    for (int i = 0; i < GGML_VEC_DOT_UNROLL; ++i) {
+        x[i] = (ggml_fp16_t *) ((char *) xv + i*xs);
     }
-#endif
-
-    *s = sumf;
-}
-
-inline static void ggml_vec_dot_f16(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y) {
-    ggml_float sumf = 0.0;
 
     #if defined(GGML_SIMD)
         const int np = (n & ~(GGML_F16_STEP - 1));
 
-        GGML_F16_VEC sum[GGML_F16_ARR] = { GGML_F16_VEC_ZERO };
+        GGML_F16_VEC sum[GGML_VEC_DOT_UNROLL][GGML_F16_ARR] = { { GGML_F16_VEC_ZERO } };
 
         GGML_F16_VEC ax[GGML_F16_ARR];
         GGML_F16_VEC ay[GGML_F16_ARR];
 
         for (int i = 0; i < np; i += GGML_F16_STEP) {
             for (int j = 0; j < GGML_F16_ARR; j++) {
-                ax[j] = GGML_F16_VEC_LOAD(x + i + j*GGML_F16_EPR, j);
                 ay[j] = GGML_F16_VEC_LOAD(y + i + j*GGML_F16_EPR, j);
 
-                sum[j] = GGML_F16_VEC_FMA(sum[j], ax[j], ay[j]);
+                for (int k = 0; k < GGML_VEC_DOT_UNROLL; ++k) {
+                    ax[j] = GGML_F16_VEC_LOAD(x[k] + i + j*GGML_F16_EPR, j);
+
+                    sum[k][j] = GGML_F16_VEC_FMA(sum[k][j], ax[j], ay[j]);
+                }
             }
         }
 
         // reduce sum0..sum3 to sum0
-        GGML_F16_VEC_REDUCE(sumf, sum);
+        for (int k = 0; k < GGML_VEC_DOT_UNROLL; ++k) {
+            GGML_F16_VEC_REDUCE(sumf[k], sum[k]);
+        }
 
         // leftovers
         for (int i = np; i < n; ++i) {
-            sumf += GGML_FP16_TO_FP32(x[i])*GGML_FP16_TO_FP32(y[i]);
+            for (int j = 0; j < GGML_VEC_DOT_UNROLL; ++j) {
+                sumf[j] += GGML_FP16_TO_FP32(x[j][i])*GGML_FP16_TO_FP32(y[i]);
+            }
         }
     #else
         for (int i = 0; i < n; ++i) {
-            sumf += GGML_FP16_TO_FP32(x[i])*GGML_FP16_TO_FP32(y[i]);
+            for (int j = 0; j < GGML_VEC_DOT_UNROLL; ++j) {
+                sumf[j] += GGML_FP16_TO_FP32(x[j][i])*GGML_FP16_TO_FP32(y[i]);
+            }
         }
     #endif
 
-    *s = sumf;
+    for (int i = 0; i < GGML_VEC_DOT_UNROLL; ++i) {
+        s[i] = sumf[i];
+    }
 }
 
-inline static void ggml_vec_dot_q4_0(const int n, float * restrict s, const void * restrict x, const void * restrict y) {
-    const int nb = n / QK;
-
-    assert(n % QK == 0);
-    assert(nb % 2 == 0);
-
-    const float * restrict pd0 = (const float *) x;
-    const float * restrict pd1 = (const float *) y;
+//inline static void ggml_vec_scale_f32(const int n, float * y, const float   v) { for (int i = 0; i < n; ++i) y[i] *= v;          }
+inline static void ggml_vec_scale_f32(const int n, float * y, const float   v) {
+    #if defined(GGML_SIMD)
+        const int np = (n & ~(GGML_F32_STEP - 1));
 
-    const uint8_t * restrict pb0 = (const uint8_t *) (pd0 + nb);
-    const uint8_t * restrict pb1 = (const uint8_t *) (pd1 + nb);
+        GGML_F32_VEC vx = GGML_F32_VEC_SET1(v);
 
-    float sumf = 0.0;
+        GGML_F32_VEC ay[GGML_F32_ARR];
 
-#ifdef __ARM_NEON
-#if QK == 32
-    float sum0 = 0.0f;
-    float sum1 = 0.0f;
+        for (int i = 0; i < np; i += GGML_F32_STEP) {
+            for (int j = 0; j < GGML_F32_ARR; j++) {
+                ay[j] = GGML_F32_VEC_LOAD(y + i + j*GGML_F32_EPR);
+                ay[j] = GGML_F32_VEC_MUL(ay[j], vx);
 
-    for (int i = 0; i < nb; i += 2) {
-        const float d0_0 = pd0[i + 0];
-        const float d1_0 = pd1[i + 0];
-        const float d0_1 = pd0[i + 1];
-        const float d1_1 = pd1[i + 1];
+                GGML_F32_VEC_STORE(y + i + j*GGML_F32_EPR, ay[j]);
+            }
+        }
 
-        //printf("d0_0: %f, d1_0: %f, d0_1: %f, d1_1: %f\n", d0_0, d1_0, d0_1, d1_1);
+        // leftovers
+        for (int i = np; i < n; ++i) {
+            y[i] *= v;
+        }
+    #else
+        // scalar
+        for (int i = 0; i < n; ++i) {
+            y[i] *= v;
+        }
+    #endif
+}
 
-        const uint8_t * restrict p0 = pb0 + i*16;
-        const uint8_t * restrict p1 = pb1 + i*16;
+inline static void ggml_vec_norm_f32 (const int n, float * s, const float * x) { ggml_vec_dot_f32(n, s, x, x); *s = sqrt(*s);   }
+inline static void ggml_vec_sqr_f32  (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = x[i]*x[i];   }
+inline static void ggml_vec_sqrt_f32 (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = sqrt(x[i]); }
+inline static void ggml_vec_abs_f32  (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = fabsf(x[i]); }
+inline static void ggml_vec_sgn_f32  (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = (x[i] > 0.f) ? 1.f : ((x[i] < 0.f) ? -1.f : 0.f); }
+inline static void ggml_vec_step_f32 (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = (x[i] > 0.f) ? 1.f : 0.f; }
+inline static void ggml_vec_relu_f32 (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = (x[i] > 0.f) ? x[i] : 0.f; }
 
-        const uint8x16_t m4b = vdupq_n_u8(0xf);
-        const int8x16_t  s8b = vdupq_n_s8(0x8);
+static const ggml_float GELU_COEF_A    = 0.044715;
+static const ggml_float SQRT_2_OVER_PI = 0.79788456080286535587989211986876;
 
-        const uint8x16_t v0_0 = vld1q_u8(p0);
-        const uint8x16_t v1_0 = vld1q_u8(p1);
-        const uint8x16_t v0_1 = vld1q_u8(p0 + 16);
-        const uint8x16_t v1_1 = vld1q_u8(p1 + 16);
+inline static float ggml_gelu_f32(float x) {
+    return 0.5*x*(1.0 + tanh(SQRT_2_OVER_PI*x*(1.0 + GELU_COEF_A*x*x)));
+}
 
-        // 4-bit -> 8-bit
-        const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8(v0_0, m4b));
-        const int8x16_t v1_0l = vreinterpretq_s8_u8(vandq_u8(v1_0, m4b));
+inline static float ggml_sigmoid_f32(float x) {
+    // Numerically stable sigmoid
+    if (x >= 0) {
+        const float z = exp(-x);
+        return 1 / (1 + z);
+    } else {
+        const float z = exp(x);
+        return z / (1 + z);
+    }
 
-        const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
-        const int8x16_t v1_0h = vreinterpretq_s8_u8(vshrq_n_u8(v1_0, 4));
-
-        const int8x16_t v0_1l = vreinterpretq_s8_u8(vandq_u8(v0_1, m4b));
-        const int8x16_t v1_1l = vreinterpretq_s8_u8(vandq_u8(v1_1, m4b));
-
-        const int8x16_t v0_1h = vreinterpretq_s8_u8(vshrq_n_u8(v0_1, 4));
-        const int8x16_t v1_1h = vreinterpretq_s8_u8(vshrq_n_u8(v1_1, 4));
-
-        // sub 8
-        const int8x16_t v0_0ls = vsubq_s8(v0_0l, s8b);
-        const int8x16_t v1_0ls = vsubq_s8(v1_0l, s8b);
-
-        const int8x16_t v0_0hs = vsubq_s8(v0_0h, s8b);
-        const int8x16_t v1_0hs = vsubq_s8(v1_0h, s8b);
-
-        const int8x16_t v0_1ls = vsubq_s8(v0_1l, s8b);
-        const int8x16_t v1_1ls = vsubq_s8(v1_1l, s8b);
-
-        const int8x16_t v0_1hs = vsubq_s8(v0_1h, s8b);
-        const int8x16_t v1_1hs = vsubq_s8(v1_1h, s8b);
-
-        // dot product into int16x8_t
-        const int16x8_t pl0l = vmull_s8(vget_low_s8 (v0_0ls), vget_low_s8 (v1_0ls));
-        const int16x8_t pl0h = vmull_s8(vget_high_s8(v0_0ls), vget_high_s8(v1_0ls));
-
-        const int16x8_t ph0l = vmull_s8(vget_low_s8 (v0_0hs), vget_low_s8 (v1_0hs));
-        const int16x8_t ph0h = vmull_s8(vget_high_s8(v0_0hs), vget_high_s8(v1_0hs));
-
-        const int16x8_t pl1l = vmull_s8(vget_low_s8 (v0_1ls), vget_low_s8 (v1_1ls));
-        const int16x8_t pl1h = vmull_s8(vget_high_s8(v0_1ls), vget_high_s8(v1_1ls));
-
-        const int16x8_t ph1l = vmull_s8(vget_low_s8 (v0_1hs), vget_low_s8 (v1_1hs));
-        const int16x8_t ph1h = vmull_s8(vget_high_s8(v0_1hs), vget_high_s8(v1_1hs));
-
-        const int16x8_t pl_0 = vaddq_s16(pl0l, pl0h);
-        const int16x8_t ph_0 = vaddq_s16(ph0l, ph0h);
-
-        const int16x8_t pl_1 = vaddq_s16(pl1l, pl1h);
-        const int16x8_t ph_1 = vaddq_s16(ph1l, ph1h);
-
-        const int16x8_t p_0 = vaddq_s16(pl_0, ph_0);
-        const int16x8_t p_1 = vaddq_s16(pl_1, ph_1);
-
-        // scalar
-#if defined(__ARM_FEATURE_QRDMX)
-        sum0 += d0_0*d1_0*vaddvq_s16(p_0);
-        sum1 += d0_1*d1_1*vaddvq_s16(p_1);
-#else
-        sum0 += d0_0*d1_0*(vgetq_lane_s16(p_0, 0) + vgetq_lane_s16(p_0, 1) + vgetq_lane_s16(p_0, 2) + vgetq_lane_s16(p_0, 3) + vgetq_lane_s16(p_0, 4) + vgetq_lane_s16(p_0, 5) + vgetq_lane_s16(p_0, 6) + vgetq_lane_s16(p_0, 7));
-        sum1 += d0_1*d1_1*(vgetq_lane_s16(p_1, 0) + vgetq_lane_s16(p_1, 1) + vgetq_lane_s16(p_1, 2) + vgetq_lane_s16(p_1, 3) + vgetq_lane_s16(p_1, 4) + vgetq_lane_s16(p_1, 5) + vgetq_lane_s16(p_1, 6) + vgetq_lane_s16(p_1, 7));
-#endif
-    }
-
-    sumf = sum0 + sum1;
-#else
-#error "not implemented for QK"
-#endif
-#elif defined(__wasm_simd128__)
-#if QK == 32
-    // wasm simd
-    float sum0 = 0.0f;
-    float sum1 = 0.0f;
-
-    for (int i = 0; i < nb; i += 2) {
-        const float d0_0 = pd0[i + 0];
-        const float d0_1 = pd0[i + 1];
-        const float d1_0 = pd1[i + 0];
-        const float d1_1 = pd1[i + 1];
-
-        const uint8_t * restrict p0 = pb0 + i*16;
-        const uint8_t * restrict p1 = pb1 + i*16;
-
-        const v128_t m4b = wasm_u8x16_splat(0xf);
-        const v128_t s8b = wasm_i8x16_splat(0x8);
-
-        const v128_t v0_0 = wasm_v128_load(p0);
-        const v128_t v0_1 = wasm_v128_load(p0 + 16);
-        const v128_t v1_0 = wasm_v128_load(p1);
-        const v128_t v1_1 = wasm_v128_load(p1 + 16);
-
-        // 4-bit -> 8-bit
-        const v128_t v0_0l = wasm_v128_and(v0_0, m4b);
-        const v128_t v1_0l = wasm_v128_and(v1_0, m4b);
-
-        const v128_t v0_0h = wasm_u8x16_shr(v0_0, 4);
-        const v128_t v1_0h = wasm_u8x16_shr(v1_0, 4);
-
-        const v128_t v0_1l = wasm_v128_and(v0_1, m4b);
-        const v128_t v1_1l = wasm_v128_and(v1_1, m4b);
-
-        const v128_t v0_1h = wasm_u8x16_shr(v0_1, 4);
-        const v128_t v1_1h = wasm_u8x16_shr(v1_1, 4);
-
-        // sub 8
-        const v128_t v0_0ls = wasm_i8x16_sub(v0_0l, s8b);
-        const v128_t v1_0ls = wasm_i8x16_sub(v1_0l, s8b);
-
-        const v128_t v0_0hs = wasm_i8x16_sub(v0_0h, s8b);
-        const v128_t v1_0hs = wasm_i8x16_sub(v1_0h, s8b);
-
-        const v128_t v0_1ls = wasm_i8x16_sub(v0_1l, s8b);
-        const v128_t v1_1ls = wasm_i8x16_sub(v1_1l, s8b);
-
-        const v128_t v0_1hs = wasm_i8x16_sub(v0_1h, s8b);
-        const v128_t v1_1hs = wasm_i8x16_sub(v1_1h, s8b);
-
-        // dot product into int16x8_t
-        const v128_t pl0l = wasm_i16x8_mul(wasm_i16x8_extend_low_i8x16(v0_0ls), wasm_i16x8_extend_low_i8x16(v1_0ls));
-        const v128_t pl0h = wasm_i16x8_mul(wasm_i16x8_extend_high_i8x16(v0_0ls), wasm_i16x8_extend_high_i8x16(v1_0ls));
-
-        const v128_t ph0l = wasm_i16x8_mul(wasm_i16x8_extend_low_i8x16(v0_0hs), wasm_i16x8_extend_low_i8x16(v1_0hs));
-        const v128_t ph0h = wasm_i16x8_mul(wasm_i16x8_extend_high_i8x16(v0_0hs), wasm_i16x8_extend_high_i8x16(v1_0hs));
-
-        const v128_t pl1l = wasm_i16x8_mul(wasm_i16x8_extend_low_i8x16(v0_1ls), wasm_i16x8_extend_low_i8x16(v1_1ls));
-        const v128_t pl1h = wasm_i16x8_mul(wasm_i16x8_extend_high_i8x16(v0_1ls), wasm_i16x8_extend_high_i8x16(v1_1ls));
-
-        const v128_t ph1l = wasm_i16x8_mul(wasm_i16x8_extend_low_i8x16(v0_1hs), wasm_i16x8_extend_low_i8x16(v1_1hs));
-        const v128_t ph1h = wasm_i16x8_mul(wasm_i16x8_extend_high_i8x16(v0_1hs), wasm_i16x8_extend_high_i8x16(v1_1hs));
-
-        const v128_t pl_0 = wasm_i16x8_add(pl0l, pl0h);
-        const v128_t ph_0 = wasm_i16x8_add(ph0l, ph0h);
-
-        const v128_t pl_1 = wasm_i16x8_add(pl1l, pl1h);
-        const v128_t ph_1 = wasm_i16x8_add(ph1l, ph1h);
-
-        const v128_t p_0 = wasm_i16x8_add(pl_0, ph_0);
-        const v128_t p_1 = wasm_i16x8_add(pl_1, ph_1);
-
-        sum0 += d0_0*d1_0*(
-                wasm_i16x8_extract_lane(p_0, 0) + wasm_i16x8_extract_lane(p_0, 1) +
-                wasm_i16x8_extract_lane(p_0, 2) + wasm_i16x8_extract_lane(p_0, 3) +
-                wasm_i16x8_extract_lane(p_0, 4) + wasm_i16x8_extract_lane(p_0, 5) +
-                wasm_i16x8_extract_lane(p_0, 6) + wasm_i16x8_extract_lane(p_0, 7));
-        sum1 += d0_1*d1_1*(
-                wasm_i16x8_extract_lane(p_1, 0) + wasm_i16x8_extract_lane(p_1, 1) +
-                wasm_i16x8_extract_lane(p_1, 2) + wasm_i16x8_extract_lane(p_1, 3) +
-                wasm_i16x8_extract_lane(p_1, 4) + wasm_i16x8_extract_lane(p_1, 5) +
-                wasm_i16x8_extract_lane(p_1, 6) + wasm_i16x8_extract_lane(p_1, 7));
-    }
-
-    sumf = sum0 + sum1;
-#else
-#error "not implemented for QK"
-#endif
-#else
-    // scalar
-    for (int i = 0; i < nb; i++) {
-        const float d0 = pd0[i];
-        const float d1 = pd1[i];
-
-        const uint8_t * restrict p0 = pb0 + i*QK/2;
-        const uint8_t * restrict p1 = pb1 + i*QK/2;
-
-        for (int j = 0; j < QK/2; j++) {
-            const uint8_t v0 = p0[j];
-            const uint8_t v1 = p1[j];
-
-            const float f0 = d0*((int8_t) (v0 & 0xf) - 8);
-            const float f1 = d0*((int8_t) (v0 >> 4)  - 8);
-
-            const float f2 = d1*((int8_t) (v1 & 0xf) - 8);
-            const float f3 = d1*((int8_t) (v1 >> 4)  - 8);
-
-            sumf += f0*f2 + f1*f3;
-        }
-    }
-#endif
-
-    *s = sumf;
-}
-
-inline static void ggml_vec_dot_q4_1(const int n, float * restrict s, const void * restrict x, const void * restrict y) {
-    const int nb = n / QK;
-
-    const float * restrict pm0 = (const float *) x;
-    const float * restrict pm1 = (const float *) y;
-
-    const float * restrict pd0 = (const float *) (pm0 + nb);
-    const float * restrict pd1 = (const float *) (pm1 + nb);
-
-    const uint8_t * restrict pb0 = (const uint8_t *) (pd0 + nb);
-    const uint8_t * restrict pb1 = (const uint8_t *) (pd1 + nb);
-
-    float sumf = 0.0;
-
-#if 1
-    // scalar
-    for (int i = 0; i < nb; i++) {
-        const float m0 = pm0[i];
-        const float m1 = pm1[i];
-
-        const float d0 = pd0[i];
-        const float d1 = pd1[i];
-
-        const uint8_t * restrict p0 = pb0 + i*QK/2;
-        const uint8_t * restrict p1 = pb1 + i*QK/2;
-
-        for (int j = 0; j < QK/2; j++) {
-            const uint8_t v0 = p0[j];
-            const uint8_t v1 = p1[j];
-
-            const float f0 = d0*(v0 & 0xf) + m0;
-            const float f1 = d0*(v0 >> 4)  + m0;
-
-            const float f2 = d1*(v1 & 0xf) + m1;
-            const float f3 = d1*(v1 >> 4)  + m1;
-
-            sumf += f0*f2 + f1*f3;
-        }
-    }
-#endif
-
-    *s = sumf;
-}
-
-// compute GGML_VEC_DOT_UNROLL dot products at once
-// xs - x row stride in bytes
-inline static void ggml_vec_dot_f16_unroll(const int n, const int xs, float * restrict s, void * restrict xv, ggml_fp16_t * restrict y) {
-    ggml_float sumf[GGML_VEC_DOT_UNROLL] = { 0.0 };
-
-    ggml_fp16_t * restrict x[GGML_VEC_DOT_UNROLL];
-
-    for (int i = 0; i < GGML_VEC_DOT_UNROLL; ++i) {
-        x[i] = (ggml_fp16_t *) ((char *) xv + i*xs);
-    }
-
-    #if defined(GGML_SIMD)
-        const int np = (n & ~(GGML_F16_STEP - 1));
-
-        GGML_F16_VEC sum[GGML_VEC_DOT_UNROLL][GGML_F16_ARR] = { { GGML_F16_VEC_ZERO } };
-
-        GGML_F16_VEC ax[GGML_F16_ARR];
-        GGML_F16_VEC ay[GGML_F16_ARR];
-
-        for (int i = 0; i < np; i += GGML_F16_STEP) {
-            for (int j = 0; j < GGML_F16_ARR; j++) {
-                ay[j] = GGML_F16_VEC_LOAD(y + i + j*GGML_F16_EPR, j);
-
-                for (int k = 0; k < GGML_VEC_DOT_UNROLL; ++k) {
-                    ax[j] = GGML_F16_VEC_LOAD(x[k] + i + j*GGML_F16_EPR, j);
-
-                    sum[k][j] = GGML_F16_VEC_FMA(sum[k][j], ax[j], ay[j]);
-                }
-            }
-        }
-
-        // reduce sum0..sum3 to sum0
-        for (int k = 0; k < GGML_VEC_DOT_UNROLL; ++k) {
-            GGML_F16_VEC_REDUCE(sumf[k], sum[k]);
-        }
-
-        // leftovers
-        for (int i = np; i < n; ++i) {
-            for (int j = 0; j < GGML_VEC_DOT_UNROLL; ++j) {
-                sumf[j] += GGML_FP16_TO_FP32(x[j][i])*GGML_FP16_TO_FP32(y[i]);
-            }
-        }
-    #else
-        for (int i = 0; i < n; ++i) {
-            for (int j = 0; j < GGML_VEC_DOT_UNROLL; ++j) {
-                sumf[j] += GGML_FP16_TO_FP32(x[j][i])*GGML_FP16_TO_FP32(y[i]);
-            }
-        }
-    #endif
-
-    for (int i = 0; i < GGML_VEC_DOT_UNROLL; ++i) {
-        s[i] = sumf[i];
-    }
-}
-
-inline static void ggml_vec_mad_f32(const int n, float * restrict y, const float * restrict x, const float v) {
-    #if defined(GGML_SIMD)
-        const int np = (n & ~(GGML_F32_STEP - 1));
-
-        GGML_F32_VEC vx = GGML_F32_VEC_SET1(v);
-
-        GGML_F32_VEC ax[GGML_F32_ARR];
-        GGML_F32_VEC ay[GGML_F32_ARR];
-
-        for (int i = 0; i < np; i += GGML_F32_STEP) {
-            for (int j = 0; j < GGML_F32_ARR; j++) {
-                ax[j] = GGML_F32_VEC_LOAD(x + i + j*GGML_F32_EPR);
-                ay[j] = GGML_F32_VEC_LOAD(y + i + j*GGML_F32_EPR);
-                ay[j] = GGML_F32_VEC_FMA(ay[j], ax[j], vx);
-
-                GGML_F32_VEC_STORE(y + i + j*GGML_F32_EPR, ay[j]);
-            }
-        }
-
-        // leftovers
-        for (int i = np; i < n; ++i) {
-            y[i] += x[i]*v;
-        }
-    #else
-        // scalar
-        for (int i = 0; i < n; ++i) {
-            y[i] += x[i]*v;
-        }
-    #endif
-}
-
-inline static void ggml_vec_mad_f16(const int n, ggml_fp16_t * restrict y, ggml_fp16_t * restrict x, const float v) {
-    #if defined(GGML_SIMD)
-        const int np = (n & ~(GGML_F16_STEP - 1));
-
-        GGML_F16_VEC vx = GGML_F16_VEC_SET1(v);
-
-        GGML_F16_VEC ax[GGML_F16_ARR];
-        GGML_F16_VEC ay[GGML_F16_ARR];
-
-        for (int i = 0; i < np; i += GGML_F16_STEP) {
-            for (int j = 0; j < GGML_F16_ARR; j++) {
-                ax[j] = GGML_F16_VEC_LOAD(x + i + j*GGML_F16_EPR, j);
-                ay[j] = GGML_F16_VEC_LOAD(y + i + j*GGML_F16_EPR, j);
-                ay[j] = GGML_F16_VEC_FMA(ay[j], ax[j], vx);
-
-                GGML_F16_VEC_STORE(y + i + j*GGML_F16_EPR, ay, j);
-            }
-        }
-
-        // leftovers
-        for (int i = np; i < n; ++i) {
-            GGML_ASSERT(false);
-            y[i] = GGML_FP32_TO_FP16(GGML_FP16_TO_FP32(y[i]) + GGML_FP16_TO_FP32(x[i])*v);
-        }
-    #else
-        for (int i = 0; i < n; ++i) {
-            y[i] = GGML_FP32_TO_FP16(GGML_FP16_TO_FP32(y[i]) + GGML_FP16_TO_FP32(x[i])*v);
-        }
-    #endif
-}
-
-inline static void ggml_vec_mad_q4_0(const int n, float * restrict y, void * restrict x, const float v) {
-    assert(n % QK == 0);
-
-    const int nb = n / QK;
-
-    const float   * restrict pd = (const float *)   (x);
-    const uint8_t * restrict pb = (const uint8_t *) (pd + nb);
-
-#if __ARM_NEON
-#if QK == 32
-    for (int i = 0; i < nb; ++i) {
-        const float d0 = pd[i]*v;
-
-        const uint8_t * restrict pp = pb + i*16;
-
-        const uint8x8_t m4b = vdup_n_u8(0xf);
-        const int8x8_t  s8b = vdup_n_s8(0x8);
-
-        const float32x4_t vd = vdupq_n_f32(d0);
-
-        for (int j = 0; j < 2; j++) {
-            const uint8x8_t vx = vld1_u8(pp + j*8);
-
-            const int8x8_t vxl = vreinterpret_s8_u8(vand_u8(vx, m4b));
-            const int8x8_t vxh = vreinterpret_s8_u8(vshr_n_u8(vx, 4));
-
-            // sub 8
-            const int8x8_t vxls = vsub_s8(vxl, s8b);
-            const int8x8_t vxhs = vsub_s8(vxh, s8b);
-
-            //const int8x8_t vxlt = vzip_s8(vxls, vxhs)[0];
-            //const int8x8_t vxht = vzip_s8(vxls, vxhs)[1];
-            const int8x8_t vxlt = vzip1_s8(vxls, vxhs);
-            const int8x8_t vxht = vzip2_s8(vxls, vxhs);
-
-            const int8x16_t vxq = vcombine_s8(vxlt, vxht);
-
-            // convert to 2x int16x8_t
-            const int16x8_t vxq0 = vmovl_s8(vget_low_s8 (vxq));
-            const int16x8_t vxq1 = vmovl_s8(vget_high_s8(vxq));
-
-            // convert to 4x float32x4_t
-            const float32x4_t vx0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16 (vxq0)));
-            const float32x4_t vx1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(vxq0)));
-            const float32x4_t vx2 = vcvtq_f32_s32(vmovl_s16(vget_low_s16 (vxq1)));
-            const float32x4_t vx3 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(vxq1)));
-
-            const float32x4_t vy0 = vld1q_f32(y + i*32 + j*16 + 0);
-            const float32x4_t vy1 = vld1q_f32(y + i*32 + j*16 + 4);
-            const float32x4_t vy2 = vld1q_f32(y + i*32 + j*16 + 8);
-            const float32x4_t vy3 = vld1q_f32(y + i*32 + j*16 + 12);
-
-            const float32x4_t vr0 = vfmaq_f32(vy0, vx0, vd);
-            const float32x4_t vr1 = vfmaq_f32(vy1, vx1, vd);
-            const float32x4_t vr2 = vfmaq_f32(vy2, vx2, vd);
-            const float32x4_t vr3 = vfmaq_f32(vy3, vx3, vd);
-
-            vst1q_f32(y + i*32 + j*16 + 0,  vr0);
-            vst1q_f32(y + i*32 + j*16 + 4,  vr1);
-            vst1q_f32(y + i*32 + j*16 + 8,  vr2);
-            vst1q_f32(y + i*32 + j*16 + 12, vr3);
-        }
-    }
-#endif
-#else
-    // scalar
-    for (int i = 0; i < nb; i++) {
-        const float d = pd[i];
-
-        const uint8_t * restrict pp = pb + i*QK/2;
-
-        for (int l = 0; l < QK; l += 2) {
-            const uint8_t vi = pp[l/2];
-
-            const int8_t vi0 = vi & 0xf;
-            const int8_t vi1 = vi >> 4;
-
-            const float v0 = (vi0 - 8)*d;
-            const float v1 = (vi1 - 8)*d;
-
-            y[i*QK + l + 0] += v0*v;
-            y[i*QK + l + 1] += v1*v;
-
-            assert(!isnan(y[i*QK + l + 0]));
-            assert(!isnan(y[i*QK + l + 1]));
-            assert(!isinf(y[i*QK + l + 0]));
-            assert(!isinf(y[i*QK + l + 1]));
-        }
-    }
-#endif
-}
-
-inline static void ggml_vec_mad_q4_1(const int n, float * restrict y, void * restrict x, const float v) {
-    assert(n % QK == 0);
-
-    const int nb = n / QK;
-
-    const float   * restrict pm = (const float *)   (x);
-    const float   * restrict pd = (const float *)   (pm + nb);
-    const uint8_t * restrict pb = (const uint8_t *) (pd + nb);
-
-    for (int i = 0; i < nb; i++) {
-        const float m = pm[i];
-        const float d = pd[i];
-
-        const uint8_t * restrict pp = pb + i*QK/2;
-
-        for (int l = 0; l < QK; l += 2) {
-            const uint8_t vi = pp[l/2];
-
-            const uint8_t vi0 = vi & 0xf;
-            const uint8_t vi1 = vi >> 4;
-
-            const float v0 = d*vi0 + m;
-            const float v1 = d*vi1 + m;
-
-            y[i*QK + l + 0] += v0*v;
-            y[i*QK + l + 1] += v1*v;
-
-            assert(!isnan(y[i*QK + l + 0]));
-            assert(!isnan(y[i*QK + l + 1]));
-            assert(!isinf(y[i*QK + l + 0]));
-            assert(!isinf(y[i*QK + l + 1]));
-            //printf("mad: v0 %f v1 %f, i = %d, l = %d, d = %f, vi = %d, vi0 = %d, vi1 = %d\n", v0, v1, i, l, d, vi, vi0, vi1);
-        }
-    }
-}
-
-//inline static void ggml_vec_scale_f32(const int n, float * y, const float   v) { for (int i = 0; i < n; ++i) y[i] *= v;          }
-inline static void ggml_vec_scale_f32(const int n, float * y, const float   v) {
-    #if defined(GGML_SIMD)
-        const int np = (n & ~(GGML_F32_STEP - 1));
-
-        GGML_F32_VEC vx = GGML_F32_VEC_SET1(v);
-
-        GGML_F32_VEC ay[GGML_F32_ARR];
-
-        for (int i = 0; i < np; i += GGML_F32_STEP) {
-            for (int j = 0; j < GGML_F32_ARR; j++) {
-                ay[j] = GGML_F32_VEC_LOAD(y + i + j*GGML_F32_EPR);
-                ay[j] = GGML_F32_VEC_MUL(ay[j], vx);
-
-                GGML_F32_VEC_STORE(y + i + j*GGML_F32_EPR, ay[j]);
-            }
-        }
-
-        // leftovers
-        for (int i = np; i < n; ++i) {
-            y[i] *= v;
-        }
-    #else
-        // scalar
-        for (int i = 0; i < n; ++i) {
-            y[i] *= v;
-        }
-    #endif
-}
-
-inline static void ggml_vec_norm_f32 (const int n, float * s, const float * x) { ggml_vec_dot_f32(n, s, x, x); *s = sqrt(*s);   }
-inline static void ggml_vec_sqr_f32  (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = x[i]*x[i];   }
-inline static void ggml_vec_sqrt_f32 (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = sqrt(x[i]); }
-inline static void ggml_vec_abs_f32  (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = fabsf(x[i]); }
-inline static void ggml_vec_sgn_f32  (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = (x[i] > 0.f) ? 1.f : ((x[i] < 0.f) ? -1.f : 0.f); }
-inline static void ggml_vec_step_f32 (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = (x[i] > 0.f) ? 1.f : 0.f; }
-inline static void ggml_vec_relu_f32 (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = (x[i] > 0.f) ? x[i] : 0.f; }
-
-static const ggml_float GELU_COEF_A    = 0.044715;
-static const ggml_float SQRT_2_OVER_PI = 0.79788456080286535587989211986876;
-
-inline static float ggml_gelu_f32(float x) {
-    return 0.5*x*(1.0 + tanh(SQRT_2_OVER_PI*x*(1.0 + GELU_COEF_A*x*x)));
-}
-
-inline static float ggml_sigmoid_f32(float x) {
-    // Numerically stable sigmoid
-    if (x >= 0) {
-        const float z = exp(-x);
-        return 1 / (1 + z);
-    } else {
-        const float z = exp(x);
-        return z / (1 + z);
-    }
-
-}
+}
 
 inline static float ggml_silu_f32(float x) {
     return x * ggml_sigmoid_f32(x);
@@ -1840,6 +668,9 @@ inline static void ggml_vec_norm_inv_f32(const int n, float * s, const float * x
 //
 
 static const int GGML_BLCK_SIZE[GGML_TYPE_COUNT] = {
+    QK,
+    QK,
+    QK,
     QK,
     QK,
     1,
@@ -1849,11 +680,14 @@ static const int GGML_BLCK_SIZE[GGML_TYPE_COUNT] = {
     1,
 };
 
-static_assert(GGML_TYPE_COUNT == 7, "GGML_TYPE_COUNT != 5");
+static_assert(GGML_TYPE_COUNT == 10, "GGML_TYPE_COUNT != 10");
 
 static const size_t GGML_TYPE_SIZE[GGML_TYPE_COUNT] = {
     sizeof(float  )   + QK/2,
     sizeof(float  )*2 + QK/2,
+    sizeof(block_q4_0i),
+    sizeof(block_q4_0h),
+    sizeof(float  )   + QK,
     sizeof(int8_t ),
     sizeof(int16_t),
     sizeof(int32_t),
@@ -1862,7 +696,7 @@ static const size_t GGML_TYPE_SIZE[GGML_TYPE_COUNT] = {
 };
 
 // don't forget to update the array above when adding new types
-static_assert(GGML_TYPE_COUNT == 7, "GGML_TYPE_COUNT != 5");
+static_assert(GGML_TYPE_COUNT == 10, "GGML_TYPE_COUNT != 10");
 
 static const char * GGML_OP_LABEL[GGML_OP_COUNT] = {
     "NONE",
@@ -1978,6 +812,7 @@ struct ggml_context {
     size_t mem_size;
     void * mem_buffer;
     bool   mem_buffer_owned;
+    bool   no_alloc;
 
     int n_objects;
 
@@ -1986,6 +821,8 @@ struct ggml_context {
 
     struct ggml_scratch scratch;
     struct ggml_scratch scratch_save;
+
+    bool no_alloc_save;
 };
 
 struct ggml_context_container {
@@ -2012,8 +849,248 @@ struct ggml_compute_params {
     // work buffer for all threads
     size_t wsize;
     void * wdata;
+
+    // chunks of rows taken so far by the threads of the node, NULL for a static split (see ggml_compute_rows)
+    atomic_int * chunk;
+};
+
+// chunks of GGML_SCHED_ROWS_CHUNKED per thread: more chunks balance better, each one costs an atomic increment
+#define GGML_SCHED_ROWS_CHUNKS_PER_THREAD 4
+
+// the rows of a row-parallel op, one range at a time:
+//
+//   struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+//
+//   while (ggml_compute_rows_next(&rows)) {
+//       for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+//           ...
+//       }
+//   }
+//
+// without a chunk counter, a thread gets a single range: the ith of nth equal ranges
+// with a chunk counter, the threads take chunks from it until there are none left, so a thread that falls behind
+// leaves its chunks to the others. The chunks do not depend on the thread, so neither do the results
+struct ggml_compute_rows {
+    atomic_int * chunk;
+
+    int nr; // rows
+    int dr; // rows per range
+    int n;  // ranges
+    int k;  // the range of a thread without a chunk counter
+
+    // current range
+    int ir0;
+    int ir1;
+};
+
+// the chunks are a multiple of align rows (except the last one)
+static struct ggml_compute_rows ggml_compute_rows_init(const struct ggml_compute_params * params, int nr, int align) {
+    struct ggml_compute_rows rows = {
+        /*.chunk =*/ params->chunk,
+        /*.nr    =*/ nr,
+        /*.dr    =*/ 1,
+        /*.n     =*/ 0,
+        /*.k     =*/ params->ith,
+        /*.ir0   =*/ 0,
+        /*.ir1   =*/ 0,
+    };
+
+    if (rows.chunk) {
+        const int n_chunks = params->nth*GGML_SCHED_ROWS_CHUNKS_PER_THREAD;
+
+        rows.dr = (nr + n_chunks - 1)/n_chunks;
+        rows.dr = (rows.dr + align - 1)/align*align;
+    } else {
+        rows.dr = (nr + params->nth - 1)/params->nth;
+    }
+
+    rows.dr = MAX(1, rows.dr);
+    rows.n  = (nr + rows.dr - 1)/rows.dr;
+
+    return rows;
+}
+
+static bool ggml_compute_rows_next(struct ggml_compute_rows * rows) {
+    const int k = rows->chunk ? atomic_fetch_add(rows->chunk, 1) : rows->k;
+
+    rows->k = rows->n;
+
+    if (k >= rows->n) {
+        return false;
+    }
+
+    rows->ir0 = k*rows->dr;
+    rows->ir1 = MIN(rows->ir0 + rows->dr, rows->nr);
+
+    return true;
+}
+
+//
+// NUMA
+//
+
+#define GGML_NUMA_MAX_NODES 8
+#define GGML_NUMA_MAX_CPUS  512
+
+struct ggml_numa_node {
+    int cpus[GGML_NUMA_MAX_CPUS];
+    int n_cpus;
 };
 
+struct ggml_numa_nodes {
+    struct ggml_numa_node nodes[GGML_NUMA_MAX_NODES];
+    int n_nodes;
+    int n_cpus;
+};
+
+// the nodes with cpus, empty until ggml_numa_init
+static struct ggml_numa_nodes g_numa = { 0 };
+
+#if defined(__linux__)
+static bool ggml_path_exists(const char * path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+#endif
+
+void ggml_numa_init(void) {
+    if (g_numa.n_nodes > 0) {
+        return;
+    }
+
+#if defined(__linux__)
+    char path[256];
+
+    // the ids of the cpus and of the nodes can have gaps
+    int n_cpus = 0;
+    for (int c = 0; c < GGML_NUMA_MAX_CPUS; c++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", c);
+        if (ggml_path_exists(path)) {
+            n_cpus = c + 1;
+        }
+    }
+
+    for (int n = 0; n < GGML_NUMA_MAX_NODES; n++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n);
+        if (!ggml_path_exists(path)) {
+            continue;
+        }
+
+        struct ggml_numa_node * node = &g_numa.nodes[g_numa.n_nodes];
+
+        node->n_cpus = 0;
+        for (int c = 0; c < n_cpus; c++) {
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpu%d", n, c);
+            if (ggml_path_exists(path)) {
+                node->cpus[node->n_cpus++] = c;
+            }
+        }
+
+        // memory-only nodes get no threads
+        if (node->n_cpus > 0) {
+            g_numa.n_cpus += node->n_cpus;
+            g_numa.n_nodes++;
+        }
+    }
+
+    GGML_PRINT_DEBUG("%s: found %d nodes, %d cpus\n", __func__, g_numa.n_nodes, g_numa.n_cpus);
+#endif
+}
+
+bool ggml_is_numa(void) {
+    return g_numa.n_nodes > 1;
+}
+
+// spread the pages of a new buffer round-robin over the nodes, before anything touches them
+static void ggml_numa_interleave(void * data, size_t size) {
+#if defined(__linux__) && defined(SYS_mbind)
+    if (!ggml_is_numa()) {
+        return;
+    }
+
+    const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+
+    const uintptr_t p0 = ((uintptr_t) data + page - 1)/page*page;
+    const uintptr_t p1 = ((uintptr_t) data + size)/page*page;
+
+    if (p1 <= p0) {
+        return;
+    }
+
+    // all the nodes, including the memory-only ones
+    unsigned long mask = 0;
+    for (int n = 0; n < GGML_NUMA_MAX_NODES; n++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n);
+        if (ggml_path_exists(path)) {
+            mask |= 1UL << n;
+        }
+    }
+
+    const int mpol_interleave = 3; // MPOL_INTERLEAVE, <numaif.h> comes with libnuma
+
+    if (syscall(SYS_mbind, (void *) p0, p1 - p0, mpol_interleave, &mask, GGML_NUMA_MAX_NODES + 1, 0) != 0) {
+        GGML_PRINT_DEBUG("%s: mbind failed\n", __func__);
+    }
+#else
+    UNUSED(data);
+    UNUSED(size);
+#endif
+}
+
+// the cpus of ggml_set_thread_affinity
+static int g_affinity_cpus[GGML_NUMA_MAX_CPUS];
+static int g_affinity_n_cpus = 0;
+
+void ggml_set_thread_affinity(const int * cpus, int n_cpus) {
+    g_affinity_n_cpus = MIN(MAX(0, n_cpus), GGML_NUMA_MAX_CPUS);
+
+    for (int i = 0; i < g_affinity_n_cpus; i++) {
+        g_affinity_cpus[i] = cpus[i];
+    }
+}
+
+int ggml_get_thread_affinity(int * cpus, int n_max) {
+    for (int i = 0; i < MIN(n_max, g_affinity_n_cpus); i++) {
+        cpus[i] = g_affinity_cpus[i];
+    }
+
+    return g_affinity_n_cpus;
+}
+
+#if defined(__linux__)
+static void ggml_thread_set_cpus(const int * cpus, int n_cpus) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int c = 0; c < n_cpus; c++) {
+        CPU_SET(cpus[c], &cpuset);
+    }
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+        GGML_PRINT_DEBUG("%s: pthread_setaffinity_np failed\n", __func__);
+    }
+}
+#endif
+
+// keep thread ith of nth on its cpus:
+//   - with ggml_set_thread_affinity: the single cpu cpus[ith % n_cpus]
+//   - in NUMA mode: the cpus of node ith*n_nodes/nth, so the threads are spread evenly over the nodes and the
+//     scheduler of the OS does not move them across sockets
+static void ggml_thread_bind(int ith, int nth) {
+#if defined(__linux__)
+    if (g_affinity_n_cpus > 0) {
+        ggml_thread_set_cpus(&g_affinity_cpus[ith % g_affinity_n_cpus], 1);
+    } else if (ggml_is_numa()) {
+        const struct ggml_numa_node * node = &g_numa.nodes[ith*g_numa.n_nodes/nth];
+
+        ggml_thread_set_cpus(node->cpus, node->n_cpus);
+    }
+#else
+    UNUSED(ith);
+    UNUSED(nth);
+#endif
+}
+
 //
 // ggml state
 //
@@ -2192,6 +1269,13 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
     static bool is_first_call = true;
 
     if (is_first_call) {
+        // pick the kernels for the current CPU
+        {
+            const struct ggml_kernels * kernels = ggml_kernels_get(); UNUSED(kernels);
+
+            GGML_PRINT_DEBUG("%s: using %s kernels\n", __func__, kernels->name);
+        }
+
         // initialize GELU, SILU, EXP and F32 tables
         {
             const uint64_t t_start = ggml_time_us(); UNUSED(t_start);
@@ -2200,7 +1284,7 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
             for (int i = 0; i < (1 << 16); ++i) {
                 uint16_t ui = i;
                 memcpy(&ii, &ui, sizeof(ii));
-                const float f = table_f32_f16[i] = GGML_COMPUTE_FP16_TO_FP32(ii);
+                const float f = ggml_table_f32_f16[i] = GGML_COMPUTE_FP16_TO_FP32(ii);
                 table_gelu_f16[i] = GGML_FP32_TO_FP16(ggml_gelu_f32(f));
                 table_silu_f16[i] = GGML_FP32_TO_FP16(ggml_silu_f32(f));
                 table_exp_f16[i]  = GGML_FP32_TO_FP16(exp(f));
@@ -2256,15 +1340,21 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
         /*.mem_size         =*/ params.mem_size,
         /*.mem_buffer       =*/ params.mem_buffer ? params.mem_buffer : malloc(params.mem_size),
         /*.mem_buffer_owned =*/ params.mem_buffer ? false : true,
+        /*.no_alloc         =*/ params.no_alloc,
         /*.n_objects        =*/ 0,
         /*.objects_begin    =*/ NULL,
         /*.objects_end      =*/ NULL,
         /*.scratch          =*/ { 0, 0, NULL, },
         /*.scratch_save     =*/ { 0, 0, NULL, },
+        /*.no_alloc_save    =*/ false,
     };
 
     ggml_assert_aligned(ctx->mem_buffer);
 
+    if (ctx->mem_buffer_owned) {
+        ggml_numa_interleave(ctx->mem_buffer, ctx->mem_size);
+    }
+
     GGML_PRINT_DEBUG("%s: context initialized\n", __func__);
 
     ggml_critical_section_end();
@@ -2305,6 +1395,10 @@ size_t ggml_used_mem(const struct ggml_context * ctx) {
     return ctx->objects_end->offs + ctx->objects_end->size;
 }
 
+size_t ggml_tensor_overhead(void) {
+    return GGML_OBJECT_SIZE + sizeof(struct ggml_tensor);
+}
+
 size_t ggml_set_scratch(struct ggml_context * ctx, struct ggml_scratch scratch) {
     const size_t result = ctx->scratch.data ? ctx->scratch.offs : 0;
 
@@ -2330,7 +1424,7 @@ struct ggml_tensor * ggml_new_tensor_impl(
 
     size_t size_needed = 0;
 
-    if (data == NULL) {
+    if (data == NULL && !ctx->no_alloc) {
         size_needed += GGML_TYPE_SIZE[type]*(ne[0]/GGML_BLCK_SIZE[type]);
         for (int i = 1; i < n_dims; i++) {
             size_needed *= ne[i];
@@ -2342,7 +1436,7 @@ struct ggml_tensor * ggml_new_tensor_impl(
     char * const mem_buffer = ctx->mem_buffer;
     struct ggml_object * const obj_new = (struct ggml_object *)(mem_buffer + cur_end);
 
-    if (ctx->scratch.data == NULL || data != NULL) {
+    if (ctx->scratch.data == NULL || data != NULL || ctx->no_alloc) {
         size_needed += sizeof(struct ggml_tensor);
 
         if (cur_end + size_needed + GGML_OBJECT_SIZE > ctx->mem_size) {
@@ -2414,7 +1508,9 @@ struct ggml_tensor * ggml_new_tensor_impl(
         /*.perf_runs    =*/ 0,
         /*.perf_cycles  =*/ 0,
         /*.perf_time_us =*/ 0,
-        /*.data         =*/ data == NULL ? (void *)(result + 1) : data,
+        /*.data         =*/ (data == NULL && !ctx->no_alloc) ? (void *)(result + 1) : data,
+        /*.view_src     =*/ NULL,
+        /*.view_offs    =*/ 0,
         /*.pad          =*/ { 0 },
     };
 
@@ -2484,9 +1580,14 @@ struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value) {
     ctx->scratch_save = ctx->scratch;
     ctx->scratch.data = NULL;
 
+    // the value is set right away, also in a no_alloc context
+    ctx->no_alloc_save = ctx->no_alloc;
+    ctx->no_alloc = false;
+
     struct ggml_tensor * result = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
 
-    ctx->scratch = ctx->scratch_save;
+    ctx->scratch  = ctx->scratch_save;
+    ctx->no_alloc = ctx->no_alloc_save;
 
     ggml_set_i32(result, value);
 
@@ -2497,9 +1598,14 @@ struct ggml_tensor * ggml_new_f32(struct ggml_context * ctx, float value) {
     ctx->scratch_save = ctx->scratch;
     ctx->scratch.data = NULL;
 
+    // the value is set right away, also in a no_alloc context
+    ctx->no_alloc_save = ctx->no_alloc;
+    ctx->no_alloc = false;
+
     struct ggml_tensor * result = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 1);
 
-    ctx->scratch = ctx->scratch_save;
+    ctx->scratch  = ctx->scratch_save;
+    ctx->no_alloc = ctx->no_alloc_save;
 
     ggml_set_f32(result, value);
 
@@ -2531,6 +1637,18 @@ struct ggml_tensor * ggml_set_i32 (struct ggml_tensor * tensor, int32_t value) {
             {
                 GGML_ASSERT(false);
             } break;
+        case GGML_TYPE_Q4_0I:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q4_0H:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q8_0:
+            {
+                GGML_ASSERT(false);
+            } break;
         case GGML_TYPE_I8:
             {
                 assert(tensor->nb[0] == sizeof(int8_t));
@@ -2591,6 +1709,18 @@ struct ggml_tensor * ggml_set_f32(struct ggml_tensor * tensor, float value) {
             {
                 GGML_ASSERT(false);
             } break;
+        case GGML_TYPE_Q4_0I:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q4_0H:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q8_0:
+            {
+                GGML_ASSERT(false);
+            } break;
         case GGML_TYPE_I8:
             {
                 assert(tensor->nb[0] == sizeof(int8_t));
@@ -2641,7 +1771,19 @@ int32_t ggml_get_i32_1d(const struct ggml_tensor * tensor, int i) {
             {
                 GGML_ASSERT(false);
             } break;
-        case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_1:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q4_0I:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q4_0H:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q8_0:
             {
                 GGML_ASSERT(false);
             } break;
@@ -2689,6 +1831,18 @@ void ggml_set_i32_1d(const struct ggml_tensor * tensor, int i, int32_t value) {
             {
                 GGML_ASSERT(false);
             } break;
+        case GGML_TYPE_Q4_0I:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q4_0H:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q8_0:
+            {
+                GGML_ASSERT(false);
+            } break;
         case GGML_TYPE_I8:
             {
                 GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
@@ -2731,6 +1885,18 @@ float ggml_get_f32_1d(const struct ggml_tensor * tensor, int i) {
             {
                 GGML_ASSERT(false);
             } break;
+        case GGML_TYPE_Q4_0I:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q4_0H:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q8_0:
+            {
+                GGML_ASSERT(false);
+            } break;
         case GGML_TYPE_I8:
             {
                 GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
@@ -2775,6 +1941,18 @@ void ggml_set_f32_1d(const struct ggml_tensor * tensor, int i, float value) {
             {
                 GGML_ASSERT(false);
             } break;
+        case GGML_TYPE_Q4_0I:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q4_0H:
+            {
+                GGML_ASSERT(false);
+            } break;
+        case GGML_TYPE_Q8_0:
+            {
+                GGML_ASSERT(false);
+            } break;
         case GGML_TYPE_I8:
             {
                 GGML_ASSERT(tensor->nb[0] == sizeof(int8_t));
@@ -2816,10 +1994,20 @@ float * ggml_get_data_f32(const struct ggml_tensor * tensor) {
     return (float *)(tensor->data);
 }
 
+// tensor is a view of src at offset bytes - ggml_graph_alloc finds the data of a view from the tensor that owns it
+static void ggml_set_view_src(struct ggml_tensor * tensor, struct ggml_tensor * src, size_t offset) {
+    tensor->view_src  = src->view_src ? src->view_src : src;
+    tensor->view_offs = src->view_offs + offset;
+}
+
 struct ggml_tensor * ggml_view_tensor(
         struct ggml_context * ctx,
-        const struct ggml_tensor * src) {
-    return ggml_new_tensor_impl(ctx, src->type, src->n_dims, src->ne, src->data);
+        struct ggml_tensor  * src) {
+    struct ggml_tensor * result = ggml_new_tensor_impl(ctx, src->type, src->n_dims, src->ne, src->data);
+
+    ggml_set_view_src(result, src, 0);
+
+    return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -3598,6 +2786,7 @@ struct ggml_tensor * ggml_reshape(
     }
 
     struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, b->n_dims, b->ne, a->data);
+    ggml_set_view_src(result, a, 0);
 
     result->op   = GGML_OP_RESHAPE;
     result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
@@ -3624,6 +2813,7 @@ struct ggml_tensor * ggml_reshape_2d(
 
     const int ne[2] = { ne0, ne1 };
     struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 2, ne, a->data);
+    ggml_set_view_src(result, a, 0);
 
     result->op   = GGML_OP_RESHAPE;
     result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
@@ -3651,6 +2841,7 @@ struct ggml_tensor * ggml_reshape_3d(
 
     const int ne[3] = { ne0, ne1, ne2 };
     struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 3, ne, a->data);
+    ggml_set_view_src(result, a, 0);
 
     result->op   = GGML_OP_RESHAPE;
     result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
@@ -3672,6 +2863,7 @@ struct ggml_tensor * ggml_view_1d(
     }
 
     struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 1, &ne0, (char *) a->data + offset);
+    ggml_set_view_src(result, a, offset);
 
     result->op   = GGML_OP_VIEW;
     result->grad = NULL;
@@ -3697,6 +2889,7 @@ struct ggml_tensor * ggml_view_2d(
     const int ne[GGML_MAX_DIMS] = { ne0, ne1, 1, 1 };
 
     struct ggml_tensor * result = ggml_new_tensor_impl(ctx, a->type, 2, ne, (char *) a->data + offset);
+    ggml_set_view_src(result, a, offset);
 
     result->nb[1] = nb1;
     result->nb[2] = result->nb[1]*ne1;
@@ -3897,7 +3090,13 @@ struct ggml_tensor * ggml_rope(
     //struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
     struct ggml_tensor * result = ggml_view_tensor(ctx, a);
 
-    struct ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 3);
+    ctx->no_alloc_save = ctx->no_alloc;
+    ctx->no_alloc = false;
+
+    struct ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 4);
+
+    ctx->no_alloc = ctx->no_alloc_save;
+
     ((int32_t *) b->data)[0] = n_past;
     ((int32_t *) b->data)[1] = n_dims;
     ((int32_t *) b->data)[2] = mode;
@@ -3911,6 +3110,16 @@ struct ggml_tensor * ggml_rope(
     return result;
 }
 
+// ggml_set_n_past
+
+void ggml_set_n_past(struct ggml_tensor * tensor, int n_past) {
+    GGML_ASSERT(tensor->op == GGML_OP_ROPE || tensor->op == GGML_OP_DIAG_MASK_INF);
+    GGML_ASSERT(n_past >= 0);
+
+    // the first parameter of both
+    ((int32_t *) tensor->src1->data)[0] = n_past;
+}
+
 // ggml_conv_1d_1s
 
 struct ggml_tensor * ggml_conv_1d_1s(
@@ -4046,7 +3255,6 @@ static void ggml_compute_forward_dup_f16(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    GGML_ASSERT(params->ith == 0);
     GGML_ASSERT(ggml_is_contiguous(dst));
     GGML_ASSERT(ggml_nelements(dst) == ggml_nelements(src0));
 
@@ -4054,6 +3262,9 @@ static void ggml_compute_forward_dup_f16(
         return;
     }
 
+    const int ith = params->ith;
+    const int nth = params->nth;
+
     const int ne00 = src0->ne[0];
     const int ne01 = src0->ne[1];
     const int ne02 = src0->ne[2];
@@ -4065,41 +3276,52 @@ static void ggml_compute_forward_dup_f16(
     const size_t nb03 = src0->nb[3];
 
     if (ggml_is_contiguous(src0) && src0->type == dst->type) {
-        memcpy(dst->data, src0->data, ggml_nelements(dst) * GGML_TYPE_SIZE[src0->type]);
+        const int ne = ggml_nelements(dst);
+
+        // elements per thread
+        const int de = (ne + nth - 1)/nth;
+
+        // element range for this thread
+        const int ie0 = MIN(de*ith, ne);
+        const int ie1 = MIN(ie0 + de, ne);
+
+        memcpy((char *) dst->data + ie0*nb00, (char *) src0->data + ie0*nb00, (ie1 - ie0)*nb00);
         return;
     }
 
+    // the rows of src0 are stored one after the other in dst
+    const int nr = ne01*ne02*ne03;
+
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     if (src0->nb[0] == sizeof(ggml_fp16_t)) {
         if (dst->type == GGML_TYPE_F16) {
-            int id = 0;
             const size_t rs = ne00*nb00;
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        const char * src0_ptr = (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03;
-                        char * dst_ptr = (char *) dst->data + id*rs;
+            while (ggml_compute_rows_next(&rows)) {
+                for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+                    const int i03 = ir/(ne02*ne01);
+                    const int i02 = (ir - i03*ne02*ne01)/ne01;
+                    const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-                        memcpy(dst_ptr, src0_ptr, rs);
+                    const char * src0_ptr = (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03;
+                    char * dst_ptr = (char *) dst->data + ir*rs;
 
-                        id++;
-                    }
+                    memcpy(dst_ptr, src0_ptr, rs);
                 }
             }
         } else if (dst->type == GGML_TYPE_F32) {
-            int id = 0;
-            float * dst_ptr = (float *) dst->data;
+            while (ggml_compute_rows_next(&rows)) {
+                for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+                    const int i03 = ir/(ne02*ne01);
+                    const int i02 = (ir - i03*ne02*ne01)/ne01;
+                    const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                    const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+                    float * dst_ptr = (float *) dst->data + ir*ne00;
 
-                            dst_ptr[id] = GGML_FP16_TO_FP32(*src0_ptr);
-                            id++;
-                        }
-                    }
+                    ggml_vec_fp16_to_fp32(ne00, dst_ptr, src0_ptr);
                 }
             }
         } else {
@@ -4109,34 +3331,34 @@ static void ggml_compute_forward_dup_f16(
         //printf("%s: this is not optimal - fix me\n", __func__);
 
         if (dst->type == GGML_TYPE_F32) {
-            int id = 0;
-            float * dst_ptr = (float *) dst->data;
+            while (ggml_compute_rows_next(&rows)) {
+                for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+                    const int i03 = ir/(ne02*ne01);
+                    const int i02 = (ir - i03*ne02*ne01)/ne01;
+                    const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                    float * dst_ptr = (float *) dst->data + ir*ne00;
 
-                            dst_ptr[id] = GGML_FP16_TO_FP32(*src0_ptr);
-                            id++;
-                        }
+                    for (int i00 = 0; i00 < ne00; i00++) {
+                        const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+
+                        dst_ptr[i00] = GGML_FP16_TO_FP32(*src0_ptr);
                     }
                 }
             }
         } else if (dst->type == GGML_TYPE_F16) {
-            int id = 0;
-            ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
+            while (ggml_compute_rows_next(&rows)) {
+                for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+                    const int i03 = ir/(ne02*ne01);
+                    const int i02 = (ir - i03*ne02*ne01)/ne01;
+                    const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                    ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data + ir*ne00;
 
-                            dst_ptr[id] = *src0_ptr;
-                            id++;
-                        }
+                    for (int i00 = 0; i00 < ne00; i00++) {
+                        const ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+
+                        dst_ptr[i00] = *src0_ptr;
                     }
                 }
             }
@@ -4150,7 +3372,6 @@ static void ggml_compute_forward_dup_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    GGML_ASSERT(params->ith == 0);
     GGML_ASSERT(ggml_is_contiguous(dst));
     GGML_ASSERT(ggml_nelements(dst) == ggml_nelements(src0));
 
@@ -4158,6 +3379,9 @@ static void ggml_compute_forward_dup_f32(
         return;
     }
 
+    const int ith = params->ith;
+    const int nth = params->nth;
+
     const int ne00 = src0->ne[0];
     const int ne01 = src0->ne[1];
     const int ne02 = src0->ne[2];
@@ -4169,41 +3393,52 @@ static void ggml_compute_forward_dup_f32(
     const size_t nb03 = src0->nb[3];
 
     if (ggml_is_contiguous(src0) && src0->type == dst->type) {
-        memcpy(dst->data, src0->data, ggml_nelements(dst) * GGML_TYPE_SIZE[src0->type]);
+        const int ne = ggml_nelements(dst);
+
+        // elements per thread
+        const int de = (ne + nth - 1)/nth;
+
+        // element range for this thread
+        const int ie0 = MIN(de*ith, ne);
+        const int ie1 = MIN(ie0 + de, ne);
+
+        memcpy((char *) dst->data + ie0*nb00, (char *) src0->data + ie0*nb00, (ie1 - ie0)*nb00);
         return;
     }
 
+    // the rows of src0 are stored one after the other in dst
+    const int nr = ne01*ne02*ne03;
+
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     if (src0->nb[0] == sizeof(float)) {
         if (dst->type == GGML_TYPE_F32) {
-            int id = 0;
             const size_t rs = ne00*nb00;
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        const char * src0_ptr = (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03;
-                        char * dst_ptr = (char *) dst->data + id*rs;
+            while (ggml_compute_rows_next(&rows)) {
+                for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+                    const int i03 = ir/(ne02*ne01);
+                    const int i02 = (ir - i03*ne02*ne01)/ne01;
+                    const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-                        memcpy(dst_ptr, src0_ptr, rs);
+                    const char * src0_ptr = (char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03;
+                    char * dst_ptr = (char *) dst->data + ir*rs;
 
-                        id++;
-                    }
+                    memcpy(dst_ptr, src0_ptr, rs);
                 }
             }
         } else if (dst->type == GGML_TYPE_F16) {
-            int id = 0;
-            ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
+            while (ggml_compute_rows_next(&rows)) {
+                for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+                    const int i03 = ir/(ne02*ne01);
+                    const int i02 = (ir - i03*ne02*ne01)/ne01;
+                    const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                    const float * src0_ptr = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+                    ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data + ir*ne00;
 
-                            dst_ptr[id] = GGML_FP32_TO_FP16(*src0_ptr);
-                            id++;
-                        }
-                    }
+                    ggml_vec_fp32_to_fp16(ne00, dst_ptr, src0_ptr);
                 }
             }
         } else {
@@ -4213,34 +3448,34 @@ static void ggml_compute_forward_dup_f32(
         //printf("%s: this is not optimal - fix me\n", __func__);
 
         if (dst->type == GGML_TYPE_F32) {
-            int id = 0;
-            float * dst_ptr = (float *) dst->data;
+            while (ggml_compute_rows_next(&rows)) {
+                for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+                    const int i03 = ir/(ne02*ne01);
+                    const int i02 = (ir - i03*ne02*ne01)/ne01;
+                    const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                    float * dst_ptr = (float *) dst->data + ir*ne00;
 
-                            dst_ptr[id] = *src0_ptr;
-                            id++;
-                        }
+                    for (int i00 = 0; i00 < ne00; i00++) {
+                        const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+
+                        dst_ptr[i00] = *src0_ptr;
                     }
                 }
             }
         } else if (dst->type == GGML_TYPE_F16) {
-            int id = 0;
-            ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
+            while (ggml_compute_rows_next(&rows)) {
+                for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+                    const int i03 = ir/(ne02*ne01);
+                    const int i02 = (ir - i03*ne02*ne01)/ne01;
+                    const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-            for (int i03 = 0; i03 < ne03; i03++) {
-                for (int i02 = 0; i02 < ne02; i02++) {
-                    for (int i01 = 0; i01 < ne01; i01++) {
-                        for (int i00 = 0; i00 < ne00; i00++) {
-                            const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                    ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data + ir*ne00;
 
-                            dst_ptr[id] = GGML_FP32_TO_FP16(*src0_ptr);
-                            id++;
-                        }
+                    for (int i00 = 0; i00 < ne00; i00++) {
+                        const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+
+                        dst_ptr[i00] = GGML_FP32_TO_FP16(*src0_ptr);
                     }
                 }
             }
@@ -4265,6 +3500,9 @@ static void ggml_compute_forward_dup(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4342,6 +3580,9 @@ static void ggml_compute_forward_add(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4360,25 +3601,30 @@ static void ggml_compute_forward_sub_f32(
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n  = ggml_nrows(src0);
+
+    const int nr = ggml_nrows(src0);
     const int nc = src0->ne[0];
 
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     assert( dst->nb[0] == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
     assert(src1->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_sub_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])),
-                (float *) ((char *) src1->data + i*(src1->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_sub_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])),
+                    (float *) ((char *) src1->data + i*(src1->nb[1])));
+        }
     }
 }
 
@@ -4394,6 +3640,9 @@ static void ggml_compute_forward_sub(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4412,35 +3661,40 @@ static void ggml_compute_forward_mul_f32(
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n  = ggml_nrows(src0);
+
+    const int nr = ggml_nrows(src0);
     const int nc = src0->ne[0];
 
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     assert( dst->nb[0] == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
     assert(src1->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_mul_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])),
-                (float *) ((char *) src1->data + i*(src1->nb[1])));
-        // // print the first 3 and last 3 elements of the result vector
-        // printf("ggml_compute_forward_mul_f32: dst = [" );
-        // for (int j = 0; j < 3; j++) {
-        //     printf("%f, ", ((float *) ((char *) dst->data  + i*( dst->nb[1])))[j]);
-        // }
-        // printf("..., ");
-        // for (int j = nc-3; j < nc; j++) {
-        //     printf("%f, ", ((float *) ((char *) dst->data  + i*( dst->nb[1])))[j]);
-        // }
-        // printf("]\n");
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_mul_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])),
+                    (float *) ((char *) src1->data + i*(src1->nb[1])));
+            // // print the first 3 and last 3 elements of the result vector
+            // printf("ggml_compute_forward_mul_f32: dst = [" );
+            // for (int j = 0; j < 3; j++) {
+            //     printf("%f, ", ((float *) ((char *) dst->data  + i*( dst->nb[1])))[j]);
+            // }
+            // printf("..., ");
+            // for (int j = nc-3; j < nc; j++) {
+            //     printf("%f, ", ((float *) ((char *) dst->data  + i*( dst->nb[1])))[j]);
+            // }
+            // printf("]\n");
+        }
     }
     // printf("\n\n");
 }
@@ -4457,6 +3711,9 @@ static void ggml_compute_forward_mul(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4475,25 +3732,30 @@ static void ggml_compute_forward_div_f32(
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n  = ggml_nrows(src0);
+
+    const int nr = ggml_nrows(src0);
     const int nc = src0->ne[0];
 
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     assert( dst->nb[0] == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
     assert(src1->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_div_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])),
-                (float *) ((char *) src1->data + i*(src1->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_div_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])),
+                    (float *) ((char *) src1->data + i*(src1->nb[1])));
+        }
     }
 }
 
@@ -4509,6 +3771,9 @@ static void ggml_compute_forward_div(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4526,23 +3791,28 @@ static void ggml_compute_forward_sqr_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n     = ggml_nrows(src0);
-    const int nc    = src0->ne[0];
+
+    const int nr = ggml_nrows(src0);
+    const int nc = src0->ne[0];
+
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
 
     assert( dst->nb[0] == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_sqr_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_sqr_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])));
+        }
     }
 }
 
@@ -4557,6 +3827,9 @@ static void ggml_compute_forward_sqr(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4574,23 +3847,28 @@ static void ggml_compute_forward_sqrt_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n  = ggml_nrows(src0);
+
+    const int nr = ggml_nrows(src0);
     const int nc = src0->ne[0];
 
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     assert( dst->nb[0] == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_sqrt_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_sqrt_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])));
+        }
     }
 }
 
@@ -4605,6 +3883,9 @@ static void ggml_compute_forward_sqrt(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4663,6 +3944,9 @@ static void ggml_compute_forward_sum(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4740,6 +4024,9 @@ static void ggml_compute_forward_mean(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4757,7 +4044,6 @@ static void ggml_compute_forward_repeat_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_can_repeat(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
@@ -4775,19 +4061,24 @@ static void ggml_compute_forward_repeat_f32(
     const int nc0 = src0->ne[0];
     const int nr0 = src0->ne[1];
     const int ncr = nc/nc0; // guaranteed to be an integer due to the check in ggml_can_repeat
-    const int nrr = nr/nr0; // guaranteed to be an integer due to the check in ggml_can_repeat
 
     // TODO: support for transposed / permuted tensors
     assert( dst->nb[0] == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
 
-    // TODO: maybe this is not optimal?
-    for (int i = 0; i < nrr; i++) {
-        for (int j = 0; j < ncr; j++) {
-            for (int k = 0; k < nr0; k++) {
+
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
+    while (ggml_compute_rows_next(&rows)) {
+        for (int ir = rows.ir0; ir < rows.ir1; ir++) {
+            // dst row ir repeats src0 row k
+            const int k = ir%nr0;
+
+            for (int j = 0; j < ncr; j++) {
                 ggml_vec_cpy_f32(nc0,
-                        (float *) ((char *)  dst->data + (i*nr0 + k)*( dst->nb[1]) + j*nc0*( dst->nb[0])),
-                        (float *) ((char *) src0->data + (        k)*(src0->nb[1])));
+                        (float *) ((char *)  dst->data + ir*( dst->nb[1]) + j*nc0*( dst->nb[0])),
+                        (float *) ((char *) src0->data +  k*(src0->nb[1])));
             }
         }
     }
@@ -4804,6 +4095,9 @@ static void ggml_compute_forward_repeat(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4821,23 +4115,28 @@ static void ggml_compute_forward_abs_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n  = ggml_nrows(src0);
+
+    const int nr = ggml_nrows(src0);
     const int nc = src0->ne[0];
 
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     assert(dst->nb[0]  == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_abs_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_abs_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])));
+        }
     }
 }
 
@@ -4852,6 +4151,9 @@ static void ggml_compute_forward_abs(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4869,23 +4171,28 @@ static void ggml_compute_forward_sgn_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n  = ggml_nrows(src0);
+
+    const int nr = ggml_nrows(src0);
     const int nc = src0->ne[0];
 
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     assert(dst->nb[0]  == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_sgn_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_sgn_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])));
+        }
     }
 }
 
@@ -4900,6 +4207,9 @@ static void ggml_compute_forward_sgn(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4917,23 +4227,28 @@ static void ggml_compute_forward_neg_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n  = ggml_nrows(src0);
+
+    const int nr = ggml_nrows(src0);
     const int nc = src0->ne[0];
 
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     assert(dst->nb[0]  == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_neg_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_neg_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])));
+        }
     }
 }
 
@@ -4948,6 +4263,9 @@ static void ggml_compute_forward_neg(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -4965,23 +4283,28 @@ static void ggml_compute_forward_step_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n  = ggml_nrows(src0);
+
+    const int nr = ggml_nrows(src0);
     const int nc = src0->ne[0];
 
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     assert(dst->nb[0]  == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_step_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_step_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])));
+        }
     }
 }
 
@@ -4996,6 +4319,9 @@ static void ggml_compute_forward_step(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -5013,23 +4339,28 @@ static void ggml_compute_forward_relu_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    const int n  = ggml_nrows(src0);
+
+    const int nr = ggml_nrows(src0);
     const int nc = src0->ne[0];
 
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
     assert(dst->nb[0]  == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
 
-    for (int i = 0; i < n; i++) {
-        ggml_vec_relu_f32(nc,
-                (float *) ((char *) dst->data  + i*( dst->nb[1])),
-                (float *) ((char *) src0->data + i*(src0->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; i++) {
+            ggml_vec_relu_f32(nc,
+                    (float *) ((char *) dst->data  + i*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i*(src0->nb[1])));
+        }
     }
 }
 
@@ -5044,6 +4375,9 @@ static void ggml_compute_forward_relu(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -5069,33 +4403,29 @@ static void ggml_compute_forward_gelu_f32(
         return;
     }
 
-    const int ith = params->ith;
-    const int nth = params->nth;
 
     const int nc = src0->ne[0];
     const int nr = ggml_nrows(src0);
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_gelu_f32(nc,
-                (float *) ((char *) dst->data  + i1*( dst->nb[1])),
-                (float *) ((char *) src0->data + i1*(src0->nb[1])));
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i1 = rows.ir0; i1 < rows.ir1; i1++) {
+            ggml_vec_gelu_f32(nc,
+                    (float *) ((char *) dst->data  + i1*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i1*(src0->nb[1])));
 
-    #ifndef NDEBUG
-            for (int k = 0; k < nc; k++) {
-                const float x = ((float *) ((char *) dst->data + i1*( dst->nb[1])))[k];
-                UNUSED(x);
-                assert(!isnan(x));
-                assert(!isinf(x));
+        #ifndef NDEBUG
+                for (int k = 0; k < nc; k++) {
+                    const float x = ((float *) ((char *) dst->data + i1*( dst->nb[1])))[k];
+                    UNUSED(x);
+                    assert(!isnan(x));
+                    assert(!isinf(x));
+                }
+        #endif
             }
-    #endif
-        }
+    }
 }
 
 static void ggml_compute_forward_gelu(
@@ -5109,6 +4439,9 @@ static void ggml_compute_forward_gelu(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -5134,147 +4467,61 @@ static void ggml_compute_forward_silu_f32(
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
-    }
-
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    const int nc = src0->ne[0];
-    const int nr = ggml_nrows(src0);
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
-
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_silu_f32(nc,
-                (float *) ((char *) dst->data  + i1*( dst->nb[1])),
-                (float *) ((char *) src0->data + i1*(src0->nb[1])));
-
-    #ifndef NDEBUG
-            for (int k = 0; k < nc; k++) {
-                const float x = ((float *) ((char *) dst->data + i1*( dst->nb[1])))[k];
-                UNUSED(x);
-                assert(!isnan(x));
-                assert(!isinf(x));
-            }
-    #endif
-        }
-}
-
-static void ggml_compute_forward_silu(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_silu_f32(params, src0, dst);
-            } break;
-        case GGML_TYPE_Q4_0:
-        case GGML_TYPE_Q4_1:
-        case GGML_TYPE_I8:
-        case GGML_TYPE_I16:
-        case GGML_TYPE_I32:
-        case GGML_TYPE_F16:
-        case GGML_TYPE_COUNT:
-            {
-                assert(false);
-            } break;
-    }
-}
-
-// ggml_compute_forward_norm
-
-static void ggml_compute_forward_norm_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        struct ggml_tensor * dst) {
-    GGML_ASSERT(ggml_are_same_shape(src0, dst));
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
-
-    GGML_ASSERT(src0->nb[0] == sizeof(float));
-
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    const int ne00 = src0->ne[0];
-    const int ne01 = src0->ne[1];
-    const int ne02 = src0->ne[2];
-    const int ne03 = src0->ne[3];
-
-    const size_t nb01 = src0->nb[1];
-    const size_t nb02 = src0->nb[2];
-    const size_t nb03 = src0->nb[3];
-
-    const size_t nb1 = dst->nb[1];
-    const size_t nb2 = dst->nb[2];
-    const size_t nb3 = dst->nb[3];
-
-    const ggml_float eps = 1e-5f; // TODO: make this a parameter
-
-    // TODO: optimize
-    for (int i03 = 0; i03 < ne03; i03++) {
-        for (int i02 = 0; i02 < ne02; i02++) {
-            for (int i01 = ith; i01 < ne01; i01 += nth) {
-                const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
-
-                ggml_float mean = 0.0;
-                for (int i00 = 0; i00 < ne00; i00++) {
-                    mean += x[i00];
-                }
+    }
 
-                mean /= ne00;
 
-                float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
+    const int nc = src0->ne[0];
+    const int nr = ggml_nrows(src0);
 
-                ggml_float sum2 = 0.0;
-                for (int i00 = 0; i00 < ne00; i00++) {
-                    ggml_float v = x[i00] - mean;
-                    y[i00] = v;
-                    sum2 += v*v;
-                }
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
 
-                const float scale = 1.0/sqrt(sum2/ne00 + eps);
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i1 = rows.ir0; i1 < rows.ir1; i1++) {
+            ggml_vec_silu_f32(nc,
+                    (float *) ((char *) dst->data  + i1*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i1*(src0->nb[1])));
 
-                ggml_vec_scale_f32(ne00, y, scale);
+        #ifndef NDEBUG
+                for (int k = 0; k < nc; k++) {
+                    const float x = ((float *) ((char *) dst->data + i1*( dst->nb[1])))[k];
+                    UNUSED(x);
+                    assert(!isnan(x));
+                    assert(!isinf(x));
+                }
+        #endif
             }
-        }
     }
 }
 
-static void ggml_compute_forward_norm(
+static void ggml_compute_forward_silu(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
     switch (src0->type) {
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_norm_f32(params, src0, dst);
+                ggml_compute_forward_silu_f32(params, src0, dst);
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
         case GGML_TYPE_F16:
         case GGML_TYPE_COUNT:
             {
-                GGML_ASSERT(false);
+                assert(false);
             } break;
     }
 }
 
-// ggml_compute_forward_rms_norm
+// ggml_compute_forward_norm
 
-// Does RMS Norm without mutliplying by the scale
-static void ggml_compute_forward_rms_norm_f32(
+static void ggml_compute_forward_norm_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
@@ -5302,7 +4549,7 @@ static void ggml_compute_forward_rms_norm_f32(
     const size_t nb2 = dst->nb[2];
     const size_t nb3 = dst->nb[3];
 
-    const ggml_float eps = 1e-6f; // TODO: make this a parameter
+    const ggml_float eps = 1e-5f; // TODO: make this a parameter
 
     // TODO: optimize
     for (int i03 = 0; i03 < ne03; i03++) {
@@ -5310,324 +4557,174 @@ static void ggml_compute_forward_rms_norm_f32(
             for (int i01 = ith; i01 < ne01; i01 += nth) {
                 const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
 
-                ggml_float mean_sq = 0.0;
+                ggml_float mean = 0.0;
                 for (int i00 = 0; i00 < ne00; i00++) {
-                    mean_sq += (x[i00] * x[i00]);
+                    mean += x[i00];
                 }
 
-                mean_sq /= ne00;
+                mean /= ne00;
 
                 float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
 
+                ggml_float sum2 = 0.0;
                 for (int i00 = 0; i00 < ne00; i00++) {
-                    y[i00] = x[i00];
+                    ggml_float v = x[i00] - mean;
+                    y[i00] = v;
+                    sum2 += v*v;
                 }
 
-                const float scale = 1.0 / sqrt(mean_sq + eps);
-                // printf("\n  rsqrt: %f , ith: %d, ne00: %d \n", scale, ith, ne00);
+                const float scale = 1.0/sqrt(sum2/ne00 + eps);
 
                 ggml_vec_scale_f32(ne00, y, scale);
-                // printf("\n  ith: %d, y_scale: %.6f %.6f %.6f ... %.6f %.6f %.6f \n", ith, y[0], y[1], y[2], y[ne00-3], y[ne00-2], y[ne00-1]);
             }
         }
     }
 }
 
-static void ggml_compute_forward_rms_norm(
+static void ggml_compute_forward_norm(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
     switch (src0->type) {
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_rms_norm_f32(params, src0, dst);
+                ggml_compute_forward_norm_f32(params, src0, dst);
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
         case GGML_TYPE_F16:
         case GGML_TYPE_COUNT:
             {
-                assert(false);
+                GGML_ASSERT(false);
             } break;
     }
 }
 
-// ggml_compute_forward_mul_mat
+// ggml_compute_forward_rms_norm
 
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-// helper function to determine if it is better to use BLAS or not
-// for large matrices, BLAS is faster
-static bool ggml_compute_forward_mul_mat_use_blas(
+// Does RMS Norm without mutliplying by the scale
+static void ggml_compute_forward_rms_norm_f32(
+        const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    UNUSED(src0);
-
-    const int ne10 = src1->ne[0];
-
-    const int ne0 = dst->ne[0];
-    const int ne1 = dst->ne[1];
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
 
-    // TODO: find the optimal values for these
-    if (ggml_is_contiguous(src0) &&
-        ggml_is_contiguous(src1) && ((ne0 >= 32 && ne1 >= 32 && ne10 >= 32))) {
-        //printf("BLAS: %d %d %d\n", ne0, ne1, ne10);
-        return true;
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
     }
 
-    return false;
-}
-#endif
+    GGML_ASSERT(src0->nb[0] == sizeof(float));
 
-static void ggml_compute_forward_mul_mat_f32(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
+    const int ith = params->ith;
+    const int nth = params->nth;
 
     const int ne00 = src0->ne[0];
     const int ne01 = src0->ne[1];
     const int ne02 = src0->ne[2];
     const int ne03 = src0->ne[3];
 
-    const int ne10 = src1->ne[0];
-    const int ne11 = src1->ne[1];
-    const int ne12 = src1->ne[2];
-    const int ne13 = src1->ne[3];
-
-    const int ne0  = dst->ne[0];
-    const int ne1  = dst->ne[1];
-    const int ne2  = dst->ne[2];
-    const int ne3  = dst->ne[3];
-    const int ne   = ne0*ne1*ne2*ne3;
-
-    const int nb00 = src0->nb[0];
-    const int nb01 = src0->nb[1];
-    const int nb02 = src0->nb[2];
-    const int nb03 = src0->nb[3];
-
-    const int nb10 = src1->nb[0];
-    const int nb11 = src1->nb[1];
-    const int nb12 = src1->nb[2];
-    const int nb13 = src1->nb[3];
-
-    const int nb0  = dst->nb[0];
-    const int nb1  = dst->nb[1];
-    const int nb2  = dst->nb[2];
-    const int nb3  = dst->nb[3];
-
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    assert(ne02 == ne12);
-    assert(ne03 == ne13);
-    assert(ne2  == ne12);
-    assert(ne3  == ne13);
-
-    // TODO: we don't support permuted src0
-    assert(nb00 == sizeof(float) || nb01 == sizeof(float));
-
-    // dst cannot be transposed or permuted
-    assert(nb0 == sizeof(float));
-    assert(nb0 <= nb1);
-    assert(nb1 <= nb2);
-    assert(nb2 <= nb3);
-
-    assert(ne0 == ne01);
-    assert(ne1 == ne11);
-    assert(ne2 == ne02);
-    assert(ne3 == ne03);
-
-    // nb01 >= nb00 - src0 is not transposed
-    //   compute by src0 rows
-    //
-    // nb00 <  nb01 - src0 is transposed
-    //   compute by src0 columns
-
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-    if (ggml_compute_forward_mul_mat_use_blas(src0, src1, dst)) {
-        GGML_ASSERT(nb10 == sizeof(float));
-
-        if (params->ith != 0) {
-            return;
-        }
-
-        if (params->type == GGML_TASK_INIT) {
-            return;
-        }
-
-        if (params->type == GGML_TASK_FINALIZE) {
-            return;
-        }
-
-        for (int i03 = 0; i03 < ne03; i03++) {
-            for (int i02 = 0; i02 < ne02; i02++) {
-                const float * x = (float *) (src0->data);
-                const float * y = (float *) ((char *) src1->data + i02*nb12 + i03*nb13);
-
-                float * d = (float *) ((char *) dst->data + i02*nb2 + i03*nb3);
-
-                // zT = y * xT
-                {
-                    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-                            ne11, ne01, ne10,
-                            1.0f,    y, ne10,
-                                     x, ne10,
-                            0.0f,    d, ne01);
-                }
-            }
-        }
-
-        //printf("CBLAS F32 = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
-
-        return;
-    }
-#endif
-
-    if (params->type == GGML_TASK_INIT) {
-        if (nb01 >= nb00) {
-            return;
-        }
-
-        // TODO: fix this memset (wsize is overestimated)
-        memset(params->wdata, 0, params->wsize);
-        return;
-    }
-
-    if (params->type == GGML_TASK_FINALIZE) {
-        if (nb01 >= nb00) {
-            return;
-        }
-
-        // TODO: fix this memset (wsize is overestimated)
-        //assert(params->wsize == (ggml_nbytes(dst) + CACHE_LINE_SIZE)*nth);
-
-        float * const wdata = params->wdata;
-
-        // cols per thread
-        const int dc = (ne + nth - 1)/nth;
-
-        // col range for this thread
-        const int ic0 = dc*ith;
-        const int ic1 = MIN(ic0 + dc, ne);
-
-        ggml_vec_cpy_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + ic0);
-
-        for (int k = 1; k < nth; k++) {
-            ggml_vec_acc_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + (ne + CACHE_LINE_SIZE_F32)*k + ic0);
-        }
-
-        return;
-    }
-
-    if (nb01 >= nb00) {
-        // TODO: do not support transposed src1
-        assert(nb10 == sizeof(float));
-
-        // parallelize by src0 rows using ggml_vec_dot_f32
-
-        // total rows in src0
-        const int nr = ne01*ne02*ne03;
-
-        // rows per thread
-        const int dr = (nr + nth - 1)/nth;
-
-        // row range for this thread
-        const int ir0 = dr*ith;
-        const int ir1 = MIN(ir0 + dr, nr);
-
-        for (int ir = ir0; ir < ir1; ++ir) {
-            // src0 indices
-            const int i03 = ir/(ne02*ne01);
-            const int i02 = (ir - i03*ne02*ne01)/ne01;
-            const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
-
-            for (int ic = 0; ic < ne11; ++ic) {
-                // src1 indices
-                const int i13 = i03;
-                const int i12 = i02;
-                const int i11 = ic;
-
-                // dst indices
-                const int i0 = i01;
-                const int i1 = i11;
-                const int i2 = i02;
-                const int i3 = i03;
-
-                ggml_vec_dot_f32(ne00,
-                        (float *) ((char *)  dst->data + (i0*nb0 + i1*nb1 + i2*nb2 + i3*nb3)),
-                        (float *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03)),
-                        (float *) ((char *) src1->data + (i11*nb11 + i12*nb12 + i13*nb13)));
-            }
-        }
-    } else {
-        // parallelize by src1 columns using ggml_vec_mad_f32
-        // each thread has its own work data
-        // during FINALIZE we accumulate all work data into dst
-
-        // total columns in src1
-        const int nc = ne10;
-
-        // columns per thread
-        const int dc = (nc + nth - 1)/nth;
+    const size_t nb01 = src0->nb[1];
+    const size_t nb02 = src0->nb[2];
+    const size_t nb03 = src0->nb[3];
 
-        // column range for this thread
-        const int ic0 = dc*ith;
-        const int ic1 = MIN(ic0 + dc, nc);
+    const size_t nb1 = dst->nb[1];
+    const size_t nb2 = dst->nb[2];
+    const size_t nb3 = dst->nb[3];
 
-        // work data for thread
-        const int wo = (ne + CACHE_LINE_SIZE_F32)*ith;
-        float * const wdata = params->wdata;
+    const ggml_float eps = 1e-6f; // TODO: make this a parameter
 
-        for (int i13 = 0; i13 < ne13; ++i13) {
-            for (int i12 = 0; i12 < ne12; ++i12) {
-                for (int i11 = 0; i11 < ne11; ++i11) {
-                    for (int ic = ic0; ic < ic1; ++ic) {
-                        // src1 indices
-                        const int i10 = ic;
+    // TODO: optimize
+    for (int i03 = 0; i03 < ne03; i03++) {
+        for (int i02 = 0; i02 < ne02; i02++) {
+            for (int i01 = ith; i01 < ne01; i01 += nth) {
+                const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
 
-                        // src0 indices
-                        const int i03 = i13;
-                        const int i02 = i12;
-                        const int i00 = ic;
+                ggml_float mean_sq = 0.0;
+                for (int i00 = 0; i00 < ne00; i00++) {
+                    mean_sq += (x[i00] * x[i00]);
+                }
 
-                        // dst indices
-                        const int i1 = i11;
-                        const int i2 = i12;
-                        const int i3 = i13;
+                mean_sq /= ne00;
 
-                        assert(sizeof(float)*(wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0 + ne01) <= params->wsize);
+                float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
 
-                        ggml_vec_mad_f32(ne01,
-                                (float *) (wdata + wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0),
-                                (float *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03)),
-                               *(float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13)));
-                    }
+                for (int i00 = 0; i00 < ne00; i00++) {
+                    y[i00] = x[i00];
                 }
+
+                const float scale = 1.0 / sqrt(mean_sq + eps);
+                // printf("\n  rsqrt: %f , ith: %d, ne00: %d \n", scale, ith, ne00);
+
+                ggml_vec_scale_f32(ne00, y, scale);
+                // printf("\n  ith: %d, y_scale: %.6f %.6f %.6f ... %.6f %.6f %.6f \n", ith, y[0], y[1], y[2], y[ne00-3], y[ne00-2], y[ne00-1]);
             }
         }
     }
+}
 
-    //int64_t t1 = ggml_perf_time_us();
-    //static int64_t acc = 0;
-    //acc += t1 - t0;
-    //if (t1 - t0 > 10) {
-    //    printf("\n");
-    //    printf("ne00 = %5d, ne01 = %5d, ne02 = %5d, ne03 = %5d\n", ne00, ne01, ne02, ne03);
-    //    printf("nb00 = %5d, nb01 = %5d, nb02 = %5d, nb03 = %5d\n", nb00, nb01, nb02, nb03);
-    //    printf("ne10 = %5d, ne11 = %5d, ne12 = %5d, ne13 = %5d\n", ne10, ne11, ne12, ne13);
-    //    printf("nb10 = %5d, nb11 = %5d, nb12 = %5d, nb13 = %5d\n", nb10, nb11, nb12, nb13);
+static void ggml_compute_forward_rms_norm(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_rms_norm_f32(params, src0, dst);
+            } break;
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_I8:
+        case GGML_TYPE_I16:
+        case GGML_TYPE_I32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_COUNT:
+            {
+                assert(false);
+            } break;
+    }
+}
 
-    //    printf("XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX task %d/%d: %d us, acc = %d\n", ith, nth, (int) (t1 - t0), (int) acc);
-    //}
+// ggml_compute_forward_mul_mat
+
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+// helper function to determine if it is better to use BLAS or not
+// for large matrices, BLAS is faster
+static bool ggml_compute_forward_mul_mat_use_blas(
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * dst) {
+    const int ne10 = src1->ne[0];
+
+    const int ne0 = dst->ne[0];
+    const int ne1 = dst->ne[1];
+
+    // Q4_0 has its own GEMM kernel for batched src1 (ggml_gemm_q4_0_q8_0), which is faster than
+    // dequantizing the whole src0 to F32 for the SGEMM call
+    if (src0->type == GGML_TYPE_Q4_0) {
+        return false;
+    }
+
+    // TODO: find the optimal values for these
+    if (ggml_is_contiguous(src0) &&
+        ggml_is_contiguous(src1) && ((ne0 >= 32 && ne1 >= 32 && ne10 >= 32))) {
+        //printf("BLAS: %d %d %d\n", ne0, ne1, ne10);
+        return true;
+    }
+
+    return false;
 }
+#endif
 
-static void ggml_compute_forward_mul_mat_f16_f32(
+static void ggml_compute_forward_mul_mat_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
@@ -5669,24 +4766,24 @@ static void ggml_compute_forward_mul_mat_f16_f32(
     const int ith = params->ith;
     const int nth = params->nth;
 
-    GGML_ASSERT(ne02 == ne12);
-    GGML_ASSERT(ne03 == ne13);
-    GGML_ASSERT(ne2  == ne12);
-    GGML_ASSERT(ne3  == ne13);
+    assert(ne02 == ne12);
+    assert(ne03 == ne13);
+    assert(ne2  == ne12);
+    assert(ne3  == ne13);
 
     // TODO: we don't support permuted src0
-    GGML_ASSERT(nb00 == sizeof(ggml_fp16_t) || nb01 == sizeof(ggml_fp16_t));
+    assert(nb00 == sizeof(float) || nb01 == sizeof(float));
 
     // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
-    GGML_ASSERT(nb0 <= nb1);
-    GGML_ASSERT(nb1 <= nb2);
-    GGML_ASSERT(nb2 <= nb3);
+    assert(nb0 == sizeof(float));
+    assert(nb0 <= nb1);
+    assert(nb1 <= nb2);
+    assert(nb2 <= nb3);
 
-    GGML_ASSERT(ne0 == ne01);
-    GGML_ASSERT(ne1 == ne11);
-    GGML_ASSERT(ne2 == ne02);
-    GGML_ASSERT(ne3 == ne03);
+    assert(ne0 == ne01);
+    assert(ne1 == ne11);
+    assert(ne2 == ne02);
+    assert(ne3 == ne03);
 
     // nb01 >= nb00 - src0 is not transposed
     //   compute by src0 rows
@@ -5710,63 +4807,25 @@ static void ggml_compute_forward_mul_mat_f16_f32(
             return;
         }
 
-        float * const wdata = params->wdata;
-
         for (int i03 = 0; i03 < ne03; i03++) {
             for (int i02 = 0; i02 < ne02; i02++) {
-                {
-                    int id = 0;
-                    for (int i01 = 0; i01 < ne01; ++i01) {
-                        for (int i00 = 0; i00 < ne00; ++i00) {
-                            wdata[id++] = GGML_FP16_TO_FP32(*(ggml_fp16_t *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01 + i00*nb00));
-                        }
-                    }
-                }
-
-                const float * x = wdata;
+                const float * x = (float *) (src0->data);
                 const float * y = (float *) ((char *) src1->data + i02*nb12 + i03*nb13);
 
-                //      float * z =                          wdata + ne00*ne01;
-
-                // z = x * yT
-                //{
-                //    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-                //            ne01, ne11, ne00,
-                //            1.0f, x, ne00,
-                //                  y, ne00,
-                //            0.0f, z, ne11);
-                //}
-
                 float * d = (float *) ((char *) dst->data + i02*nb2 + i03*nb3);
 
-                // transpose z
-                //for (int j = 0; j < ne11; ++j) {
-                //    for (int i = 0; i < ne01; ++i) {
-                //        d[j*ne01 + i] = z[i*ne11 + j];
-                //    }
-                //}
-
+                // zT = y * xT
                 {
-#if 1
-                    // zT = y * xT
                     cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
                             ne11, ne01, ne10,
-                            1.0f,    y, ne00,
-                                     x, ne00,
-                            0.0f,    d, ne01);
-#else
-                    // zT = (xT * y)T
-                    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans,
-                            ne01, ne11, ne10,
-                            1.0f,    x, ne00,
-                                     y, ne00,
+                            1.0f,    y, ne10,
+                                     x, ne10,
                             0.0f,    d, ne01);
-#endif
                 }
             }
         }
 
-        /*printf("CBLAS F16 = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);*/
+        //printf("CBLAS F32 = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
 
         return;
     }
@@ -5774,21 +4833,6 @@ static void ggml_compute_forward_mul_mat_f16_f32(
 
     if (params->type == GGML_TASK_INIT) {
         if (nb01 >= nb00) {
-            ggml_fp16_t * const wdata = params->wdata;
-
-            int id = 0;
-            for (int i13 = 0; i13 < ne13; ++i13) {
-                for (int i12 = 0; i12 < ne12; ++i12) {
-                    for (int i11 = 0; i11 < ne11; ++i11) {
-                        for (int i10 = 0; i10 < ne10; ++i10) {
-                            wdata[id++] = GGML_FP32_TO_FP16(*(float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + i10*nb10));
-                        }
-                    }
-                }
-            }
-
-            GGML_ASSERT(id*sizeof(ggml_fp16_t) <= params->wsize);
-
             return;
         }
 
@@ -5805,7 +4849,7 @@ static void ggml_compute_forward_mul_mat_f16_f32(
         // TODO: fix this memset (wsize is overestimated)
         //assert(params->wsize == (ggml_nbytes(dst) + CACHE_LINE_SIZE)*nth);
 
-        ggml_fp16_t * const wdata = params->wdata;
+        float * const wdata = params->wdata;
 
         // cols per thread
         const int dc = (ne + nth - 1)/nth;
@@ -5814,64 +4858,55 @@ static void ggml_compute_forward_mul_mat_f16_f32(
         const int ic0 = dc*ith;
         const int ic1 = MIN(ic0 + dc, ne);
 
-        for (int i = ic0; i < ic1; ++i) {
-            ((float *) dst->data)[i] = GGML_FP16_TO_FP32(wdata[i]);
-        }
+        ggml_vec_cpy_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + ic0);
 
         for (int k = 1; k < nth; k++) {
-            for (int i = ic0; i < ic1; ++i) {
-                ((float *) dst->data)[i] += GGML_FP16_TO_FP32(wdata[(ne + CACHE_LINE_SIZE_F32)*k + i]);
-            }
+            ggml_vec_acc_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + (ne + CACHE_LINE_SIZE_F32)*k + ic0);
         }
 
         return;
     }
 
     if (nb01 >= nb00) {
-        // fp16 -> half the size, so divide by 2
         // TODO: do not support transposed src1
-        assert(nb10/2 == sizeof(ggml_fp16_t));
+        assert(nb10 == sizeof(float));
 
-        // parallelize by src0 rows using ggml_vec_dot_f16
+        // parallelize by src0 rows using ggml_vec_dot_f32
 
         // total rows in src0
         const int nr = ne01*ne02*ne03;
 
-        // rows per thread
-        const int dr = (nr + nth - 1)/nth;
-
-        // row range for this thread
-        const int ir0 = dr*ith;
-        const int ir1 = MIN(ir0 + dr, nr);
-
-        ggml_fp16_t * wdata = params->wdata;
-
-        for (int ir = ir0; ir < ir1; ++ir) {
-            // src0 indices
-            const int i03 = ir/(ne02*ne01);
-            const int i02 = (ir - i03*ne02*ne01)/ne01;
-            const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+        // the rows of this thread
+        struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
 
-            const int i13 = i03;
-            const int i12 = i02;
+        while (ggml_compute_rows_next(&rows)) {
+            for (int ir = rows.ir0; ir < rows.ir1; ++ir) {
+                // src0 indices
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-            const int i0 = i01;
-            const int i2 = i02;
-            const int i3 = i03;
+                for (int ic = 0; ic < ne11; ++ic) {
+                    // src1 indices
+                    const int i13 = i03;
+                    const int i12 = i02;
+                    const int i11 = ic;
 
-            ggml_fp16_t * src0_row = (ggml_fp16_t *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03));
-            ggml_fp16_t * src1_col =                                wdata + (       0 + i12*ne11 + i13*ne12*ne11)*ne00;
-
-            float * dst_col = (float *) ((char *) dst->data + (i0*nb0 + 0*nb1 + i2*nb2 + i3*nb3));
-
-            assert(ne00 % 32 == 0);
+                    // dst indices
+                    const int i0 = i01;
+                    const int i1 = i11;
+                    const int i2 = i02;
+                    const int i3 = i03;
 
-            for (int ic = 0; ic < ne11; ++ic) {
-                ggml_vec_dot_f16(ne00, &dst_col[ic*ne0], src0_row, src1_col + ic*ne00);
+                    ggml_vec_dot_f32(ne00,
+                            (float *) ((char *)  dst->data + (i0*nb0 + i1*nb1 + i2*nb2 + i3*nb3)),
+                            (float *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03)),
+                            (float *) ((char *) src1->data + (i11*nb11 + i12*nb12 + i13*nb13)));
+                }
             }
         }
     } else {
-        // parallelize by src1 columns using ggml_vec_mad_f16
+        // parallelize by src1 columns using ggml_vec_mad_f32
         // each thread has its own work data
         // during FINALIZE we accumulate all work data into dst
 
@@ -5887,18 +4922,11 @@ static void ggml_compute_forward_mul_mat_f16_f32(
 
         // work data for thread
         const int wo = (ne + CACHE_LINE_SIZE_F32)*ith;
-        ggml_fp16_t * const wdata = params->wdata;
+        float * const wdata = params->wdata;
 
         for (int i13 = 0; i13 < ne13; ++i13) {
             for (int i12 = 0; i12 < ne12; ++i12) {
                 for (int i11 = 0; i11 < ne11; ++i11) {
-                    // dst indices
-                    const int i1 = i11;
-                    const int i2 = i12;
-                    const int i3 = i13;
-
-                    ggml_fp16_t * dst_row = wdata + wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0;
-
                     for (int ic = ic0; ic < ic1; ++ic) {
                         // src1 indices
                         const int i10 = ic;
@@ -5908,19 +4936,24 @@ static void ggml_compute_forward_mul_mat_f16_f32(
                         const int i02 = i12;
                         const int i00 = ic;
 
-                        assert(sizeof(ggml_fp16_t)*(wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0 + ne01) <= params->wsize);
+                        // dst indices
+                        const int i1 = i11;
+                        const int i2 = i12;
+                        const int i3 = i13;
 
-                        ggml_fp16_t * src0_col =  (ggml_fp16_t *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03));
-                        float         src1_val = *      (float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13));
+                        assert(sizeof(float)*(wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0 + ne01) <= params->wsize);
 
-                        ggml_vec_mad_f16(ne01, dst_row, src0_col, src1_val);
+                        ggml_vec_mad_f32(ne01,
+                                (float *) (wdata + wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0),
+                                (float *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03)),
+                               *(float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13)));
                     }
                 }
             }
         }
     }
 
-    //int64_t t1 = ggml_time_us();
+    //int64_t t1 = ggml_perf_time_us();
     //static int64_t acc = 0;
     //acc += t1 - t0;
     //if (t1 - t0 > 10) {
@@ -5928,12 +4961,13 @@ static void ggml_compute_forward_mul_mat_f16_f32(
     //    printf("ne00 = %5d, ne01 = %5d, ne02 = %5d, ne03 = %5d\n", ne00, ne01, ne02, ne03);
     //    printf("nb00 = %5d, nb01 = %5d, nb02 = %5d, nb03 = %5d\n", nb00, nb01, nb02, nb03);
     //    printf("ne10 = %5d, ne11 = %5d, ne12 = %5d, ne13 = %5d\n", ne10, ne11, ne12, ne13);
+    //    printf("nb10 = %5d, nb11 = %5d, nb12 = %5d, nb13 = %5d\n", nb10, nb11, nb12, nb13);
 
     //    printf("XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX task %d/%d: %d us, acc = %d\n", ith, nth, (int) (t1 - t0), (int) acc);
     //}
 }
 
-static void ggml_compute_forward_mul_mat_q4_0_f32(
+static void ggml_compute_forward_mul_mat_f16_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
@@ -5981,7 +5015,7 @@ static void ggml_compute_forward_mul_mat_q4_0_f32(
     GGML_ASSERT(ne3  == ne13);
 
     // TODO: we don't support permuted src0
-    GGML_ASSERT(nb00 == (int) GGML_TYPE_SIZE[GGML_TYPE_Q4_0] || nb01 == (int) GGML_TYPE_SIZE[GGML_TYPE_Q4_0]);
+    GGML_ASSERT(nb00 == sizeof(ggml_fp16_t) || nb01 == sizeof(ggml_fp16_t));
 
     // dst cannot be transposed or permuted
     GGML_ASSERT(nb0 == sizeof(float));
@@ -6023,11 +5057,9 @@ static void ggml_compute_forward_mul_mat_q4_0_f32(
                 {
                     int id = 0;
                     for (int i01 = 0; i01 < ne01; ++i01) {
-                        //for (int i00 = 0; i00 < ne00; ++i00) {
-                        //    wdata[id++] = GGML_FP16_TO_FP32(*(ggml_fp16_t *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01 + i00*nb00));
-                        //}
-                        dequantize_row_q4_0((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01, wdata + id, ne00);
-                        id += ne00;
+                        for (int i00 = 0; i00 < ne00; ++i00) {
+                            wdata[id++] = GGML_FP16_TO_FP32(*(ggml_fp16_t *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01 + i00*nb00));
+                        }
                     }
                 }
 
@@ -6074,29 +5106,35 @@ static void ggml_compute_forward_mul_mat_q4_0_f32(
             }
         }
 
-        /*printf("CBLAS Q4_0 = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);*/
+        /*printf("CBLAS F16 = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);*/
 
         return;
     }
 #endif
 
     if (params->type == GGML_TASK_INIT) {
-        //printf("HHHHHHHHH ith = %d, nth = %d\n", ith, nth);
         if (nb01 >= nb00) {
-            char * wdata = params->wdata;
+            ggml_fp16_t * const wdata = params->wdata;
 
+            int id = 0;
             for (int i13 = 0; i13 < ne13; ++i13) {
                 for (int i12 = 0; i12 < ne12; ++i12) {
                     for (int i11 = 0; i11 < ne11; ++i11) {
-                        //for (int i10 = 0; i10 < ne10; ++i10) {
-                        //    wdata[id++] = GGML_FP32_TO_FP16(*(float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + i10*nb10));
-                        //}
-                        quantize_row_q4_0((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11), (void *) wdata, ne10);
-                        wdata += (ne10*GGML_TYPE_SIZE[GGML_TYPE_Q4_0])/GGML_BLCK_SIZE[GGML_TYPE_Q4_0];
+                        if (nb10 == sizeof(float)) {
+                            ggml_vec_fp32_to_fp16(ne10, wdata + id, (float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11));
+                            id += ne10;
+                            continue;
+                        }
+
+                        for (int i10 = 0; i10 < ne10; ++i10) {
+                            wdata[id++] = GGML_FP32_TO_FP16(*(float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + i10*nb10));
+                        }
                     }
                 }
             }
 
+            GGML_ASSERT(id*sizeof(ggml_fp16_t) <= params->wsize);
+
             return;
         }
 
@@ -6110,7 +5148,10 @@ static void ggml_compute_forward_mul_mat_q4_0_f32(
             return;
         }
 
-        float * const wdata = params->wdata;
+        // TODO: fix this memset (wsize is overestimated)
+        //assert(params->wsize == (ggml_nbytes(dst) + CACHE_LINE_SIZE)*nth);
+
+        ggml_fp16_t * const wdata = params->wdata;
 
         // cols per thread
         const int dc = (ne + nth - 1)/nth;
@@ -6119,59 +5160,62 @@ static void ggml_compute_forward_mul_mat_q4_0_f32(
         const int ic0 = dc*ith;
         const int ic1 = MIN(ic0 + dc, ne);
 
-        ggml_vec_cpy_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + ic0);
+        for (int i = ic0; i < ic1; ++i) {
+            ((float *) dst->data)[i] = GGML_FP16_TO_FP32(wdata[i]);
+        }
 
         for (int k = 1; k < nth; k++) {
-            ggml_vec_acc_f32(ic1 - ic0, (float *) dst->data + ic0, wdata + (ne + CACHE_LINE_SIZE_F32)*k + ic0);
+            for (int i = ic0; i < ic1; ++i) {
+                ((float *) dst->data)[i] += GGML_FP16_TO_FP32(wdata[(ne + CACHE_LINE_SIZE_F32)*k + i]);
+            }
         }
 
         return;
     }
 
     if (nb01 >= nb00) {
+        // fp16 -> half the size, so divide by 2
         // TODO: do not support transposed src1
+        assert(nb10/2 == sizeof(ggml_fp16_t));
 
-        // parallelize by src0 rows using ggml_vec_dot_q4_0
+        // parallelize by src0 rows using ggml_vec_dot_f16
 
         // total rows in src0
         const int nr = ne01*ne02*ne03;
 
-        // rows per thread
-        const int dr = (nr + nth - 1)/nth;
-
-        // row range for this thread
-        const int ir0 = dr*ith;
-        const int ir1 = MIN(ir0 + dr, nr);
+        // the rows of this thread
+        struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
 
-        void * wdata = params->wdata;
+        ggml_fp16_t * wdata = params->wdata;
 
-        for (int ir = ir0; ir < ir1; ++ir) {
-            // src0 indices
-            const int i03 = ir/(ne02*ne01);
-            const int i02 = (ir - i03*ne02*ne01)/ne01;
-            const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+        while (ggml_compute_rows_next(&rows)) {
+            for (int ir = rows.ir0; ir < rows.ir1; ++ir) {
+                // src0 indices
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-            const int i13 = i03;
-            const int i12 = i02;
+                const int i13 = i03;
+                const int i12 = i02;
 
-            const int i0 = i01;
-            const int i2 = i02;
-            const int i3 = i03;
+                const int i0 = i01;
+                const int i2 = i02;
+                const int i3 = i03;
 
-            void * src0_row = (void *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03));
-            char * src1_col =          ((char *)      wdata + (      (0 + i12*ne11 + i13*ne12*ne11)*ne00*GGML_TYPE_SIZE[GGML_TYPE_Q4_0])/GGML_BLCK_SIZE[GGML_TYPE_Q4_0]);
+                ggml_fp16_t * src0_row = (ggml_fp16_t *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03));
+                ggml_fp16_t * src1_col =                                wdata + (       0 + i12*ne11 + i13*ne12*ne11)*ne00;
 
-            float * dst_col = (float *) ((char *) dst->data + (i0*nb0 + 0*nb1 + i2*nb2 + i3*nb3));
+                float * dst_col = (float *) ((char *) dst->data + (i0*nb0 + 0*nb1 + i2*nb2 + i3*nb3));
 
-            assert(ne00 % 32 == 0);
+                assert(ne00 % 32 == 0);
 
-            for (int ic = 0; ic < ne11; ++ic) {
-                ggml_vec_dot_q4_0(ne00, &dst_col[ic*ne0], src0_row, ((void *) (src1_col + (ic*ne00*GGML_TYPE_SIZE[GGML_TYPE_Q4_0])/GGML_BLCK_SIZE[GGML_TYPE_Q4_0])));
+                for (int ic = 0; ic < ne11; ++ic) {
+                    ggml_vec_dot_f16(ne00, &dst_col[ic*ne0], src0_row, src1_col + ic*ne00);
+                }
             }
         }
     } else {
-        //printf("AAAAA ith = %d, nth = %d\n", ith, nth);
-        // parallelize by src1 columns using ggml_vec_mad_q4_0
+        // parallelize by src1 columns using ggml_vec_mad_f16
         // each thread has its own work data
         // during FINALIZE we accumulate all work data into dst
 
@@ -6187,7 +5231,7 @@ static void ggml_compute_forward_mul_mat_q4_0_f32(
 
         // work data for thread
         const int wo = (ne + CACHE_LINE_SIZE_F32)*ith;
-        float * const wdata = params->wdata;
+        ggml_fp16_t * const wdata = params->wdata;
 
         for (int i13 = 0; i13 < ne13; ++i13) {
             for (int i12 = 0; i12 < ne12; ++i12) {
@@ -6197,7 +5241,7 @@ static void ggml_compute_forward_mul_mat_q4_0_f32(
                     const int i2 = i12;
                     const int i3 = i13;
 
-                    float * dst_row = wdata + wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0;
+                    ggml_fp16_t * dst_row = wdata + wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0;
 
                     for (int ic = ic0; ic < ic1; ++ic) {
                         // src1 indices
@@ -6208,12 +5252,12 @@ static void ggml_compute_forward_mul_mat_q4_0_f32(
                         const int i02 = i12;
                         const int i00 = ic;
 
-                        assert(sizeof(float)*(wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0 + ne01) <= params->wsize);
+                        assert(sizeof(ggml_fp16_t)*(wo + i3*ne2*ne1*ne0 + i2*ne1*ne0 + i1*ne0 + ne01) <= params->wsize);
 
-                        void * src0_col =   (void *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03));
-                        float  src1_val = *(float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13));
+                        ggml_fp16_t * src0_col =  (ggml_fp16_t *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03));
+                        float         src1_val = *      (float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13));
 
-                        ggml_vec_mad_q4_0(ne01, dst_row, src0_col, src1_val);
+                        ggml_vec_mad_f16(ne01, dst_row, src0_col, src1_val);
                     }
                 }
             }
@@ -6233,7 +5277,101 @@ static void ggml_compute_forward_mul_mat_q4_0_f32(
     //}
 }
 
-static void ggml_compute_forward_mul_mat_q4_1_f32(
+// the type of the activations in the quantized matrix multiplications
+static bool g_q8_activations = true;
+
+void ggml_set_q8_activations(bool enable) {
+    g_q8_activations = enable;
+}
+
+bool ggml_get_q8_activations(void) {
+    return g_q8_activations;
+}
+
+// the 4-bit weight types supported by ggml_compute_forward_mul_mat_q_f32
+static inline bool ggml_is_quantized_q4(enum ggml_type type) {
+    return type == GGML_TYPE_Q4_0 || type == GGML_TYPE_Q4_1 || type == GGML_TYPE_Q4_0I || type == GGML_TYPE_Q4_0H;
+}
+
+// kernels used to multiply src0 of the given quantized type with F32 src1
+struct ggml_mul_mat_q_fns {
+    enum ggml_type vec_dot_type; // src1 is converted to this type during INIT
+
+    void (*quantize_row_vec_dot)(const float * x, void * y, int k);
+    void (*dequantize_row)      (const void * x, float * y, int k);
+
+    void (*vec_dot)(const int n, float * s, const void * x, const void * y);
+    void (*vec_mad)(const int n, float * y, void * x, const float v);
+
+    // optional: GGML_VEC_DOT_Q_UNROLL rows of src0 at once
+    void (*vec_dot_unroll)(const int n, const int xs, float * s, const void * x, const void * y);
+
+    // optional: GGML_VEC_DOT_Q_UNROLL rows of src0 times GGML_GEMM_Q_COLS columns of src1
+    void (*gemm)(const int n, const int xs, const int ys, float * s, const int ss, const void * x, const void * y);
+};
+
+static struct ggml_mul_mat_q_fns ggml_mul_mat_q_get_fns(enum ggml_type type) {
+    struct ggml_mul_mat_q_fns q = { 0 };
+
+    switch (type) {
+        case GGML_TYPE_Q4_0:
+            {
+                q.dequantize_row = g_kernels->dequantize_row_q4_0;
+                q.vec_mad        = ggml_vec_mad_q4_0;
+
+                if (g_q8_activations) {
+                    q.vec_dot_type         = GGML_TYPE_Q8_0;
+                    q.quantize_row_vec_dot = g_kernels->quantize_row_q8_0;
+                    q.vec_dot              = ggml_vec_dot_q4_0_q8_0;
+                    q.vec_dot_unroll       = ggml_vec_dot_q4_0_q8_0_unroll;
+                    q.gemm                 = ggml_gemm_q4_0_q8_0;
+                } else {
+                    q.vec_dot_type         = GGML_TYPE_Q4_0;
+                    q.quantize_row_vec_dot = g_kernels->quantize_row_q4_0;
+                    q.vec_dot              = ggml_vec_dot_q4_0;
+                }
+            } break;
+        case GGML_TYPE_Q4_1:
+            {
+                q.dequantize_row = g_kernels->dequantize_row_q4_1;
+                q.vec_mad        = ggml_vec_mad_q4_1;
+
+                if (g_q8_activations) {
+                    q.vec_dot_type         = GGML_TYPE_Q8_0;
+                    q.quantize_row_vec_dot = g_kernels->quantize_row_q8_0;
+                    q.vec_dot              = ggml_vec_dot_q4_1_q8_0;
+                } else {
+                    q.vec_dot_type         = GGML_TYPE_Q4_1;
+                    q.quantize_row_vec_dot = g_kernels->quantize_row_q4_1;
+                    q.vec_dot              = ggml_vec_dot_q4_1;
+                }
+            } break;
+        case GGML_TYPE_Q4_0I:
+            {
+                q.dequantize_row       = g_kernels->dequantize_row_q4_0i;
+                q.vec_mad              = ggml_vec_mad_q4_0i;
+                q.vec_dot_type         = GGML_TYPE_Q8_0;
+                q.quantize_row_vec_dot = g_kernels->quantize_row_q8_0;
+                q.vec_dot              = ggml_vec_dot_q4_0i_q8_0;
+            } break;
+        case GGML_TYPE_Q4_0H:
+            {
+                q.dequantize_row       = g_kernels->dequantize_row_q4_0h;
+                q.vec_mad              = ggml_vec_mad_q4_0h;
+                q.vec_dot_type         = GGML_TYPE_Q8_0;
+                q.quantize_row_vec_dot = g_kernels->quantize_row_q8_0;
+                q.vec_dot              = ggml_vec_dot_q4_0h_q8_0;
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+
+    return q;
+}
+
+static void ggml_compute_forward_mul_mat_q_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
@@ -6275,13 +5413,17 @@ static void ggml_compute_forward_mul_mat_q4_1_f32(
     const int ith = params->ith;
     const int nth = params->nth;
 
+    const enum ggml_type type = src0->type;
+    const struct ggml_mul_mat_q_fns q = ggml_mul_mat_q_get_fns(type);
+    const enum ggml_type vec_dot_type = q.vec_dot_type;
+
     GGML_ASSERT(ne02 == ne12);
     GGML_ASSERT(ne03 == ne13);
     GGML_ASSERT(ne2  == ne12);
     GGML_ASSERT(ne3  == ne13);
 
     // TODO: we don't support permuted src0
-    GGML_ASSERT(nb00 == (int) GGML_TYPE_SIZE[GGML_TYPE_Q4_1] || nb01 == (int) GGML_TYPE_SIZE[GGML_TYPE_Q4_1]);
+    GGML_ASSERT(nb00 == (int) GGML_TYPE_SIZE[type] || nb01 == (int) GGML_TYPE_SIZE[type]);
 
     // dst cannot be transposed or permuted
     GGML_ASSERT(nb0 == sizeof(float));
@@ -6326,7 +5468,7 @@ static void ggml_compute_forward_mul_mat_q4_1_f32(
                         //for (int i00 = 0; i00 < ne00; ++i00) {
                         //    wdata[id++] = GGML_FP16_TO_FP32(*(ggml_fp16_t *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01 + i00*nb00));
                         //}
-                        dequantize_row_q4_1((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01, wdata + id, ne00);
+                        q.dequantize_row((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01, wdata + id, ne00);
                         id += ne00;
                     }
                 }
@@ -6374,27 +5516,38 @@ static void ggml_compute_forward_mul_mat_q4_1_f32(
             }
         }
 
-        //printf("CBLAS = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
+        /*printf("CBLAS = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);*/
 
         return;
     }
 #endif
 
     if (params->type == GGML_TASK_INIT) {
-        //printf("HHHHHHHHH ith = %d, nth = %d\n", ith, nth);
         if (nb01 >= nb00) {
+            // INIT runs on all threads (see ggml_compute_forward_task_phases)
+            // each thread converts a range of src1 rows
+
+            const size_t row_size = (ne10*GGML_TYPE_SIZE[vec_dot_type])/GGML_BLCK_SIZE[vec_dot_type];
+
+            // total rows in src1
+            const int nr = ne11*ne12*ne13;
+
+            // rows per thread
+            const int dr = (nr + nth - 1)/nth;
+
+            // row range for this thread
+            const int ir0 = dr*ith;
+            const int ir1 = MIN(ir0 + dr, nr);
+
             char * wdata = params->wdata;
 
-            for (int i13 = 0; i13 < ne13; ++i13) {
-                for (int i12 = 0; i12 < ne12; ++i12) {
-                    for (int i11 = 0; i11 < ne11; ++i11) {
-                        //for (int i10 = 0; i10 < ne10; ++i10) {
-                        //    wdata[id++] = GGML_FP32_TO_FP16(*(float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + i10*nb10));
-                        //}
-                        quantize_row_q4_1((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11), (void *) wdata, ne10);
-                        wdata += (ne10*GGML_TYPE_SIZE[GGML_TYPE_Q4_1])/GGML_BLCK_SIZE[GGML_TYPE_Q4_1];
-                    }
-                }
+            for (int ir = ir0; ir < ir1; ++ir) {
+                // src1 indices
+                const int i13 = ir/(ne12*ne11);
+                const int i12 = (ir - i13*ne12*ne11)/ne11;
+                const int i11 = (ir - i13*ne12*ne11 - i12*ne11);
+
+                q.quantize_row_vec_dot((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11), (void *) (wdata + ir*row_size), ne10);
             }
 
             return;
@@ -6431,47 +5584,115 @@ static void ggml_compute_forward_mul_mat_q4_1_f32(
     if (nb01 >= nb00) {
         // TODO: do not support transposed src1
 
-        // parallelize by src0 rows using ggml_vec_dot_q4_1
+        // parallelize by src0 rows using q.vec_dot
 
         // total rows in src0
         const int nr = ne01*ne02*ne03;
 
-        // rows per thread
-        const int dr = (nr + nth - 1)/nth;
-
-        // row range for this thread
-        const int ir0 = dr*ith;
-        const int ir1 = MIN(ir0 + dr, nr);
+        // the rows of this thread
+        struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, GGML_VEC_DOT_Q_UNROLL);
 
         void * wdata = params->wdata;
 
-        for (int ir = ir0; ir < ir1; ++ir) {
-            // src0 indices
-            const int i03 = ir/(ne02*ne01);
-            const int i02 = (ir - i03*ne02*ne01)/ne01;
-            const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+        const size_t col_size = (ne00*GGML_TYPE_SIZE[vec_dot_type])/GGML_BLCK_SIZE[vec_dot_type];
+
+        if (q.gemm && ne11 >= GGML_MUL_MAT_Q_GEMM_MIN_NE11) {
+            // src0 rows per L2 block, a multiple of the tile height
+            const int blck = MAX(GGML_VEC_DOT_Q_UNROLL, (GGML_MUL_MAT_Q_GEMM_L2_BLOCK/nb01)/GGML_VEC_DOT_Q_UNROLL*GGML_VEC_DOT_Q_UNROLL);
+
+            while (ggml_compute_rows_next(&rows)) {
+                for (int ib0 = rows.ir0; ib0 < rows.ir1; ) {
+                    // src0 indices
+                    const int i03 = ib0/(ne02*ne01);
+                    const int i02 = (ib0 - i03*ne02*ne01)/ne01;
+                    const int i01 = (ib0 - i03*ne02*ne01 - i02*ne01);
+
+                    const int i13 = i03;
+                    const int i12 = i02;
+
+                    // the block does not cross into the next src0 matrix
+                    const int ib1 = MIN(MIN(ib0 + blck, rows.ir1), ib0 + ne01 - i01);
+
+                    char * src0_blk = (char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03);
+                    char * src1_mat = (char *)      wdata + (0 + i12*ne11 + i13*ne12*ne11)*col_size;
+
+                    float * dst_blk = (float *) ((char *) dst->data + (i01*nb0 + i02*nb2 + i03*nb3));
+
+                    for (int ic = 0; ic < ne11; ic += GGML_GEMM_Q_COLS) {
+                        const int nc = MIN(GGML_GEMM_Q_COLS, ne11 - ic);
+
+                        for (int ir = 0; ir < ib1 - ib0; ) {
+                            char  * src0_row = src0_blk + ir*nb01;
+                            char  * src1_col = src1_mat + ic*col_size;
+                            float * dst_col  = dst_blk  + ic*ne0 + ir;
+
+                            if (ir + GGML_VEC_DOT_Q_UNROLL <= ib1 - ib0) {
+                                if (nc == GGML_GEMM_Q_COLS) {
+                                    q.gemm(ne00, nb01, col_size, dst_col, ne0, src0_row, src1_col);
+                                } else {
+                                    for (int jc = 0; jc < nc; ++jc) {
+                                        q.vec_dot_unroll(ne00, nb01, dst_col + jc*ne0, src0_row, src1_col + jc*col_size);
+                                    }
+                                }
+
+                                ir += GGML_VEC_DOT_Q_UNROLL;
+                            } else {
+                                for (int jc = 0; jc < nc; ++jc) {
+                                    q.vec_dot(ne00, dst_col + jc*ne0, src0_row, src1_col + jc*col_size);
+                                }
+
+                                ir += 1;
+                            }
+                        }
+                    }
+
+                    ib0 = ib1;
+                }
+            }
+
+            return;
+        }
+
+        while (ggml_compute_rows_next(&rows)) {
+            for (int ir = rows.ir0; ir < rows.ir1; ) {
+                // src0 indices
+                const int i03 = ir/(ne02*ne01);
+                const int i02 = (ir - i03*ne02*ne01)/ne01;
+                const int i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+                const int i13 = i03;
+                const int i12 = i02;
+
+                const int i0 = i01;
+                const int i2 = i02;
+                const int i3 = i03;
 
-            const int i13 = i03;
-            const int i12 = i02;
+                void * src0_row = (void *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03));
+                char * src1_col =          ((char *)      wdata + (      (0 + i12*ne11 + i13*ne12*ne11)*ne00*GGML_TYPE_SIZE[vec_dot_type])/GGML_BLCK_SIZE[vec_dot_type]);
 
-            const int i0 = i01;
-            const int i2 = i02;
-            const int i3 = i03;
+                float * dst_col = (float *) ((char *) dst->data + (i0*nb0 + 0*nb1 + i2*nb2 + i3*nb3));
 
-            void * src0_row = (void *) ((char *) src0->data + (i01*nb01 + i02*nb02 + i03*nb03));
-            char * src1_col =          ((char *)      wdata + (      (0 + i12*ne11 + i13*ne12*ne11)*ne00*GGML_TYPE_SIZE[GGML_TYPE_Q4_1])/GGML_BLCK_SIZE[GGML_TYPE_Q4_1]);
+                assert(ne00 % 32 == 0);
 
-            float * dst_col = (float *) ((char *) dst->data + (i0*nb0 + 0*nb1 + i2*nb2 + i3*nb3));
+                // the next GGML_VEC_DOT_Q_UNROLL rows of the same src0 matrix share each column of src1
+                if (q.vec_dot_unroll && ir + GGML_VEC_DOT_Q_UNROLL <= rows.ir1 && i01 + GGML_VEC_DOT_Q_UNROLL <= ne01) {
+                    for (int ic = 0; ic < ne11; ++ic) {
+                        q.vec_dot_unroll(ne00, nb01, &dst_col[ic*ne0], src0_row, (void *) (src1_col + ic*col_size));
+                    }
 
-            assert(ne00 % 32 == 0);
+                    ir += GGML_VEC_DOT_Q_UNROLL;
+                } else {
+                    for (int ic = 0; ic < ne11; ++ic) {
+                        q.vec_dot(ne00, &dst_col[ic*ne0], src0_row, (void *) (src1_col + ic*col_size));
+                    }
 
-            for (int ic = 0; ic < ne11; ++ic) {
-                ggml_vec_dot_q4_1(ne00, &dst_col[ic*ne0], src0_row, ((void *) (src1_col + (ic*ne00*GGML_TYPE_SIZE[GGML_TYPE_Q4_1])/GGML_BLCK_SIZE[GGML_TYPE_Q4_1])));
+                    ir += 1;
+                }
             }
         }
     } else {
         //printf("AAAAA ith = %d, nth = %d\n", ith, nth);
-        // parallelize by src1 columns using ggml_vec_mad_q4_1
+        // parallelize by src1 columns using q.vec_mad
         // each thread has its own work data
         // during FINALIZE we accumulate all work data into dst
 
@@ -6513,7 +5734,7 @@ static void ggml_compute_forward_mul_mat_q4_1_f32(
                         void * src0_col =   (void *) ((char *) src0->data + (i00*nb00 + i02*nb02 + i03*nb03));
                         float  src1_val = *(float *) ((char *) src1->data + (i10*nb10 + i11*nb11 + i12*nb12 + i13*nb13));
 
-                        ggml_vec_mad_q4_1(ne01, dst_row, src0_col, src1_val);
+                        q.vec_mad(ne01, dst_row, src0_col, src1_val);
                     }
                 }
             }
@@ -6540,12 +5761,11 @@ static void ggml_compute_forward_mul_mat(
         struct ggml_tensor * dst) {
     switch (src0->type) {
         case GGML_TYPE_Q4_0:
-            {
-                ggml_compute_forward_mul_mat_q4_0_f32(params, src0, src1, dst);
-            } break;
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
             {
-                ggml_compute_forward_mul_mat_q4_1_f32(params, src0, src1, dst);
+                ggml_compute_forward_mul_mat_q_f32(params, src0, src1, dst);
             } break;
         case GGML_TYPE_F16:
             {
@@ -6555,6 +5775,7 @@ static void ggml_compute_forward_mul_mat(
             {
                 ggml_compute_forward_mul_mat_f32(params, src0, src1, dst);
             } break;
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -6612,21 +5833,17 @@ static void ggml_compute_forward_scale_f32(
     // scale factor
     const float v = *(float *) src1->data;
 
-    const int ith = params->ith;
-    const int nth = params->nth;
 
     const int nc = src0->ne[0];
     const int nr = ggml_nrows(src0);
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_scale_f32(nc, (float *) ((char *) dst->data + i1*(dst->nb[1])), v);
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i1 = rows.ir0; i1 < rows.ir1; i1++) {
+            ggml_vec_scale_f32(nc, (float *) ((char *) dst->data + i1*(dst->nb[1])), v);
+        }
     }
 }
 
@@ -6642,6 +5859,9 @@ static void ggml_compute_forward_scale(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -6706,13 +5926,11 @@ static void ggml_compute_forward_transpose(
 
 // ggml_compute_forward_get_rows
 
-static void ggml_compute_forward_get_rows_q4_0(
+static void ggml_compute_forward_get_rows_q(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
               struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
@@ -6720,43 +5938,25 @@ static void ggml_compute_forward_get_rows_q4_0(
     const int nc = src0->ne[0];
     const int nr = ggml_nelements(src1);
 
+    const enum ggml_type type = src0->type;
+    const struct ggml_mul_mat_q_fns q = ggml_mul_mat_q_get_fns(type);
+
     assert( dst->ne[0] == nc);
     assert( dst->ne[1] == nr);
-    assert(src0->nb[0] == GGML_TYPE_SIZE[GGML_TYPE_Q4_0]);
-
-    for (int i = 0; i < nr; ++i) {
-        const int r = ((int32_t *) src1->data)[i];
-
-        dequantize_row_q4_0(
-                (const void *) ((char *) src0->data + r*src0->nb[1]),
-                     (float *) ((char *)  dst->data + i*dst->nb[1]), nc);
-    }
-}
-
-static void ggml_compute_forward_get_rows_q4_1(
-        const struct ggml_compute_params * params,
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-
-    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
-        return;
-    }
+    assert(src0->nb[0] == GGML_TYPE_SIZE[type]);
 
-    const int nc = src0->ne[0];
-    const int nr = ggml_nelements(src1);
 
-    assert( dst->ne[0] == nc);
-    assert( dst->ne[1] == nr);
-    assert(src0->nb[0] == GGML_TYPE_SIZE[GGML_TYPE_Q4_1]);
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
 
-    for (int i = 0; i < nr; ++i) {
-        const int r = ((int32_t *) src1->data)[i];
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; ++i) {
+            const int r = ((int32_t *) src1->data)[i];
 
-        dequantize_row_q4_1(
-                (const void *) ((char *) src0->data + r*src0->nb[1]),
-                     (float *) ((char *)  dst->data + i*dst->nb[1]), nc);
+            q.dequantize_row(
+                    (const void *) ((char *) src0->data + r*src0->nb[1]),
+                         (float *) ((char *)  dst->data + i*dst->nb[1]), nc);
+        }
     }
 }
 
@@ -6765,8 +5965,6 @@ static void ggml_compute_forward_get_rows_f16(
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
               struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
@@ -6778,12 +5976,18 @@ static void ggml_compute_forward_get_rows_f16(
     assert( dst->ne[1] == nr);
     assert(src0->nb[0] == sizeof(ggml_fp16_t));
 
-    for (int i = 0; i < nr; ++i) {
-        const int r = ((int32_t *) src1->data)[i];
 
-        for (int j = 0; j < nc; ++j) {
-            ggml_fp16_t v = ((ggml_fp16_t *) ((char *) src0->data + r*src0->nb[1]))[j];
-            ((float *) ((char *)  dst->data + i*dst->nb[1]))[j] = GGML_FP16_TO_FP32(v);
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; ++i) {
+            const int r = ((int32_t *) src1->data)[i];
+
+            for (int j = 0; j < nc; ++j) {
+                ggml_fp16_t v = ((ggml_fp16_t *) ((char *) src0->data + r*src0->nb[1]))[j];
+                ((float *) ((char *)  dst->data + i*dst->nb[1]))[j] = GGML_FP16_TO_FP32(v);
+            }
         }
     }
 }
@@ -6793,8 +5997,6 @@ static void ggml_compute_forward_get_rows_f32(
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
               struct ggml_tensor * dst) {
-    assert(params->ith == 0);
-
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
@@ -6806,12 +6008,18 @@ static void ggml_compute_forward_get_rows_f32(
     assert( dst->ne[1] == nr);
     assert(src0->nb[0] == sizeof(float));
 
-    for (int i = 0; i < nr; ++i) {
-        const int r = ((int32_t *) src1->data)[i];
 
-        ggml_vec_cpy_f32(nc,
-                (float *) ((char *)  dst->data + i*dst->nb[1]),
-                (float *) ((char *) src0->data + r*src0->nb[1]));
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
+
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i = rows.ir0; i < rows.ir1; ++i) {
+            const int r = ((int32_t *) src1->data)[i];
+
+            ggml_vec_cpy_f32(nc,
+                    (float *) ((char *)  dst->data + i*dst->nb[1]),
+                    (float *) ((char *) src0->data + r*src0->nb[1]));
+        }
     }
 }
 
@@ -6822,12 +6030,11 @@ static void ggml_compute_forward_get_rows(
         struct ggml_tensor * dst) {
     switch (src0->type) {
         case GGML_TYPE_Q4_0:
-            {
-                ggml_compute_forward_get_rows_q4_0(params, src0, src1, dst);
-            } break;
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
             {
-                ggml_compute_forward_get_rows_q4_1(params, src0, src1, dst);
+                ggml_compute_forward_get_rows_q(params, src0, src1, dst);
             } break;
         case GGML_TYPE_F16:
             {
@@ -6837,6 +6044,7 @@ static void ggml_compute_forward_get_rows(
             {
                 ggml_compute_forward_get_rows_f32(params, src0, src1, dst);
             } break;
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -6872,7 +6080,6 @@ static void ggml_compute_forward_diag_mask_inf_f32(
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(src1->type == GGML_TYPE_I32);
     assert(ggml_nelements(src1) == 1);
 
@@ -6887,18 +6094,26 @@ static void ggml_compute_forward_diag_mask_inf_f32(
     const int n  = ggml_nrows(src0);
     const int nc = src0->ne[0];
     const int nr = src0->ne[1];
-    const int nz = n/nr;
 
     assert( dst->nb[0] == sizeof(float));
     assert(src0->nb[0] == sizeof(float));
 
-    for (int k = 0; k < nz; k++) {
-        for (int j = 0; j < nr; j++) {
-            for (int i = n_past; i < nc; i++) {
-                if (i > n_past + j) {
-                    *(float *)((char *) dst->data + k*dst->nb[2] + j*dst->nb[1] + i*dst->nb[0]) = -INFINITY;
-                }
-            }
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // rows per thread (the nz matrices are split together)
+    const int dr = (n + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, n);
+
+    for (int ir = ir0; ir < ir1; ir++) {
+        const int k = ir/nr;
+        const int j = ir - k*nr;
+
+        for (int i = n_past + j + 1; i < nc; i++) {
+            *(float *)((char *) dst->data + k*dst->nb[2] + j*dst->nb[1] + i*dst->nb[0]) = -INFINITY;
         }
     }
 }
@@ -6915,6 +6130,9 @@ static void ggml_compute_forward_diag_mask_inf(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -6942,59 +6160,55 @@ static void ggml_compute_forward_soft_max_f32(
 
     // TODO: handle transposed/permuted matrices
 
-    const int ith = params->ith;
-    const int nth = params->nth;
 
     const int nc = src0->ne[0];
     const int nr = ggml_nrows(src0);
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // the rows of this thread
+    struct ggml_compute_rows rows = ggml_compute_rows_init(params, nr, 1);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        float *p = (float *)((char *) dst->data + i1*dst->nb[1]);
+    while (ggml_compute_rows_next(&rows)) {
+        for (int i1 = rows.ir0; i1 < rows.ir1; i1++) {
+            float *p = (float *)((char *) dst->data + i1*dst->nb[1]);
 
-#ifndef NDEBUG
-        for (int i = 0; i < nc; ++i) {
-            //printf("p[%d] = %f\n", i, p[i]);
-            assert(!isnan(p[i]));
-        }
-#endif
+    #ifndef NDEBUG
+            for (int i = 0; i < nc; ++i) {
+                //printf("p[%d] = %f\n", i, p[i]);
+                assert(!isnan(p[i]));
+            }
+    #endif
 
-        float max = -INFINITY;
-        ggml_vec_max_f32(nc, &max, p);
+            float max = -INFINITY;
+            ggml_vec_max_f32(nc, &max, p);
 
-        ggml_float sum = 0.0;
+            ggml_float sum = 0.0;
 
-        uint16_t scvt;
-        for (int i = 0; i < nc; i++) {
-            if (p[i] == -INFINITY) {
-                p[i] = 0.0f;
-            } else {
-                //const float val = (p[i] == -INFINITY) ? 0.0 : exp(p[i] - max);
-                ggml_fp16_t s = GGML_FP32_TO_FP16(p[i] - max);
-                memcpy(&scvt, &s, sizeof(scvt));
-                const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt]);
-                sum += val;
-                p[i] = val;
+            uint16_t scvt;
+            for (int i = 0; i < nc; i++) {
+                if (p[i] == -INFINITY) {
+                    p[i] = 0.0f;
+                } else {
+                    //const float val = (p[i] == -INFINITY) ? 0.0 : exp(p[i] - max);
+                    ggml_fp16_t s = GGML_FP32_TO_FP16(p[i] - max);
+                    memcpy(&scvt, &s, sizeof(scvt));
+                    const float val = GGML_FP16_TO_FP32(table_exp_f16[scvt]);
+                    sum += val;
+                    p[i] = val;
+                }
             }
-        }
 
-        assert(sum > 0.0f);
+            assert(sum > 0.0f);
 
-        sum = 1.0/sum;
-        ggml_vec_scale_f32(nc, p, sum);
+            sum = 1.0/sum;
+            ggml_vec_scale_f32(nc, p, sum);
 
-#ifndef NDEBUG
-        for (int i = 0; i < nc; ++i) {
-            assert(!isnan(p[i]));
-            assert(!isinf(p[i]));
+    #ifndef NDEBUG
+            for (int i = 0; i < nc; ++i) {
+                assert(!isnan(p[i]));
+                assert(!isinf(p[i]));
+            }
+    #endif
         }
-#endif
     }
 }
 
@@ -7009,6 +6223,9 @@ static void ggml_compute_forward_soft_max(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -7027,9 +6244,8 @@ static void ggml_compute_forward_rope_f32(
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(src1->type == GGML_TYPE_I32);
-    assert(ggml_nelements(src1) == 3);
+    assert(ggml_nelements(src1) == 4);
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
@@ -7056,9 +6272,27 @@ static void ggml_compute_forward_rope_f32(
 
     assert(nb0 == sizeof(float));
 
+    // the first n_past rows of dim 2 are skipped in mode 1
+    const int i2s = mode == 0 ? 0 : MIN(n_past, ne2);
+
+    const int nr = ne3*(ne2 - i2s)*ne1;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    // row index
+    int ir = 0;
+
     // TODO: optimize
     for (int i3 = 0; i3 < ne3; i3++) {
-        for (int i2 = (mode == 0 ? 0 : n_past); i2 < ne2; i2++) {
+        for (int i2 = i2s; i2 < ne2; i2++) {
             const int p = (mode == 0 ? n_past + i2 : i2);
             // // print the first 5 and last 5 elements of src
             // float * src_data  = (float *)((char *) src0->data + i3*nb3 + i2*nb2);
@@ -7067,6 +6301,9 @@ static void ggml_compute_forward_rope_f32(
             //         src_data[0], src_data[1], src_data[2], src_data[3], src_data[4], // first 5
             //         src_data[n_dims-5], src_data[n_dims-4], src_data[n_dims-3], src_data[n_dims-2], src_data[n_dims-1]); // last 5
             for (int i1 = 0; i1 < ne1; i1++) {
+                if (ir++ < ir0) continue;
+                if (ir   > ir1) break;
+
                 int upper_bound;
                 if (is_llama == 1) {
                     // printf("  LLaMa detected");
@@ -7112,9 +6349,8 @@ static void ggml_compute_forward_rope_f16(
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
-    assert(params->ith == 0);
     assert(src1->type == GGML_TYPE_I32);
-    assert(ggml_nelements(src1) == 3);
+    assert(ggml_nelements(src1) == 4);
     assert(false); // not implemented for llama
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
@@ -7139,10 +6375,31 @@ static void ggml_compute_forward_rope_f16(
 
     assert(nb0 == sizeof(ggml_fp16_t));
 
+    // the first n_past rows of dim 2 are skipped in mode 1
+    const int i2s = mode == 0 ? 0 : MIN(n_past, ne2);
+
+    const int nr = ne3*(ne2 - i2s)*ne1;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    // row index
+    int ir = 0;
+
     for (int i3 = 0; i3 < ne3; i3++) {
-        for (int i2 = (mode == 0 ? 0 : n_past); i2 < ne2; i2++) {
+        for (int i2 = i2s; i2 < ne2; i2++) {
             const int p = (mode == 0 ? n_past + i2 : i2);
             for (int i1 = 0; i1 < ne1; i1++) {
+                if (ir++ < ir0) continue;
+                if (ir   > ir1) break;
+
                 for (int i0 = 0; i0 < n_dims; i0 += 2) {
                     const double theta = pow(10000.0, ((double)-i0)/n_dims);
 
@@ -7180,6 +6437,9 @@ static void ggml_compute_forward_rope(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -7448,6 +6708,9 @@ static void ggml_compute_forward_conv_1d_1s(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -7716,6 +6979,9 @@ static void ggml_compute_forward_conv_1d_2s(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -8201,6 +7467,9 @@ static void ggml_compute_forward_flash_attn(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -8413,6 +7682,9 @@ static void ggml_compute_forward_flash_ff(
             } break;
         case GGML_TYPE_Q4_0:
         case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q4_0I:
+        case GGML_TYPE_Q4_0H:
+        case GGML_TYPE_Q8_0:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -8425,6 +7697,62 @@ static void ggml_compute_forward_flash_ff(
 
 /////////////////////////////////
 
+// GGML_TASK_INIT and GGML_TASK_FINALIZE are no-ops for most nodes
+// ggml_graph_compute runs them, and synchronizes the threads around them, only if they are listed here
+enum ggml_task_phase {
+    GGML_TASK_PHASE_INIT          = 1, // INIT on the main thread, before the other threads start COMPUTE
+    GGML_TASK_PHASE_INIT_PARALLEL = 2, // INIT split across the n_tasks threads
+    GGML_TASK_PHASE_FINALIZE      = 4, // FINALIZE on the n_tasks threads, after all of them are done with COMPUTE
+};
+
+static int ggml_compute_forward_task_phases(const struct ggml_tensor * tensor) {
+    switch (tensor->op) {
+        case GGML_OP_MUL_MAT:
+            {
+                // transposed src0: every thread accumulates into its own part of wdata, FINALIZE sums them into dst
+                if (tensor->src0->nb[1] < tensor->src0->nb[0]) {
+                    return GGML_TASK_PHASE_INIT | GGML_TASK_PHASE_FINALIZE;
+                }
+
+                // quantization of src1 in ggml_compute_forward_mul_mat_q_f32
+                if (ggml_is_quantized_q4(tensor->src0->type)) {
+                    return GGML_TASK_PHASE_INIT_PARALLEL;
+                }
+
+                // conversion of src1 to F16 in ggml_compute_forward_mul_mat_f16_f32
+                return GGML_TASK_PHASE_INIT;
+            }
+        case GGML_OP_CONV_1D_1S:
+        case GGML_OP_CONV_1D_2S:
+            {
+                return GGML_TASK_PHASE_INIT;
+            }
+        default:
+            {
+                return 0;
+            }
+    }
+}
+
+// single-task ops that run long enough for the idle workers to sleep instead of spinning
+static bool ggml_compute_forward_is_long_single_task(const struct ggml_tensor * tensor) {
+    switch (tensor->op) {
+        case GGML_OP_MUL_MAT:
+            {
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+                // the BLAS library runs on its own threads
+                return ggml_compute_forward_mul_mat_use_blas(tensor->src0, tensor->src1, tensor);
+#else
+                return false;
+#endif
+            }
+        default:
+            {
+                return false;
+            }
+    }
+}
+
 static void ggml_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * tensor) {
     GGML_ASSERT(params);
 
@@ -8913,6 +8241,7 @@ struct ggml_cgraph ggml_build_forward(struct ggml_tensor * tensor) {
         /*.n_nodes      =*/ 0,
         /*.n_leafs      =*/ 0,
         /*.n_threads    =*/ 0,
+        /*.threadpool   =*/ NULL,
         /*.work_size    =*/ 0,
         /*.work         =*/ NULL,
         /*.nodes        =*/ { NULL },
@@ -8954,246 +8283,719 @@ struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cg
         }
     }
 
-    for (int i = gf->n_nodes - 1; i >= 0; i--) {
-        struct ggml_tensor * node = gf->nodes[i];
+    for (int i = gf->n_nodes - 1; i >= 0; i--) {
+        struct ggml_tensor * node = gf->nodes[i];
+
+        if (node->is_param) {
+            GGML_PRINT_DEBUG("%s: found root node %p\n", __func__, (void *) node);
+            ggml_build_forward_impl(&result, node->grad, true);
+        }
+    }
+
+    return result;
+}
+
+//
+// thread data
+//
+// synchronization is done via busy loops
+// I tried using spin locks, but not sure how to use them correctly - the things I tried were slower than busy loops
+//
+
+#ifdef __APPLE__
+
+//#include <os/lock.h>
+//
+//typedef os_unfair_lock ggml_lock_t;
+//
+//#define ggml_lock_init(x)    UNUSED(x)
+//#define ggml_lock_destroy(x) UNUSED(x)
+//#define ggml_lock_lock       os_unfair_lock_lock
+//#define ggml_lock_unlock     os_unfair_lock_unlock
+//
+//#define GGML_LOCK_INITIALIZER OS_UNFAIR_LOCK_INIT
+
+typedef int ggml_lock_t;
+
+#define ggml_lock_init(x)    UNUSED(x)
+#define ggml_lock_destroy(x) UNUSED(x)
+#define ggml_lock_lock(x)    UNUSED(x)
+#define ggml_lock_unlock(x)  UNUSED(x)
+
+#define GGML_LOCK_INITIALIZER 0
+
+typedef pthread_t ggml_thread_t;
+
+#define ggml_thread_create pthread_create
+#define ggml_thread_join   pthread_join
+
+typedef pthread_mutex_t ggml_mutex_t;
+typedef pthread_cond_t  ggml_cond_t;
+
+#define ggml_mutex_init(x)  pthread_mutex_init(x, NULL)
+#define ggml_mutex_destroy  pthread_mutex_destroy
+#define ggml_mutex_lock     pthread_mutex_lock
+#define ggml_mutex_unlock   pthread_mutex_unlock
+#define ggml_cond_init(x)   pthread_cond_init(x, NULL)
+#define ggml_cond_destroy   pthread_cond_destroy
+#define ggml_cond_wait      pthread_cond_wait
+#define ggml_cond_broadcast pthread_cond_broadcast
+
+#else
+
+//typedef pthread_spinlock_t ggml_lock_t;
+
+//#define ggml_lock_init(x) pthread_spin_init(x, PTHREAD_PROCESS_PRIVATE)
+//#define ggml_lock_destroy pthread_spin_destroy
+//#define ggml_lock_lock    pthread_spin_lock
+//#define ggml_lock_unlock  pthread_spin_unlock
+
+typedef int ggml_lock_t;
+
+#define ggml_lock_init(x)    UNUSED(x)
+#define ggml_lock_destroy(x) UNUSED(x)
+#define ggml_lock_lock(x)    UNUSED(x)
+#define ggml_lock_unlock(x)  UNUSED(x)
+
+#define GGML_LOCK_INITIALIZER 0
+
+typedef pthread_t ggml_thread_t;
+
+#define ggml_thread_create pthread_create
+#define ggml_thread_join   pthread_join
+
+typedef pthread_mutex_t ggml_mutex_t;
+typedef pthread_cond_t  ggml_cond_t;
+
+#define ggml_mutex_init(x)  pthread_mutex_init(x, NULL)
+#define ggml_mutex_destroy  pthread_mutex_destroy
+#define ggml_mutex_lock     pthread_mutex_lock
+#define ggml_mutex_unlock   pthread_mutex_unlock
+#define ggml_cond_init(x)   pthread_cond_init(x, NULL)
+#define ggml_cond_destroy   pthread_cond_destroy
+#define ggml_cond_wait      pthread_cond_wait
+#define ggml_cond_broadcast pthread_cond_broadcast
+
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ggml_spin_pause() _mm_pause()
+#elif defined(__aarch64__)
+#define ggml_spin_pause() __asm__ __volatile__("yield")
+#else
+#define ggml_spin_pause()
+#endif
+
+// number of checks a waiting thread spins for before it blocks on a condition variable
+static int g_n_spin = GGML_DEFAULT_N_SPIN;
+
+void ggml_set_n_spin(int n_spin) {
+    g_n_spin = MAX(0, n_spin);
+}
+
+int ggml_get_n_spin(void) {
+    return g_n_spin;
+}
+
+static enum ggml_sched_rows g_sched_rows = GGML_SCHED_ROWS_CHUNKED;
+
+void ggml_set_sched_rows(enum ggml_sched_rows sched_rows) {
+    g_sched_rows = sched_rows;
+}
+
+enum ggml_sched_rows ggml_get_sched_rows(void) {
+    return g_sched_rows;
+}
+
+struct ggml_compute_state_shared {
+    ggml_lock_t spin;
+
+    int n_threads;
+    int n_spin;
+
+    // synchronization primitives
+    atomic_int  n_ready;
+    atomic_bool has_work;
+    atomic_bool stop; // stop all threads
+
+    // the threads that are done spinning block on cond
+    // whoever changes has_work or n_ready wakes them up if n_sleeping > 0
+    atomic_int    n_sleeping;
+    ggml_mutex_t  mutex;
+    ggml_cond_t   cond;
+
+    // set while the workers are not expected to get work soon: between graphs, or while the main thread
+    // runs a long single-task node (e.g. a BLAS call that uses its own threads) - the waiting threads
+    // block right away instead of spinning first
+    atomic_bool sleep;
+};
+
+// scheduling data of a graph node, see ggml_graph_compute_sched
+struct ggml_compute_node {
+    int stage;   // nodes of the same stage do not depend on each other
+    int thread0; // the thread that runs task 0 of the node
+
+    // the part of the work buffer of the node
+    size_t wsize;
+    size_t woffs;
+
+    // chunks of rows taken during COMPUTE (GGML_SCHED_ROWS_CHUNKED)
+    atomic_int chunk;
+};
+
+// nodes that run together: each thread runs its part of all of them, with no barrier in between
+struct ggml_compute_stage {
+    struct ggml_tensor       ** nodes; // all the nodes of the graph
+    struct ggml_compute_node  * sched; // all the nodes of the graph
+
+    const int * ids; // the nodes of the stage
+    int n_ids;
+
+    char * wdata;
+
+    // the threads of a node take its rows in chunks during COMPUTE
+    bool chunked;
+};
+
+struct ggml_compute_state {
+    ggml_thread_t thrd;
+
+    // type and thread index, the nodes come from stage
+    struct ggml_compute_params params;
+    const struct ggml_compute_stage * stage;
+
+    // when the thread was done with its part of the last round
+    int64_t t_done;
+
+    struct ggml_compute_state_shared * shared;
+};
+
+enum ggml_compute_wait {
+    GGML_COMPUTE_WAIT_WORK,    // has_work is set
+    GGML_COMPUTE_WAIT_NO_WORK, // has_work is cleared
+    GGML_COMPUTE_WAIT_READY,   // all the threads have left the barrier (n_ready == 0)
+};
+
+static bool ggml_graph_compute_wait_done(struct ggml_compute_state_shared * shared, enum ggml_compute_wait what) {
+    if (atomic_load(&shared->stop)) {
+        return true;
+    }
+
+    switch (what) {
+        case GGML_COMPUTE_WAIT_WORK:    return  atomic_load(&shared->has_work);
+        case GGML_COMPUTE_WAIT_NO_WORK: return !atomic_load(&shared->has_work);
+        case GGML_COMPUTE_WAIT_READY:   return  atomic_load(&shared->n_ready) == 0;
+    }
+
+    return true;
+}
+
+// spin for up to n_spin checks, then sleep until ggml_graph_compute_notify
+static void ggml_graph_compute_wait(struct ggml_compute_state_shared * shared, enum ggml_compute_wait what) {
+    if (!atomic_load(&shared->sleep)) {
+        for (int i = 0; i < shared->n_spin; i++) {
+            if (ggml_graph_compute_wait_done(shared, what)) {
+                return;
+            }
+            ggml_spin_pause();
+        }
+    }
+
+    if (ggml_graph_compute_wait_done(shared, what)) {
+        return;
+    }
+
+    ggml_mutex_lock(&shared->mutex);
+    atomic_fetch_add(&shared->n_sleeping, 1);
+    while (!ggml_graph_compute_wait_done(shared, what)) {
+        ggml_cond_wait(&shared->cond, &shared->mutex);
+    }
+    atomic_fetch_sub(&shared->n_sleeping, 1);
+    ggml_mutex_unlock(&shared->mutex);
+}
+
+// call after changing has_work, n_ready or stop
+// a waiter increments n_sleeping before its last check, so either it sees the change or we see it sleeping
+static void ggml_graph_compute_notify(struct ggml_compute_state_shared * shared) {
+    if (atomic_load(&shared->n_sleeping) > 0) {
+        ggml_mutex_lock(&shared->mutex);
+        ggml_cond_broadcast(&shared->cond);
+        ggml_mutex_unlock(&shared->mutex);
+    }
+}
+
+// barrier of all the threads - the last one to arrive clears has_work
+static void ggml_graph_compute_barrier_arrive(struct ggml_compute_state_shared * shared) {
+    if (atomic_fetch_add(&shared->n_ready, 1) == shared->n_threads - 1) {
+        atomic_store(&shared->has_work, false);
+        ggml_graph_compute_notify(shared);
+    } else {
+        ggml_graph_compute_wait(shared, GGML_COMPUTE_WAIT_NO_WORK);
+    }
+}
+
+static void ggml_graph_compute_barrier_leave(struct ggml_compute_state_shared * shared) {
+    if (atomic_fetch_sub(&shared->n_ready, 1) == 1) {
+        ggml_graph_compute_notify(shared);
+    }
+}
+
+// run the tasks of thread params->ith (out of params->nth) of the nodes of the stage, for the task type params->type
+static void ggml_graph_compute_stage(const struct ggml_compute_params * params, const struct ggml_compute_stage * stage) {
+    for (int k = 0; k < stage->n_ids; k++) {
+        const int i = stage->ids[k];
+
+        struct ggml_tensor       * node  = stage->nodes[i];
+        struct ggml_compute_node * sched = &stage->sched[i];
+
+        // the tasks of the node go to the threads starting from thread0
+        const int ith = (params->ith - sched->thread0 + params->nth) % params->nth;
+
+        if (ith >= node->n_tasks) {
+            continue;
+        }
+
+        if (params->type != GGML_TASK_COMPUTE) {
+            const int phases = ggml_compute_forward_task_phases(node);
+
+            if (params->type == GGML_TASK_INIT) {
+                if (!(phases & GGML_TASK_PHASE_INIT_PARALLEL) && (ith > 0 || !(phases & GGML_TASK_PHASE_INIT))) {
+                    continue;
+                }
+            } else if (!(phases & GGML_TASK_PHASE_FINALIZE)) {
+                continue;
+            }
+        }
+
+        struct ggml_compute_params node_params = {
+            /*.type  =*/ params->type,
+            /*.ith   =*/ ith,
+            /*.nth   =*/ node->n_tasks,
+            /*.wsize =*/ sched->wsize,
+            /*.wdata =*/ sched->wsize > 0 ? stage->wdata + sched->woffs : NULL,
+            /*.chunk =*/ params->type == GGML_TASK_COMPUTE && stage->chunked && node->n_tasks > 1 ? &sched->chunk : NULL,
+        };
+
+        ggml_compute_forward(&node_params, node);
+    }
+}
+
+static thread_ret_t ggml_graph_compute_thread(void * data) {
+    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+
+    ggml_thread_bind(state->params.ith, state->params.nth);
+
+    while (true) {
+        ggml_graph_compute_barrier_arrive(state->shared);
+        ggml_graph_compute_barrier_leave(state->shared);
+
+        // wait for work
+        ggml_graph_compute_wait(state->shared, GGML_COMPUTE_WAIT_WORK);
+
+        // check if we should stop
+        if (atomic_load(&state->shared->stop)) {
+            break;
+        }
+
+        if (state->stage) {
+            ggml_graph_compute_stage(&state->params, state->stage);
+
+            state->stage  = NULL;
+            state->t_done = ggml_time_us();
+        } else {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+struct ggml_threadpool {
+    struct ggml_compute_state_shared shared;
+
+    // n_threads - 1 workers, the thread that calls ggml_graph_compute is the first one
+    struct ggml_compute_state * workers;
+
+    // see ggml_threadpool_wait_us
+    int64_t wait_us;
+};
+
+struct ggml_threadpool * ggml_threadpool_create(int n_threads) {
+    if (n_threads <= 0) {
+        n_threads = 8;
+    }
+
+    struct ggml_threadpool * threadpool = malloc(sizeof(struct ggml_threadpool));
+    GGML_ASSERT(threadpool);
+
+    struct ggml_compute_state_shared * shared = &threadpool->shared;
+
+    shared->n_threads = n_threads;
+    shared->n_spin    = g_n_spin;
+
+    ggml_lock_init(&shared->spin);
+    ggml_mutex_init(&shared->mutex);
+    ggml_cond_init(&shared->cond);
+
+    atomic_store(&shared->n_ready,    0);
+    atomic_store(&shared->has_work,   true);
+    atomic_store(&shared->stop,       false);
+    atomic_store(&shared->n_sleeping, 0);
+    atomic_store(&shared->sleep,      false);
+
+    threadpool->wait_us = 0;
+
+    // the calling thread is thread 0 - it only moves to its cpu when the cpus were chosen explicitly
+    if (g_affinity_n_cpus > 0) {
+        ggml_thread_bind(0, n_threads);
+    }
+
+    threadpool->workers = n_threads > 1 ? malloc(sizeof(struct ggml_compute_state)*(n_threads - 1)) : NULL;
+
+    for (int j = 0; j < n_threads - 1; j++) {
+        threadpool->workers[j] = (struct ggml_compute_state) {
+            .thrd   = 0,
+            .params = {
+                .type  = GGML_TASK_COMPUTE,
+                .ith   = j + 1,
+                .nth   = n_threads,
+                .wsize = 0,
+                .wdata = NULL,
+                .chunk = NULL,
+            },
+            .stage  = NULL,
+            .t_done = 0,
+            .shared = shared,
+        };
+
+        int rc = ggml_thread_create(&threadpool->workers[j].thrd, NULL, ggml_graph_compute_thread, &threadpool->workers[j]);
+        GGML_ASSERT(rc == 0);
+        UNUSED(rc);
+    }
+
+    // wait for the workers to enter their wait-for-work loop - this is where ggml_graph_compute expects them
+    if (n_threads > 1) {
+        ggml_graph_compute_barrier_arrive(shared);
+        ggml_graph_compute_barrier_leave(shared);
+        ggml_graph_compute_wait(shared, GGML_COMPUTE_WAIT_READY);
+    }
+
+    // park the workers until the first graph comes
+    atomic_store(&shared->sleep, true);
+
+    return threadpool;
+}
+
+void ggml_threadpool_free(struct ggml_threadpool * threadpool) {
+    if (threadpool == NULL) {
+        return;
+    }
+
+    struct ggml_compute_state_shared * shared = &threadpool->shared;
+
+    atomic_store(&shared->stop, true);
+    atomic_store(&shared->has_work, true);
+    ggml_graph_compute_notify(shared);
+
+    for (int j = 0; j < shared->n_threads - 1; j++) {
+        int rc = ggml_thread_join(threadpool->workers[j].thrd, NULL);
+        GGML_ASSERT(rc == 0);
+        UNUSED(rc);
+    }
+
+    ggml_lock_destroy(&shared->spin);
+    ggml_mutex_destroy(&shared->mutex);
+    ggml_cond_destroy(&shared->cond);
+
+    free(threadpool->workers);
+    free(threadpool);
+}
+
+int ggml_threadpool_n_threads(const struct ggml_threadpool * threadpool) {
+    return threadpool->shared.n_threads;
+}
+
+int64_t ggml_threadpool_wait_us(const struct ggml_threadpool * threadpool) {
+    return threadpool->wait_us;
+}
 
-        if (node->is_param) {
-            GGML_PRINT_DEBUG("%s: found root node %p\n", __func__, (void *) node);
-            ggml_build_forward_impl(&result, node->grad, true);
-        }
+// start a round of a stage on the workers
+// the calling thread runs its own part (thread 0) and then waits for the workers with ggml_graph_compute_join
+static void ggml_graph_compute_launch(
+        struct ggml_threadpool * threadpool,
+        enum ggml_task_type type,
+        const struct ggml_compute_stage * stage) {
+    struct ggml_compute_state_shared * shared = &threadpool->shared;
+
+    ggml_graph_compute_barrier_arrive(shared);
+
+    for (int j = 0; j < shared->n_threads - 1; j++) {
+        threadpool->workers[j].params.type = type;
+        threadpool->workers[j].stage       = stage;
     }
 
-    return result;
+    ggml_graph_compute_barrier_leave(shared);
+    ggml_graph_compute_wait(shared, GGML_COMPUTE_WAIT_READY);
+
+    atomic_store(&shared->has_work, true);
+    ggml_graph_compute_notify(shared);
 }
 
-//
-// thread data
-//
-// synchronization is done via busy loops
-// I tried using spin locks, but not sure how to use them correctly - the things I tried were slower than busy loops
-//
+static void ggml_graph_compute_join(struct ggml_threadpool * threadpool) {
+    struct ggml_compute_state_shared * shared = &threadpool->shared;
 
-#ifdef __APPLE__
+    const int64_t t_done = ggml_time_us();
 
-//#include <os/lock.h>
-//
-//typedef os_unfair_lock ggml_lock_t;
-//
-//#define ggml_lock_init(x)    UNUSED(x)
-//#define ggml_lock_destroy(x) UNUSED(x)
-//#define ggml_lock_lock       os_unfair_lock_lock
-//#define ggml_lock_unlock     os_unfair_lock_unlock
-//
-//#define GGML_LOCK_INITIALIZER OS_UNFAIR_LOCK_INIT
+    ggml_graph_compute_barrier_arrive(shared);
+    ggml_graph_compute_barrier_leave(shared);
+    ggml_graph_compute_wait(shared, GGML_COMPUTE_WAIT_READY);
 
-typedef int ggml_lock_t;
+    // how long the threads waited for the last one
+    int64_t t_last = t_done;
+    for (int j = 0; j < shared->n_threads - 1; j++) {
+        t_last = MAX(t_last, threadpool->workers[j].t_done);
+    }
 
-#define ggml_lock_init(x)    UNUSED(x)
-#define ggml_lock_destroy(x) UNUSED(x)
-#define ggml_lock_lock(x)    UNUSED(x)
-#define ggml_lock_unlock(x)  UNUSED(x)
+    int64_t wait_us = t_last - t_done;
+    for (int j = 0; j < shared->n_threads - 1; j++) {
+        wait_us += t_last - threadpool->workers[j].t_done;
+    }
 
-#define GGML_LOCK_INITIALIZER 0
+    threadpool->wait_us += wait_us;
+}
 
-typedef pthread_t ggml_thread_t;
+// number of earlier nodes that a node is checked against in ggml_graph_compute_sched
+// the nodes before them are assumed to conflict with it
+#define GGML_SCHED_WINDOW 64
 
-#define ggml_thread_create pthread_create
-#define ggml_thread_join   pthread_join
+struct ggml_mem_range {
+    const char * lo;
+    const char * hi;
+};
 
-#else
+// from the first byte to past the last byte of the tensor data, for any order of the dimensions
+static struct ggml_mem_range ggml_mem_range_of(const struct ggml_tensor * tensor) {
+    size_t size = (tensor->ne[0]/GGML_BLCK_SIZE[tensor->type] - 1)*tensor->nb[0] + GGML_TYPE_SIZE[tensor->type];
+    for (int i = 1; i < GGML_MAX_DIMS; i++) {
+        size += (tensor->ne[i] - 1)*tensor->nb[i];
+    }
 
-//typedef pthread_spinlock_t ggml_lock_t;
+    return (struct ggml_mem_range) { (const char *) tensor->data, (const char *) tensor->data + size };
+}
 
-//#define ggml_lock_init(x) pthread_spin_init(x, PTHREAD_PROCESS_PRIVATE)
-//#define ggml_lock_destroy pthread_spin_destroy
-//#define ggml_lock_lock    pthread_spin_lock
-//#define ggml_lock_unlock  pthread_spin_unlock
+static bool ggml_mem_range_overlap(struct ggml_mem_range a, struct ggml_mem_range b) {
+    return a.lo < b.hi && b.lo < a.hi;
+}
 
-typedef int ggml_lock_t;
+// the memory that a node writes (dst) and reads (src) when it is computed
+struct ggml_compute_node_mem {
+    struct ggml_mem_range dst;
+    struct ggml_mem_range src[2 + GGML_MAX_OPT];
+    int n_src;
+};
 
-#define ggml_lock_init(x)    UNUSED(x)
-#define ggml_lock_destroy(x) UNUSED(x)
-#define ggml_lock_lock(x)    UNUSED(x)
-#define ggml_lock_unlock(x)  UNUSED(x)
+static void ggml_compute_node_mem_init(struct ggml_compute_node_mem * mem, const struct ggml_tensor * node) {
+    mem->n_src = 0;
 
-#define GGML_LOCK_INITIALIZER 0
+    switch (node->op) {
+        case GGML_OP_NONE:
+        case GGML_OP_RESHAPE:
+        case GGML_OP_VIEW:
+        case GGML_OP_PERMUTE:
+        case GGML_OP_TRANSPOSE:
+            {
+                // no computation
+                mem->dst = (struct ggml_mem_range) { NULL, NULL };
+                return;
+            }
+        default:
+            break;
+    }
 
-typedef pthread_t ggml_thread_t;
+    mem->dst = ggml_mem_range_of(node);
 
-#define ggml_thread_create pthread_create
-#define ggml_thread_join   pthread_join
+    if (node->src0) {
+        mem->src[mem->n_src++] = ggml_mem_range_of(node->src0);
+    }
+    if (node->src1) {
+        mem->src[mem->n_src++] = ggml_mem_range_of(node->src1);
+    }
+    for (int k = 0; k < GGML_MAX_OPT; k++) {
+        if (node->opt[k]) {
+            mem->src[mem->n_src++] = ggml_mem_range_of(node->opt[k]);
+        }
+    }
+}
 
-#endif
+static bool ggml_compute_node_mem_is_nop(const struct ggml_compute_node_mem * mem) {
+    return mem->dst.lo == NULL;
+}
 
-struct ggml_compute_state_shared {
-    ggml_lock_t spin;
+// true if node b cannot run at the same time as the earlier node a
+static bool ggml_compute_node_mem_conflict(const struct ggml_compute_node_mem * a, const struct ggml_compute_node_mem * b) {
+    if (ggml_mem_range_overlap(a->dst, b->dst)) {
+        return true;
+    }
+    for (int k = 0; k < b->n_src; k++) {
+        if (ggml_mem_range_overlap(a->dst, b->src[k])) {
+            return true;
+        }
+    }
+    for (int k = 0; k < a->n_src; k++) {
+        if (ggml_mem_range_overlap(a->src[k], b->dst)) {
+            return true;
+        }
+    }
 
-    int n_threads;
+    return false;
+}
 
-    // synchronization primitives
-    atomic_int  n_ready;
-    atomic_bool has_work;
-    atomic_bool stop; // stop all threads
-};
+// put every node in the earliest stage that comes after all the earlier nodes it conflicts with: the ones that write
+// memory it reads or writes, or read memory it writes
+// the memory is compared instead of following src0/src1 because some nodes only meet through views of the same
+// tensor - e.g. the KV cache is written by a ggml_cpy into a view and read later through another view
+// returns the number of stages
+static int ggml_graph_compute_sched(
+        const struct ggml_cgraph * cgraph,
+        struct ggml_compute_node * sched,
+        struct ggml_compute_node_mem * mem) {
+    int n_stages = 0;
 
-struct ggml_compute_state {
-    ggml_thread_t thrd;
+    // no node can go before this stage: it is after the nodes that left the window and the nodes that run alone
+    int stage_min = 0;
 
-    struct ggml_compute_params params;
-    struct ggml_tensor * node;
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
 
-    struct ggml_compute_state_shared * shared;
-};
+        ggml_compute_node_mem_init(&mem[i], node);
 
-static thread_ret_t ggml_graph_compute_thread(void * data) {
-    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+        if (i > GGML_SCHED_WINDOW && !ggml_compute_node_mem_is_nop(&mem[i - GGML_SCHED_WINDOW - 1])) {
+            stage_min = MAX(stage_min, sched[i - GGML_SCHED_WINDOW - 1].stage + 1);
+        }
 
-    const int n_threads = state->shared->n_threads;
+        int stage = stage_min;
 
-    while (true) {
-        if (atomic_fetch_add(&state->shared->n_ready, 1) == n_threads - 1) {
-            atomic_store(&state->shared->has_work, false);
+        if (ggml_compute_node_mem_is_nop(&mem[i])) {
+            // any stage will do
+        } else if (node->n_tasks == 1 && ggml_compute_forward_is_long_single_task(node)) {
+            // alone in a stage after all the earlier nodes, so that it has the whole CPU
+            stage     = n_stages;
+            stage_min = n_stages + 1;
         } else {
-            while (atomic_load(&state->shared->has_work)) {
-                if (atomic_load(&state->shared->stop)) {
-                    return 0;
+            for (int j = i - 1; j >= MAX(0, i - GGML_SCHED_WINDOW); j--) {
+                if (sched[j].stage >= stage && ggml_compute_node_mem_conflict(&mem[j], &mem[i])) {
+                    stage = sched[j].stage + 1;
                 }
-                ggml_lock_lock  (&state->shared->spin);
-                ggml_lock_unlock(&state->shared->spin);
             }
         }
 
-        atomic_fetch_sub(&state->shared->n_ready, 1);
+        sched[i].stage = stage;
 
-        // wait for work
-        while (!atomic_load(&state->shared->has_work)) {
-            if (atomic_load(&state->shared->stop)) {
-                return 0;
-            }
-            ggml_lock_lock  (&state->shared->spin);
-            ggml_lock_unlock(&state->shared->spin);
-        }
+        n_stages = MAX(n_stages, stage + 1);
+    }
 
-        // check if we should stop
-        if (atomic_load(&state->shared->stop)) {
-            break;
-        }
+    return n_stages;
+}
 
-        if (state->node) {
-            if (state->params.ith < state->params.nth) {
-                ggml_compute_forward(&state->params, state->node);
-            }
+// the smallest cost of a task (see ggml_compute_node_cost) that is worth waking a thread for: about the time of
+// handing a node to a thread and waiting for it at the end of the round, a few microseconds
+#define GGML_TASK_MIN_COST (32*1024)
 
-            state->node = NULL;
-        } else {
-            break;
-        }
+// rough cost of a node in element operations: a multiply-add of mul_mat counts 1/8 (the dot products run on SIMD
+// registers of 8 floats and stream src0 from memory once), the ops with exp/tanh or two passes over a row count 4
+static int64_t ggml_compute_node_cost(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_MUL_MAT:
+            return node->src0->ne[0]*(int64_t) ggml_nelements(node)/8;
+        case GGML_OP_GELU:
+        case GGML_OP_SILU:
+        case GGML_OP_NORM:
+        case GGML_OP_RMS_NORM:
+        case GGML_OP_SOFT_MAX:
+        case GGML_OP_ROPE:
+            return 4*(int64_t) ggml_nelements(node);
+        default:
+            return ggml_nelements(node);
     }
+}
 
-    return 0;
+// the threads of a node: as many as have GGML_TASK_MIN_COST of work each, up to n_threads
+// the other threads are free for the nodes of the same stage or wait for the next round
+static int ggml_compute_n_tasks(const struct ggml_tensor * node, int n_threads) {
+    const int64_t n_tasks = ggml_compute_node_cost(node)/GGML_TASK_MIN_COST;
+
+    return (int) MAX(1, MIN(n_threads, n_tasks));
 }
 
-void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
-    if (cgraph->n_threads <= 0) {
-        cgraph->n_threads = 8;
-    }
+// how ggml_graph_compute runs a graph: the tasks of the nodes, their stages and their parts of the work buffer
+struct ggml_compute_plan {
+    struct ggml_compute_node     * sched;
+    struct ggml_compute_node_mem * mem;
 
-    const int n_threads = cgraph->n_threads;
+    // the nodes of each stage in graph order: stage s is ids[stage_ids[s]] .. ids[stage_ids[s + 1] - 1]
+    int * ids;
+    int * stage_ids;
+    int   n_stages;
 
-    struct ggml_compute_state_shared state_shared = {
-        /*.spin      =*/ GGML_LOCK_INITIALIZER,
-        /*.n_threads =*/ n_threads,
-        /*.n_ready   =*/ 0,
-        /*.has_work  =*/ false,
-        /*.stop      =*/ false,
-    };
-    struct ggml_compute_state * workers = n_threads > 1 ? alloca(sizeof(struct ggml_compute_state)*(n_threads - 1)) : NULL;
+    size_t work_size;
+};
 
-    // create thread pool
-    if (n_threads > 1) {
-        ggml_lock_init(&state_shared.spin);
-
-        atomic_store(&state_shared.has_work, true);
-
-        for (int j = 0; j < n_threads - 1; j++) {
-            workers[j] = (struct ggml_compute_state) {
-                .thrd   = 0,
-                .params = {
-                    .type  = GGML_TASK_COMPUTE,
-                    .ith   = j + 1,
-                    .nth   = n_threads,
-                    .wsize = cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-                    .wdata = cgraph->work ? cgraph->work->data : NULL,
-                },
-                .node   = NULL,
-                .shared = &state_shared,
-            };
+// the stages depend on where the tensors are (see ggml_graph_compute_sched) - so does the size of the work buffer
+static void ggml_graph_compute_plan(struct ggml_cgraph * cgraph, const int n_threads, struct ggml_compute_plan * plan) {
+    const int n_nodes = cgraph->n_nodes;
 
-            int rc = ggml_thread_create(&workers[j].thrd, NULL, ggml_graph_compute_thread, &workers[j]);
-            GGML_ASSERT(rc == 0);
-            UNUSED(rc);
-        }
-    }
+    struct ggml_compute_node     * sched = malloc(n_nodes*sizeof(struct ggml_compute_node));
+    struct ggml_compute_node_mem * mem   = malloc(n_nodes*sizeof(struct ggml_compute_node_mem));
 
-    // initialize tasks + work buffer
+    // initialize tasks + the work buffer size of each node
     {
-        size_t work_size = 0;
-
         // thread scheduling for the different operations
-        for (int i = 0; i < cgraph->n_nodes; i++) {
+        for (int i = 0; i < n_nodes; i++) {
             struct ggml_tensor * node = cgraph->nodes[i];
 
+            sched[i].wsize = 0;
+
             switch (node->op) {
                 case GGML_OP_DUP:
-                    {
-                        node->n_tasks = 1;
-                    } break;
                 case GGML_OP_ADD:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
                 case GGML_OP_SUB:
                 case GGML_OP_MUL:
                 case GGML_OP_DIV:
                 case GGML_OP_SQR:
                 case GGML_OP_SQRT:
-                case GGML_OP_SUM:
-                case GGML_OP_MEAN:
                 case GGML_OP_REPEAT:
                 case GGML_OP_ABS:
                 case GGML_OP_SGN:
                 case GGML_OP_NEG:
                 case GGML_OP_STEP:
                 case GGML_OP_RELU:
+                    {
+                        node->n_tasks = ggml_compute_n_tasks(node, n_threads);
+                    } break;
+                case GGML_OP_SUM:
+                case GGML_OP_MEAN:
                     {
                         node->n_tasks = 1;
                     } break;
                 case GGML_OP_GELU:
                     {
-                        node->n_tasks = n_threads;
+                        node->n_tasks = ggml_compute_n_tasks(node, n_threads);
                     } break;
                 case GGML_OP_SILU:
                     {
-                        node->n_tasks = n_threads;
+                        node->n_tasks = ggml_compute_n_tasks(node, n_threads);
                     } break;
                 case GGML_OP_NORM:
                     {
-                        node->n_tasks = n_threads;
+                        node->n_tasks = ggml_compute_n_tasks(node, n_threads);
                     } break;
                 case GGML_OP_RMS_NORM:
                     {
-                        node->n_tasks = n_threads;
+                        node->n_tasks = ggml_compute_n_tasks(node, n_threads);
                     } break;
                 case GGML_OP_MUL_MAT:
                     {
-                        node->n_tasks = n_threads;
-
-                        // TODO: use different scheduling for different matrix sizes
-                        //const int nr0 = ggml_nrows(node->src0);
-                        //const int nr1 = ggml_nrows(node->src1);
-
-                        //node->n_tasks = MIN(n_threads, MAX(1, nr0/128));
-                        //printf("nr0 = %8d, nr1 = %8d, nr0*nr1 = %8d, n_tasks = %d\n", nr0, nr1, nr0*nr1, node->n_tasks);
+                        node->n_tasks = ggml_compute_n_tasks(node, n_threads);
 
                         size_t cur = 0;
 
@@ -9206,8 +9008,7 @@ void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph)
                                 node->src1->type == GGML_TYPE_F32) {
 #if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
                                 if (ggml_compute_forward_mul_mat_use_blas(node->src0, node->src1, node)) {
-                                    node->n_tasks = 1; // TODO: this actually is doing nothing
-                                                       //       the threads are still spinning
+                                    node->n_tasks = 1;
                                     cur = GGML_TYPE_SIZE[GGML_TYPE_F32]*(node->src0->ne[0]*node->src0->ne[1]);
                                     //printf("src0: ne0 = %d, ne1 = %d, ne = %d\n", node->src0->ne[0], node->src0->ne[1], node->src0->ne[0]*node->src0->ne[1]);
                                     //printf("src1: ne0 = %d, ne1 = %d, ne = %d\n", node->src1->ne[0], node->src1->ne[1], node->src1->ne[0]*node->src1->ne[1]);
@@ -9220,59 +9021,53 @@ void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph)
 #endif
                             } else if (node->src0->type == GGML_TYPE_F32 &&
                                        node->src1->type == GGML_TYPE_F32) {
-                                cur = 0;
-                            } else if (node->src0->type == GGML_TYPE_Q4_0 &&
-                                       node->src1->type == GGML_TYPE_F32) {
 #if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
                                 if (ggml_compute_forward_mul_mat_use_blas(node->src0, node->src1, node)) {
                                     node->n_tasks = 1;
-                                    cur = GGML_TYPE_SIZE[GGML_TYPE_F32]*(node->src0->ne[0]*node->src0->ne[1]);
-                                } else {
-                                    cur = (GGML_TYPE_SIZE[GGML_TYPE_Q4_0]*ggml_nelements(node->src1))/GGML_BLCK_SIZE[GGML_TYPE_Q4_0];
                                 }
-#else
-                                cur = (GGML_TYPE_SIZE[GGML_TYPE_Q4_0]*ggml_nelements(node->src1))/GGML_BLCK_SIZE[GGML_TYPE_Q4_0];
 #endif
-                            } else if (node->src0->type == GGML_TYPE_Q4_1 &&
+                                cur = 0;
+                            } else if (ggml_is_quantized_q4(node->src0->type) &&
                                        node->src1->type == GGML_TYPE_F32) {
+                                const enum ggml_type vec_dot_type = ggml_mul_mat_q_get_fns(node->src0->type).vec_dot_type;
 #if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
                                 if (ggml_compute_forward_mul_mat_use_blas(node->src0, node->src1, node)) {
                                     node->n_tasks = 1;
                                     cur = GGML_TYPE_SIZE[GGML_TYPE_F32]*(node->src0->ne[0]*node->src0->ne[1]);
                                 } else {
-                                    cur = (GGML_TYPE_SIZE[GGML_TYPE_Q4_1]*ggml_nelements(node->src1))/GGML_BLCK_SIZE[GGML_TYPE_Q4_1];
+                                    cur = (GGML_TYPE_SIZE[vec_dot_type]*ggml_nelements(node->src1))/GGML_BLCK_SIZE[vec_dot_type];
                                 }
 #else
-                                cur = (GGML_TYPE_SIZE[GGML_TYPE_Q4_1]*ggml_nelements(node->src1))/GGML_BLCK_SIZE[GGML_TYPE_Q4_1];
+                                cur = (GGML_TYPE_SIZE[vec_dot_type]*ggml_nelements(node->src1))/GGML_BLCK_SIZE[vec_dot_type];
 #endif
                             } else {
                                 GGML_ASSERT(false);
                             }
                         }
 
-                        work_size = MAX(work_size, cur);
+                        sched[i].wsize = cur;
                     } break;
                 case GGML_OP_SCALE:
                     {
-                        node->n_tasks = n_threads;
+                        node->n_tasks = ggml_compute_n_tasks(node, n_threads);
                     } break;
                 case GGML_OP_CPY:
+                case GGML_OP_GET_ROWS:
+                case GGML_OP_DIAG_MASK_INF:
+                    {
+                        node->n_tasks = ggml_compute_n_tasks(node, n_threads);
+                    } break;
                 case GGML_OP_RESHAPE:
                 case GGML_OP_VIEW:
                 case GGML_OP_PERMUTE:
                 case GGML_OP_TRANSPOSE:
-                case GGML_OP_GET_ROWS:
-                case GGML_OP_DIAG_MASK_INF:
                     {
                         node->n_tasks = 1;
                     } break;
                 case GGML_OP_SOFT_MAX:
-                    {
-                        node->n_tasks = n_threads;
-                    } break;
                 case GGML_OP_ROPE:
                     {
-                        node->n_tasks = 1;
+                        node->n_tasks = ggml_compute_n_tasks(node, n_threads);
                     } break;
                 case GGML_OP_CONV_1D_1S:
                 case GGML_OP_CONV_1D_2S:
@@ -9302,229 +9097,340 @@ void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph)
                             GGML_ASSERT(false);
                         }
 
-                        work_size = MAX(work_size, cur);
+                        sched[i].wsize = cur;
                     } break;
                 case GGML_OP_FLASH_ATTN:
                     {
                         node->n_tasks = n_threads;
 
-                        size_t cur = 0;
+                        size_t cur = 0;
+
+                        const int ne11 = ggml_up(node->src1->ne[1], GGML_SOFT_MAX_UNROLL);
+
+                        if (node->src1->type == GGML_TYPE_F32) {
+                            cur  = sizeof(float)*ne11*node->n_tasks; // TODO: this can become (n_tasks-1)
+                            cur += sizeof(float)*ne11*node->n_tasks; // this is overestimated by x2
+                        }
+
+                        if (node->src1->type == GGML_TYPE_F16) {
+                            cur  = sizeof(float)*ne11*node->n_tasks; // TODO: this can become (n_tasks-1)
+                            cur += sizeof(float)*ne11*node->n_tasks; // this is overestimated by x2
+                        }
+
+                        sched[i].wsize = cur;
+                    } break;
+                case GGML_OP_FLASH_FF:
+                    {
+                        node->n_tasks = n_threads;
+
+                        size_t cur = 0;
+
+                        if (node->src1->type == GGML_TYPE_F32) {
+                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
+                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
+                        }
+
+                        if (node->src1->type == GGML_TYPE_F16) {
+                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
+                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
+                        }
+
+                        sched[i].wsize = cur;
+                    } break;
+                case GGML_OP_NONE:
+                    {
+                        node->n_tasks = 1;
+                    } break;
+                case GGML_OP_COUNT:
+                    {
+                        GGML_ASSERT(false);
+                    } break;
+            }
+        }
+    }
+
+    // group the nodes into stages
+    const int n_stages = ggml_graph_compute_sched(cgraph, sched, mem);
+
+    int * ids       = malloc(n_nodes*sizeof(int));
+    int * stage_ids = calloc(n_stages + 1, sizeof(int));
+
+    // spread the tasks of the nodes of a stage over the threads and give each node its own part of the work buffer
+    size_t work_size = 0;
+
+    {
+        for (int i = 0; i < n_nodes; i++) {
+            stage_ids[sched[i].stage + 1]++;
+        }
+        for (int s = 0; s < n_stages; s++) {
+            stage_ids[s + 1] += stage_ids[s];
+        }
+        for (int i = 0; i < n_nodes; i++) {
+            ids[stage_ids[sched[i].stage]++] = i;
+        }
+        for (int s = n_stages; s > 0; s--) {
+            stage_ids[s] = stage_ids[s - 1];
+        }
+        stage_ids[0] = 0;
+
+        for (int s = 0; s < n_stages; s++) {
+            int    thread0 = 0;
+            size_t woffs   = 0;
+
+            for (int k = stage_ids[s]; k < stage_ids[s + 1]; k++) {
+                const int i = ids[k];
+
+                sched[i].thread0 = 0;
+                sched[i].woffs   = woffs;
+
+                atomic_store(&sched[i].chunk, 0);
+
+                if (ggml_compute_node_mem_is_nop(&mem[i])) {
+                    continue;
+                }
+
+                sched[i].thread0 = thread0;
+                thread0 = (thread0 + cgraph->nodes[i]->n_tasks) % n_threads;
+
+                if (sched[i].wsize > 0) {
+                    // the threads of a node keep their parts of the work buffer CACHE_LINE_SIZE bytes apart
+                    sched[i].wsize += CACHE_LINE_SIZE*(n_threads - 1);
+
+                    woffs += (sched[i].wsize + CACHE_LINE_SIZE - 1)/CACHE_LINE_SIZE*CACHE_LINE_SIZE;
+                }
+            }
+
+            work_size = MAX(work_size, woffs);
+        }
+    }
+
+    *plan = (struct ggml_compute_plan) {
+        /*.sched     =*/ sched,
+        /*.mem       =*/ mem,
+        /*.ids       =*/ ids,
+        /*.stage_ids =*/ stage_ids,
+        /*.n_stages  =*/ n_stages,
+        /*.work_size =*/ work_size,
+    };
+}
+
+static void ggml_compute_plan_free(struct ggml_compute_plan * plan) {
+    free(plan->ids);
+    free(plan->stage_ids);
+    free(plan->mem);
+    free(plan->sched);
+}
+
+// the threads that ggml_graph_compute runs a graph on
+static int ggml_graph_n_threads(const struct ggml_cgraph * cgraph) {
+    if (cgraph->threadpool) {
+        return cgraph->threadpool->shared.n_threads;
+    }
+
+    return cgraph->n_threads > 0 ? cgraph->n_threads : 8;
+}
+
+size_t ggml_graph_work_size(struct ggml_cgraph * cgraph) {
+    struct ggml_compute_plan plan;
+    ggml_graph_compute_plan(cgraph, ggml_graph_n_threads(cgraph), &plan);
 
-                        const int ne11 = ggml_up(node->src1->ne[1], GGML_SOFT_MAX_UNROLL);
+    const size_t work_size = plan.work_size;
 
-                        if (node->src1->type == GGML_TYPE_F32) {
-                            cur  = sizeof(float)*ne11*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*ne11*node->n_tasks; // this is overestimated by x2
-                        }
+    ggml_compute_plan_free(&plan);
 
-                        if (node->src1->type == GGML_TYPE_F16) {
-                            cur  = sizeof(float)*ne11*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*ne11*node->n_tasks; // this is overestimated by x2
-                        }
+    return work_size;
+}
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_FLASH_FF:
-                    {
-                        node->n_tasks = n_threads;
+void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
+    struct ggml_threadpool * threadpool = cgraph->threadpool;
 
-                        size_t cur = 0;
+    cgraph->n_threads = ggml_graph_n_threads(cgraph);
 
-                        if (node->src1->type == GGML_TYPE_F32) {
-                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
-                        }
+    const int n_threads = cgraph->n_threads;
 
-                        if (node->src1->type == GGML_TYPE_F16) {
-                            cur  = sizeof(float)*node->src1->ne[1]*node->n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*node->src1->ne[1]*node->n_tasks; // this is overestimated by x2
-                        }
+    // without a thread pool from the caller, use a temporary one for this graph
+    if (threadpool == NULL && n_threads > 1) {
+        threadpool = ggml_threadpool_create(n_threads);
+    }
 
-                        work_size = MAX(work_size, cur);
-                    } break;
-                case GGML_OP_NONE:
-                    {
-                        node->n_tasks = 1;
-                    } break;
-                case GGML_OP_COUNT:
-                    {
-                        GGML_ASSERT(false);
-                    } break;
-            }
-        }
+    struct ggml_compute_state_shared * state_shared = threadpool ? &threadpool->shared : NULL;
 
-        if (cgraph->work != NULL && work_size > cgraph->work_size) {
-            GGML_ASSERT(false); // TODO: better handling
-        }
+    struct ggml_compute_plan plan;
+    ggml_graph_compute_plan(cgraph, n_threads, &plan);
 
-        if (work_size > 0 && cgraph->work == NULL) {
-            cgraph->work_size = work_size + CACHE_LINE_SIZE*(n_threads - 1);
+    struct ggml_compute_node     * sched     = plan.sched;
+    struct ggml_compute_node_mem * mem       = plan.mem;
+    const int                    * ids       = plan.ids;
+    const int                    * stage_ids = plan.stage_ids;
 
-            GGML_PRINT_DEBUG("%s: allocating work buffer for graph (%zu bytes)\n", __func__, cgraph->work_size);
-            cgraph->work = ggml_new_tensor_1d(ctx, GGML_TYPE_I8, cgraph->work_size);
-        }
+    const int n_stages = plan.n_stages;
+
+    // the workers spin again before sleeping
+    if (n_threads > 1) {
+        atomic_store(&state_shared->sleep, false);
     }
 
-    const int64_t perf_start_cycles  = ggml_perf_cycles();
-    const int64_t perf_start_time_us = ggml_perf_time_us();
+    // the work buffer of an earlier computation can be too small if the graph is now computed on more threads
+    if (plan.work_size > 0 && (cgraph->work == NULL || plan.work_size > cgraph->work_size)) {
+        cgraph->work_size = plan.work_size;
 
-    for (int i = 0; i < cgraph->n_nodes; i++) {
-        GGML_PRINT_DEBUG_5("%s: %d/%d\n", __func__, i, cgraph->n_nodes);
+        GGML_PRINT_DEBUG("%s: allocating work buffer for graph (%zu bytes)\n", __func__, cgraph->work_size);
 
-        struct ggml_tensor * node = cgraph->nodes[i];
+        ctx->no_alloc_save = ctx->no_alloc;
+        ctx->no_alloc = false;
 
-        // TODO: this could be used to avoid unnecessary computations, but it needs to be improved
-        //if (node->grad == NULL && node->perf_runs > 0) {
-        //    continue;
-        //}
+        cgraph->work = ggml_new_tensor_1d(ctx, GGML_TYPE_I8, cgraph->work_size);
 
-        const int64_t perf_node_start_cycles  = ggml_perf_cycles();
-        const int64_t perf_node_start_time_us = ggml_perf_time_us();
+        ctx->no_alloc = ctx->no_alloc_save;
+    }
 
-        // INIT
-        struct ggml_compute_params params = {
-            /*.type  =*/ GGML_TASK_INIT,
-            /*.ith   =*/ 0,
-            /*.nth   =*/ node->n_tasks,
-            /*.wsize =*/ cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-            /*.wdata =*/ cgraph->work ? cgraph->work->data : NULL,
+    const int64_t perf_start_cycles  = ggml_perf_cycles();
+    const int64_t perf_start_time_us = ggml_perf_time_us();
+
+    for (int s = 0; s < n_stages; s++) {
+        GGML_PRINT_DEBUG_5("%s: stage %d/%d\n", __func__, s, n_stages);
+
+        const struct ggml_compute_stage stage = {
+            /*.nodes   =*/ cgraph->nodes,
+            /*.sched   =*/ sched,
+            /*.ids     =*/ ids + stage_ids[s],
+            /*.n_ids   =*/ stage_ids[s + 1] - stage_ids[s],
+            /*.wdata   =*/ cgraph->work ? cgraph->work->data : NULL,
+            /*.chunked =*/ g_sched_rows == GGML_SCHED_ROWS_CHUNKED,
         };
 
-        ggml_compute_forward(&params, node);
+        const int64_t perf_stage_start_cycles  = ggml_perf_cycles();
+        const int64_t perf_stage_start_time_us = ggml_perf_time_us();
 
-        // COMPUTE
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
+        int  n_busy   = 0;     // nodes that compute something
+        int  n_tasks  = 1;     // max tasks of a node
+        bool init     = false;
+        bool finalize = false;
+        bool is_long  = false;
 
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+        // INIT and FINALIZE can stay on this thread if all of their tasks are task 0 of nodes that start on thread 0
+        bool init_main     = true;
+        bool finalize_main = true;
 
-            // launch thread pool
-            for (int j = 0; j < n_threads - 1; j++) {
-                workers[j].params = (struct ggml_compute_params) {
-                    .type  = GGML_TASK_COMPUTE,
-                    .ith   = j + 1,
-                    .nth   = node->n_tasks,
-                    .wsize = cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-                    .wdata = cgraph->work ? cgraph->work->data : NULL,
-                };
-                workers[j].node = node;
-            }
+        for (int k = 0; k < stage.n_ids; k++) {
+            const int i = stage.ids[k];
 
-            atomic_fetch_sub(&state_shared.n_ready, 1);
+            const struct ggml_tensor * node = cgraph->nodes[i];
 
-            while (atomic_load(&state_shared.n_ready) > 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
+            if (ggml_compute_node_mem_is_nop(&mem[i])) {
+                continue;
             }
 
-            atomic_store(&state_shared.has_work, true);
-        }
+            const int phases = ggml_compute_forward_task_phases(node);
 
-        params.type = GGML_TASK_COMPUTE;
-        ggml_compute_forward(&params, node);
+            n_busy++;
+            n_tasks = MAX(n_tasks, node->n_tasks);
 
-        // wait for thread pool
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
+            if (phases & (GGML_TASK_PHASE_INIT | GGML_TASK_PHASE_INIT_PARALLEL)) {
+                init = true;
+                init_main = init_main && sched[i].thread0 == 0 && (!(phases & GGML_TASK_PHASE_INIT_PARALLEL) || node->n_tasks == 1);
             }
 
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
+            if (phases & GGML_TASK_PHASE_FINALIZE) {
+                finalize = true;
+                finalize_main = finalize_main && sched[i].thread0 == 0 && node->n_tasks == 1;
             }
 
-            atomic_fetch_sub(&state_shared.n_ready, 1);
-
-            while (atomic_load(&state_shared.n_ready) != 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+            is_long = is_long || (node->n_tasks == 1 && ggml_compute_forward_is_long_single_task(node));
         }
 
-        // FINALIZE
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
+        // a single node with a single task runs on this thread only
+        const bool parallel = n_threads > 1 && (n_tasks > 1 || n_busy > 1);
 
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
-            }
+        // the workers have nothing to do until the next stage - if this one takes a while, let them sleep without spinning first
+        const bool workers_sleep = n_threads > 1 && !parallel && is_long;
 
-            // launch thread pool
-            for (int j = 0; j < n_threads - 1; j++) {
-                workers[j].params = (struct ggml_compute_params) {
-                    .type  = GGML_TASK_FINALIZE,
-                    .ith   = j + 1,
-                    .nth   = node->n_tasks,
-                    .wsize = cgraph->work ? ggml_nbytes(cgraph->work) : 0,
-                    .wdata = cgraph->work ? cgraph->work->data : NULL,
-                };
-                workers[j].node = node;
+        if (workers_sleep) {
+            atomic_store(&state_shared->sleep, true);
+        }
+
+        struct ggml_compute_params params = {
+            /*.type  =*/ GGML_TASK_INIT,
+            /*.ith   =*/ 0,
+            /*.nth   =*/ n_threads,
+            /*.wsize =*/ 0,
+            /*.wdata =*/ NULL,
+            /*.chunk =*/ NULL,
+        };
+
+        // INIT
+        if (init) {
+            if (parallel && !init_main) {
+                ggml_graph_compute_launch(threadpool, GGML_TASK_INIT, &stage);
             }
 
-            atomic_fetch_sub(&state_shared.n_ready, 1);
+            ggml_graph_compute_stage(&params, &stage);
 
-            while (atomic_load(&state_shared.n_ready) > 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
+            if (parallel && !init_main) {
+                ggml_graph_compute_join(threadpool);
             }
+        }
 
-            atomic_store(&state_shared.has_work, true);
+        // COMPUTE
+        if (parallel) {
+            ggml_graph_compute_launch(threadpool, GGML_TASK_COMPUTE, &stage);
         }
 
-        params.type = GGML_TASK_FINALIZE;
-        ggml_compute_forward(&params, node);
+        params.type = GGML_TASK_COMPUTE;
+        ggml_graph_compute_stage(&params, &stage);
 
-        // wait for thread pool
-        if (node->n_tasks > 1) {
-            if (atomic_fetch_add(&state_shared.n_ready, 1) == n_threads - 1) {
-                atomic_store(&state_shared.has_work, false);
-            }
+        if (parallel) {
+            ggml_graph_compute_join(threadpool);
+        }
 
-            while (atomic_load(&state_shared.has_work)) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
+        // FINALIZE
+        if (finalize) {
+            if (parallel && !finalize_main) {
+                ggml_graph_compute_launch(threadpool, GGML_TASK_FINALIZE, &stage);
             }
 
-            atomic_fetch_sub(&state_shared.n_ready, 1);
+            params.type = GGML_TASK_FINALIZE;
+            ggml_graph_compute_stage(&params, &stage);
 
-            while (atomic_load(&state_shared.n_ready) != 0) {
-                ggml_lock_lock  (&state_shared.spin);
-                ggml_lock_unlock(&state_shared.spin);
+            if (parallel && !finalize_main) {
+                ggml_graph_compute_join(threadpool);
             }
         }
 
-        // performance stats (node)
+        if (workers_sleep) {
+            atomic_store(&state_shared->sleep, false);
+        }
+
+        // performance stats (nodes)
+        // the nodes of a stage run at the same time - each one is charged an equal share of the stage
         {
-            int64_t perf_cycles_cur  = ggml_perf_cycles()  - perf_node_start_cycles;
-            int64_t perf_time_us_cur = ggml_perf_time_us() - perf_node_start_time_us;
+            int64_t perf_cycles_cur  = ggml_perf_cycles()  - perf_stage_start_cycles;
+            int64_t perf_time_us_cur = ggml_perf_time_us() - perf_stage_start_time_us;
+
+            for (int k = 0; k < stage.n_ids; k++) {
+                const int i = stage.ids[k];
+
+                struct ggml_tensor * node = cgraph->nodes[i];
+
+                node->perf_runs++;
 
-            node->perf_runs++;
-            node->perf_cycles  += perf_cycles_cur;
-            node->perf_time_us += perf_time_us_cur;
+                if (!ggml_compute_node_mem_is_nop(&mem[i])) {
+                    node->perf_cycles  += perf_cycles_cur/n_busy;
+                    node->perf_time_us += perf_time_us_cur/n_busy;
+                }
+            }
         }
     }
 
-    // join thread pool
-    if (n_threads > 1) {
-        atomic_store(&state_shared.stop, true);
-        atomic_store(&state_shared.has_work, true);
+    ggml_compute_plan_free(&plan);
 
-        for (int j = 0; j < n_threads - 1; j++) {
-            int rc = ggml_thread_join(workers[j].thrd, NULL);
-            GGML_ASSERT(rc == 0);
-            UNUSED(rc);
-        }
+    // park the workers until the next graph
+    if (n_threads > 1) {
+        atomic_store(&state_shared->sleep, true);
+    }
 
-        ggml_lock_destroy(&state_shared.spin);
+    if (threadpool != cgraph->threadpool) {
+        ggml_threadpool_free(threadpool);
     }
 
     // performance stats (graph)
@@ -9545,6 +9451,308 @@ void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph)
     }
 }
 
+void ggml_graph_set_view_offset(struct ggml_cgraph * cgraph, struct ggml_tensor * view, size_t offset) {
+    GGML_ASSERT(view->op == GGML_OP_VIEW);
+    GGML_ASSERT(offset + ggml_nbytes(view) <= ggml_nbytes(view->src0));
+
+    const void * data_old = view->data;
+
+    // the view and the nodes that alias it: same data and the view (or one of its aliases) as a source
+    struct ggml_tensor * moved[GGML_MAX_OPT + 4];
+    int n_moved = 0;
+
+    view->data      = (char *) view->src0->data + offset;
+    view->view_offs = view->src0->view_offs + offset;
+    moved[n_moved++] = view;
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        if (node == view || node->data != data_old) {
+            continue;
+        }
+
+        for (int k = 0; k < n_moved; k++) {
+            if (node->src0 == moved[k] || node->src1 == moved[k]) {
+                GGML_ASSERT(n_moved < (int) (sizeof(moved)/sizeof(moved[0])));
+
+                node->data      = view->data;
+                node->view_offs = view->view_offs;
+                moved[n_moved++] = node;
+                break;
+            }
+        }
+    }
+}
+
+// ggml_graph_alloc
+
+// the free blocks of the buffer, by offset - the end of the buffer (past the last used block) is free too
+#define GGML_ALLOC_MAX_FREE 256
+
+struct ggml_alloc_block {
+    size_t offs;
+    size_t size;
+};
+
+struct ggml_alloc {
+    size_t end;      // end of the last used block
+    size_t end_max;  // the size of the buffer that is needed
+
+    int n_free;
+    struct ggml_alloc_block free[GGML_ALLOC_MAX_FREE];
+};
+
+// the smallest free block that fits, or the end of the buffer
+static size_t ggml_alloc_block_new(struct ggml_alloc * alloc, size_t size) {
+    size = ((size + GGML_MEM_ALIGN - 1)/GGML_MEM_ALIGN)*GGML_MEM_ALIGN;
+
+    int best = -1;
+    for (int i = 0; i < alloc->n_free; i++) {
+        if (alloc->free[i].size >= size && (best < 0 || alloc->free[i].size < alloc->free[best].size)) {
+            best = i;
+        }
+    }
+
+    if (best < 0) {
+        const size_t offs = alloc->end;
+
+        alloc->end     += size;
+        alloc->end_max  = MAX(alloc->end_max, alloc->end);
+
+        return offs;
+    }
+
+    struct ggml_alloc_block * block = &alloc->free[best];
+
+    const size_t offs = block->offs;
+
+    block->offs += size;
+    block->size -= size;
+
+    if (block->size == 0) {
+        alloc->n_free--;
+        memmove(block, block + 1, (alloc->n_free - best)*sizeof(struct ggml_alloc_block));
+    }
+
+    return offs;
+}
+
+static void ggml_alloc_block_free(struct ggml_alloc * alloc, size_t offs, size_t size) {
+    size = ((size + GGML_MEM_ALIGN - 1)/GGML_MEM_ALIGN)*GGML_MEM_ALIGN;
+
+    // the first free block after the freed one
+    int i = 0;
+    while (i < alloc->n_free && alloc->free[i].offs < offs) {
+        i++;
+    }
+
+    const bool merge_prev = i > 0 && alloc->free[i - 1].offs + alloc->free[i - 1].size == offs;
+    const bool merge_next = i < alloc->n_free && offs + size == alloc->free[i].offs;
+
+    if (merge_prev && merge_next) {
+        alloc->free[i - 1].size += size + alloc->free[i].size;
+        alloc->n_free--;
+        memmove(&alloc->free[i], &alloc->free[i + 1], (alloc->n_free - i)*sizeof(struct ggml_alloc_block));
+        i--;
+    } else if (merge_prev) {
+        alloc->free[i - 1].size += size;
+        i--;
+    } else if (merge_next) {
+        alloc->free[i].offs  = offs;
+        alloc->free[i].size += size;
+    } else {
+        GGML_ASSERT(alloc->n_free < GGML_ALLOC_MAX_FREE);
+
+        memmove(&alloc->free[i + 1], &alloc->free[i], (alloc->n_free - i)*sizeof(struct ggml_alloc_block));
+        alloc->free[i] = (struct ggml_alloc_block) { offs, size };
+        alloc->n_free++;
+    }
+
+    // a free block at the end goes back to the end of the buffer
+    if (i == alloc->n_free - 1 && alloc->free[i].offs + alloc->free[i].size == alloc->end) {
+        alloc->end = alloc->free[i].offs;
+        alloc->n_free--;
+    }
+}
+
+// what ggml_graph_alloc knows about a tensor of the graph
+struct ggml_alloc_tensor {
+    struct ggml_tensor * tensor;
+
+    int n_children; // the nodes that read the tensor
+    int n_reads;    // the nodes that read the tensor or a view of it, not computed yet (for a tensor that owns data)
+
+    bool   placed;
+    bool   keep;    // an input or an output - never freed
+    size_t offs;
+};
+
+static struct ggml_alloc_tensor * ggml_alloc_tensor_get(
+        struct ggml_alloc_tensor * table, size_t n_table, struct ggml_tensor * tensor) {
+    size_t i = ((uintptr_t) tensor/sizeof(struct ggml_tensor)) % n_table;
+
+    while (table[i].tensor != NULL && table[i].tensor != tensor) {
+        i = (i + 1) % n_table;
+    }
+
+    table[i].tensor = tensor;
+
+    return &table[i];
+}
+
+// the tensor that owns the data of a tensor
+static struct ggml_tensor * ggml_alloc_owner(struct ggml_tensor * tensor) {
+    return tensor->view_src ? tensor->view_src : tensor;
+}
+
+// a tensor of a no_alloc context that ggml_graph_alloc places
+static bool ggml_alloc_is_owned(struct ggml_tensor * tensor) {
+    return tensor->view_src == NULL && tensor->data == NULL;
+}
+
+// the tensors that a node reads
+static int ggml_alloc_node_srcs(struct ggml_tensor * node, struct ggml_tensor * srcs[2 + GGML_MAX_OPT]) {
+    int n_srcs = 0;
+
+    if (node->src0) {
+        srcs[n_srcs++] = node->src0;
+    }
+    if (node->src1) {
+        srcs[n_srcs++] = node->src1;
+    }
+    for (int k = 0; k < GGML_MAX_OPT; k++) {
+        if (node->opt[k]) {
+            srcs[n_srcs++] = node->opt[k];
+        }
+    }
+
+    return n_srcs;
+}
+
+// place the tensors in the order the nodes are computed: the result of a node goes over the tensors that were read
+// for the last time before it, and a tensor is freed after the last node that reads it (or a view of it)
+// returns the size of the buffer - the data of the tensors is set only if buffer is not NULL
+static size_t ggml_graph_alloc_impl(struct ggml_cgraph * cgraph, char * buffer) {
+    const size_t n_table = 4*(cgraph->n_nodes + cgraph->n_leafs) + 1;
+
+    struct ggml_alloc_tensor * table = calloc(n_table, sizeof(struct ggml_alloc_tensor));
+    struct ggml_alloc        * alloc = calloc(1, sizeof(struct ggml_alloc));
+
+    struct ggml_tensor * srcs[2 + GGML_MAX_OPT];
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        const int n_srcs = ggml_alloc_node_srcs(node, srcs);
+        for (int k = 0; k < n_srcs; k++) {
+            ggml_alloc_tensor_get(table, n_table, srcs[k])->n_children++;
+            ggml_alloc_tensor_get(table, n_table, ggml_alloc_owner(srcs[k]))->n_reads++;
+        }
+    }
+
+    // the results that no node reads are the outputs of the graph - also when they are views (e.g. in place)
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        if (ggml_alloc_tensor_get(table, n_table, node)->n_children == 0) {
+            ggml_alloc_tensor_get(table, n_table, ggml_alloc_owner(node))->keep = true;
+        }
+    }
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        const int n_srcs = ggml_alloc_node_srcs(node, srcs);
+
+        // a tensor that is read before a node writes it is an input: it is set before the graph is computed
+        // the destination of ggml_cpy is written without being read
+        for (int k = 0; k < n_srcs; k++) {
+            struct ggml_tensor * owner = ggml_alloc_owner(srcs[k]);
+
+            if (node->op == GGML_OP_CPY && srcs[k] == node->src1 && owner == ggml_alloc_owner(node)) {
+                continue;
+            }
+
+            struct ggml_alloc_tensor * t = ggml_alloc_tensor_get(table, n_table, owner);
+
+            if (ggml_alloc_is_owned(owner) && !t->placed) {
+                t->placed = true;
+                t->keep   = true;
+                t->offs   = ggml_alloc_block_new(alloc, ggml_nbytes(owner));
+            }
+        }
+
+        // the result - before the sources are freed, so that it does not overlap them
+        {
+            struct ggml_tensor * owner = ggml_alloc_owner(node);
+
+            struct ggml_alloc_tensor * t = ggml_alloc_tensor_get(table, n_table, owner);
+
+            if (ggml_alloc_is_owned(owner) && !t->placed) {
+                t->placed = true;
+                t->offs   = ggml_alloc_block_new(alloc, ggml_nbytes(owner));
+            }
+        }
+
+        for (int k = 0; k < n_srcs; k++) {
+            struct ggml_tensor * owner = ggml_alloc_owner(srcs[k]);
+
+            struct ggml_alloc_tensor * t = ggml_alloc_tensor_get(table, n_table, owner);
+
+            if (--t->n_reads == 0 && ggml_alloc_is_owned(owner) && !t->keep) {
+                ggml_alloc_block_free(alloc, t->offs, ggml_nbytes(owner));
+            }
+        }
+    }
+
+    const size_t size = alloc->end_max;
+
+    if (buffer) {
+        for (size_t i = 0; i < n_table; i++) {
+            if (table[i].tensor && table[i].placed) {
+                table[i].tensor->data = buffer + table[i].offs;
+            }
+        }
+
+        // the views follow the tensors that own their data
+        for (int i = 0; i < cgraph->n_nodes; i++) {
+            struct ggml_tensor * node = cgraph->nodes[i];
+
+            if (node->view_src) {
+                node->data = (char *) node->view_src->data + node->view_offs;
+            }
+        }
+        for (int i = 0; i < cgraph->n_leafs; i++) {
+            struct ggml_tensor * leaf = cgraph->leafs[i];
+
+            if (leaf->view_src) {
+                leaf->data = (char *) leaf->view_src->data + leaf->view_offs;
+            }
+        }
+    }
+
+    free(alloc);
+    free(table);
+
+    return size;
+}
+
+size_t ggml_graph_alloc_size(struct ggml_cgraph * cgraph) {
+    return ggml_graph_alloc_impl(cgraph, NULL);
+}
+
+void ggml_graph_alloc(struct ggml_cgraph * cgraph, void * buffer, size_t size) {
+    ggml_assert_aligned(buffer);
+
+    const size_t size_needed = ggml_graph_alloc_impl(cgraph, buffer);
+
+    if (size_needed > size) {
+        GGML_PRINT("%s: the buffer is too small (needed %zu, available %zu)\n", __func__, size_needed, size);
+        GGML_ASSERT(false);
+    }
+}
+
 void ggml_graph_reset(struct ggml_cgraph * cgraph) {
     for (int i = 0; i < cgraph->n_nodes; i++) {
         struct ggml_tensor * grad = cgraph->grads[i];
@@ -10412,35 +10620,23 @@ enum ggml_opt_result ggml_opt(
 ////////////////////////////////////////////////////////////////////////////////
 
 int ggml_cpu_has_avx(void) {
-#if defined(__AVX__)
-    return 1;
-#else
-    return 0;
-#endif
+    return ggml_kernels_get()->avx;
 }
 
 int ggml_cpu_has_avx2(void) {
-#if defined(__AVX2__)
-    return 1;
-#else
-    return 0;
-#endif
+    return ggml_kernels_get()->avx2;
 }
 
 int ggml_cpu_has_avx512(void) {
-#if defined(__AVX512F__)
-    return 1;
-#else
-    return 0;
-#endif
+    return ggml_kernels_get()->avx512;
+}
+
+int ggml_cpu_has_avx512_vnni(void) {
+    return ggml_kernels_get()->avx512_vnni;
 }
 
 int ggml_cpu_has_fma(void) {
-#if defined(__FMA__)
-    return 1;
-#else
-    return 0;
-#endif
+    return ggml_kernels_get()->fma;
 }
 
 int ggml_cpu_has_neon(void) {
@@ -10460,11 +10656,7 @@ int ggml_cpu_has_arm_fma(void) {
 }
 
 int ggml_cpu_has_f16c(void) {
-#if defined(__F16C__)
-    return 1;
-#else
-    return 0;
-#endif
+    return ggml_kernels_get()->f16c;
 }
 
 int ggml_cpu_has_fp16_va(void) {
@@ -10492,11 +10684,7 @@ int ggml_cpu_has_blas(void) {
 }
 
 int ggml_cpu_has_sse3(void) {
-#if defined(__SSE3__)
-    return 1;
-#else
-    return 0;
-#endif
+    return ggml_kernels_get()->sse3;
 }
 
 int ggml_cpu_has_vsx(void) {
@@ -0,0 +1,171 @@
+#include "ggml/ggml.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_LAYERS 8
+
+float frand() {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+void fill_random(float * x, int n, float fmin, float fmax) {
+    for (int i = 0; i < n; i++) {
+        x[i] = frand()*(fmax - fmin) + fmin;
+    }
+}
+
+// a stack of layers with the kinds of nodes of the transformers: views, in-place ops, ggml_cpy into a new tensor
+// the weights are in ctx_w - the rest is created in ctx
+struct ggml_tensor * build(
+        struct ggml_context * ctx,
+        struct ggml_tensor ** w,
+        struct ggml_tensor * inp) {
+    const int n = inp->ne[0];
+    const int m = inp->ne[1];
+
+    struct ggml_tensor * cur = inp;
+
+    for (int il = 0; il < N_LAYERS; il++) {
+        struct ggml_tensor * x = ggml_mul_mat(ctx, w[il], cur);
+
+        // in place
+        x = ggml_soft_max(ctx, ggml_scale(ctx, x, ggml_new_f32(ctx, 0.5f)));
+
+        // through a view and a copy
+        x = ggml_cpy(ctx, ggml_transpose(ctx, x), ggml_new_tensor_2d(ctx, GGML_TYPE_F32, m, n));
+        x = ggml_cpy(ctx, ggml_transpose(ctx, x), ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n, m));
+        x = ggml_reshape_2d(ctx, x, n, m);
+
+        cur = ggml_add(ctx, cur, ggml_gelu(ctx, x));
+    }
+
+    return cur;
+}
+
+// the result of a graph placed by ggml_graph_alloc must be the same as with a context that allocates, in less memory
+bool test_graph_alloc(int n_threads) {
+    const int n = 64;
+    const int m = 16;
+
+    struct ggml_init_params params_w = {
+        .mem_size   = 4*1024*1024,
+        .mem_buffer = NULL,
+    };
+
+    struct ggml_context * ctx_w = ggml_init(params_w);
+
+    struct ggml_tensor * w[N_LAYERS];
+    for (int il = 0; il < N_LAYERS; il++) {
+        w[il] = ggml_new_tensor_2d(ctx_w, GGML_TYPE_F32, n, n);
+        fill_random((float *) w[il]->data, n*n, -0.5f, 0.5f);
+    }
+
+    float * inp_data = malloc(n*m*sizeof(float));
+    fill_random(inp_data, n*m, -1.0f, 1.0f);
+
+    // reference
+    struct ggml_init_params params_ref = {
+        .mem_size   = 16*1024*1024,
+        .mem_buffer = NULL,
+    };
+
+    struct ggml_context * ctx_ref = ggml_init(params_ref);
+
+    struct ggml_tensor * inp_ref = ggml_new_tensor_2d(ctx_ref, GGML_TYPE_F32, n, m);
+    memcpy(inp_ref->data, inp_data, n*m*sizeof(float));
+
+    struct ggml_tensor * out_ref = build(ctx_ref, w, inp_ref);
+
+    struct ggml_cgraph gf_ref = ggml_build_forward(out_ref);
+    gf_ref.n_threads = n_threads;
+
+    ggml_graph_compute(ctx_ref, &gf_ref);
+
+    size_t size_ref = 0;
+    for (int i = 0; i < gf_ref.n_nodes; i++) {
+        if (gf_ref.nodes[i]->op != GGML_OP_TRANSPOSE && gf_ref.nodes[i]->op != GGML_OP_RESHAPE) {
+            size_ref += ggml_nbytes(gf_ref.nodes[i]);
+        }
+    }
+
+    // placed by ggml_graph_alloc
+    struct ggml_init_params params = {
+        .mem_size   = 1024*1024,
+        .mem_buffer = NULL,
+        .no_alloc   = true,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+
+    struct ggml_tensor * inp = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n, m);
+    struct ggml_tensor * out = build(ctx, w, inp);
+
+    struct ggml_cgraph gf = ggml_build_forward(out);
+    gf.n_threads = n_threads;
+
+    const size_t size = ggml_graph_alloc_size(&gf);
+
+    void * buffer = malloc(size);
+    ggml_graph_alloc(&gf, buffer, size);
+
+    memcpy(inp->data, inp_data, n*m*sizeof(float));
+
+    ggml_graph_compute(ctx, &gf);
+
+    bool ok = true;
+
+    // the intermediate results of 1 layer are about 5 tensors the size of the input
+    if (size >= size_ref/2) {
+        printf("error: graph alloc, n_threads = %d, size = %zu, without reuse = %zu\n", n_threads, size, size_ref);
+        ok = false;
+    }
+
+    for (int i = 0; i < n*m && ok; i++) {
+        const float ref = ((float *) out_ref->data)[i];
+        const float res = ((float *) out->data)[i];
+
+        if (fabsf(ref - res) > 1e-6f) {
+            printf("error: graph alloc, n_threads = %d, i = %d, ref = %f, res = %f\n", n_threads, i, ref, res);
+            ok = false;
+        }
+    }
+
+    // the input is kept
+    if (ok && memcmp(inp->data, inp_data, n*m*sizeof(float)) != 0) {
+        printf("error: graph alloc, n_threads = %d, the input was overwritten\n", n_threads);
+        ok = false;
+    }
+
+    free(buffer);
+    free(inp_data);
+
+    ggml_free(ctx);
+    ggml_free(ctx_ref);
+    ggml_free(ctx_w);
+
+    return ok;
+}
+
+int main(int argc, const char ** argv) {
+    int n_failed = 0;
+
+    for (int n_threads = 1; n_threads <= 4; n_threads++) {
+        printf("testing: n_threads = %d\n", n_threads);
+
+        if (!test_graph_alloc(n_threads)) {
+            n_failed++;
+        }
+    }
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    printf("all tests passed\n");
+
+    return 0;
+}
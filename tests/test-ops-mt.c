@@ -0,0 +1,195 @@
+#include "ggml/ggml.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the ops split their rows between the threads - each row is computed by one thread in the same way, so the result
+// must be the same bit for bit for any number of threads. The tensors are large enough for 4 tasks per node
+
+float frand() {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+struct ggml_tensor * new_random(struct ggml_context * ctx, enum ggml_type type, int ne0, int ne1, int ne2) {
+    struct ggml_tensor * t = ggml_new_tensor_3d(ctx, type, ne0, ne1, ne2);
+
+    const int n = ggml_nelements(t);
+
+    for (int i = 0; i < n; i++) {
+        const float x = frand()*2.0f - 1.0f;
+
+        if (type == GGML_TYPE_F16) {
+            ((ggml_fp16_t *) t->data)[i] = ggml_fp32_to_fp16(x);
+        } else {
+            ((float *) t->data)[i] = x;
+        }
+    }
+
+    return t;
+}
+
+// the graph of a test: its result from random inputs
+typedef struct ggml_tensor * (*build_t)(struct ggml_context * ctx);
+
+struct ggml_tensor * build_dup_f32(struct ggml_context * ctx) {
+    return ggml_cpy(ctx, new_random(ctx, GGML_TYPE_F32, 389, 411, 1), ggml_new_tensor_2d(ctx, GGML_TYPE_F16, 389, 411));
+}
+
+struct ggml_tensor * build_dup_f32_transposed(struct ggml_context * ctx) {
+    struct ggml_tensor * a = ggml_transpose(ctx, new_random(ctx, GGML_TYPE_F32, 389, 411, 1));
+
+    return ggml_cpy(ctx, a, ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 411, 389));
+}
+
+struct ggml_tensor * build_dup_f32_permuted(struct ggml_context * ctx) {
+    struct ggml_tensor * a = ggml_permute(ctx, new_random(ctx, GGML_TYPE_F32, 67, 43, 59), 0, 2, 1, 3);
+
+    return ggml_cpy(ctx, a, ggml_new_tensor_3d(ctx, GGML_TYPE_F16, 67, 59, 43));
+}
+
+struct ggml_tensor * build_dup_f16(struct ggml_context * ctx) {
+    return ggml_cpy(ctx, new_random(ctx, GGML_TYPE_F16, 389, 411, 1), ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 389, 411));
+}
+
+struct ggml_tensor * build_dup_f16_transposed(struct ggml_context * ctx) {
+    struct ggml_tensor * a = ggml_transpose(ctx, new_random(ctx, GGML_TYPE_F16, 389, 411, 1));
+
+    return ggml_cpy(ctx, a, ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 411, 389));
+}
+
+struct ggml_tensor * build_dup_f16_permuted(struct ggml_context * ctx) {
+    struct ggml_tensor * a = ggml_permute(ctx, new_random(ctx, GGML_TYPE_F16, 67, 43, 59), 0, 2, 1, 3);
+
+    return ggml_cpy(ctx, a, ggml_new_tensor_3d(ctx, GGML_TYPE_F16, 67, 59, 43));
+}
+
+// [n_rot, n_head, N] like the Q and K of the LLaMA example
+struct ggml_tensor * build_rope(struct ggml_context * ctx) {
+    return ggml_rope(ctx, new_random(ctx, GGML_TYPE_F32, 64, 8, 83), 21, 64, 0, 1);
+}
+
+// mode 1 skips the first n_past rows of dim 2
+struct ggml_tensor * build_rope_mode1(struct ggml_context * ctx) {
+    return ggml_rope(ctx, new_random(ctx, GGML_TYPE_F32, 64, 8, 83), 21, 64, 1, 0);
+}
+
+// the rows of all the matrices are split together
+struct ggml_tensor * build_diag_mask_inf(struct ggml_context * ctx) {
+    return ggml_diag_mask_inf(ctx, new_random(ctx, GGML_TYPE_F32, 131, 127, 9), 5);
+}
+
+struct ggml_tensor * build_get_rows(struct ggml_context * ctx, enum ggml_type type) {
+    struct ggml_tensor * a    = new_random(ctx, type, 389, 500, 1);
+    struct ggml_tensor * rows = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 397);
+
+    for (int i = 0; i < 397; i++) {
+        ((int32_t *) rows->data)[i] = rand()%500;
+    }
+
+    return ggml_get_rows(ctx, a, rows);
+}
+
+struct ggml_tensor * build_get_rows_f32(struct ggml_context * ctx) {
+    return build_get_rows(ctx, GGML_TYPE_F32);
+}
+
+struct ggml_tensor * build_get_rows_f16(struct ggml_context * ctx) {
+    return build_get_rows(ctx, GGML_TYPE_F16);
+}
+
+struct ggml_tensor * build_repeat(struct ggml_context * ctx) {
+    return ggml_repeat(ctx, new_random(ctx, GGML_TYPE_F32, 389, 1, 1), ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 1167, 137));
+}
+
+// the result of the graph of build computed with n_threads, from the same inputs for each call
+void * compute(build_t build, int n_threads, size_t * size) {
+    struct ggml_init_params params = {
+        .mem_size   = 16*1024*1024,
+        .mem_buffer = NULL,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+
+    srand(0);
+
+    struct ggml_tensor * res = build(ctx);
+
+    struct ggml_cgraph gf = ggml_build_forward(res);
+    gf.n_threads = n_threads;
+
+    ggml_graph_compute(ctx, &gf);
+
+    *size = ggml_nbytes(res);
+
+    void * data = malloc(*size);
+    memcpy(data, res->data, *size);
+
+    ggml_free(ctx);
+
+    return data;
+}
+
+bool test_op(const char * name, build_t build, int n_threads) {
+    size_t size_ref = 0;
+    size_t size_res = 0;
+
+    void * ref = compute(build, 1,         &size_ref);
+    void * res = compute(build, n_threads, &size_res);
+
+    bool ok = size_ref == size_res;
+
+    for (size_t i = 0; i < size_ref && ok; i++) {
+        if (((const uint8_t *) ref)[i] != ((const uint8_t *) res)[i]) {
+            printf("error: %s, n_threads = %d, byte %zu differs\n", name, n_threads, i);
+            ok = false;
+        }
+    }
+
+    free(ref);
+    free(res);
+
+    return ok;
+}
+
+int main(int argc, const char ** argv) {
+    const struct {
+        const char * name;
+        build_t      build;
+    } tests[] = {
+        { "dup_f32",            build_dup_f32            },
+        { "dup_f32_transposed", build_dup_f32_transposed },
+        { "dup_f32_permuted",   build_dup_f32_permuted   },
+        { "dup_f16",            build_dup_f16            },
+        { "dup_f16_transposed", build_dup_f16_transposed },
+        { "dup_f16_permuted",   build_dup_f16_permuted   },
+        { "rope",               build_rope               },
+        { "rope_mode1",         build_rope_mode1         },
+        { "diag_mask_inf",      build_diag_mask_inf      },
+        { "get_rows_f32",       build_get_rows_f32       },
+        { "get_rows_f16",       build_get_rows_f16       },
+        { "repeat",             build_repeat             },
+    };
+
+    int n_failed = 0;
+
+    for (int n_threads = 1; n_threads <= 4; n_threads++) {
+        printf("testing: n_threads = %d\n", n_threads);
+
+        for (size_t i = 0; i < sizeof(tests)/sizeof(tests[0]); i++) {
+            if (!test_op(tests[i].name, tests[i].build, n_threads)) {
+                n_failed++;
+            }
+        }
+    }
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    printf("all tests passed\n");
+
+    return 0;
+}
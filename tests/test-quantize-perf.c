@@ -0,0 +1,237 @@
+// tokens/s and logits drift of the two activation types of the quantized matrix multiplication
+//
+// the model is a synthetic LLaMA-like stack of feed-forward blocks followed by the output projection:
+//
+//   x = x + W2*silu(W1*rms_norm(x))   (n_layer times)
+//   logits = W*rms_norm(x)
+//
+// the reference graph uses F32 copies of the dequantized weights, so the drift of the logits only
+// measures the error introduced by quantizing the activations (Q8_0 vs the type of the weights)
+//
+// usage: test-quantize-perf [n_embd n_ff n_layer n_vocab n_tokens n_threads]
+//
+// n_embd and n_ff must be multiples of 64 (the SIMD kernels process the blocks in pairs)
+//
+// LLaMA 7B: test-quantize-perf 4096 11008 4 32000 16 8 (the F32 reference weights need ~360 MB per layer)
+//
+
+#include "ggml/ggml.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct layer {
+    struct ggml_tensor * w1;
+    struct ggml_tensor * w2;
+};
+
+float frand() {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+void fill_random(float * x, int n, float fmin, float fmax) {
+    for (int i = 0; i < n; i++) {
+        x[i] = frand()*(fmax - fmin) + fmin;
+    }
+}
+
+// quantize random weights into wq and store the dequantized values in wf
+void init_weights(struct ggml_tensor * wq, struct ggml_tensor * wf) {
+    const int ne0 = wq->ne[0];
+    const int ne1 = wq->ne[1];
+
+    const float a = 1.0f/sqrtf(ne0);
+
+    float * tmp = malloc(ne0*sizeof(float));
+
+    for (int i = 0; i < ne1; i++) {
+        fill_random(tmp, ne0, -a, a);
+
+        void  * rowq = (char *) wq->data + i*wq->nb[1];
+        float * rowf = (float *) ((char *) wf->data + i*wf->nb[1]);
+
+        if (wq->type == GGML_TYPE_Q4_0) {
+            quantize_row_q4_0(tmp, rowq, ne0);
+            dequantize_row_q4_0(rowq, rowf, ne0);
+        } else {
+            quantize_row_q4_1(tmp, rowq, ne0);
+            dequantize_row_q4_1(rowq, rowf, ne0);
+        }
+    }
+
+    free(tmp);
+}
+
+struct ggml_tensor * build_model(struct ggml_context * ctx, struct ggml_tensor * inp, const struct layer * layers, int n_layer, struct ggml_tensor * output) {
+    struct ggml_tensor * x = inp;
+
+    for (int il = 0; il < n_layer; il++) {
+        struct ggml_tensor * cur = ggml_rms_norm(ctx, x);
+
+        cur = ggml_mul_mat(ctx, layers[il].w1, cur);
+        cur = ggml_silu(ctx, cur);
+        cur = ggml_mul_mat(ctx, layers[il].w2, cur);
+
+        x = ggml_add(ctx, x, cur);
+    }
+
+    return ggml_mul_mat(ctx, output, ggml_rms_norm(ctx, x));
+}
+
+int argmax(const float * x, int n) {
+    int res = 0;
+    for (int i = 1; i < n; i++) {
+        if (x[i] > x[res]) {
+            res = i;
+        }
+    }
+
+    return res;
+}
+
+struct drift {
+    double sum_sq;
+    double max_abs;
+    int    n_top1;
+};
+
+void drift_update(struct drift * d, const float * res, const float * ref, int n) {
+    double sum_sq = 0.0;
+    for (int i = 0; i < n; i++) {
+        const double diff = res[i] - ref[i];
+        sum_sq += diff*diff;
+        d->max_abs = fmax(d->max_abs, fabs(diff));
+    }
+
+    d->sum_sq += sum_sq/n;
+    d->n_top1 += argmax(res, n) == argmax(ref, n);
+}
+
+// returns false if the Q8_0 activations drift more than the Q4 ones
+bool test_perf(enum ggml_type type, int n_embd, int n_ff, int n_layer, int n_vocab, int n_tokens, int n_threads) {
+    const size_t size_q = (2*n_layer*ggml_type_sizef(type)*n_embd*n_ff) + ggml_type_sizef(type)*n_embd*n_vocab;
+    const size_t size_f = (2*n_layer*sizeof(float)*n_embd*n_ff)         + sizeof(float)*n_embd*n_vocab;
+
+    struct ggml_init_params params = {
+        .mem_size   = size_q + size_f + 64*1024*1024,
+        .mem_buffer = NULL,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+    if (!ctx) {
+        fprintf(stderr, "%s: ggml_init() failed\n", __func__);
+        return false;
+    }
+
+    struct layer * layers_q = malloc(n_layer*sizeof(struct layer));
+    struct layer * layers_f = malloc(n_layer*sizeof(struct layer));
+
+    for (int il = 0; il < n_layer; il++) {
+        layers_q[il].w1 = ggml_new_tensor_2d(ctx, type,          n_embd, n_ff);
+        layers_q[il].w2 = ggml_new_tensor_2d(ctx, type,          n_ff,   n_embd);
+        layers_f[il].w1 = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_embd, n_ff);
+        layers_f[il].w2 = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_ff,   n_embd);
+
+        init_weights(layers_q[il].w1, layers_f[il].w1);
+        init_weights(layers_q[il].w2, layers_f[il].w2);
+    }
+
+    struct ggml_tensor * output_q = ggml_new_tensor_2d(ctx, type,          n_embd, n_vocab);
+    struct ggml_tensor * output_f = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_embd, n_vocab);
+
+    init_weights(output_q, output_f);
+
+    struct ggml_tensor * inp = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_embd);
+
+    struct ggml_tensor * logits_q = build_model(ctx, inp, layers_q, n_layer, output_q);
+    struct ggml_tensor * logits_f = build_model(ctx, inp, layers_f, n_layer, output_f);
+
+    struct ggml_cgraph gf_q = ggml_build_forward(logits_q);
+    struct ggml_cgraph gf_f = ggml_build_forward(logits_f);
+
+    gf_q.n_threads = n_threads;
+    gf_f.n_threads = n_threads;
+
+    float * ref = malloc(n_vocab*sizeof(float));
+
+    // [0] - Q8_0 activations, [1] - activations quantized to the weight type
+    struct drift drift[2] = { 0 };
+    int64_t      t_us[2]  = { 0 };
+
+    for (int it = 0; it < n_tokens; it++) {
+        fill_random((float *) inp->data, n_embd, -1.0f, 1.0f);
+
+        ggml_graph_compute(ctx, &gf_f);
+        memcpy(ref, logits_f->data, n_vocab*sizeof(float));
+
+        for (int k = 0; k < 2; k++) {
+            ggml_set_q8_activations(k == 0);
+
+            const int64_t t_start_us = ggml_time_us();
+            ggml_graph_compute(ctx, &gf_q);
+            t_us[k] += ggml_time_us() - t_start_us;
+
+            drift_update(&drift[k], (float *) logits_q->data, ref, n_vocab);
+        }
+    }
+
+    ggml_set_q8_activations(true);
+
+    for (int k = 0; k < 2; k++) {
+        printf("  %s: %8.2f tokens/s, logits drift: rms = %.6f, max = %.6f, top-1 = %d/%d\n",
+                k == 0 ? "Q8_0" : (type == GGML_TYPE_Q4_0 ? "Q4_0" : "Q4_1"),
+                1e6*n_tokens/t_us[k],
+                sqrt(drift[k].sum_sq/n_tokens), drift[k].max_abs, drift[k].n_top1, n_tokens);
+    }
+
+    free(ref);
+    free(layers_q);
+    free(layers_f);
+
+    ggml_free(ctx);
+
+    return drift[0].sum_sq <= drift[1].sum_sq;
+}
+
+int main(int argc, const char ** argv) {
+    int n_embd    = 512;
+    int n_ff      = 1408;
+    int n_layer   = 4;
+    int n_vocab   = 4000;
+    int n_tokens  = 8;
+    int n_threads = 1;
+
+    if (argc > 1) n_embd    = atoi(argv[1]);
+    if (argc > 2) n_ff      = atoi(argv[2]);
+    if (argc > 3) n_layer   = atoi(argv[3]);
+    if (argc > 4) n_vocab   = atoi(argv[4]);
+    if (argc > 5) n_tokens  = atoi(argv[5]);
+    if (argc > 6) n_threads = atoi(argv[6]);
+
+    printf("n_embd = %d, n_ff = %d, n_layer = %d, n_vocab = %d, n_tokens = %d, n_threads = %d\n",
+            n_embd, n_ff, n_layer, n_vocab, n_tokens, n_threads);
+
+    const enum ggml_type types[] = { GGML_TYPE_Q4_0, GGML_TYPE_Q4_1 };
+
+    int n_failed = 0;
+
+    for (int t = 0; t < (int) (sizeof(types)/sizeof(types[0])); t++) {
+        printf("weights %s:\n", types[t] == GGML_TYPE_Q4_0 ? "Q4_0" : "Q4_1");
+
+        if (!test_perf(types[t], n_embd, n_ff, n_layer, n_vocab, n_tokens, n_threads)) {
+            printf("error: the Q8_0 activations drift more than the Q4 activations\n");
+            n_failed++;
+        }
+    }
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    printf("all tests passed\n");
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include "ggml/ggml.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+float frand() {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+void fill_random(float * x, int n, float fmin, float fmax) {
+    for (int i = 0; i < n; i++) {
+        x[i] = frand()*(fmax - fmin) + fmin;
+    }
+}
+
+void quantize_row(enum ggml_type type, const float * x, void * y, int k) {
+    switch (type) {
+        case GGML_TYPE_Q4_0:  quantize_row_q4_0 (x, y, k); break;
+        case GGML_TYPE_Q4_1:  quantize_row_q4_1 (x, y, k); break;
+        case GGML_TYPE_Q4_0I: quantize_row_q4_0i(x, y, k); break;
+        case GGML_TYPE_Q4_0H: quantize_row_q4_0h(x, y, k); break;
+        default: assert(false);
+    }
+}
+
+void dequantize_row(enum ggml_type type, const void * x, float * y, int k) {
+    switch (type) {
+        case GGML_TYPE_Q4_0:  dequantize_row_q4_0 (x, y, k); break;
+        case GGML_TYPE_Q4_1:  dequantize_row_q4_1 (x, y, k); break;
+        case GGML_TYPE_Q4_0I: dequantize_row_q4_0i(x, y, k); break;
+        case GGML_TYPE_Q4_0H: dequantize_row_q4_0h(x, y, k); break;
+        default: assert(false);
+    }
+}
+
+// reference: dot product of the dequantized rows, accumulated in double
+// src1 goes through the same quantization that ggml_mul_mat applies to it
+double ref_dot(enum ggml_type type, const void * x, const float * y, int n) {
+    float * xf = malloc(n*sizeof(float));
+    float * yf = malloc(n*sizeof(float));
+    void  * yq = malloc(n*sizeof(float));
+
+    dequantize_row(type, x, xf, n);
+
+    // the interleaved types always use Q8_0 activations
+    if (ggml_get_q8_activations() || type == GGML_TYPE_Q4_0I || type == GGML_TYPE_Q4_0H) {
+        quantize_row_q8_0(y, yq, n);
+        dequantize_row_q8_0(yq, yf, n);
+    } else {
+        quantize_row(type, y, yq, n);
+        dequantize_row(type, yq, yf, n);
+    }
+
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        sum += (double) xf[i]*(double) yf[i];
+    }
+
+    free(xf);
+    free(yf);
+    free(yq);
+
+    return sum;
+}
+
+// the interleaved layouts hold the same values as Q4_0
+bool test_interleaved(enum ggml_type type, int n) {
+    float * x  = malloc(n*sizeof(float));
+    float * y0 = malloc(n*sizeof(float));
+    float * y1 = malloc(n*sizeof(float));
+    void  * q0 = malloc(n*sizeof(float));
+    void  * q1 = malloc(n*sizeof(float));
+
+    fill_random(x, n, -1.0f, 1.0f);
+
+    quantize_row(GGML_TYPE_Q4_0, x, q0, n);
+    quantize_row(type,           x, q1, n);
+
+    dequantize_row(GGML_TYPE_Q4_0, q0, y0, n);
+    dequantize_row(type,           q1, y1, n);
+
+    bool ok = true;
+
+    for (int i = 0; i < n; i++) {
+        // fp16 scales: the relative error of the scale is at most 2^-11
+        const float eps = type == GGML_TYPE_Q4_0H ? 1e-3f*fabsf(y0[i]) + 1e-6f : 0.0f;
+
+        if (fabsf(y0[i] - y1[i]) > eps) {
+            printf("error: type = %d, n = %d, i = %d, q4_0 = %f, res = %f\n", type, n, i, y0[i], y1[i]);
+            ok = false;
+            break;
+        }
+    }
+
+    free(x);
+    free(y0);
+    free(y1);
+    free(q0);
+    free(q1);
+
+    return ok;
+}
+
+bool test_mul_mat(enum ggml_type type, int n_threads, int ne0, int ne1, int ne11) {
+    struct ggml_init_params params = {
+        .mem_size   = 64*1024*1024,
+        .mem_buffer = NULL,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+
+    struct ggml_tensor * a = ggml_new_tensor_2d(ctx, type,          ne0, ne1);
+    struct ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne11);
+
+    float * tmp = malloc(ne0*sizeof(float));
+    for (int i = 0; i < ne1; i++) {
+        fill_random(tmp, ne0, -1.0f, 1.0f);
+
+        quantize_row(type, tmp, (char *) a->data + i*a->nb[1], ne0);
+    }
+    free(tmp);
+
+    fill_random((float *) b->data, ne0*ne11, -1.0f, 1.0f);
+
+    struct ggml_tensor * c = ggml_mul_mat(ctx, a, b);
+
+    struct ggml_cgraph gf = ggml_build_forward(c);
+    gf.n_threads = n_threads;
+
+    ggml_graph_compute(ctx, &gf);
+
+    bool ok = true;
+
+    for (int i11 = 0; i11 < ne11 && ok; i11++) {
+        for (int i1 = 0; i1 < ne1; i1++) {
+            const void  * x = (const char *) a->data + i1*a->nb[1];
+            const float * y = (const float *) ((const char *) b->data + i11*b->nb[1]);
+
+            const double ref = ref_dot(type, x, y, ne0);
+            const float  res = ((float *) c->data)[i11*ne1 + i1];
+
+            if (fabs(res - ref) > 1e-4*ne0) {
+                printf("error: type = %d, ne0 = %d, i1 = %d, i11 = %d, ref = %f, res = %f\n",
+                        type, ne0, i1, i11, ref, res);
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+int main(int argc, const char ** argv) {
+    const enum ggml_type types[] = { GGML_TYPE_Q4_0, GGML_TYPE_Q4_1, GGML_TYPE_Q4_0I, GGML_TYPE_Q4_0H };
+
+    const int sizes[] = { 32, 64, 96, 128, 160, 320, 4096 };
+
+    int n_failed = 0;
+
+    for (int s = 0; s < (int) (sizeof(sizes)/sizeof(sizes[0])); s++) {
+        if (!test_interleaved(GGML_TYPE_Q4_0I, sizes[s]) || !test_interleaved(GGML_TYPE_Q4_0H, sizes[s])) {
+            n_failed++;
+        }
+    }
+
+    for (int q8 = 1; q8 >= 0; q8--) {
+        ggml_set_q8_activations(q8);
+
+        for (int t = 0; t < (int) (sizeof(types)/sizeof(types[0])); t++) {
+            for (int s = 0; s < (int) (sizeof(sizes)/sizeof(sizes[0])); s++) {
+                for (int n_threads = 1; n_threads <= 3; n_threads++) {
+                    const int ne0  = sizes[s];
+                    const int ne1  = 1 + rand()%16;
+                    const int ne11 = 1 + rand()%8;
+
+                    printf("testing: type = %d, q8 = %d, ne0 = %4d, ne1 = %2d, ne11 = %d, n_threads = %d\n",
+                            types[t], q8, ne0, ne1, ne11, n_threads);
+
+                    if (!test_mul_mat(types[t], n_threads, ne0, ne1, ne11)) {
+                        n_failed++;
+                    }
+                }
+            }
+        }
+
+        // whole tiles of the q4_0 gemm with an odd number of blocks
+        for (int n_threads = 1; n_threads <= 3; n_threads++) {
+            printf("testing: type = %d, q8 = %d, ne0 = %4d, ne1 = %2d, ne11 = %d, n_threads = %d\n",
+                    GGML_TYPE_Q4_0, q8, 96, 16, 8, n_threads);
+
+            if (!test_mul_mat(GGML_TYPE_Q4_0, n_threads, 96, 16, 8)) {
+                n_failed++;
+            }
+        }
+    }
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    printf("all tests passed\n");
+
+    return 0;
+}
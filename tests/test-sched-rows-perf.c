@@ -0,0 +1,178 @@
+// time of a quantized matrix multiplication with the two ways of splitting its rows between the threads
+// (see ggml_set_sched_rows) and how long the threads wait at the end of it for the slowest one
+//
+// the noise threads spin on their own, like other processes competing for the cores. The thread that shares
+// a core with one of them falls behind: with GGML_SCHED_ROWS_STATIC the others wait for it at the end of
+// the node, with GGML_SCHED_ROWS_CHUNKED they take over its remaining chunks of rows
+//
+// usage: test-sched-rows-perf [ne0 ne1 ne11 n_iter n_threads n_noise]
+//
+// ne0 must be a multiple of 64 (the SIMD kernels process the blocks in pairs)
+//
+// LLaMA 7B feed-forward, one token, one busy core: test-sched-rows-perf 4096 11008 1 64 8 1
+//
+
+#include "ggml/ggml.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+float frand() {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+void fill_random(float * x, int n, float fmin, float fmax) {
+    for (int i = 0; i < n; i++) {
+        x[i] = frand()*(fmax - fmin) + fmin;
+    }
+}
+
+static atomic_int g_noise_stop;
+
+void * noise_thread(void * data) {
+    volatile float x = 1.0f;
+
+    while (!atomic_load(&g_noise_stop)) {
+        for (int i = 0; i < 1000; i++) {
+            x = x*0.999f + 0.001f;
+        }
+    }
+
+    (void) data;
+
+    return NULL;
+}
+
+// the time per graph and the wait per graph of one way of splitting the rows, the result goes to res
+void run(enum ggml_sched_rows sched_rows, struct ggml_context * ctx, struct ggml_cgraph * gf, struct ggml_tensor * c,
+        int n_iter, int n_threads, float * res) {
+    ggml_set_sched_rows(sched_rows);
+
+    struct ggml_threadpool * threadpool = ggml_threadpool_create(n_threads);
+
+    gf->threadpool = threadpool;
+
+    // warm up
+    ggml_graph_compute(ctx, gf);
+
+    const int64_t wait_us    = ggml_threadpool_wait_us(threadpool);
+    const int64_t t_start_us = ggml_time_us();
+
+    for (int it = 0; it < n_iter; it++) {
+        ggml_graph_compute(ctx, gf);
+    }
+
+    const int64_t t_us = ggml_time_us() - t_start_us;
+
+    printf("  %-7s: %8.3f ms/graph, the threads wait %8.3f ms/graph for the slowest one\n",
+            sched_rows == GGML_SCHED_ROWS_STATIC ? "static" : "chunked",
+            1e-3*t_us/n_iter, 1e-3*(ggml_threadpool_wait_us(threadpool) - wait_us)/n_iter);
+
+    memcpy(res, c->data, ggml_nbytes(c));
+
+    gf->threadpool = NULL;
+
+    ggml_threadpool_free(threadpool);
+}
+
+int main(int argc, const char ** argv) {
+    int ne0       = 2048;
+    int ne1       = 2048;
+    int ne11      = 1;
+    int n_iter    = 32;
+    int n_threads = 4;
+    int n_noise   = 1;
+
+    if (argc > 1) ne0       = atoi(argv[1]);
+    if (argc > 2) ne1       = atoi(argv[2]);
+    if (argc > 3) ne11      = atoi(argv[3]);
+    if (argc > 4) n_iter    = atoi(argv[4]);
+    if (argc > 5) n_threads = atoi(argv[5]);
+    if (argc > 6) n_noise   = atoi(argv[6]);
+
+    printf("ne0 = %d, ne1 = %d, ne11 = %d, n_iter = %d, n_threads = %d, n_noise = %d\n",
+            ne0, ne1, ne11, n_iter, n_threads, n_noise);
+
+    struct ggml_init_params params = {
+        .mem_size   = ggml_type_sizef(GGML_TYPE_Q4_0)*ne0*ne1 + sizeof(float)*(ne0 + ne1)*ne11 + 16*1024*1024,
+        .mem_buffer = NULL,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+    if (!ctx) {
+        fprintf(stderr, "%s: ggml_init() failed\n", __func__);
+        return 1;
+    }
+
+    struct ggml_tensor * a = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, ne0, ne1);
+    struct ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32,  ne0, ne11);
+
+    float * tmp = malloc(ne0*sizeof(float));
+    for (int i = 0; i < ne1; i++) {
+        fill_random(tmp, ne0, -1.0f, 1.0f);
+
+        quantize_row_q4_0(tmp, (char *) a->data + i*a->nb[1], ne0);
+    }
+    free(tmp);
+
+    fill_random((float *) b->data, ne0*ne11, -1.0f, 1.0f);
+
+    struct ggml_tensor * c = ggml_mul_mat(ctx, a, b);
+
+    struct ggml_cgraph gf = ggml_build_forward(c);
+
+    const int n = ggml_nelements(c);
+
+    float * res_static  = malloc(n*sizeof(float));
+    float * res_chunked = malloc(n*sizeof(float));
+
+    pthread_t * noise = malloc(n_noise*sizeof(pthread_t));
+
+    atomic_store(&g_noise_stop, 0);
+    for (int j = 0; j < n_noise; j++) {
+        pthread_create(&noise[j], NULL, noise_thread, NULL);
+    }
+
+    const enum ggml_sched_rows sched_rows = ggml_get_sched_rows();
+
+    run(GGML_SCHED_ROWS_STATIC,  ctx, &gf, c, n_iter, n_threads, res_static);
+    run(GGML_SCHED_ROWS_CHUNKED, ctx, &gf, c, n_iter, n_threads, res_chunked);
+
+    ggml_set_sched_rows(sched_rows);
+
+    atomic_store(&g_noise_stop, 1);
+    for (int j = 0; j < n_noise; j++) {
+        pthread_join(noise[j], NULL);
+    }
+
+    free(noise);
+
+    // the same rows with the same kernels - only the rows at the boundaries of the ranges can take a different kernel
+    int n_failed = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (fabsf(res_static[i] - res_chunked[i]) > 1e-4f*ne0) {
+            printf("error: i = %d, static = %f, chunked = %f\n", i, res_static[i], res_chunked[i]);
+            n_failed++;
+            break;
+        }
+    }
+
+    free(res_static);
+    free(res_chunked);
+
+    ggml_free(ctx);
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    printf("all tests passed\n");
+
+    return 0;
+}
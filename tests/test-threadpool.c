@@ -0,0 +1,217 @@
+#include "ggml/ggml.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+float frand() {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+void fill_random(float * x, int n, float fmin, float fmax) {
+    for (int i = 0; i < n; i++) {
+        x[i] = frand()*(fmax - fmin) + fmin;
+    }
+}
+
+// a graph computed on a thread pool many times must give the same result as computing it on
+// temporary threads (the nodes split their work in the same way for the same number of threads)
+bool test_threadpool(int n_threads, int n_iter) {
+    struct ggml_init_params params = {
+        .mem_size   = 16*1024*1024,
+        .mem_buffer = NULL,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+
+    const int ne0 = 256;
+    const int ne1 = 64;
+
+    struct ggml_tensor * a = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1);
+    struct ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, 8);
+
+    fill_random((float *) a->data, ne0*ne1, -1.0f, 1.0f);
+
+    struct ggml_tensor * c = ggml_soft_max(ctx, ggml_mul_mat(ctx, a, ggml_gelu(ctx, b)));
+
+    struct ggml_cgraph gf = ggml_build_forward(c);
+
+    const int n = ggml_nelements(c);
+
+    float * ref = malloc(n*sizeof(float));
+
+    struct ggml_threadpool * threadpool = ggml_threadpool_create(n_threads);
+
+    bool ok = ggml_threadpool_n_threads(threadpool) == n_threads;
+
+    for (int it = 0; it < n_iter && ok; it++) {
+        fill_random((float *) b->data, ggml_nelements(b), -1.0f, 1.0f);
+
+        gf.threadpool = NULL;
+        gf.n_threads  = n_threads;
+        ggml_graph_compute(ctx, &gf);
+        memcpy(ref, c->data, n*sizeof(float));
+
+        memset(c->data, 0, n*sizeof(float));
+
+        gf.threadpool = threadpool;
+        gf.n_threads  = 0;
+        ggml_graph_compute(ctx, &gf);
+
+        if (gf.n_threads != n_threads) {
+            printf("error: n_threads = %d, graph n_threads = %d\n", n_threads, gf.n_threads);
+            ok = false;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (((float *) c->data)[i] != ref[i]) {
+                printf("error: n_threads = %d, iter = %d, i = %d, ref = %f, res = %f\n",
+                        n_threads, it, i, ref[i], ((float *) c->data)[i]);
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    ggml_threadpool_free(threadpool);
+
+    free(ref);
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+// nodes that only meet through views of the same tensor (like the KV cache in the LLaMA example) must run in
+// graph order: ggml_cpy into one view, then a read through another view, then a write over what was read
+bool test_views(int n_threads) {
+    struct ggml_init_params params = {
+        .mem_size   = 16*1024*1024,
+        .mem_buffer = NULL,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+
+    const int n = 1024;
+
+    struct ggml_tensor * cache = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 2*n);
+    struct ggml_tensor * a     = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n);
+    struct ggml_tensor * b     = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n);
+
+    ggml_set_f32(cache, 0.0f);
+
+    fill_random((float *) a->data, n, -1.0f, 1.0f);
+    fill_random((float *) b->data, n, -1.0f, 1.0f);
+
+    struct ggml_cgraph gf = { .n_threads = n_threads };
+
+    // cache[n:2n] = a, then sum = cache[n/2:3n/2]*2, then cache[0:n] = b
+    ggml_build_forward_expand(&gf, ggml_cpy(ctx, ggml_scale(ctx, a, ggml_new_f32(ctx, 1.0f)), ggml_view_1d(ctx, cache, n, n*sizeof(float))));
+
+    struct ggml_tensor * sum = ggml_scale(ctx, ggml_view_1d(ctx, cache, n, (n/2)*sizeof(float)), ggml_new_f32(ctx, 2.0f));
+    struct ggml_tensor * res = ggml_cpy(ctx, sum, ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n));
+    ggml_build_forward_expand(&gf, res);
+
+    ggml_build_forward_expand(&gf, ggml_cpy(ctx, ggml_scale(ctx, b, ggml_new_f32(ctx, 1.0f)), ggml_view_1d(ctx, cache, n, 0)));
+
+    ggml_graph_compute(ctx, &gf);
+
+    bool ok = true;
+
+    for (int i = 0; i < n; i++) {
+        const float ref = i < n/2 ? 0.0f : 2.0f*((float *) a->data)[i - n/2];
+
+        if (((float *) res->data)[i] != ref || ((float *) cache->data)[i] != ((float *) b->data)[i]) {
+            printf("error: views, n_threads = %d, i = %d, ref = %f, res = %f\n", n_threads, i, ref, ((float *) res->data)[i]);
+            ok = false;
+            break;
+        }
+    }
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+// a graph computed again after ggml_graph_set_view_offset must write through the moved view, like the cached
+// graph of the LLaMA example that copies each new token into the next row of the KV cache
+bool test_view_offset(int n_threads) {
+    struct ggml_init_params params = {
+        .mem_size   = 16*1024*1024,
+        .mem_buffer = NULL,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+
+    const int n      = 256;
+    const int n_rows = 4;
+
+    struct ggml_tensor * cache = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_rows*n);
+    struct ggml_tensor * a     = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n);
+
+    ggml_set_f32(cache, 0.0f);
+
+    struct ggml_cgraph gf = { .n_threads = n_threads };
+
+    // cache[row] = a
+    struct ggml_tensor * row = ggml_view_1d(ctx, cache, n, 0);
+    ggml_build_forward_expand(&gf, ggml_cpy(ctx, ggml_scale(ctx, a, ggml_new_f32(ctx, 1.0f)), row));
+
+    bool ok = true;
+
+    for (int ir = 0; ir < n_rows && ok; ir++) {
+        ggml_graph_set_view_offset(&gf, row, ir*n*sizeof(float));
+
+        ggml_set_f32(a, (float) (ir + 1));
+        ggml_graph_compute(ctx, &gf);
+
+        for (int i = 0; i < n_rows*n; i++) {
+            const float ref = i/n <= ir ? (float) (i/n + 1) : 0.0f;
+
+            if (((float *) cache->data)[i] != ref) {
+                printf("error: view offset, n_threads = %d, row = %d, i = %d, ref = %f, res = %f\n",
+                        n_threads, ir, i, ref, ((float *) cache->data)[i]);
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+int main(int argc, const char ** argv) {
+    int n_failed = 0;
+
+    for (int n_threads = 1; n_threads <= 4; n_threads++) {
+        printf("testing: n_threads = %d\n", n_threads);
+
+        if (!test_threadpool(n_threads, 10)) {
+            n_failed++;
+        }
+
+        if (!test_views(n_threads)) {
+            n_failed++;
+        }
+
+        if (!test_view_offset(n_threads)) {
+            n_failed++;
+        }
+    }
+
+    // a pool that never computes a graph
+    ggml_threadpool_free(ggml_threadpool_create(3));
+
+    if (n_failed > 0) {
+        printf("%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    printf("all tests passed\n");
+
+    return 0;
+}